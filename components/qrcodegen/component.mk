@@ -8,3 +8,12 @@
 #
 
 COMPONENT_ADD_INCLUDEDIRS := .
+
+# The lookup tables of qrcodegen.c are generated into the build directory
+CFLAGS += -I$(COMPONENT_BUILD_DIR)
+COMPONENT_EXTRA_CLEAN := qrcodegen_tables.h
+
+qrcodegen.o: qrcodegen_tables.h
+
+qrcodegen_tables.h: $(COMPONENT_PATH)/gen_tables.py $(COMPONENT_PATH)/qrcodegen.c $(SDKCONFIG_MAKEFILE)
+	$(PYTHON) $< $@ $(CONFIG_QRCODEGEN_TEMPLATE_VERSION_MAX)
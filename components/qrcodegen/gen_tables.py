@@ -0,0 +1,240 @@
+#!/usr/bin/env python3
+#
+# Generates the constant lookup tables of qrcodegen.c into a C header.
+#
+# Usage: gen_tables.py [qrcodegen_tables.h [template_version_max]]
+#
+# The Reed-Solomon divisors are generated for the degrees of ECC_CODEWORDS_PER_BLOCK, which is
+# read from qrcodegen.c next to this script.
+#
+# The function module templates are generated for the versions 1 to template_version_max
+# (default 10, 0 for none), trading flash for encoding speed.
+#
+# The output is included by qrcodegen.c only, so every table is 'static const'
+# and carries the QRCODEGEN_TABLE_ATTR placement attribute defined there.
+#
+
+import os
+import re
+import sys
+
+
+def gf_tables():
+    # Powers of the generator element 0x02 in GF(2^8/0x11D), and their inverse
+    exp = []
+    log = [0] * 256
+    x = 1
+    for i in range(255):
+        exp.append(x)
+        log[x] = i
+        x <<= 1
+        if x & 0x100:
+            x ^= 0x11D
+    # Doubled so that exp[log[a] + log[b]] never needs a modulo
+    return exp + exp + [exp[0], exp[1]], log
+
+
+QRCODEGEN_C = os.path.join(os.path.dirname(os.path.abspath(__file__)), "qrcodegen.c")
+
+
+def rs_degrees():
+    # The distinct values of ECC_CODEWORDS_PER_BLOCK, read from qrcodegen.c itself so that the
+    # generated divisors can't miss a degree the encoder asks for
+    with open(QRCODEGEN_C) as f:
+        source = f.read()
+    table = re.search(r"ECC_CODEWORDS_PER_BLOCK\[4\]\[41\] = \{(.*?)\n\};", source, re.S)
+    assert table, "ECC_CODEWORDS_PER_BLOCK not found in " + QRCODEGEN_C
+    values = [int(v) for v in re.findall(r"-?\d+", re.sub(r"//[^\n]*", "", table.group(1)))]
+    assert len(values) == 4 * 41
+    return sorted(set(v for v in values if v > 0))
+
+
+def rs_divisor(degree, exp, log):
+    # Same as reedSolomonComputeDivisor(): the product (x - r^0) * ... * (x - r^{degree-1})
+    # without its leading term, coefficients from the highest to the lowest power
+    def mul(x, y):
+        return 0 if x == 0 or y == 0 else exp[log[x] + log[y]]
+
+    result = [0] * degree
+    result[degree - 1] = 1
+    for i in range(degree):
+        for j in range(degree):
+            result[j] = mul(result[j], exp[i])
+            if j + 1 < degree:
+                result[j] ^= result[j + 1]
+    return result
+
+
+# The mask patterns of the QR Code standard, as in the original applyMask() of qrcodegen.c
+MASK_FUNCTIONS = (
+    lambda x, y: (x + y) % 2 == 0,
+    lambda x, y: y % 2 == 0,
+    lambda x, y: x % 3 == 0,
+    lambda x, y: (x + y) % 3 == 0,
+    lambda x, y: (x // 3 + y // 2) % 2 == 0,
+    lambda x, y: x * y % 2 + x * y % 3 == 0,
+    lambda x, y: (x * y % 2 + x * y % 3) % 2 == 0,
+    lambda x, y: ((x + y) % 2 + x * y % 3) % 2 == 0,
+)
+MASK_PERIOD_X = 6
+MASK_PERIOD_Y = 12
+
+
+def mask_row_patterns():
+    # Every mask is periodic with 6 in x and with a divisor of 12 in y, so a mask row is
+    # fully described by its first 6 modules, with bit k being the module at x = k
+    result = []
+    for f in MASK_FUNCTIONS:
+        for y in range(MASK_PERIOD_Y):
+            assert all(f(x, y) == f(x + MASK_PERIOD_X, y) == f(x, y + MASK_PERIOD_Y) for x in range(36))
+            result.append(sum(1 << x for x in range(MASK_PERIOD_X) if f(x, y)))
+    return result
+
+
+def alignment_pattern_positions(version):
+    # Same as getAlignmentPatternPositions()
+    if version == 1:
+        return []
+    num_align = version // 7 + 2
+    step = 26 if version == 32 else (version * 4 + num_align * 2 + 1) // (num_align * 2 - 2) * 2
+    result = [version * 4 + 10 - i * step for i in range(num_align - 1)]
+    return [6] + result[::-1]
+
+
+def function_templates(version):
+    # Returns (function, base): the modules of initializeFunctionModules(), and the image left by
+    # initializeFunctionModules() then drawWhiteFunctionModules() without any codewords, as
+    # module grids indexed [y][x]
+    size = version * 4 + 17
+    function = [[False] * size for _ in range(size)]
+
+    def fill(left, top, width, height):
+        for y in range(top, top + height):
+            for x in range(left, left + width):
+                function[y][x] = True
+
+    fill(6, 0, 1, size)
+    fill(0, 6, size, 1)
+    fill(0, 0, 9, 9)
+    fill(size - 8, 0, 8, 9)
+    fill(0, size - 8, 9, 8)
+    align = alignment_pattern_positions(version)
+    corners = {(0, 0), (0, len(align) - 1), (len(align) - 1, 0)}
+    for i, ax in enumerate(align):
+        for j, ay in enumerate(align):
+            if (i, j) not in corners:
+                fill(ax - 2, ay - 2, 5, 5)
+    if version >= 7:
+        fill(size - 11, 0, 3, 6)
+        fill(0, size - 11, 6, 3)
+
+    base = [row[:] for row in function]
+    for i in range(7, size - 7, 2):
+        base[i][6] = False
+        base[6][i] = False
+    for dy in range(-4, 5):
+        for dx in range(-4, 5):
+            if max(abs(dx), abs(dy)) in (2, 4):
+                for cx, cy in ((3, 3), (size - 4, 3), (3, size - 4)):
+                    if 0 <= cx + dx < size and 0 <= cy + dy < size:
+                        base[cy + dy][cx + dx] = False
+    for i, ax in enumerate(align):
+        for j, ay in enumerate(align):
+            if (i, j) not in corners:
+                for dy in (-1, 0, 1):
+                    for dx in (-1, 0, 1):
+                        base[ay + dy][ax + dx] = dx == 0 and dy == 0
+    if version >= 7:
+        rem = version
+        for _ in range(12):
+            rem = (rem << 1) ^ ((rem >> 11) * 0x1F25)
+        bits = version << 12 | rem
+        for i in range(6):
+            for j in range(3):
+                k = size - 11 + j
+                base[i][k] = base[k][i] = (bits & 1) != 0
+                bits >>= 1
+    return function, base
+
+
+def pack_modules(grid):
+    # The qrcode[] format: the size, then the modules in row-major order, LSB first
+    size = len(grid)
+    result = [size] + [0] * ((size * size + 7) // 8)
+    for y in range(size):
+        for x in range(size):
+            if grid[y][x]:
+                i = y * size + x
+                result[(i >> 3) + 1] |= 1 << (i & 7)
+    return result
+
+
+def emit_array(out, ctype, name, values, per_line=16, fmt="0x{:02X}"):
+    out.write("static const {} {}[{}] QRCODEGEN_TABLE_ATTR = {{\n".format(ctype, name, len(values)))
+    for i in range(0, len(values), per_line):
+        out.write("\t" + ", ".join(fmt.format(v) for v in values[i:i + per_line]) + ",\n")
+    out.write("};\n\n")
+
+
+def main():
+    out = open(sys.argv[1], "w") if len(sys.argv) > 1 else sys.stdout
+    template_version_max = int(sys.argv[2]) if len(sys.argv) > 2 else 10
+    assert 0 <= template_version_max <= 40
+    exp, log = gf_tables()
+
+    out.write("// Generated by gen_tables.py - do not edit.\n")
+    out.write("#pragma once\n\n")
+
+    out.write("// Antilogarithms: GF256_EXP[i] = 0x02^i in GF(2^8/0x11D), for 0 <= i < 512\n")
+    emit_array(out, "uint8_t", "GF256_EXP", exp)
+    out.write("// Logarithms: GF256_LOG[0x02^i] = i, for 0 <= i < 255; GF256_LOG[0] is unused\n")
+    emit_array(out, "uint8_t", "GF256_LOG", log)
+
+    # The generator coefficients are never zero, so they are stored as logarithms,
+    # ready for reedSolomonComputeRemainder()
+    degrees = rs_degrees()
+    offsets = [-1] * (degrees[-1] + 1)
+    divisors = []
+    for degree in degrees:
+        coefs = rs_divisor(degree, exp, log)
+        assert 0 not in coefs
+        offsets[degree] = len(divisors)
+        divisors += [log[c] for c in coefs]
+    out.write("// The highest degree in ECC_CODEWORDS_PER_BLOCK\n")
+    out.write("#define RS_DIVISOR_DEGREE_MAX {}\n\n".format(degrees[-1]))
+    out.write("// Start of the generator polynomial of each degree in RS_DIVISOR_LOG, or -1 if that degree is unused\n")
+    emit_array(out, "int16_t", "RS_DIVISOR_OFFSET", offsets, fmt="{:3d}")
+    out.write("// Reed-Solomon generator polynomials of the degrees in RS_DIVISOR_OFFSET, as the logarithms of\n")
+    out.write("// their coefficients from the highest to the lowest power, excluding the leading term (always 1)\n")
+    emit_array(out, "uint8_t", "RS_DIVISOR_LOG", divisors)
+
+    out.write("// Mask patterns: bit k of MASK_ROW_PATTERNS[mask][y % 12] is set iff the mask inverts the module\n")
+    out.write("// at (x, y) with x % 6 == k\n")
+    patterns = mask_row_patterns()
+    out.write("static const uint8_t MASK_ROW_PATTERNS[8][{}] QRCODEGEN_TABLE_ATTR = {{\n".format(MASK_PERIOD_Y))
+    for i in range(0, len(patterns), MASK_PERIOD_Y):
+        out.write("\t{" + ", ".join("0x{:02X}".format(v) for v in patterns[i:i + MASK_PERIOD_Y]) + "},\n")
+    out.write("};\n\n")
+
+    # Each template is a whole qrcode[] buffer of its version, size byte included
+    out.write("#define QRCODEGEN_TEMPLATE_VERSION_MAX {}\n\n".format(template_version_max))
+    if template_version_max > 0:
+        offsets = [0, 0]
+        functions = []
+        bases = []
+        for version in range(1, template_version_max + 1):
+            function, base = function_templates(version)
+            functions += pack_modules(function)
+            bases += pack_modules(base)
+            offsets.append(len(functions))
+        out.write("// Start of the templates of each version in FUNCTION_TEMPLATES and BASE_TEMPLATES\n")
+        emit_array(out, "uint16_t", "TEMPLATE_OFFSET", offsets, fmt="{:4d}")
+        out.write("// The function modules of each version, as marked black by initializeFunctionModules()\n")
+        emit_array(out, "uint8_t", "FUNCTION_TEMPLATES", functions)
+        out.write("// The function modules of each version with their colors, as drawn by drawWhiteFunctionModules()\n")
+        out.write("// over FUNCTION_TEMPLATES, except the format bits; all the other modules are white\n")
+        emit_array(out, "uint8_t", "BASE_TEMPLATES", bases)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,981 @@
+/*
+ * Host benchmark of the QR Code generator
+ *
+ * Reports the cost of the Reed-Solomon ECC stage per codeword, with the
+ * table-driven GF(256) arithmetic of qrcodegen.c ("table") against the
+ * original bitwise Russian peasant multiplication ("bitwise"), both computing
+ * the generator polynomial on every run. The "encoder" column is the ECC stage
+ * as the encoder runs it: addEccAndInterleave() with the precomputed generators.
+ *
+ * Also reports the cost of applying all 8 masks once, as qrcodegen_Mask_AUTO does twice,
+ * with the word-parallel applyMask() against the original module-by-module loop.
+ *
+ * And the cost of one penalty score, with the bit-parallel getPenaltyScore() against
+ * the original module-by-module scorer. The scores of both are compared on codes
+ * of random payloads at every version, and any difference fails the run.
+ *
+ * And the cost of a whole qrcodegen_Mask_AUTO encode, with the masks scored sequentially
+ * against a qrcodegen_MaskPool of 2 and 4 workers. The codes must be identical. The speedup
+ * depends on the CPUs of the host, which are reported; the firmware times the pool on target.
+ *
+ * And the cost of rendering a code into an SSD1306 page buffer, with qrcodegen_renderPages()
+ * against one qrcodegen_getModule() call per pixel. Both are compared at random
+ * positions, quiet zones and scales, and any difference fails the run.
+ *
+ * And qrcodegen_encodeSegmentsCompact() against the bitmap encoder: the codes are compared
+ * at every version, error correction level and mask, the encode times are reported, and the
+ * peak stack of a version 10 encode is measured on a thread with a painted stack. Streamed into
+ * a page buffer by qrcodegen_renderPageRow(), the compact encoder must draw the same pixels as
+ * qrcodegen_renderPages(), and must peak lower on the stack than the bitmap encoder followed
+ * by qrcodegen_renderPages(), or the run fails.
+ *
+ * And qrcodegen_Mask_FAST against qrcodegen_Mask_AUTO over a corpus of Wi-Fi and URL payloads:
+ * the encode times, how often the chosen mask differs, and how much higher the total penalty is.
+ * The mask choice alone is also timed for each number of fully scored candidates; with all 8
+ * it must always choose like qrcodegen_Mask_AUTO.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "qrcodegen.h"
+#include "qrcodegen_pool.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+	#include <x86intrin.h>
+	#define TICK_UNIT "cycles"
+	static uint64_t ticks(void) {
+		return __rdtsc();
+	}
+#else
+	#define TICK_UNIT "ns"
+	static uint64_t ticks(void) {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+	}
+#endif
+
+
+/*---- Private functions of qrcodegen.c, exposed by QRCODEGEN_TEST ----*/
+
+extern const int8_t ECC_CODEWORDS_PER_BLOCK[4][41];
+extern const int8_t NUM_ERROR_CORRECTION_BLOCKS[4][41];
+void addEccAndInterleave(uint8_t data[], int version, enum qrcodegen_Ecc ecl, uint8_t result[]);
+int getNumDataCodewords(int version, enum qrcodegen_Ecc ecl);
+int getNumRawDataModules(int ver);
+void initializeFunctionModules(int version, uint8_t qrcode[]);
+void applyMask(const uint8_t functionModules[], uint8_t qrcode[], enum qrcodegen_Mask mask);
+bool getModule(const uint8_t qrcode[], int x, int y);
+void setModule(uint8_t qrcode[], int x, int y, bool isBlack);
+long getPenaltyScore(const uint8_t qrcode[]);
+enum qrcodegen_Mask chooseMaskFast(const uint8_t functionModules[], uint8_t qrcode[],
+	enum qrcodegen_Ecc ecl, int numCandidates);
+void reedSolomonComputeDivisor(int degree, uint8_t result[]);
+void reedSolomonComputeRemainder(const uint8_t data[], int dataLen,
+	const uint8_t generator[], int degree, uint8_t result[]);
+
+
+
+/*---- Reference implementation: the original bitwise arithmetic ----*/
+
+static uint8_t bitwiseMultiply(uint8_t x, uint8_t y) {
+	uint8_t z = 0;
+	for (int i = 7; i >= 0; i--) {
+		z = (uint8_t)((z << 1) ^ ((z >> 7) * 0x11D));
+		z ^= ((y >> i) & 1) * x;
+	}
+	return z;
+}
+
+
+static void bitwiseComputeRemainder(const uint8_t data[], int dataLen,
+		const uint8_t generator[], int degree, uint8_t result[]) {
+	memset(result, 0, (size_t)degree);
+	for (int i = 0; i < dataLen; i++) {
+		uint8_t factor = data[i] ^ result[0];
+		memmove(&result[0], &result[1], (size_t)(degree - 1));
+		result[degree - 1] = 0;
+		for (int j = 0; j < degree; j++)
+			result[j] ^= bitwiseMultiply(generator[j], factor);
+	}
+}
+
+
+typedef void (*RemainderFunc)(const uint8_t data[], int dataLen,
+	const uint8_t generator[], int degree, uint8_t result[]);
+
+
+static void moduleApplyMask(const uint8_t functionModules[], uint8_t qrcode[], enum qrcodegen_Mask mask) {
+	int qrsize = qrcodegen_getSize(qrcode);
+	for (int y = 0; y < qrsize; y++) {
+		for (int x = 0; x < qrsize; x++) {
+			if (getModule(functionModules, x, y))
+				continue;
+			bool invert;
+			switch ((int)mask) {
+				case 0:  invert = (x + y) % 2 == 0;                    break;
+				case 1:  invert = y % 2 == 0;                          break;
+				case 2:  invert = x % 3 == 0;                          break;
+				case 3:  invert = (x + y) % 3 == 0;                    break;
+				case 4:  invert = (x / 3 + y / 2) % 2 == 0;            break;
+				case 5:  invert = x * y % 2 + x * y % 3 == 0;          break;
+				case 6:  invert = (x * y % 2 + x * y % 3) % 2 == 0;    break;
+				default: invert = ((x + y) % 2 + x * y % 3) % 2 == 0;  break;
+			}
+			bool val = getModule(qrcode, x, y);
+			setModule(qrcode, x, y, val ^ invert);
+		}
+	}
+}
+
+
+typedef void (*ApplyMaskFunc)(const uint8_t functionModules[], uint8_t qrcode[], enum qrcodegen_Mask mask);
+
+
+static int moduleFinderPenaltyCountPatterns(const int runHistory[7]) {
+	int n = runHistory[1];
+	bool core = n > 0 && runHistory[2] == n && runHistory[3] == n * 3 && runHistory[4] == n && runHistory[5] == n;
+	return (core && runHistory[0] >= n * 4 && runHistory[6] >= n ? 1 : 0)
+	     + (core && runHistory[6] >= n * 4 && runHistory[0] >= n ? 1 : 0);
+}
+
+
+static void moduleFinderPenaltyAddHistory(int currentRunLength, int runHistory[7], int qrsize) {
+	if (runHistory[0] == 0)
+		currentRunLength += qrsize;
+	memmove(&runHistory[1], &runHistory[0], 6 * sizeof(runHistory[0]));
+	runHistory[0] = currentRunLength;
+}
+
+
+static int moduleFinderPenaltyTerminateAndCount(bool currentRunColor, int currentRunLength, int runHistory[7], int qrsize) {
+	if (currentRunColor) {
+		moduleFinderPenaltyAddHistory(currentRunLength, runHistory, qrsize);
+		currentRunLength = 0;
+	}
+	currentRunLength += qrsize;
+	moduleFinderPenaltyAddHistory(currentRunLength, runHistory, qrsize);
+	return moduleFinderPenaltyCountPatterns(runHistory);
+}
+
+
+// The original scorer, with getModule() flipped for the columns
+static long moduleLinePenalty(const uint8_t qrcode[], int qrsize, int line, bool vertical) {
+	long result = 0;
+	bool runColor = false;
+	int run = 0;
+	int runHistory[7] = {0};
+	for (int i = 0; i < qrsize; i++) {
+		bool color = vertical ? getModule(qrcode, line, i) : getModule(qrcode, i, line);
+		if (color == runColor) {
+			run++;
+			if (run == 5)
+				result += 3;
+			else if (run > 5)
+				result++;
+		} else {
+			moduleFinderPenaltyAddHistory(run, runHistory, qrsize);
+			if (!runColor)
+				result += moduleFinderPenaltyCountPatterns(runHistory) * 40;
+			runColor = color;
+			run = 1;
+		}
+	}
+	return result + moduleFinderPenaltyTerminateAndCount(runColor, run, runHistory, qrsize) * 40;
+}
+
+
+static long modulePenaltyScore(const uint8_t qrcode[]) {
+	int qrsize = qrcodegen_getSize(qrcode);
+	long result = 0;
+	for (int i = 0; i < qrsize; i++)
+		result += moduleLinePenalty(qrcode, qrsize, i, false) + moduleLinePenalty(qrcode, qrsize, i, true);
+	for (int y = 0; y < qrsize - 1; y++) {
+		for (int x = 0; x < qrsize - 1; x++) {
+			bool  color = getModule(qrcode, x, y);
+			if (  color == getModule(qrcode, x + 1, y) &&
+			      color == getModule(qrcode, x, y + 1) &&
+			      color == getModule(qrcode, x + 1, y + 1))
+				result += 3;
+		}
+	}
+	int black = 0;
+	for (int y = 0; y < qrsize; y++) {
+		for (int x = 0; x < qrsize; x++)
+			black += getModule(qrcode, x, y) ? 1 : 0;
+	}
+	int total = qrsize * qrsize;
+	int k = (int)((labs(black * 20L - total * 10L) + total - 1) / total) - 1;
+	return result + k * 10;
+}
+
+
+typedef long (*PenaltyFunc)(const uint8_t qrcode[]);
+
+
+
+/*---- Benchmark of the ECC stage ----*/
+
+// Calculates the ECC of all blocks of the given data the way addEccAndInterleave() does,
+// leaving the ECC of the blocks concatenated in ecc[]. Returns the elapsed ticks.
+static uint64_t timeEcc(RemainderFunc remainder, const uint8_t data[], int version, enum qrcodegen_Ecc ecl,
+		int iterations, uint8_t ecc[]) {
+	int numBlocks = NUM_ERROR_CORRECTION_BLOCKS[(int)ecl][version];
+	int blockEccLen = ECC_CODEWORDS_PER_BLOCK[(int)ecl][version];
+	int rawCodewords = getNumRawDataModules(version) / 8;
+	int numShortBlocks = numBlocks - rawCodewords % numBlocks;
+	int shortBlockDataLen = rawCodewords / numBlocks - blockEccLen;
+	uint8_t rsdiv[30];
+
+	uint64_t start = ticks();
+	for (int n = 0; n < iterations; n++) {
+		reedSolomonComputeDivisor(blockEccLen, rsdiv);
+		const uint8_t *dat = data;
+		for (int i = 0; i < numBlocks; i++) {
+			int datLen = shortBlockDataLen + (i < numShortBlocks ? 0 : 1);
+			remainder(dat, datLen, rsdiv, blockEccLen, &ecc[i * blockEccLen]);
+			dat += datLen;
+		}
+	}
+	return ticks() - start;
+}
+
+
+// Runs addEccAndInterleave() on the given data. Returns the elapsed ticks.
+static uint64_t timeEncoderEcc(uint8_t data[], int version, enum qrcodegen_Ecc ecl, int iterations, uint8_t result[]) {
+	uint64_t start = ticks();
+	for (int n = 0; n < iterations; n++)
+		addEccAndInterleave(data, version, ecl, result);
+	return ticks() - start;
+}
+
+
+static void benchEcc(void) {
+	static const int versions[] = {1, 3, 5, 10, 20, 30, 40};
+	static const char *eclNames = "LMQH";
+	uint8_t data[qrcodegen_BUFFER_LEN_MAX];
+	uint8_t eccTable[qrcodegen_BUFFER_LEN_MAX], eccBitwise[qrcodegen_BUFFER_LEN_MAX];
+	uint8_t interleaved[qrcodegen_BUFFER_LEN_MAX];
+
+	printf("ECC stage, " TICK_UNIT " per codeword\n");
+	printf("%-8s %-4s %10s %10s %10s %10s %8s\n", "version", "ecc", "codewords", "bitwise", "table", "encoder", "speedup");
+	for (size_t v = 0; v < sizeof(versions) / sizeof(versions[0]); v++) {
+		int version = versions[v];
+		for (int e = 0; e < 4; e++) {
+			enum qrcodegen_Ecc ecl = (enum qrcodegen_Ecc)e;
+			int dataLen = getNumDataCodewords(version, ecl);
+			int rawCodewords = getNumRawDataModules(version) / 8;
+			for (int i = 0; i < dataLen; i++)
+				data[i] = (uint8_t)rand();
+
+			int iterations = 2000000 / rawCodewords + 1;
+			uint64_t bitwise = timeEcc(bitwiseComputeRemainder, data, version, ecl, iterations, eccBitwise);
+			uint64_t table = timeEcc(reedSolomonComputeRemainder, data, version, ecl, iterations, eccTable);
+			uint64_t encoder = timeEncoderEcc(data, version, ecl, iterations, interleaved);
+			if (memcmp(eccBitwise, eccTable, (size_t)(rawCodewords - dataLen)) != 0) {
+				fprintf(stderr, "ECC mismatch at version %d, ecc %c\n", version, eclNames[e]);
+				exit(EXIT_FAILURE);
+			}
+
+			double perBitwise = (double)bitwise / iterations / rawCodewords;
+			double perTable = (double)table / iterations / rawCodewords;
+			double perEncoder = (double)encoder / iterations / rawCodewords;
+			printf("%-8d %-4c %10d %10.1f %10.1f %10.1f %7.1fx\n",
+				version, eclNames[e], rawCodewords, perBitwise, perTable, perEncoder, perBitwise / perEncoder);
+		}
+	}
+}
+
+
+/*---- Benchmark of masking ----*/
+
+// Applies all 8 masks to the given QR Code the given number of times. Returns the elapsed ticks.
+static uint64_t timeMasks(ApplyMaskFunc apply, const uint8_t functionModules[], uint8_t qrcode[], int iterations) {
+	uint64_t start = ticks();
+	for (int n = 0; n < iterations; n++) {
+		for (int i = 0; i < 8; i++)
+			apply(functionModules, qrcode, (enum qrcodegen_Mask)i);
+	}
+	return ticks() - start;
+}
+
+
+static void benchMask(void) {
+	static const int versions[] = {1, 3, 5, 10, 20, 30, 40};
+	uint8_t functionModules[qrcodegen_BUFFER_LEN_MAX];
+	uint8_t byModule[qrcodegen_BUFFER_LEN_MAX], byWord[qrcodegen_BUFFER_LEN_MAX];
+
+	printf("\nMasking, " TICK_UNIT " per set of 8 masks\n");
+	printf("%-8s %10s %10s %10s %8s\n", "version", "modules", "module", "word", "speedup");
+	for (size_t v = 0; v < sizeof(versions) / sizeof(versions[0]); v++) {
+		int version = versions[v];
+		initializeFunctionModules(version, functionModules);
+		int qrsize = qrcodegen_getSize(functionModules);
+		int len = (qrsize * qrsize + 7) / 8 + 1;
+		byModule[0] = (uint8_t)qrsize;
+		for (int i = 1; i < len; i++)
+			byModule[i] = (uint8_t)rand();
+		byModule[len - 1] &= (uint8_t)(0xFF >> ((8 - qrsize * qrsize % 8) % 8));
+		memcpy(byWord, byModule, (size_t)len);
+
+		int iterations = 20000000 / (qrsize * qrsize) + 1;
+		uint64_t module = timeMasks(moduleApplyMask, functionModules, byModule, iterations);
+		uint64_t word = timeMasks(applyMask, functionModules, byWord, iterations);
+		if (memcmp(byModule, byWord, (size_t)len) != 0) {
+			fprintf(stderr, "Mask mismatch at version %d\n", version);
+			exit(EXIT_FAILURE);
+		}
+
+		double perModule = (double)module / iterations;
+		double perWord = (double)word / iterations;
+		printf("%-8d %10d %10.0f %10.0f %7.1fx\n", version, qrsize * qrsize, perModule, perWord, perModule / perWord);
+	}
+}
+
+
+/*---- Benchmark of the penalty score ----*/
+
+// Encodes a random payload of random length exactly at the given version with the given mask
+static void encodeRandom(int version, enum qrcodegen_Mask mask, uint8_t qrcode[]) {
+	uint8_t dataAndTemp[qrcodegen_BUFFER_LEN_MAX];
+	int capacity = getNumDataCodewords(version, qrcodegen_Ecc_LOW) - 3;
+	int len = rand() % capacity + 1;
+	for (int i = 0; i < len; i++)
+		dataAndTemp[i] = (uint8_t)rand();
+	if (!qrcodegen_encodeBinary(dataAndTemp, (size_t)len, qrcode, qrcodegen_Ecc_LOW, version, version, mask, false)) {
+		fprintf(stderr, "Encoding failed at version %d\n", version);
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+// Scores the given QR Code the given number of times. Returns the elapsed ticks.
+static uint64_t timePenalty(PenaltyFunc penalty, const uint8_t qrcode[], int iterations, long *score) {
+	uint64_t start = ticks();
+	for (int n = 0; n < iterations; n++)
+		*score = penalty(qrcode);
+	return ticks() - start;
+}
+
+
+static void benchPenalty(void) {
+	uint8_t qrcode[qrcodegen_BUFFER_LEN_MAX];
+
+	// Differential check over random payloads and masks, at every version
+	for (int version = qrcodegen_VERSION_MIN; version <= qrcodegen_VERSION_MAX; version++) {
+		for (int n = 0; n < 50; n++) {
+			encodeRandom(version, (enum qrcodegen_Mask)(rand() % 8), qrcode);
+			long module = modulePenaltyScore(qrcode), word = getPenaltyScore(qrcode);
+			if (module != word) {
+				fprintf(stderr, "Penalty mismatch at version %d: %ld != %ld\n", version, word, module);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+
+	static const int versions[] = {1, 3, 5, 10, 20, 30, 40};
+	printf("\nPenalty score, " TICK_UNIT " per score\n");
+	printf("%-8s %10s %10s %10s %8s\n", "version", "modules", "module", "word", "speedup");
+	for (size_t v = 0; v < sizeof(versions) / sizeof(versions[0]); v++) {
+		int version = versions[v];
+		encodeRandom(version, qrcodegen_Mask_0, qrcode);
+		int qrsize = qrcodegen_getSize(qrcode);
+		int iterations = 20000000 / (qrsize * qrsize) + 1;
+		long moduleScore, wordScore;
+		uint64_t module = timePenalty(modulePenaltyScore, qrcode, iterations, &moduleScore);
+		uint64_t word = timePenalty(getPenaltyScore, qrcode, iterations, &wordScore);
+
+		double perModule = (double)module / iterations;
+		double perWord = (double)word / iterations;
+		printf("%-8d %10d %10.0f %10.0f %7.1fx\n", version, qrsize * qrsize, perModule, perWord, perModule / perWord);
+	}
+}
+
+
+/*---- Benchmark of the parallel mask evaluation ----*/
+
+// Encodes the given bytes with the automatic mask at exactly the given version, the given number of times.
+// Returns the elapsed ticks.
+static uint64_t timeAutoEncode(const uint8_t data[], size_t len, int version, struct qrcodegen_MaskPool *pool,
+		int iterations, uint8_t qrcode[]) {
+	uint8_t tempBuffer[qrcodegen_BUFFER_LEN_MAX];
+	uint64_t start = ticks();
+	for (int n = 0; n < iterations; n++) {
+		memcpy(tempBuffer, data, len);
+		struct qrcodegen_Segment seg;
+		seg.mode = qrcodegen_Mode_BYTE;
+		seg.bitLength = (int)len * 8;
+		seg.numChars = (int)len;
+		seg.data = tempBuffer;
+		if (!qrcodegen_encodeSegmentsScored(&seg, 1, qrcodegen_Ecc_LOW, version, version, qrcodegen_Mask_AUTO,
+				false, tempBuffer, qrcode, pool != NULL ? qrcodegen_scoreMasksOnPool : NULL, pool)) {
+			fprintf(stderr, "Encoding failed at version %d\n", version);
+			exit(EXIT_FAILURE);
+		}
+	}
+	return ticks() - start;
+}
+
+
+static void benchPool(void) {
+	struct qrcodegen_MaskPool *pools[2] = {
+		qrcodegen_createMaskPool(2, qrcodegen_VERSION_MAX),
+		qrcodegen_createMaskPool(4, qrcodegen_VERSION_MAX),
+	};
+	if (pools[0] == NULL || pools[1] == NULL) {
+		fprintf(stderr, "Cannot create the mask pools\n");
+		exit(EXIT_FAILURE);
+	}
+
+	static const int versions[] = {1, 3, 5, 10, 20, 30, 40};
+	// The workers only overlap on as many CPUs; on one the speedup is below 1, from the hand-over alone
+	printf("\nAutomatic mask encode, " TICK_UNIT " per encode, %ld CPUs online\n", sysconf(_SC_NPROCESSORS_ONLN));
+	printf("%-8s %10s %10s %10s %8s %8s\n", "version", "serial", "2 workers", "4 workers", "speedup", "speedup");
+	for (size_t v = 0; v < sizeof(versions) / sizeof(versions[0]); v++) {
+		int version = versions[v];
+		uint8_t data[qrcodegen_BUFFER_LEN_MAX];
+		size_t len = (size_t)(getNumDataCodewords(version, qrcodegen_Ecc_LOW) - 3);
+		for (size_t i = 0; i < len; i++)
+			data[i] = (uint8_t)rand();
+		int qrsize = version * 4 + 17;
+		int iterations = 2000000 / (qrsize * qrsize) + 1;
+
+		uint8_t serialCode[qrcodegen_BUFFER_LEN_MAX], pooledCode[qrcodegen_BUFFER_LEN_MAX];
+		uint64_t serial = timeAutoEncode(data, len, version, NULL, iterations, serialCode);
+		uint64_t pooled[2];
+		for (int p = 0; p < 2; p++) {
+			pooled[p] = timeAutoEncode(data, len, version, pools[p], iterations, pooledCode);
+			if (memcmp(serialCode, pooledCode, (size_t)qrcodegen_BUFFER_LEN_FOR_VERSION(version)) != 0) {
+				fprintf(stderr, "Pooled encode differs at version %d\n", version);
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		double perSerial = (double)serial / iterations;
+		double per2 = (double)pooled[0] / iterations, per4 = (double)pooled[1] / iterations;
+		printf("%-8d %10.0f %10.0f %10.0f %7.1fx %7.1fx\n", version, perSerial, per2, per4,
+			perSerial / per2, perSerial / per4);
+	}
+	qrcodegen_deleteMaskPool(pools[0]);
+	qrcodegen_deleteMaskPool(pools[1]);
+
+#ifdef NDEBUG
+	// A code above the maxVersion of a pool must stay out of its work buffers: without assertions
+	// it gets mask 0, which an encode with that mask must match
+	struct qrcodegen_MaskPool *small = qrcodegen_createMaskPool(2, 3);
+	uint8_t tempBuffer[qrcodegen_BUFFER_LEN_MAX], pooledCode[qrcodegen_BUFFER_LEN_MAX], mask0Code[qrcodegen_BUFFER_LEN_MAX];
+	if (small == NULL
+			|| !qrcodegen_encodeSegmentsScored(NULL, 0, qrcodegen_Ecc_LOW, 10, 10, qrcodegen_Mask_AUTO, false,
+				tempBuffer, pooledCode, qrcodegen_scoreMasksOnPool, small)
+			|| !qrcodegen_encodeSegmentsAdvanced(NULL, 0, qrcodegen_Ecc_LOW, 10, 10, qrcodegen_Mask_0, false,
+				tempBuffer, mask0Code)
+			|| memcmp(pooledCode, mask0Code, (size_t)qrcodegen_BUFFER_LEN_FOR_VERSION(10)) != 0) {
+		fprintf(stderr, "A pool for version 3 mishandles a version 10 code\n");
+		exit(EXIT_FAILURE);
+	}
+	qrcodegen_deleteMaskPool(small);
+#endif
+}
+
+
+/*---- Benchmark of the page renderer ----*/
+
+// Same as qrcodegen_renderPages(), pixel by pixel
+static void pixelRenderPages(const uint8_t qrcode[], uint8_t pages[], int width, int numPages,
+		int left, int top, int quietZone, int scale) {
+	int qrsize = qrcodegen_getSize(qrcode);
+	int extent = (qrsize + quietZone * 2) * scale;
+	for (int y = 0; y < numPages * 8; y++) {
+		for (int x = 0; x < width; x++) {
+			if (x < left || x >= left + extent || y < top || y >= top + extent)
+				continue;
+			int mx = (x - left) / scale - quietZone, my = (y - top) / scale - quietZone;
+			uint8_t bit = (uint8_t)(1 << (y % 8));
+			if (qrcodegen_getModule(qrcode, mx, my))
+				pages[y / 8 * width + x] |= bit;
+			else
+				pages[y / 8 * width + x] &= (uint8_t)~bit;
+		}
+	}
+}
+
+
+typedef void (*RenderFunc)(const uint8_t qrcode[], uint8_t pages[], int width, int numPages,
+	int left, int top, int quietZone, int scale);
+
+// Renders the given QR Code the given number of times. Returns the elapsed ticks.
+static uint64_t timeRender(RenderFunc render, const uint8_t qrcode[], uint8_t pages[], int width, int numPages,
+		int left, int top, int quietZone, int scale, int iterations) {
+	uint64_t start = ticks();
+	for (int n = 0; n < iterations; n++)
+		render(qrcode, pages, width, numPages, left, top, quietZone, scale);
+	return ticks() - start;
+}
+
+
+static void benchRender(void) {
+	uint8_t qrcode[qrcodegen_BUFFER_LEN_MAX];
+	static uint8_t pixel[128 * 16], word[128 * 16];
+	
+	// Differential check at random positions, quiet zones and scales, over prefilled buffers
+	for (int n = 0; n < 2000; n++) {
+		int version = rand() % 10 + 1;
+		encodeRandom(version, (enum qrcodegen_Mask)(rand() % 8), qrcode);
+		int width = rand() % 128 + 1, numPages = rand() % 16 + 1;
+		int quietZone = rand() % 5, scale = rand() % 3 + 1;
+		int left = rand() % (width + 40) - 40, top = rand() % (numPages * 8 + 40) - 40;
+		for (int i = 0; i < width * numPages; i++)
+			pixel[i] = word[i] = (uint8_t)rand();
+		pixelRenderPages(qrcode, pixel, width, numPages, left, top, quietZone, scale);
+		qrcodegen_renderPages(qrcode, word, width, numPages, left, top, quietZone, scale);
+		if (memcmp(pixel, word, (size_t)(width * numPages)) != 0) {
+			fprintf(stderr, "Render mismatch: version %d, %dx%d pages, at (%d, %d), quiet zone %d, scale %d\n",
+				version, width, numPages, left, top, quietZone, scale);
+			exit(EXIT_FAILURE);
+		}
+	}
+	
+	// The layouts of the QR area of the 128x32 panel of main/, and of a 128x64 panel at 2x
+	static const struct {
+		const char *name;
+		int version, width, numPages, left, top, quietZone, scale;
+	} layouts[] = {
+		{"v3 48x32 1x", 3, 48, 4, 7, 0, 1, 1},
+		{"v3 128x64 2x", 3, 128, 8, 32, 1, 1, 2},
+		{"v10 128x64 1x", 10, 128, 8, 0, 0, 0, 1},
+	};
+	printf("\nPage rendering, " TICK_UNIT " per frame\n");
+	printf("%-14s %10s %10s %8s\n", "layout", "pixel", "word", "speedup");
+	for (size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+		encodeRandom(layouts[l].version, qrcodegen_Mask_0, qrcode);
+		int iterations = 20000;
+		uint64_t p = timeRender(pixelRenderPages, qrcode, pixel, layouts[l].width, layouts[l].numPages,
+			layouts[l].left, layouts[l].top, layouts[l].quietZone, layouts[l].scale, iterations);
+		uint64_t w = timeRender(qrcodegen_renderPages, qrcode, word, layouts[l].width, layouts[l].numPages,
+			layouts[l].left, layouts[l].top, layouts[l].quietZone, layouts[l].scale, iterations);
+		double perPixel = (double)p / iterations, perWord = (double)w / iterations;
+		printf("%-14s %10.0f %10.0f %7.1fx\n", layouts[l].name, perPixel, perWord, perPixel / perWord);
+	}
+}
+
+
+/*---- Benchmark of the compact encoder ----*/
+
+// Fills segs[] with a random mix of numeric, alphanumeric and byte segments that fits the given
+// version at low ECC, their data in buf[]. Returns the number of segments.
+static size_t makeRandomSegments(int version, struct qrcodegen_Segment segs[4], uint8_t buf[]) {
+	static const char *alnum = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:";
+	int budget = getNumDataCodewords(version, qrcodegen_Ecc_LOW) - 12;  // Bytes left for the payload
+	size_t len = 0;
+	for (; len < 4 && budget > 1; len++) {
+		char text[1024];
+		int n = rand() % (budget < 300 ? budget : 300) + 1;
+		int kind = rand() % 3;
+		for (int i = 0; i < n; i++)
+			text[i] = kind == 0 ? (char)('0' + rand() % 10) : kind == 1 ? alnum[rand() % 45] : (char)(rand() % 255 + 1);
+		text[n] = '\0';
+		if (kind == 0)
+			segs[len] = qrcodegen_makeNumeric(text, buf);
+		else if (kind == 1)
+			segs[len] = qrcodegen_makeAlphanumeric(text, buf);
+		else
+			segs[len] = qrcodegen_makeBytes((const uint8_t *)text, (size_t)n, buf);
+		buf += (segs[len].bitLength + 7) / 8;
+		budget -= n + 3;
+	}
+	return len;
+}
+
+
+// Returns a byte mode segment of the given data, which stays in place
+static struct qrcodegen_Segment byteSegment(uint8_t data[], size_t len) {
+	struct qrcodegen_Segment seg;
+	seg.mode = qrcodegen_Mode_BYTE;
+	seg.bitLength = (int)len * 8;
+	seg.numChars = (int)len;
+	seg.data = data;
+	return seg;
+}
+
+
+// A qrcodegen_RowSink that only counts the black modules, for the timings and the stack measurement
+static void countRow(void *context, int y, const uint32_t row[], int size) {
+	(void)y;
+	for (int i = 0; i * 32 < size; i++)
+		*(long *)context += __builtin_popcount(row[i]);
+}
+
+
+// The encodes whose stack is measured, each with its buffers as a caller on a small stack would have them
+static const struct qrcodegen_Segment *stackSegs;
+static size_t stackLen;
+
+static __attribute__((noinline)) void stackBitmapEncode(void) {
+	uint8_t tempBuffer[qrcodegen_BUFFER_LEN_FOR_VERSION(10)], qrcode[qrcodegen_BUFFER_LEN_FOR_VERSION(10)];
+	if (!qrcodegen_encodeSegmentsAdvanced(stackSegs, stackLen, qrcodegen_Ecc_LOW, 10, 10, qrcodegen_Mask_AUTO,
+			false, tempBuffer, qrcode))
+		exit(EXIT_FAILURE);
+	__asm__ volatile("" : : "r"(qrcode) : "memory");
+}
+
+static long stackBlack;
+
+static __attribute__((noinline)) void stackCompactEncode(void) {
+	uint8_t work[qrcodegen_COMPACT_BUFFER_LEN_FOR_ECL(10, qrcodegen_Ecc_LOW)];
+	if (!qrcodegen_encodeSegmentsCompact(stackSegs, stackLen, qrcodegen_Ecc_LOW, 10, 10, qrcodegen_Mask_AUTO,
+			false, work, countRow, &stackBlack))
+		exit(EXIT_FAILURE);
+}
+
+// The frame of stackCompactEncode() without the encode, so that the difference is the encoder alone
+static __attribute__((noinline)) void stackCompactBuffer(void) {
+	uint8_t work[qrcodegen_COMPACT_BUFFER_LEN_FOR_ECL(10, qrcodegen_Ecc_LOW)];
+	memset(work, 0, sizeof(work));  // Down to the lowest byte of the frame, as the probe sees it
+	__asm__ volatile("" : : "r"(work) : "memory");
+}
+
+// The same, drawn into the page buffer of stackLayout at stackVersion; the pages are not counted
+static struct qrcodegen_PageLayout stackLayout;
+static int stackVersion;
+
+static __attribute__((noinline)) void stackBitmapRender(void) {
+	uint8_t tempBuffer[qrcodegen_BUFFER_LEN_FOR_VERSION(stackVersion)], qrcode[qrcodegen_BUFFER_LEN_FOR_VERSION(stackVersion)];
+	if (!qrcodegen_encodeSegmentsAdvanced(stackSegs, stackLen, qrcodegen_Ecc_LOW, stackVersion, stackVersion,
+			qrcodegen_Mask_AUTO, false, tempBuffer, qrcode))
+		exit(EXIT_FAILURE);
+	qrcodegen_renderPages(qrcode, stackLayout.pages, stackLayout.width, stackLayout.numPages,
+		stackLayout.left, stackLayout.top, stackLayout.quietZone, stackLayout.scale);
+}
+
+static __attribute__((noinline)) void stackCompactRender(void) {
+	uint8_t work[qrcodegen_COMPACT_BUFFER_LEN_FOR_ECL(stackVersion, qrcodegen_Ecc_LOW)];
+	if (!qrcodegen_encodeSegmentsCompact(stackSegs, stackLen, qrcodegen_Ecc_LOW, stackVersion, stackVersion,
+			qrcodegen_Mask_AUTO, false, work, qrcodegen_renderPageRow, &stackLayout))
+		exit(EXIT_FAILURE);
+}
+
+
+enum { STACK_SIZE = 1 << 16, STACK_PAINT = 0xA5 };
+
+struct StackProbe {
+	void (*encode)(void);
+	uint8_t *stack;
+	size_t peak;
+};
+
+// Runs the encode, then finds the lowest byte of the painted stack that was written
+static void *stackProbeThread(void *arg) {
+	struct StackProbe *probe = (struct StackProbe *)arg;
+	volatile uint8_t entry = 0;  // Approximately the stack pointer at entry
+	probe->encode();
+	size_t lowest = 0;
+	while (lowest < STACK_SIZE && probe->stack[lowest] == STACK_PAINT)
+		lowest++;
+	probe->peak = (size_t)((const uint8_t *)&entry - &probe->stack[lowest]);
+	return NULL;
+}
+
+// Returns the peak stack usage in bytes of the given function, run on a fresh painted stack
+static size_t measureStack(void (*encode)(void)) {
+	struct StackProbe probe = {encode, malloc(STACK_SIZE), 0};
+	if (probe.stack == NULL)
+		exit(EXIT_FAILURE);
+	memset(probe.stack, STACK_PAINT, STACK_SIZE);
+	pthread_attr_t attr;
+	pthread_t thread;
+	pthread_attr_init(&attr);
+	pthread_attr_setstack(&attr, probe.stack, STACK_SIZE);
+	if (pthread_create(&thread, &attr, stackProbeThread, &probe) != 0) {
+		fprintf(stderr, "Cannot create the stack probe thread\n");
+		exit(EXIT_FAILURE);
+	}
+	pthread_join(thread, NULL);
+	pthread_attr_destroy(&attr);
+	free(probe.stack);
+	return probe.peak;
+}
+
+
+static void benchCompact(void) {
+	static uint8_t buf[qrcodegen_BUFFER_LEN_MAX], tempBuffer[qrcodegen_BUFFER_LEN_MAX];
+	static uint8_t bitmap[qrcodegen_BUFFER_LEN_MAX], compact[qrcodegen_BUFFER_LEN_MAX];
+	uint8_t work[qrcodegen_COMPACT_BUFFER_LEN_FOR_VERSION(qrcodegen_VERSION_MAX)];
+	struct qrcodegen_Segment segs[4];
+	
+	// Differential check at every version and error correction level, with a random fixed mask
+	// or the automatic one, which the compact encoder must choose alike
+	for (int version = qrcodegen_VERSION_MIN; version <= qrcodegen_VERSION_MAX; version++) {
+		for (int e = 0; e < 4; e++) {
+			for (int n = 0; n < (version <= 10 ? 6 : 2); n++) {
+				size_t len = makeRandomSegments(version, segs, buf);
+				enum qrcodegen_Mask mask = (enum qrcodegen_Mask)(n % 2 == 0 ? -1 : rand() % 8);
+				// Tight versions at this level, so that the boosted level may change
+				bool ok = qrcodegen_encodeSegmentsCompact(segs, len, (enum qrcodegen_Ecc)e, 1, version, mask, n < 2,
+					work, qrcodegen_storeRow, compact);
+				bool bitmapOk = qrcodegen_encodeSegmentsAdvanced(segs, len, (enum qrcodegen_Ecc)e, 1, version, mask, n < 2,
+					tempBuffer, bitmap);
+				if (ok != bitmapOk || (ok && memcmp(compact, bitmap,
+						(size_t)qrcodegen_BUFFER_LEN_FOR_VERSION(qrcodegen_getSize(bitmap) / 4 - 4)) != 0)) {
+					fprintf(stderr, "Compact encode differs at version %d, ECC level %d, mask %d\n", version, e, (int)mask);
+					exit(EXIT_FAILURE);
+				}
+			}
+		}
+	}
+	
+	// Differential check of the pages, at random positions, quiet zones and scales over prefilled buffers
+	static uint8_t rendered[128 * 16], streamed[128 * 16];
+	for (int n = 0; n < 2000; n++) {
+		int version = rand() % 10 + 1;
+		size_t len = makeRandomSegments(version, segs, buf);
+		struct qrcodegen_PageLayout layout = {streamed, rand() % 128 + 1, rand() % 16 + 1, 0, 0, rand() % 5, rand() % 3 + 1};
+		layout.left = rand() % (layout.width + 40) - 40;
+		layout.top = rand() % (layout.numPages * 8 + 40) - 40;
+		for (int i = 0; i < layout.width * layout.numPages; i++)
+			rendered[i] = streamed[i] = (uint8_t)rand();
+		enum qrcodegen_Mask mask = (enum qrcodegen_Mask)(rand() % 8);
+		if (!qrcodegen_encodeSegmentsAdvanced(segs, len, qrcodegen_Ecc_LOW, 1, version, mask, true, tempBuffer, bitmap)
+				|| !qrcodegen_encodeSegmentsCompact(segs, len, qrcodegen_Ecc_LOW, 1, version, mask, true, work,
+					qrcodegen_renderPageRow, &layout)) {
+			fprintf(stderr, "Cannot encode the random segments at version %d\n", version);
+			exit(EXIT_FAILURE);
+		}
+		qrcodegen_renderPages(bitmap, rendered, layout.width, layout.numPages, layout.left, layout.top,
+			layout.quietZone, layout.scale);
+		if (memcmp(rendered, streamed, (size_t)(layout.width * layout.numPages)) != 0) {
+			fprintf(stderr, "Streamed pages differ: version %d, %dx%d pages, at (%d, %d), quiet zone %d, scale %d\n",
+				version, layout.width, layout.numPages, layout.left, layout.top, layout.quietZone, layout.scale);
+			exit(EXIT_FAILURE);
+		}
+	}
+	
+	static const int versions[] = {1, 3, 5, 10, 20};
+	printf("\nCompact encode with automatic mask, " TICK_UNIT " per encode\n");
+	printf("%-8s %10s %10s %8s\n", "version", "bitmap", "compact", "slowdown");
+	for (size_t v = 0; v < sizeof(versions) / sizeof(versions[0]); v++) {
+		int version = versions[v];
+		size_t len = (size_t)(getNumDataCodewords(version, qrcodegen_Ecc_LOW) - 3);
+		for (size_t i = 0; i < len; i++)
+			buf[i] = (uint8_t)rand();
+		struct qrcodegen_Segment seg = byteSegment(buf, len);
+		int qrsize = version * 4 + 17;
+		int iterations = 200000 / (qrsize * qrsize) + 1;
+		
+		uint64_t start = ticks();
+		for (int n = 0; n < iterations; n++) {
+			qrcodegen_encodeSegmentsAdvanced(&seg, 1, qrcodegen_Ecc_LOW, version, version, qrcodegen_Mask_AUTO,
+				false, tempBuffer, bitmap);
+		}
+		uint64_t bitmapTicks = ticks() - start;
+		long black = 0;
+		start = ticks();
+		for (int n = 0; n < iterations; n++) {
+			qrcodegen_encodeSegmentsCompact(&seg, 1, qrcodegen_Ecc_LOW, version, version, qrcodegen_Mask_AUTO,
+				false, work, countRow, &black);
+		}
+		uint64_t compactTicks = ticks() - start;
+		double perBitmap = (double)bitmapTicks / iterations, perCompact = (double)compactTicks / iterations;
+		printf("%-8d %10.0f %10.0f %7.1fx\n", version, perBitmap, perCompact, perCompact / perBitmap);
+	}
+	
+	// Peak stack of a version 10 encode, buffers included; the segment data is not counted
+	size_t len = (size_t)(getNumDataCodewords(10, qrcodegen_Ecc_LOW) - 3);
+	for (size_t i = 0; i < len; i++)
+		buf[i] = (uint8_t)rand();
+	segs[0] = byteSegment(buf, len);
+	stackSegs = segs;
+	stackLen = 1;
+	printf("\nPeak stack of a version 10 encode, bytes (one bitmap: %d)\n", qrcodegen_BUFFER_LEN_FOR_VERSION(10));
+	printf("%-8s %10zu\n", "bitmap", measureStack(stackBitmapEncode));
+	// The encoder and its work buffer, without the padding and return address of the caller frame
+	size_t compactPeak = measureStack(stackCompactEncode) - measureStack(stackCompactBuffer)
+		+ qrcodegen_COMPACT_BUFFER_LEN_FOR_ECL(10, qrcodegen_Ecc_LOW);
+	printf("%-8s %10zu\n", "compact", compactPeak);
+	if (compactPeak >= (size_t)qrcodegen_BUFFER_LEN_FOR_VERSION(10)) {
+		fprintf(stderr, "The compact encoder peaks at %zu bytes, not under one version 10 bitmap\n", compactPeak);
+		exit(EXIT_FAILURE);
+	}
+	
+	// Peak stack of an encode drawn into pages: the QR area of main/ at version 3, and a 128x64 panel
+	static const struct {
+		int version, width, numPages, left, top, quietZone, scale;
+	} layouts[] = {
+		{3, 48, 4, 7, 0, 1, 1},
+		{10, 128, 8, 0, 0, 0, 1},
+	};
+	printf("\nPeak stack of an encode into pages, bytes\n");
+	printf("%-8s %10s %10s\n", "version", "bitmap", "compact");
+	for (size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+		stackVersion = layouts[l].version;
+		len = (size_t)(getNumDataCodewords(stackVersion, qrcodegen_Ecc_LOW) - 3);
+		for (size_t i = 0; i < len; i++)
+			buf[i] = (uint8_t)rand();
+		segs[0] = byteSegment(buf, len);
+		stackLayout = (struct qrcodegen_PageLayout){rendered, layouts[l].width, layouts[l].numPages,
+			layouts[l].left, layouts[l].top, layouts[l].quietZone, layouts[l].scale};
+		size_t bitmapPeak = measureStack(stackBitmapRender);
+		size_t compactPeak = measureStack(stackCompactRender);
+		printf("%-8d %10zu %10zu\n", stackVersion, bitmapPeak, compactPeak);
+		if (compactPeak >= bitmapPeak) {
+			fprintf(stderr, "The compact encode into pages takes more stack than the bitmap one at version %d\n", stackVersion);
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+
+/*---- Benchmark of the fast mask choice ----*/
+
+// Writes a random payload like the ones the devices show: Wi-Fi credentials or a setup URL
+static void makeRealisticPayload(char *out, size_t size) {
+	static const char *words[] = {"Home", "Office", "Guest", "ESP", "Lab", "Kitchen", "Garage", "IoT", "Studio", "Shop"};
+	static const char *chars = "abcdefghijkmnopqrstuvwxyzABCDEFGHJKLMNPQRSTUVWXYZ23456789";
+	static const char *hex = "0123456789ABCDEF";
+	char random[64];
+	int len = 8 + rand() % 17;
+	for (int i = 0; i < len; i++)
+		random[i] = chars[rand() % 57];
+	random[len] = '\0';
+	int id = rand() & 0xFFFFFF;
+	switch (rand() % 4) {
+		case 0:
+			snprintf(out, size, "WIFI:S:%s-%06X;T:WPA;P:%s;;", words[rand() % 10], id, random);
+			break;
+		case 1:
+			snprintf(out, size, "WIFI:S:%s %s;T:WPA;P:%s;H:%s;;", words[rand() % 10], words[rand() % 10],
+				random, rand() % 2 ? "true" : "false");
+			break;
+		case 2:
+			snprintf(out, size, "https://dev-%06x.local/setup?token=%s", id, random);
+			break;
+		default:
+			snprintf(out, size, "HTTP://192.168.4.1/%c%c%c%c", hex[id & 15], hex[id >> 4 & 15], hex[id >> 8 & 15], hex[id >> 12 & 15]);
+			break;
+	}
+}
+
+
+// Returns the error correction level and the mask of the given QR Code, read from its format bits
+static enum qrcodegen_Mask readFormat(const uint8_t qrcode[], enum qrcodegen_Ecc *ecl) {
+	int bits = 0;
+	for (int i = 0; i <= 5; i++)
+		bits |= getModule(qrcode, 8, i) << i;
+	bits |= getModule(qrcode, 8, 7) << 6;
+	bits |= getModule(qrcode, 8, 8) << 7;
+	bits |= getModule(qrcode, 7, 8) << 8;
+	for (int i = 9; i < 15; i++)
+		bits |= getModule(qrcode, 14 - i, 8) << i;
+	bits ^= 0x5412;
+	static const enum qrcodegen_Ecc levels[] = {qrcodegen_Ecc_MEDIUM, qrcodegen_Ecc_LOW, qrcodegen_Ecc_HIGH, qrcodegen_Ecc_QUARTILE};
+	*ecl = levels[bits >> 13];
+	return (enum qrcodegen_Mask)(bits >> 10 & 7);
+}
+
+
+// Returns the penalty score of the given payload encoded with the given mask, as the firmware would encode it
+static long fixedMaskPenalty(const char *payload, enum qrcodegen_Mask mask) {
+	uint8_t tempBuffer[qrcodegen_BUFFER_LEN_FOR_VERSION(10)], qrcode[qrcodegen_BUFFER_LEN_FOR_VERSION(10)];
+	if (!qrcodegen_encodeText(payload, tempBuffer, qrcode, qrcodegen_Ecc_LOW, 1, 10, mask, true))
+		exit(EXIT_FAILURE);
+	return getPenaltyScore(qrcode);
+}
+
+
+static void benchFastMask(void) {
+	enum { CORPUS = 2000, REPEATS = 3 };
+	static char payloads[CORPUS][128];
+	for (int n = 0; n < CORPUS; n++)
+		makeRealisticPayload(payloads[n], sizeof(payloads[n]));
+	
+	// Whole encodes, as the firmware does them; the best of a few runs
+	static uint8_t autoCodes[CORPUS][qrcodegen_BUFFER_LEN_FOR_VERSION(10)], fastCodes[CORPUS][qrcodegen_BUFFER_LEN_FOR_VERSION(10)];
+	uint8_t tempBuffer[qrcodegen_BUFFER_LEN_FOR_VERSION(10)];
+	uint64_t best[2] = {UINT64_MAX, UINT64_MAX};
+	for (int r = 0; r < REPEATS * 2; r++) {
+		int pass = r % 2;
+		enum qrcodegen_Mask mask = pass == 0 ? qrcodegen_Mask_AUTO : qrcodegen_Mask_FAST;
+		uint8_t (*codes)[qrcodegen_BUFFER_LEN_FOR_VERSION(10)] = pass == 0 ? autoCodes : fastCodes;
+		uint64_t start = ticks();
+		for (int n = 0; n < CORPUS; n++) {
+			if (!qrcodegen_encodeText(payloads[n], tempBuffer, codes[n], qrcodegen_Ecc_LOW, 1, 10, mask, true)) {
+				fprintf(stderr, "Encoding failed: %s\n", payloads[n]);
+				exit(EXIT_FAILURE);
+			}
+		}
+		uint64_t elapsed = ticks() - start;
+		if (elapsed < best[pass])
+			best[pass] = elapsed;
+	}
+	int differ = 0;
+	long autoTotal = 0, fastTotal = 0;
+	for (int n = 0; n < CORPUS; n++) {
+		enum qrcodegen_Ecc ecl;
+		differ += readFormat(autoCodes[n], &ecl) != readFormat(fastCodes[n], &ecl);
+		autoTotal += getPenaltyScore(autoCodes[n]);
+		fastTotal += getPenaltyScore(fastCodes[n]);
+	}
+	printf("\nFast mask choice over %d Wi-Fi and URL payloads, " TICK_UNIT " per encode\n", CORPUS);
+	printf("%-10s %10s %10s %8s %10s %8s\n", "", "auto", "fast", "speedup", "different", "penalty");
+	printf("%-10s %10.0f %10.0f %7.1fx %9.1f%% %+7.2f%%\n", "encode", (double)best[0] / CORPUS, (double)best[1] / CORPUS,
+		(double)best[0] / (double)best[1], 100.0 * differ / CORPUS, 100.0 * (double)(fastTotal - autoTotal) / (double)autoTotal);
+	
+	// The mask choice alone, on the unmasked codes, for each number of candidates scored in full
+	static uint8_t unmasked[CORPUS][qrcodegen_BUFFER_LEN_FOR_VERSION(10)], functionModules[CORPUS][qrcodegen_BUFFER_LEN_FOR_VERSION(10)];
+	static enum qrcodegen_Ecc levels[CORPUS];
+	static enum qrcodegen_Mask autoMasks[CORPUS];
+	for (int n = 0; n < CORPUS; n++) {
+		memcpy(unmasked[n], autoCodes[n], sizeof(unmasked[n]));
+		autoMasks[n] = readFormat(unmasked[n], &levels[n]);
+		initializeFunctionModules(qrcodegen_getSize(unmasked[n]) / 4 - 4, functionModules[n]);
+		applyMask(functionModules[n], unmasked[n], autoMasks[n]);
+	}
+	printf("%-10s %10s %8s %10s %8s\n", "candidates", "choice", "speedup", "different", "penalty");
+	uint64_t exact = 0;
+	for (int candidates = 8; candidates >= 1; candidates--) {
+		static enum qrcodegen_Mask masks[CORPUS];
+		uint64_t elapsed = UINT64_MAX;
+		for (int r = 0; r < REPEATS; r++) {
+			uint64_t start = ticks();
+			for (int n = 0; n < CORPUS; n++)
+				masks[n] = chooseMaskFast(functionModules[n], unmasked[n], levels[n], candidates);
+			uint64_t t = ticks() - start;
+			if (t < elapsed)
+				elapsed = t;
+		}
+		differ = 0;
+		long excess = 0;
+		for (int n = 0; n < CORPUS; n++) {
+			if (masks[n] != autoMasks[n]) {
+				differ++;
+				excess += fixedMaskPenalty(payloads[n], masks[n]) - getPenaltyScore(autoCodes[n]);
+			}
+		}
+		if (candidates == 8) {
+			exact = elapsed;
+			if (differ != 0) {
+				fprintf(stderr, "The fast mask choice with all candidates differs from the automatic one\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		printf("%-10d %10.0f %7.1fx %9.1f%% %+7.2f%%\n", candidates, (double)elapsed / CORPUS,
+			(double)exact / (double)elapsed, 100.0 * differ / CORPUS, 100.0 * (double)excess / (double)autoTotal);
+	}
+}
+
+
+int main(void) {
+	srand(1);
+	benchEcc();
+	benchMask();
+	benchPenalty();
+	benchPool();
+	benchRender();
+	benchCompact();
+	benchFastMask();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,516 @@
+/*
+ * Host tool that renders the Wi-Fi QR Codes of a list of devices, for printing stickers
+ *
+ *   qrgen [-o dir] [-f png|pbm] [-j threads] [-s scale] [-b border] [-e L|M|Q|H] [-m auto|fast|0-7] [-n] devices.csv
+ *
+ * Each record of the CSV file is "ssid,password" or "ssid,password,name", with RFC 4180
+ * quoting. Empty lines and lines starting with '#' are skipped. The payload is the one of
+ * the firmware (WIFI_QR_PAYLOAD in main/include/qr_payloads.h), with the special characters
+ * escaped, or T:nopass for an empty password. The image of each record is written to
+ * dir/name.png, or dir/NNNNNN.png with the record number if there is no name.
+ *
+ * The records are split into one contiguous shard per thread. Each thread encodes its shard
+ * in batches with qrcodegen_encodeTextBatch(), then builds each image file in memory
+ * and writes it with a single call. PNG files are 1-bit grayscale, with the image data
+ * in stored (uncompressed) deflate blocks, so no zlib is needed.
+ * With -n the images are built but not written, to time the rest.
+ */
+
+#define _DEFAULT_SOURCE  // For stpcpy() and _SC_NPROCESSORS_ONLN
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "qrcodegen.h"
+
+
+#define BATCH_SIZE  256  // Records encoded per qrcodegen_encodeTextBatch() call
+#define MAX_THREADS  64
+
+
+/*---- Options and records ----*/
+
+struct Options {
+	const char *outDir;
+	bool png;
+	int numThreads;
+	int scale;
+	int border;
+	enum qrcodegen_Ecc ecl;
+	enum qrcodegen_Mask mask;
+	bool dryRun;
+};
+
+
+struct Record {
+	int line;  // In the CSV file, for the error messages
+	char *payload;
+	char *name;  // Null for the record number
+};
+
+
+struct Shard {
+	const struct Options *options;
+	const struct Record *records;
+	size_t start;  // Index of the first record, for the record numbers
+	size_t count;
+	size_t failures;
+};
+
+
+static void usage(const char *argv0) {
+	fprintf(stderr, "Usage: %s [-o dir] [-f png|pbm] [-j threads] [-s scale] [-b border]"
+		" [-e L|M|Q|H] [-m auto|fast|0-7] [-n] devices.csv\n", argv0);
+	exit(EXIT_FAILURE);
+}
+
+
+static void *xmalloc(size_t size) {
+	void *result = malloc(size);
+	if (result == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	return result;
+}
+
+
+
+/*---- CSV parsing and payloads ----*/
+
+// Reads the whole file into a null-terminated buffer.
+static char *readFile(const char *path) {
+	FILE *in = fopen(path, "rb");
+	if (in == NULL) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	size_t capacity = 1 << 16, length = 0;
+	char *data = xmalloc(capacity);
+	for (;;) {
+		length += fread(&data[length], 1, capacity - length - 1, in);
+		if (ferror(in)) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+		if (feof(in))
+			break;
+		capacity *= 2;
+		data = realloc(data, capacity);
+		if (data == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	fclose(in);
+	data[length] = '\0';
+	return data;
+}
+
+
+// Parses the field at *p in place, unquoting it, and advances *p past it and its separator.
+// Returns the field, null-terminated, and stores the separator that ended it ('\0' at the end of the file).
+static char *parseField(char **p, char *separator) {
+	char *field = *p, *in = *p, *out = *p;
+	if (*in == '"') {
+		for (in++; *in != '\0'; in++) {
+			if (*in == '"') {
+				if (in[1] != '"') {
+					in++;
+					break;
+				}
+				in++;  // A doubled quote
+			}
+			*out++ = *in;
+		}
+	}
+	while (*in != '\0' && *in != ',' && *in != '\n' && *in != '\r')
+		*out++ = *in++;
+	*separator = *in;
+	if (*in == '\r' && in[1] == '\n')
+		in++;
+	if (*in != '\0')
+		in++;
+	*out = '\0';
+	*p = in;
+	return field;
+}
+
+
+// Appends the given text to out with the special characters of the WIFI: scheme escaped.
+static char *appendEscaped(char *out, const char *text) {
+	for (; *text != '\0'; text++) {
+		if (strchr("\\;,:\"", *text) != NULL)
+			*out++ = '\\';
+		*out++ = *text;
+	}
+	return out;
+}
+
+
+static char *makeWifiPayload(const char *ssid, const char *password) {
+	char *payload = xmalloc(strlen(ssid) * 2 + strlen(password) * 2 + 32);
+	char *out = appendEscaped(stpcpy(payload, "WIFI:S:"), ssid);
+	if (*password == '\0')
+		out = stpcpy(out, ";T:nopass");
+	else
+		out = appendEscaped(stpcpy(out, ";T:WPA;P:"), password);
+	strcpy(out, ";;");
+	return payload;
+}
+
+
+static struct Record *parseRecords(char *data, size_t *count) {
+	size_t capacity = 1024;
+	struct Record *records = xmalloc(capacity * sizeof(records[0]));
+	*count = 0;
+	char *p = data;
+	for (int line = 1; *p != '\0'; line++) {
+		if (*p == '#' || *p == '\n' || *p == '\r') {  // Comment or empty line
+			p += strcspn(p, "\n");
+			if (*p != '\0')
+				p++;
+			continue;
+		}
+		char *fields[3] = {NULL, NULL, NULL};
+		int numFields = 0;
+		char separator = ',';
+		while (separator == ',') {
+			char *field = parseField(&p, &separator);
+			if (numFields < 3)
+				fields[numFields] = field;
+			numFields++;
+		}
+		if (numFields < 2 || numFields > 3) {
+			fprintf(stderr, "line %d: expected ssid,password[,name]\n", line);
+			exit(EXIT_FAILURE);
+		}
+		if (fields[2] != NULL && (fields[2][0] == '\0' || strchr(fields[2], '/') != NULL)) {
+			fprintf(stderr, "line %d: invalid file name: %s\n", line, fields[2]);
+			exit(EXIT_FAILURE);
+		}
+		if (*count == capacity) {
+			capacity *= 2;
+			records = realloc(records, capacity * sizeof(records[0]));
+			if (records == NULL) {
+				fprintf(stderr, "Out of memory\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		struct Record *record = &records[(*count)++];
+		record->line = line;
+		record->payload = makeWifiPayload(fields[0], fields[1]);
+		record->name = fields[2];
+	}
+	return records;
+}
+
+
+
+/*---- Image files ----*/
+
+static uint32_t crcTable[256];
+
+
+static void initCrcTable(void) {
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t c = i;
+		for (int k = 0; k < 8; k++)
+			c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+		crcTable[i] = c;
+	}
+}
+
+
+static uint32_t crc32(uint32_t crc, const uint8_t data[], size_t len) {
+	crc = ~crc;
+	for (size_t i = 0; i < len; i++)
+		crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+
+static uint8_t *putBigEndian32(uint8_t *out, uint32_t val) {
+	out[0] = (uint8_t)(val >> 24);
+	out[1] = (uint8_t)(val >> 16);
+	out[2] = (uint8_t)(val >> 8);
+	out[3] = (uint8_t)val;
+	return out + 4;
+}
+
+
+// Writes the given chunk data, which starts 8 bytes after out, between its length and type and its CRC.
+static uint8_t *finishPngChunk(uint8_t *out, const char type[4], size_t dataLen) {
+	putBigEndian32(out, (uint32_t)dataLen);
+	memcpy(&out[4], type, 4);
+	return putBigEndian32(&out[8 + dataLen], crc32(0, &out[4], dataLen + 4));
+}
+
+
+// The largest file of an image with the given side in pixels.
+static size_t maxFileSize(int width) {
+	size_t rowLen = (size_t)(width + 7) / 8 + 1;  // With the filter byte of PNG
+	size_t raw = rowLen * (size_t)width;
+	return 64 + raw + (raw / 65535 + 1) * 5;
+}
+
+
+// Renders the pixel rows of the given QR Code, black set, into rows[], each rowLen bytes.
+static void renderRows(const uint8_t qrcode[], int scale, int border, uint8_t rows[], size_t rowLen) {
+	int size = qrcodegen_getSize(qrcode);
+	int width = (size + border * 2) * scale;
+	memset(rows, 0, rowLen * (size_t)width);
+	for (int y = 0; y < size; y++) {
+		uint8_t *row = &rows[rowLen * (size_t)((y + border) * scale)];
+		for (int x = 0; x < size; x++) {
+			if (!qrcodegen_getModule(qrcode, x, y))
+				continue;
+			for (int i = (x + border) * scale, end = i + scale; i < end; i++)
+				row[i >> 3] |= (uint8_t)(0x80 >> (i & 7));
+		}
+		for (int i = 1; i < scale; i++)
+			memcpy(&row[rowLen * (size_t)i], row, rowLen);
+	}
+}
+
+
+// Builds the PBM (P4) file of the given QR Code into out[] and returns its length.
+static size_t makePbm(const uint8_t qrcode[], int scale, int border, uint8_t out[]) {
+	int width = (qrcodegen_getSize(qrcode) + border * 2) * scale;
+	int headerLen = sprintf((char *)out, "P4\n%d %d\n", width, width);
+	size_t rowLen = (size_t)(width + 7) / 8;
+	renderRows(qrcode, scale, border, &out[headerLen], rowLen);
+	return (size_t)headerLen + rowLen * (size_t)width;
+}
+
+
+// Builds the PNG file of the given QR Code into out[] and returns its length. The rows are rendered
+// at the end of the buffer and moved into the deflate blocks, each row after its filter byte.
+static size_t makePng(const uint8_t qrcode[], int scale, int border, uint8_t out[], size_t outLen) {
+	static const uint8_t SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+	int width = (qrcodegen_getSize(qrcode) + border * 2) * scale;
+	size_t rowLen = (size_t)(width + 7) / 8;
+	uint8_t *rows = &out[outLen - rowLen * (size_t)width];
+	renderRows(qrcode, scale, border, rows, rowLen);
+
+	uint8_t *p = out;
+	memcpy(p, SIGNATURE, sizeof(SIGNATURE));
+	p += sizeof(SIGNATURE);
+	uint8_t *header = &p[8];
+	putBigEndian32(&header[0], (uint32_t)width);
+	putBigEndian32(&header[4], (uint32_t)width);
+	memcpy(&header[8], "\x01\x00\x00\x00\x00", 5);  // Bit depth 1, grayscale, deflate, no filtering, no interlace
+	p = finishPngChunk(p, "IHDR", 13);
+
+	// zlib stream of stored blocks, with the raw data fed through as it's produced
+	uint8_t *chunk = p;
+	uint8_t *z = &chunk[8];
+	*z++ = 0x78;
+	*z++ = 0x01;
+	size_t rawLen = (rowLen + 1) * (size_t)width;
+	size_t blockLeft = 0, rawLeft = rawLen;
+	uint32_t adlerA = 1, adlerB = 0;
+	for (int y = 0; y < width; y++) {
+		const uint8_t *row = &rows[rowLen * (size_t)y];
+		for (size_t i = 0; i <= rowLen; i++) {
+			// 0 is the filter byte, then the row inverted: 0 is black in PNG grayscale
+			uint8_t b = i == 0 ? 0 : (uint8_t)~row[i - 1];
+			if (blockLeft == 0) {
+				blockLeft = rawLeft < 65535 ? rawLeft : 65535;
+				rawLeft -= blockLeft;
+				*z++ = rawLeft == 0 ? 1 : 0;  // BFINAL on the last block, BTYPE 00
+				*z++ = (uint8_t)blockLeft;
+				*z++ = (uint8_t)(blockLeft >> 8);
+				*z++ = (uint8_t)~blockLeft;
+				*z++ = (uint8_t)(~blockLeft >> 8);
+			}
+			*z++ = b;
+			blockLeft--;
+			adlerA += b;
+			adlerB += adlerA;
+		}
+		adlerA %= 65521;  // A row of at most 2442 bytes can't overflow the sums
+		adlerB %= 65521;
+	}
+	z = putBigEndian32(z, adlerB << 16 | adlerA);
+	p = finishPngChunk(chunk, "IDAT", (size_t)(z - &chunk[8]));
+	return (size_t)(finishPngChunk(p, "IEND", 0) - out);
+}
+
+
+
+/*---- Workers ----*/
+
+static bool writeFile(const char *path, const uint8_t data[], size_t len) {
+	FILE *out = fopen(path, "wb");
+	if (out == NULL) {
+		perror(path);
+		return false;
+	}
+	setvbuf(out, NULL, _IONBF, 0);  // The file is already in one buffer
+	bool ok = fwrite(data, 1, len, out) == len;
+	if (fclose(out) != 0)
+		ok = false;
+	if (!ok)
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+	return ok;
+}
+
+
+static void *encodeShard(void *arg) {
+	struct Shard *shard = (struct Shard *)arg;
+	const struct Options *options = shard->options;
+	size_t codeLen = (size_t)qrcodegen_BUFFER_LEN_MAX;
+	size_t arenaLen = codeLen * BATCH_SIZE;
+	uint8_t *tempBuffer = xmalloc(codeLen);
+	uint8_t *arena = xmalloc(arenaLen);
+	size_t fileLen = maxFileSize((qrcodegen_VERSION_MAX * 4 + 17 + options->border * 2) * options->scale);
+	uint8_t *file = xmalloc(fileLen);
+	size_t nameLen = 16;  // Enough for the record numbers and the extension
+	for (size_t i = 0; i < shard->count; i++) {
+		if (shard->records[i].name != NULL && strlen(shard->records[i].name) + 8 > nameLen)
+			nameLen = strlen(shard->records[i].name) + 8;
+	}
+	size_t pathLen = strlen(options->outDir) + nameLen;
+	char *path = xmalloc(pathLen);
+	const char *texts[BATCH_SIZE];
+	size_t offsets[BATCH_SIZE];
+
+	for (size_t done = 0; done < shard->count; ) {
+		size_t count = shard->count - done;
+		if (count > BATCH_SIZE)
+			count = BATCH_SIZE;
+		const struct Record *records = &shard->records[done];
+		for (size_t i = 0; i < count; i++)
+			texts[i] = records[i].payload;
+		count = qrcodegen_encodeTextBatch(texts, count, tempBuffer, arena, arenaLen, offsets,
+			options->ecl, qrcodegen_VERSION_MIN, qrcodegen_VERSION_MAX, options->mask, true);
+
+		for (size_t i = 0; i < count; i++) {
+			const struct Record *record = &records[i];
+			if (offsets[i] == qrcodegen_BATCH_NO_FIT) {
+				fprintf(stderr, "line %d: payload too long: %.40s...\n", record->line, record->payload);
+				shard->failures++;
+				continue;
+			}
+			const uint8_t *qrcode = &arena[offsets[i]];
+			size_t len = options->png ? makePng(qrcode, options->scale, options->border, file, fileLen)
+				: makePbm(qrcode, options->scale, options->border, file);
+			if (options->dryRun)
+				continue;
+			const char *ext = options->png ? "png" : "pbm";
+			if (record->name != NULL)
+				snprintf(path, pathLen, "%s/%s.%s", options->outDir, record->name, ext);
+			else
+				snprintf(path, pathLen, "%s/%06zu.%s", options->outDir, shard->start + done + i + 1, ext);
+			if (!writeFile(path, file, len))
+				shard->failures++;
+		}
+		done += count;
+	}
+	free(path);
+	free(file);
+	free(arena);
+	free(tempBuffer);
+	return NULL;
+}
+
+
+static int parseInt(const char *arg, int min, int max, const char *argv0) {
+	char *end;
+	long val = strtol(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || val < min || val > max)
+		usage(argv0);
+	return (int)val;
+}
+
+
+int main(int argc, char *argv[]) {
+	struct Options options = {
+		.outDir = ".",
+		.png = true,
+		.numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN),
+		.scale = 4,
+		.border = 4,
+		.ecl = qrcodegen_Ecc_LOW,
+		.mask = qrcodegen_Mask_AUTO,
+		.dryRun = false,
+	};
+	int opt;
+	while ((opt = getopt(argc, argv, "o:f:j:s:b:e:m:n")) != -1) {
+		switch (opt) {
+			case 'o':  options.outDir = optarg;  break;
+			case 'f':
+				if (strcmp(optarg, "png") != 0 && strcmp(optarg, "pbm") != 0)
+					usage(argv[0]);
+				options.png = strcmp(optarg, "png") == 0;
+				break;
+			case 'j':  options.numThreads = parseInt(optarg, 1, MAX_THREADS, argv[0]);  break;
+			case 's':  options.scale = parseInt(optarg, 1, 64, argv[0]);  break;
+			case 'b':  options.border = parseInt(optarg, 0, 64, argv[0]);  break;
+			case 'e': {
+				const char *levels = "LMQH";
+				if (strlen(optarg) != 1 || strchr(levels, optarg[0]) == NULL)
+					usage(argv[0]);
+				options.ecl = (enum qrcodegen_Ecc)(strchr(levels, optarg[0]) - levels);
+				break;
+			}
+			case 'm':
+				if (strcmp(optarg, "auto") == 0)
+					options.mask = qrcodegen_Mask_AUTO;
+				else if (strcmp(optarg, "fast") == 0)
+					options.mask = qrcodegen_Mask_FAST;
+				else
+					options.mask = (enum qrcodegen_Mask)parseInt(optarg, 0, 7, argv[0]);
+				break;
+			case 'n':  options.dryRun = true;  break;
+			default:  usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argv[0]);
+	if (options.numThreads < 1)
+		options.numThreads = 1;
+	else if (options.numThreads > MAX_THREADS)
+		options.numThreads = MAX_THREADS;
+	initCrcTable();
+
+	size_t count;
+	struct Record *records = parseRecords(readFile(argv[optind]), &count);
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	struct Shard shards[MAX_THREADS];
+	pthread_t threads[MAX_THREADS];
+	int numThreads = options.numThreads;
+	for (int i = 0; i < numThreads; i++) {
+		size_t first = count * (size_t)i / (size_t)numThreads;
+		size_t last = count * (size_t)(i + 1) / (size_t)numThreads;
+		shards[i] = (struct Shard){&options, &records[first], first, last - first, 0};
+		if (pthread_create(&threads[i], NULL, encodeShard, &shards[i]) != 0) {
+			fprintf(stderr, "Cannot create thread %d\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+	size_t failures = 0;
+	for (int i = 0; i < numThreads; i++) {
+		pthread_join(threads[i], NULL);
+		failures += shards[i].failures;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+	fprintf(stderr, "%zu codes in %.3f s (%.0f codes/s, %d threads)%s\n", count - failures, seconds,
+		seconds > 0 ? (double)(count - failures) / seconds : 0.0, numThreads, options.dryRun ? ", not written" : "");
+	if (failures > 0) {
+		fprintf(stderr, "%zu failed\n", failures);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
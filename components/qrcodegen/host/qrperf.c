@@ -0,0 +1,342 @@
+/*
+ * Performance regression check of the QR Code generator
+ *
+ *   qrperf [-b baseline.json] [-t tolerance] [-o results.json]
+ *
+ * Times the stages of the bitmap encoder in ns, per version and error correction level,
+ * with a byte segment that fills the data capacity:
+ * - pack: packSegments(), the segments, terminator and padding into data codewords
+ * - ecc: addEccAndInterleave()
+ * - draw: initializeFunctionModules() and drawCodewords()
+ * - mask: the search of qrcodegen_Mask_AUTO, applying, scoring and undoing each of the 8 masks
+ * - penalty: one getPenaltyScore()
+ * - encode, encode_fast: a whole qrcodegen_encodeSegmentsAdvanced() with qrcodegen_Mask_AUTO
+ *   and qrcodegen_Mask_FAST
+ * Each time is the best of several runs, to keep out the noise of other processes.
+ *
+ * The results are printed as JSON, one "v<version>-<ecc>/<stage>" key per line, with the time
+ * of a fixed calibration loop. Given a baseline, a previous output of this program, each result
+ * is compared with the baseline scaled by the ratio of the calibration times, so that a
+ * baseline of a faster or slower machine roughly applies. Single results are too noisy to fail
+ * on, so the ratios are averaged per stage (geometric mean over the versions and levels):
+ * if a stage is slower by more than the tolerance (default 0.15, i.e. 15%), the exit status
+ * is 1. The single results slower by more than twice the tolerance are listed as a hint.
+ * To record a new baseline, after a deliberate change or on another machine:
+ *
+ *   qrperf -o host/qrperf_baseline.json
+ */
+
+#define _POSIX_C_SOURCE 200809L  // For clock_gettime()
+
+#include <stdbool.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "qrcodegen.h"
+
+
+/*---- Private functions of qrcodegen.c, exposed by QRCODEGEN_TEST ----*/
+
+int packSegments(const struct qrcodegen_Segment segs[], size_t len,
+	int version, enum qrcodegen_Ecc ecl, uint8_t qrcode[]);
+void addEccAndInterleave(uint8_t data[], int version, enum qrcodegen_Ecc ecl, uint8_t result[]);
+int getNumDataCodewords(int version, enum qrcodegen_Ecc ecl);
+int getNumRawDataModules(int ver);
+void initializeFunctionModules(int version, uint8_t qrcode[]);
+void drawCodewords(const uint8_t data[], int dataLen, uint8_t qrcode[]);
+void applyMask(const uint8_t functionModules[], uint8_t qrcode[], enum qrcodegen_Mask mask);
+long getPenaltyScore(const uint8_t qrcode[]);
+
+
+
+/*---- Timing ----*/
+
+enum Stage {PACK, ECC, DRAW, MASK, PENALTY, ENCODE, ENCODE_FAST, NUM_STAGES};
+
+static const char *STAGE_NAMES[NUM_STAGES] = {"pack", "ecc", "draw", "mask", "penalty", "encode", "encode_fast"};
+
+static const int VERSIONS[] = {1, 2, 3, 4, 5, 7, 10, 15, 20, 25, 30, 35, 40};
+
+#define RUNS  5  // The best of which is kept
+#define MIN_RUN_NS  1000000  // Iterations are doubled until a run takes this long
+#define NOISE_FLOOR_NS  50.0  // Single results closer than this to the baseline are not listed
+
+
+// The inputs of one version and ECC level, prepared once
+struct Case {
+	int version;
+	enum qrcodegen_Ecc ecl;
+	struct qrcodegen_Segment seg;
+	uint8_t payload[qrcodegen_BUFFER_LEN_MAX];
+	uint8_t data[qrcodegen_BUFFER_LEN_MAX];  // The data codewords
+	uint8_t codewords[qrcodegen_BUFFER_LEN_MAX];  // With the ECC, interleaved
+	uint8_t functionModules[qrcodegen_BUFFER_LEN_MAX];
+	uint8_t unmasked[qrcodegen_BUFFER_LEN_MAX];
+	uint8_t work[qrcodegen_BUFFER_LEN_MAX];
+	uint8_t temp[qrcodegen_BUFFER_LEN_MAX];
+};
+
+static volatile long sink;  // Keeps the results alive
+
+
+static uint64_t nanoseconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+
+static void prepareCase(struct Case *c, int version, enum qrcodegen_Ecc ecl) {
+	c->version = version;
+	c->ecl = ecl;
+	int countBits = version < 10 ? 8 : 16;
+	size_t len = (size_t)((getNumDataCodewords(version, ecl) * 8 - 4 - countBits) / 8);
+	for (size_t i = 0; i < len; i++)
+		c->payload[i] = (uint8_t)rand();
+	c->seg.mode = qrcodegen_Mode_BYTE;
+	c->seg.numChars = (int)len;
+	c->seg.bitLength = (int)len * 8;
+	c->seg.data = c->payload;
+
+	packSegments(&c->seg, 1, version, ecl, c->data);
+	memcpy(c->work, c->data, sizeof(c->data));
+	addEccAndInterleave(c->work, version, ecl, c->codewords);
+	initializeFunctionModules(version, c->functionModules);
+	initializeFunctionModules(version, c->unmasked);
+	drawCodewords(c->codewords, getNumRawDataModules(version) / 8, c->unmasked);
+}
+
+
+static void runStage(struct Case *c, enum Stage stage, long iterations) {
+	int rawCodewords = getNumRawDataModules(c->version) / 8;
+	for (long i = 0; i < iterations; i++) {
+		switch (stage) {
+			case PACK:
+				sink = packSegments(&c->seg, 1, c->version, c->ecl, c->work);
+				break;
+			case ECC:
+				addEccAndInterleave(c->data, c->version, c->ecl, c->work);
+				break;
+			case DRAW:
+				initializeFunctionModules(c->version, c->work);
+				drawCodewords(c->codewords, rawCodewords, c->work);
+				break;
+			case MASK:
+				for (int m = 0; m < 8; m++) {
+					applyMask(c->functionModules, c->unmasked, (enum qrcodegen_Mask)m);
+					sink = getPenaltyScore(c->unmasked);
+					applyMask(c->functionModules, c->unmasked, (enum qrcodegen_Mask)m);
+				}
+				break;
+			case PENALTY:
+				sink = getPenaltyScore(c->unmasked);
+				break;
+			case ENCODE:
+			case ENCODE_FAST:
+				if (!qrcodegen_encodeSegmentsAdvanced(&c->seg, 1, c->ecl, c->version, c->version,
+						stage == ENCODE ? qrcodegen_Mask_AUTO : qrcodegen_Mask_FAST, false, c->temp, c->work)) {
+					fprintf(stderr, "Encoding failed at version %d\n", c->version);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			default:
+				abort();
+		}
+	}
+}
+
+
+// Returns the best time of one iteration of the given stage, in ns.
+static double timeStage(struct Case *c, enum Stage stage) {
+	long iterations = 1;
+	uint64_t elapsed;
+	for (;;) {
+		uint64_t start = nanoseconds();
+		runStage(c, stage, iterations);
+		elapsed = nanoseconds() - start;
+		if (elapsed >= MIN_RUN_NS)
+			break;
+		iterations *= 2;
+	}
+	for (int run = 1; run < RUNS; run++) {
+		uint64_t start = nanoseconds();
+		runStage(c, stage, iterations);
+		uint64_t t = nanoseconds() - start;
+		if (t < elapsed)
+			elapsed = t;
+	}
+	return (double)elapsed / (double)iterations;
+}
+
+
+// A fixed loop of dependent integer operations, to compare the speed of machines.
+static double timeCalibration(void) {
+	double best = 0;
+	for (int run = 0; run < RUNS; run++) {
+		uint64_t start = nanoseconds();
+		uint32_t x = 1;
+		for (long i = 0; i < (1L << 22); i++) {  // xorshift32
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+		}
+		sink = (long)x;
+		double t = (double)(nanoseconds() - start);
+		if (run == 0 || t < best)
+			best = t;
+	}
+	return best;
+}
+
+
+
+/*---- Baseline ----*/
+
+struct Result {
+	char key[32];
+	double ns;
+};
+
+
+// Reads the results of a previous output; returns their number, or -1 if the file can't be read.
+static int readBaseline(const char *path, struct Result results[], int capacity, double *calibration) {
+	FILE *in = fopen(path, "r");
+	if (in == NULL) {
+		perror(path);
+		return -1;
+	}
+	char line[256];
+	int count = 0;
+	*calibration = 0;
+	while (fgets(line, sizeof(line), in) != NULL) {
+		char key[32];
+		double ns;
+		if (sscanf(line, " \"%31[^\"]\" : %lf", key, &ns) != 2)
+			continue;
+		if (strcmp(key, "calibration") == 0)
+			*calibration = ns;
+		else if (count < capacity) {
+			strcpy(results[count].key, key);
+			results[count].ns = ns;
+			count++;
+		}
+	}
+	fclose(in);
+	return count;
+}
+
+
+static int compareWithBaseline(const struct Result results[], int count, double calibration,
+		const char *path, double tolerance) {
+	static struct Result baseline[sizeof(VERSIONS) / sizeof(VERSIONS[0]) * 4 * NUM_STAGES];
+	double baseCalibration;
+	int baseCount = readBaseline(path, baseline, (int)(sizeof(baseline) / sizeof(baseline[0])), &baseCalibration);
+	if (baseCount < 0)
+		return -1;
+	double scale = baseCalibration > 0 ? calibration / baseCalibration : 1.0;
+	fprintf(stderr, "Baseline %s: %d results, this machine runs the calibration %.2fx as long\n", path, baseCount, scale);
+
+	double logSums[NUM_STAGES] = {0};
+	int counts[NUM_STAGES] = {0};
+	for (int i = 0; i < count; i++) {
+		for (int j = 0; j < baseCount; j++) {
+			if (strcmp(results[i].key, baseline[j].key) != 0)
+				continue;
+			double expected = baseline[j].ns * scale;
+			double ratio = results[i].ns / expected;
+			int stage = i % NUM_STAGES;  // The order of main()
+			logSums[stage] += log(ratio);
+			counts[stage]++;
+			if (ratio > 1 + 2 * tolerance && results[i].ns - expected > NOISE_FLOOR_NS) {
+				fprintf(stderr, "  slower: %-18s %12.0f ns, expected %12.0f ns (%+.0f%%)\n",
+					results[i].key, results[i].ns, expected, (ratio - 1) * 100);
+			}
+			break;
+		}
+	}
+
+	int regressions = 0;
+	fprintf(stderr, "%-12s %8s %8s\n", "stage", "results", "ratio");
+	for (int s = 0; s < NUM_STAGES; s++) {
+		if (counts[s] == 0)
+			continue;
+		double ratio = exp(logSums[s] / counts[s]);
+		bool regressed = ratio > 1 + tolerance;
+		fprintf(stderr, "%-12s %8d %8.2f%s\n", STAGE_NAMES[s], counts[s], ratio, regressed ? "  REGRESSION" : "");
+		if (regressed)
+			regressions++;
+	}
+	return regressions;
+}
+
+
+
+/*---- Main ----*/
+
+static void usage(const char *argv0) {
+	fprintf(stderr, "Usage: %s [-b baseline.json] [-t tolerance] [-o results.json]\n", argv0);
+	exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[]) {
+	const char *baselinePath = NULL;
+	const char *outputPath = NULL;
+	double tolerance = 0.15;
+	int opt;
+	while ((opt = getopt(argc, argv, "b:t:o:")) != -1) {
+		switch (opt) {
+			case 'b':  baselinePath = optarg;  break;
+			case 'o':  outputPath = optarg;  break;
+			case 't':
+				tolerance = atof(optarg);
+				if (tolerance <= 0)
+					usage(argv[0]);
+				break;
+			default:  usage(argv[0]);
+		}
+	}
+	if (optind != argc)
+		usage(argv[0]);
+	FILE *out = stdout;
+	if (outputPath != NULL && (out = fopen(outputPath, "w")) == NULL) {
+		perror(outputPath);
+		return EXIT_FAILURE;
+	}
+
+	srand(1);
+	static struct Case c;
+	static struct Result results[sizeof(VERSIONS) / sizeof(VERSIONS[0]) * 4 * NUM_STAGES];
+	int count = 0;
+	double calibration = timeCalibration();
+	fprintf(out, "{\n");
+	fprintf(out, "\t\"unit\": \"ns\",\n");
+	fprintf(out, "\t\"calibration\": %.0f,\n", calibration);
+	fprintf(out, "\t\"results\": {\n");
+	for (size_t v = 0; v < sizeof(VERSIONS) / sizeof(VERSIONS[0]); v++) {
+		for (int e = 0; e < 4; e++) {
+			prepareCase(&c, VERSIONS[v], (enum qrcodegen_Ecc)e);
+			for (int s = 0; s < NUM_STAGES; s++) {
+				struct Result *r = &results[count++];
+				snprintf(r->key, sizeof(r->key), "v%d-%c/%s", VERSIONS[v], "LMQH"[e], STAGE_NAMES[s]);
+				r->ns = timeStage(&c, (enum Stage)s);
+				fprintf(out, "\t\t\"%s\": %.1f%s\n", r->key, r->ns,
+					v + 1 == sizeof(VERSIONS) / sizeof(VERSIONS[0]) && e == 3 && s == NUM_STAGES - 1 ? "" : ",");
+			}
+		}
+	}
+	fprintf(out, "\t}\n}\n");
+	if (out != stdout && fclose(out) != 0) {
+		perror(outputPath);
+		return EXIT_FAILURE;
+	}
+
+	if (baselinePath == NULL)
+		return EXIT_SUCCESS;
+	int regressions = compareWithBaseline(results, count, calibration, baselinePath, tolerance);
+	return regressions == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
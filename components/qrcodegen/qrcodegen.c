@@ -27,6 +27,33 @@
 #include <string.h>
 #include "qrcodegen.h"
 
+#ifdef ESP_PLATFORM
+	#include "sdkconfig.h"
+#endif
+
+#ifdef CONFIG_QRCODEGEN_TABLES_IN_DRAM
+	#include <esp_attr.h>
+	#define QRCODEGEN_TABLE_ATTR  DRAM_ATTR  // Keep the lookup tables in internal RAM
+#else
+	#define QRCODEGEN_TABLE_ATTR  // Default placement: read-only data, i.e. flash on the ESP32
+#endif
+
+#ifndef CONFIG_QRCODEGEN_FAST_MASK_CANDIDATES
+	#define CONFIG_QRCODEGEN_FAST_MASK_CANDIDATES 3
+#endif
+
+// Keeps a function out of its callers, so that the compact encoder only has the frames of one line
+// of calls on the stack, not all of them inlined into one. Nor may the callers keep their state in
+// registers across the call from what the compiler knows of it, which they would have to save.
+// The small helpers below those functions go into them instead of having frames of their own
+#if defined(__GNUC__)
+	#define noinline __attribute__((noipa))
+	#define alwaysinline inline __attribute__((always_inline))
+#else
+	#define noinline
+	#define alwaysinline inline
+#endif
+
 #ifndef QRCODEGEN_TEST
 	#define testable static  // Keep functions private
 #else
@@ -36,6 +63,9 @@
 
 /*---- Forward declarations for private functions ----*/
 
+// The number of 32-bit words that hold a full line (row or column) of modules of the largest QR Code
+#define qrcodegen_LINE_WORDS  ((qrcodegen_VERSION_MAX * 4 + 17 + 31) / 32)
+
 // Regarding all public and private functions defined in this source file:
 // - They require all pointer/array arguments to be not null unless the array length is zero.
 // - They only read input scalar/array arguments, write to output pointer/array
@@ -52,31 +82,95 @@
 // - They are completely thread-safe if the caller does not give the
 //   same writable buffer to concurrent calls to these functions.
 
+static int makeTextSegment(const char *text, size_t bufLen, uint8_t buf[], struct qrcodegen_Segment *seg);
 testable void appendBitsToBuffer(unsigned int val, int numBits, uint8_t buffer[], int *bitLen);
 
+struct BitWriter;
+static void bitWriterInit(struct BitWriter *writer, uint8_t buffer[], int bitLen);
+static void bitWriterAppend(struct BitWriter *writer, uint32_t val, int numBits);
+static void bitWriterAppendBits(struct BitWriter *writer, const uint8_t data[], int numBits);
+static int bitWriterFinish(struct BitWriter *writer);
+
+static int selectVersion(const struct qrcodegen_Segment segs[], size_t len, enum qrcodegen_Ecc *ecl,
+	int minVersion, int maxVersion, bool boostEcl, int *dataUsedBits);
+testable int packSegments(const struct qrcodegen_Segment segs[], size_t len,
+	int version, enum qrcodegen_Ecc ecl, uint8_t qrcode[]);
+static void encodeSegmentsAtVersion(const struct qrcodegen_Segment segs[], size_t len, enum qrcodegen_Ecc ecl,
+	int version, int dataUsedBits, enum qrcodegen_Mask mask, uint8_t tempBuffer[], uint8_t qrcode[],
+	qrcodegen_MaskScorer scorer, void *scorerContext);
+
+struct CompactEncoder;
+static bool startCompactEncoder(struct CompactEncoder *enc, enum qrcodegen_Ecc ecl,
+	int minVersion, int maxVersion, bool boostEcl);
+static void setCompactVersion(struct CompactEncoder *enc, int version, enum qrcodegen_Ecc ecl, int dataUsedBits);
+static void calcCompactEcc(const struct CompactEncoder *enc);
+static void setCompactMask(struct CompactEncoder *enc, enum qrcodegen_Mask mask);
+static void scanCompactRows(struct CompactEncoder *enc);
+static void scoreCompactRow(struct CompactEncoder *enc);
+static void scoreCompactColumns(struct CompactEncoder *enc);
+static uint32_t *getCompactRowLine(const struct CompactEncoder *enc);
+static int getCompactLineWords(const struct CompactEncoder *enc);
+static uint32_t *getCompactLines(const struct CompactEncoder *enc);
+static int getCompactPairModules(struct CompactEncoder *enc, bool column);
+static bool isCompactPairUpward(const struct CompactEncoder *enc);
+static int getCompactModule(const struct CompactEncoder *enc, int x, int y, int i);
+static int getCompactFunctionModule(const struct CompactEncoder *enc, int x, int y);
+static int getCompactAlignPosition(const struct CompactEncoder *enc, int i);
+static int getCompactAlignIndex(const struct CompactEncoder *enc, int pos);
+static int countColumnFunctionModules(const struct CompactEncoder *enc, int x, int end);
+static int countPairDataModules(const struct CompactEncoder *enc, int right, int end);
+static bool getCompactCodewordBit(const struct CompactEncoder *enc, int i);
+static uint8_t getCompactDataByte(const struct CompactEncoder *enc, int i);
+static int getCompactDataBit(const struct CompactEncoder *enc, int i);
+
 testable void addEccAndInterleave(uint8_t data[], int version, enum qrcodegen_Ecc ecl, uint8_t result[]);
 testable int getNumDataCodewords(int version, enum qrcodegen_Ecc ecl);
 testable int getNumRawDataModules(int ver);
 
+static const uint8_t *reedSolomonGetDivisorLog(int degree);
+static void reedSolomonComputeRemainderLog(const uint8_t data[], int dataLen,
+	const uint8_t generatorLog[], int degree, uint8_t result[]);
+static void reedSolomonDivideByteLog(uint8_t data, const uint8_t generatorLog[], int degree, uint8_t result[]);
+#ifdef QRCODEGEN_TEST
 testable void reedSolomonComputeDivisor(int degree, uint8_t result[]);
 testable void reedSolomonComputeRemainder(const uint8_t data[], int dataLen,
 	const uint8_t generator[], int degree, uint8_t result[]);
 testable uint8_t reedSolomonMultiply(uint8_t x, uint8_t y);
+#endif
 
 testable void initializeFunctionModules(int version, uint8_t qrcode[]);
 static void drawWhiteFunctionModules(uint8_t qrcode[], int version);
 static void drawFormatBits(enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask, uint8_t qrcode[]);
+static int getFormatBits(enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask);
+static long getVersionBits(int version);
 testable int getAlignmentPatternPositions(int version, uint8_t result[7]);
+static int getAlignmentPatternStep(int version);
 static void fillRectangle(int left, int top, int width, int height, uint8_t qrcode[]);
 
-static void drawCodewords(const uint8_t data[], int dataLen, uint8_t qrcode[]);
-static void applyMask(const uint8_t functionModules[], uint8_t qrcode[], enum qrcodegen_Mask mask);
-static long getPenaltyScore(const uint8_t qrcode[]);
-static int finderPenaltyCountPatterns(const int runHistory[7], int qrsize);
-static int finderPenaltyTerminateAndCount(bool currentRunColor, int currentRunLength, int runHistory[7], int qrsize);
-static void finderPenaltyAddHistory(int currentRunLength, int runHistory[7], int qrsize);
+testable void drawCodewords(const uint8_t data[], int dataLen, uint8_t qrcode[]);
+testable void applyMask(const uint8_t functionModules[], uint8_t qrcode[], enum qrcodegen_Mask mask);
+testable enum qrcodegen_Mask chooseMaskFast(const uint8_t functionModules[], uint8_t qrcode[],
+	enum qrcodegen_Ecc ecl, int numCandidates);
+testable long getPenaltyScore(const uint8_t qrcode[]);
+testable long getPenaltyScoreSampled(const uint8_t qrcode[], const uint8_t functionModules[],
+	enum qrcodegen_Mask mask, int stride, long bound);
+static uint32_t getMaskedRowBits(const uint8_t qrcode[], const uint8_t functionModules[],
+	enum qrcodegen_Mask mask, int x, int y, int n);
+static long getLinePenaltyScore(const uint32_t line[], int qrsize);
+static long getBlockPenaltyScore(const uint32_t above[], const uint32_t row[], int qrsize);
+static int getLineRunLength(const uint32_t line[], int start, int end, bool color);
+static int finderPenaltyCountPatterns(const int16_t runHistory[7], int qrsize);
+static int finderPenaltyTerminateAndCount(bool currentRunColor, int currentRunLength, int16_t runHistory[7], int qrsize);
+static void finderPenaltyAddHistory(int currentRunLength, int16_t runHistory[7], int qrsize);
 
 testable bool getModule(const uint8_t qrcode[], int x, int y);
+testable uint32_t getRowBits(const uint8_t qrcode[], int x, int y, int n);
+static uint32_t getRowBitsClipped(const uint8_t qrcode[], int x, int y, int n);
+static int floorDiv(int x, int y);
+static void xorRowBits(uint8_t qrcode[], int x, int y, int n, uint32_t bits);
+static uint64_t transposeBits8x8(uint64_t x);
+static int countTrailingZeros(uint32_t x);
+static int popCount(uint32_t x);
 testable void setModule(uint8_t qrcode[], int x, int y, bool isBlack);
 testable void setModuleBounded(uint8_t qrcode[], int x, int y, bool isBlack);
 static bool getBit(int x, int i);
@@ -105,6 +199,16 @@ testable const int8_t ECC_CODEWORDS_PER_BLOCK[4][41] = {
 
 #define qrcodegen_REED_SOLOMON_DEGREE_MAX 30  // Based on the table above
 
+// Generated by gen_tables.py at build time:
+// - GF256_EXP[512], GF256_LOG[256]: antilogarithms and logarithms in GF(2^8/0x11D)
+// - RS_DIVISOR_OFFSET[31], RS_DIVISOR_LOG[]: the generator polynomials of the degrees in the table above
+// - MASK_ROW_PATTERNS[8][12]: the first 6 modules of each mask row, as the masks are periodic with 6 in x
+#include "qrcodegen_tables.h"
+
+#if RS_DIVISOR_DEGREE_MAX != qrcodegen_REED_SOLOMON_DEGREE_MAX
+#error "qrcodegen_tables.h is out of date with ECC_CODEWORDS_PER_BLOCK, rerun gen_tables.py"
+#endif
+
 // For generating error correction codes.
 testable const int8_t NUM_ERROR_CORRECTION_BLOCKS[4][41] = {
 	// Version: (note that index 0 is for padding, and is set to an illegal value)
@@ -121,6 +225,9 @@ static const int PENALTY_N2 =  3;
 static const int PENALTY_N3 = 40;
 static const int PENALTY_N4 = 10;
 
+// For qrcodegen_Mask_FAST: the masks are ranked on every PENALTY_SAMPLE_STRIDE'th row and group of 8 columns
+static const int PENALTY_SAMPLE_STRIDE = 4;
+
 
 
 /*---- High-level QR Code encoding functions ----*/
@@ -129,37 +236,78 @@ static const int PENALTY_N4 = 10;
 bool qrcodegen_encodeText(const char *text, uint8_t tempBuffer[], uint8_t qrcode[],
 		enum qrcodegen_Ecc ecl, int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl) {
 	
+	struct qrcodegen_Segment seg;
+	int numSegs = makeTextSegment(text, (size_t)qrcodegen_BUFFER_LEN_FOR_VERSION(maxVersion), tempBuffer, &seg);
+	if (numSegs == -1) {
+		qrcode[0] = 0;  // Set size to invalid value for safety
+		return false;
+	}
+	return qrcodegen_encodeSegmentsAdvanced(&seg, (size_t)numSegs, ecl, minVersion, maxVersion, mask, boostEcl, tempBuffer, qrcode);
+}
+
+
+// Public function - see documentation comment in header file.
+size_t qrcodegen_encodeTextBatch(const char *const texts[], size_t count, uint8_t tempBuffer[],
+		uint8_t arena[], size_t arenaLen, size_t offsets[],
+		enum qrcodegen_Ecc ecl, int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl) {
+	assert(qrcodegen_VERSION_MIN <= minVersion && minVersion <= maxVersion && maxVersion <= qrcodegen_VERSION_MAX);
+	assert(0 <= (int)ecl && (int)ecl <= 3 && -2 <= (int)mask && (int)mask <= 7);
+	size_t bufLen = (size_t)qrcodegen_BUFFER_LEN_FOR_VERSION(maxVersion);
+	size_t used = 0;
+	size_t i;
+	for (i = 0; i < count; i++) {
+		offsets[i] = qrcodegen_BATCH_NO_FIT;
+		struct qrcodegen_Segment seg;
+		int numSegs = makeTextSegment(texts[i], bufLen, tempBuffer, &seg);
+		if (numSegs == -1)
+			continue;
+		
+		// The version is known before encoding, so the code is encoded in place at its exact size
+		enum qrcodegen_Ecc codeEcl = ecl;
+		int dataUsedBits;
+		int version = selectVersion(&seg, (size_t)numSegs, &codeEcl, minVersion, maxVersion, boostEcl, &dataUsedBits);
+		if (version == 0)
+			continue;
+		size_t codeLen = (size_t)qrcodegen_BUFFER_LEN_FOR_VERSION(version);
+		if (arenaLen - used < codeLen)
+			break;
+		encodeSegmentsAtVersion(&seg, (size_t)numSegs, codeEcl, version, dataUsedBits, mask,
+			tempBuffer, &arena[used], NULL, NULL);
+		offsets[i] = used;
+		used += codeLen;
+	}
+	return i;
+}
+
+
+// Makes the segment of qrcodegen_encodeText() for the given text in the given buffer,
+// and returns the number of segments: 0 for the empty text, 1, or -1 if the text
+// cannot fit in bufLen bytes of segment data.
+static int makeTextSegment(const char *text, size_t bufLen, uint8_t buf[], struct qrcodegen_Segment *seg) {
 	size_t textLen = strlen(text);
 	if (textLen == 0)
-		return qrcodegen_encodeSegmentsAdvanced(NULL, 0, ecl, minVersion, maxVersion, mask, boostEcl, tempBuffer, qrcode);
-	size_t bufLen = (size_t)qrcodegen_BUFFER_LEN_FOR_VERSION(maxVersion);
-	
-	struct qrcodegen_Segment seg;
+		return 0;
 	if (qrcodegen_isNumeric(text)) {
 		if (qrcodegen_calcSegmentBufferSize(qrcodegen_Mode_NUMERIC, textLen) > bufLen)
-			goto fail;
-		seg = qrcodegen_makeNumeric(text, tempBuffer);
+			return -1;
+		*seg = qrcodegen_makeNumeric(text, buf);
 	} else if (qrcodegen_isAlphanumeric(text)) {
 		if (qrcodegen_calcSegmentBufferSize(qrcodegen_Mode_ALPHANUMERIC, textLen) > bufLen)
-			goto fail;
-		seg = qrcodegen_makeAlphanumeric(text, tempBuffer);
+			return -1;
+		*seg = qrcodegen_makeAlphanumeric(text, buf);
 	} else {
 		if (textLen > bufLen)
-			goto fail;
+			return -1;
 		for (size_t i = 0; i < textLen; i++)
-			tempBuffer[i] = (uint8_t)text[i];
-		seg.mode = qrcodegen_Mode_BYTE;
-		seg.bitLength = calcSegmentBitLength(seg.mode, textLen);
-		if (seg.bitLength == -1)
-			goto fail;
-		seg.numChars = (int)textLen;
-		seg.data = tempBuffer;
+			buf[i] = (uint8_t)text[i];
+		seg->mode = qrcodegen_Mode_BYTE;
+		seg->bitLength = calcSegmentBitLength(seg->mode, textLen);
+		if (seg->bitLength == -1)
+			return -1;
+		seg->numChars = (int)textLen;
+		seg->data = buf;
 	}
-	return qrcodegen_encodeSegmentsAdvanced(&seg, 1, ecl, minVersion, maxVersion, mask, boostEcl, tempBuffer, qrcode);
-	
-fail:
-	qrcode[0] = 0;  // Set size to invalid value for safety
-	return false;
+	return 1;
 }
 
 
@@ -189,6 +337,73 @@ testable void appendBitsToBuffer(unsigned int val, int numBits, uint8_t buffer[]
 }
 
 
+// Appends bits to a byte-based bit buffer like appendBitsToBuffer(), but a whole byte at a time:
+// the bits of an incomplete byte wait in a 32-bit accumulator. The bytes are stored rather than
+// ORed, so the buffer needs no clearing beforehand, and the last partial byte is only
+// stored by bitWriterFinish().
+struct BitWriter {
+	uint8_t *buffer;
+	int byteLen;  // Number of complete bytes stored
+	uint32_t accum;  // Its low accumCount bits are pending, the oldest one highest
+	int accumCount;  // In the range [0, 8) between calls
+};
+
+
+// Starts writing after the first bitLen bits of the given buffer, which are kept.
+static void bitWriterInit(struct BitWriter *writer, uint8_t buffer[], int bitLen) {
+	writer->buffer = buffer;
+	writer->byteLen = bitLen >> 3;
+	writer->accumCount = bitLen & 7;
+	writer->accum = writer->accumCount > 0 ? (uint32_t)buffer[writer->byteLen] >> (8 - writer->accumCount) : 0;
+}
+
+
+// Appends the given number of low-order bits of the given value. Requires 0 <= numBits <= 24 and val < 2^numBits.
+static void bitWriterAppend(struct BitWriter *writer, uint32_t val, int numBits) {
+	assert(0 <= numBits && numBits <= 24 && val >> numBits == 0);
+	writer->accum = writer->accum << numBits | val;  // Bits above accumCount are garbage, never stored
+	writer->accumCount += numBits;
+	while (writer->accumCount >= 8) {
+		writer->accumCount -= 8;
+		writer->buffer[writer->byteLen] = (uint8_t)(writer->accum >> writer->accumCount);
+		writer->byteLen++;
+	}
+}
+
+
+// Appends the first numBits bits of the given array, starting from the most significant bit
+// of data[0]. Copies whole bytes if the buffer is at a byte boundary, else shifts them in.
+static void bitWriterAppendBits(struct BitWriter *writer, const uint8_t data[], int numBits) {
+	assert(numBits >= 0);
+	int numBytes = numBits >> 3;
+	if (writer->accumCount == 0 && numBytes > 0) {
+		memcpy(&writer->buffer[writer->byteLen], data, (size_t)numBytes * sizeof(data[0]));
+		writer->byteLen += numBytes;
+	} else {
+		uint8_t *out = &writer->buffer[writer->byteLen];
+		uint32_t accum = writer->accum;
+		int shift = writer->accumCount;
+		for (int i = 0; i < numBytes; i++) {
+			accum = accum << 8 | data[i];
+			out[i] = (uint8_t)(accum >> shift);
+		}
+		writer->accum = accum;
+		writer->byteLen += numBytes;
+	}
+	int rest = numBits & 7;
+	if (rest > 0)
+		bitWriterAppend(writer, (uint32_t)data[numBytes] >> (8 - rest), rest);
+}
+
+
+// Stores the last partial byte, if any, with zeros after the pending bits. Returns the bit length.
+static int bitWriterFinish(struct BitWriter *writer) {
+	if (writer->accumCount > 0)
+		writer->buffer[writer->byteLen] = (uint8_t)(writer->accum << (8 - writer->accumCount));
+	return writer->byteLen * 8 + writer->accumCount;
+}
+
+
 
 /*---- Low-level QR Code encoding functions ----*/
 
@@ -203,57 +418,40 @@ bool qrcodegen_encodeSegments(const struct qrcodegen_Segment segs[], size_t len,
 // Public function - see documentation comment in header file.
 bool qrcodegen_encodeSegmentsAdvanced(const struct qrcodegen_Segment segs[], size_t len, enum qrcodegen_Ecc ecl,
 		int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl, uint8_t tempBuffer[], uint8_t qrcode[]) {
+	return qrcodegen_encodeSegmentsScored(segs, len, ecl, minVersion, maxVersion, mask, boostEcl,
+		tempBuffer, qrcode, NULL, NULL);
+}
+
+
+// Public function - see documentation comment in header file.
+bool qrcodegen_encodeSegmentsScored(const struct qrcodegen_Segment segs[], size_t len, enum qrcodegen_Ecc ecl,
+		int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl, uint8_t tempBuffer[], uint8_t qrcode[],
+		qrcodegen_MaskScorer scorer, void *scorerContext) {
 	assert(segs != NULL || len == 0);
 	assert(qrcodegen_VERSION_MIN <= minVersion && minVersion <= maxVersion && maxVersion <= qrcodegen_VERSION_MAX);
-	assert(0 <= (int)ecl && (int)ecl <= 3 && -1 <= (int)mask && (int)mask <= 7);
-	
-	// Find the minimal version number to use
-	int version, dataUsedBits;
-	for (version = minVersion; ; version++) {
-		int dataCapacityBits = getNumDataCodewords(version, ecl) * 8;  // Number of data bits available
-		dataUsedBits = getTotalBits(segs, len, version);
-		if (dataUsedBits != -1 && dataUsedBits <= dataCapacityBits)
-			break;  // This version number is found to be suitable
-		if (version >= maxVersion) {  // All versions in the range could not fit the given data
-			qrcode[0] = 0;  // Set size to invalid value for safety
-			return false;
-		}
-	}
-	assert(dataUsedBits != -1);
+	assert(0 <= (int)ecl && (int)ecl <= 3 && -2 <= (int)mask && (int)mask <= 7);
 	
-	// Increase the error correction level while the data still fits in the current version number
-	for (int i = (int)qrcodegen_Ecc_MEDIUM; i <= (int)qrcodegen_Ecc_HIGH; i++) {  // From low to high
-		if (boostEcl && dataUsedBits <= getNumDataCodewords(version, (enum qrcodegen_Ecc)i) * 8)
-			ecl = (enum qrcodegen_Ecc)i;
-	}
-	
-	// Concatenate all segments to create the data bit string
-	memset(qrcode, 0, (size_t)qrcodegen_BUFFER_LEN_FOR_VERSION(version) * sizeof(qrcode[0]));
-	int bitLen = 0;
-	for (size_t i = 0; i < len; i++) {
-		const struct qrcodegen_Segment *seg = &segs[i];
-		appendBitsToBuffer((unsigned int)seg->mode, 4, qrcode, &bitLen);
-		appendBitsToBuffer((unsigned int)seg->numChars, numCharCountBits(seg->mode, version), qrcode, &bitLen);
-		for (int j = 0; j < seg->bitLength; j++) {
-			int bit = (seg->data[j >> 3] >> (7 - (j & 7))) & 1;
-			appendBitsToBuffer((unsigned int)bit, 1, qrcode, &bitLen);
-		}
+	int dataUsedBits;
+	int version = selectVersion(segs, len, &ecl, minVersion, maxVersion, boostEcl, &dataUsedBits);
+	if (version == 0) {  // All versions in the range could not fit the given data
+		qrcode[0] = 0;  // Set size to invalid value for safety
+		return false;
 	}
+	encodeSegmentsAtVersion(segs, len, ecl, version, dataUsedBits, mask, tempBuffer, qrcode, scorer, scorerContext);
+	return true;
+}
+
+
+// Encodes the given segments at the given version and final ECC level, as chosen by selectVersion(),
+// which also gave dataUsedBits. Only the first qrcodegen_BUFFER_LEN_FOR_VERSION(version) bytes
+// of qrcode[] and tempBuffer[] are written. A helper function for the bitmap encoders.
+static void encodeSegmentsAtVersion(const struct qrcodegen_Segment segs[], size_t len, enum qrcodegen_Ecc ecl,
+		int version, int dataUsedBits, enum qrcodegen_Mask mask, uint8_t tempBuffer[], uint8_t qrcode[],
+		qrcodegen_MaskScorer scorer, void *scorerContext) {
+	int bitLen = packSegments(segs, len, version, ecl, qrcode);
 	assert(bitLen == dataUsedBits);
-	
-	// Add terminator and pad up to a byte if applicable
-	int dataCapacityBits = getNumDataCodewords(version, ecl) * 8;
-	assert(bitLen <= dataCapacityBits);
-	int terminatorBits = dataCapacityBits - bitLen;
-	if (terminatorBits > 4)
-		terminatorBits = 4;
-	appendBitsToBuffer(0, terminatorBits, qrcode, &bitLen);
-	appendBitsToBuffer(0, (8 - bitLen % 8) % 8, qrcode, &bitLen);
-	assert(bitLen % 8 == 0);
-	
-	// Pad with alternating bytes until data capacity is reached
-	for (uint8_t padByte = 0xEC; bitLen < dataCapacityBits; padByte ^= 0xEC ^ 0x11)
-		appendBitsToBuffer(padByte, 8, qrcode, &bitLen);
+	(void)bitLen;  // Only checked by the assert
+	(void)dataUsedBits;
 	
 	// Draw function and data codeword modules
 	addEccAndInterleave(qrcode, version, ecl, tempBuffer);
@@ -263,7 +461,17 @@ bool qrcodegen_encodeSegmentsAdvanced(const struct qrcodegen_Segment segs[], siz
 	initializeFunctionModules(version, tempBuffer);
 	
 	// Handle masking
-	if (mask == qrcodegen_Mask_AUTO) {  // Automatically choose best mask
+	if (mask == qrcodegen_Mask_AUTO && scorer != NULL) {  // Let the scorer evaluate the masks
+		long penalties[8];
+		scorer(scorerContext, qrcode, tempBuffer, ecl, penalties);
+		long minPenalty = LONG_MAX;
+		for (int i = 0; i < 8; i++) {  // The lowest mask wins a tie, like below
+			if (penalties[i] < minPenalty) {
+				mask = (enum qrcodegen_Mask)i;
+				minPenalty = penalties[i];
+			}
+		}
+	} else if (mask == qrcodegen_Mask_AUTO) {  // Automatically choose best mask
 		long minPenalty = LONG_MAX;
 		for (int i = 0; i < 8; i++) {
 			enum qrcodegen_Mask msk = (enum qrcodegen_Mask)i;
@@ -276,14 +484,554 @@ bool qrcodegen_encodeSegmentsAdvanced(const struct qrcodegen_Segment segs[], siz
 			}
 			applyMask(tempBuffer, qrcode, msk);  // Undoes the mask due to XOR
 		}
-	}
+	} else if (mask == qrcodegen_Mask_FAST)
+		mask = chooseMaskFast(tempBuffer, qrcode, ecl, CONFIG_QRCODEGEN_FAST_MASK_CANDIDATES);
 	assert(0 <= (int)mask && (int)mask <= 7);
 	applyMask(tempBuffer, qrcode, mask);
 	drawFormatBits(ecl, mask, qrcode);
+}
+
+
+// Writes the data codewords of the given segments at the given version and ECC level into qrcode[]:
+// the segments, the terminator and the padding, after clearing qrcodegen_BUFFER_LEN_FOR_VERSION(version)
+// bytes. Returns the bit length of the segments alone. A helper function for the bitmap encoders.
+testable int packSegments(const struct qrcodegen_Segment segs[], size_t len,
+		int version, enum qrcodegen_Ecc ecl, uint8_t qrcode[]) {
+	// Concatenate all segments to create the data bit string
+	memset(qrcode, 0, (size_t)qrcodegen_BUFFER_LEN_FOR_VERSION(version) * sizeof(qrcode[0]));
+	struct BitWriter writer;
+	bitWriterInit(&writer, qrcode, 0);
+	for (size_t i = 0; i < len; i++) {
+		const struct qrcodegen_Segment *seg = &segs[i];
+		bitWriterAppend(&writer, (uint32_t)seg->mode, 4);
+		bitWriterAppend(&writer, (uint32_t)seg->numChars, numCharCountBits(seg->mode, version));
+		bitWriterAppendBits(&writer, seg->data, seg->bitLength);
+	}
+	int bitLen = bitWriterFinish(&writer);
+	int segmentsBitLen = bitLen;
+	
+	// Add terminator and pad up to a byte if applicable
+	int dataCapacityBits = getNumDataCodewords(version, ecl) * 8;
+	assert(bitLen <= dataCapacityBits);
+	int terminatorBits = dataCapacityBits - bitLen;
+	if (terminatorBits > 4)
+		terminatorBits = 4;
+	appendBitsToBuffer(0, terminatorBits, qrcode, &bitLen);
+	appendBitsToBuffer(0, (8 - bitLen % 8) % 8, qrcode, &bitLen);
+	assert(bitLen % 8 == 0);
+	
+	// Pad with alternating bytes until data capacity is reached
+	for (uint8_t padByte = 0xEC; bitLen < dataCapacityBits; padByte ^= 0xEC ^ 0x11)
+		appendBitsToBuffer(padByte, 8, qrcode, &bitLen);
+	return segmentsBitLen;
+}
+
+
+
+// Returns the minimal version number in the given range that fits the given segments, or 0 if none does,
+// and stores the bit length of the segments. Iff boostEcl is true, raises *ecl as far as the data still
+// fits in that version. A helper function for the encoders.
+static int selectVersion(const struct qrcodegen_Segment segs[], size_t len, enum qrcodegen_Ecc *ecl,
+		int minVersion, int maxVersion, bool boostEcl, int *dataUsedBits) {
+	// Find the minimal version number to use
+	int version;
+	for (version = minVersion; ; version++) {
+		int dataCapacityBits = getNumDataCodewords(version, *ecl) * 8;  // Number of data bits available
+		*dataUsedBits = getTotalBits(segs, len, version);
+		if (*dataUsedBits != -1 && *dataUsedBits <= dataCapacityBits)
+			break;  // This version number is found to be suitable
+		if (version >= maxVersion)
+			return 0;
+	}
+	
+	// Increase the error correction level while the data still fits in the current version number
+	for (int i = (int)qrcodegen_Ecc_MEDIUM; i <= (int)qrcodegen_Ecc_HIGH; i++) {  // From low to high
+		if (boostEcl && *dataUsedBits <= getNumDataCodewords(version, (enum qrcodegen_Ecc)i) * 8)
+			*ecl = (enum qrcodegen_Ecc)i;
+	}
+	return version;
+}
+
+
+// Public function - see documentation comment in header file.
+long qrcodegen_getMaskPenalty(const uint8_t qrcode[], const uint8_t functionModules[],
+		enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask, uint8_t work[]) {
+	assert(0 <= (int)ecl && (int)ecl <= 3 && 0 <= (int)mask && (int)mask <= 7);
+	int qrsize = qrcodegen_getSize(qrcode);
+	memcpy(work, qrcode, (size_t)((qrsize * qrsize + 7) / 8 + 1) * sizeof(work[0]));
+	applyMask(functionModules, work, mask);
+	drawFormatBits(ecl, mask, work);
+	return getPenaltyScore(work);
+}
+
+
+
+/*---- Compact encoding ----*/
+
+// The state of qrcodegen_encodeSegmentsCompact(). Nothing of the QR Code is stored but the ECC
+// codewords: the data codewords are read from the segments when needed, and the modules are
+// computed one line at a time. The lines and the ECC are in the work buffer of the caller:
+// - from the first 4-byte boundary: two lines of getCompactLineWords() words, for the rows
+//   and columns of the mask scoring and for the final rows
+// - then ecc[0 : numBlocks * blockEccLen]: the ECC of block i at ecc[i * blockEccLen], not interleaved
+// The scan keeps its place in the encoder too, so that the calls below it don't save it again.
+struct CompactEncoder {
+	const struct qrcodegen_Segment *segs;
+	uint8_t *ecc;  // The work buffer until the version is known
+	qrcodegen_RowSink sink;
+	void *sinkContext;
+	
+	// The penalty score of the mask being scored, and the lowest one so far
+	int32_t penalty;
+	int32_t minPenalty;
+	
+	// Narrow fields, as this is most of the stack of the encoder
+	int16_t len;
+	int16_t qrsize;
+	
+	// The bit stream: segments, terminator and bit padding up to padStart, then pad bytes
+	int16_t padStart;
+	
+	// The block structure, as in addEccAndInterleave()
+	int16_t numBlocks;
+	int16_t blockEccLen;
+	int16_t rawCodewords;
+	int16_t dataLen;
+	int16_t numShortBlocks;
+	int16_t shortBlockDataLen;
+	
+	// The format bits that go with the mask below
+	int16_t formatBits;
+	
+	int16_t y, right, start, black;
+	
+	uint8_t version;
+	uint8_t ecl;
+	uint8_t numAlign;
+	uint8_t alignStep;  // The alignment patterns are at 6, then every alignStep from the last one back
+	uint8_t mask;  // The mask that the modules are computed with
+	uint8_t pass, best;
+	bool fast;
+};
+
+
+// Public function - see documentation comment in header file.
+bool qrcodegen_encodeSegmentsCompact(const struct qrcodegen_Segment segs[], size_t len, enum qrcodegen_Ecc ecl,
+		int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl, uint8_t workBuffer[],
+		qrcodegen_RowSink sink, void *sinkContext) {
+	assert(segs != NULL || len == 0);
+	assert(len <= INT16_MAX);
+	assert(qrcodegen_VERSION_MIN <= minVersion && minVersion <= maxVersion && maxVersion <= qrcodegen_VERSION_MAX);
+	assert(0 <= (int)ecl && (int)ecl <= 3 && -2 <= (int)mask && (int)mask <= 7);
+	
+	// Choose the mask with the same penalty scores as the full encoder, one line at a time,
+	// then emit the rows with it in a last pass. The fast choice abandons each mask once it
+	// can't beat the best so far, with the same result
+	struct CompactEncoder enc;
+	bool choose = mask == qrcodegen_Mask_AUTO || mask == qrcodegen_Mask_FAST;
+	enc.segs = segs;
+	enc.len = (int16_t)len;
+	enc.ecc = workBuffer;
+	enc.sink = sink;
+	enc.sinkContext = sinkContext;
+	enc.fast = mask == qrcodegen_Mask_FAST;
+	enc.best = (uint8_t)(choose ? qrcodegen_Mask_0 : mask);
+	enc.pass = (uint8_t)(choose ? 0 : 8);
+	enc.minPenalty = INT32_MAX;
+	if (!startCompactEncoder(&enc, ecl, minVersion, maxVersion, boostEcl))
+		return false;
+	calcCompactEcc(&enc);
+	for (; enc.pass <= 8; enc.pass++) {
+		scanCompactRows(&enc);
+		if (enc.pass < 8 && enc.penalty < enc.minPenalty) {
+			enc.best = enc.pass;
+			enc.minPenalty = enc.penalty;
+		}
+	}
 	return true;
 }
 
 
+// Fills in the encoder for the segments, which are already set.
+// Returns false if the segments don't fit in the range of versions.
+noinline static bool startCompactEncoder(struct CompactEncoder *enc, enum qrcodegen_Ecc ecl,
+		int minVersion, int maxVersion, bool boostEcl) {
+	int dataUsedBits;
+	int version = selectVersion(enc->segs, (size_t)enc->len, &ecl, minVersion, maxVersion, boostEcl, &dataUsedBits);
+	if (version == 0)
+		return false;
+	setCompactVersion(enc, version, ecl, dataUsedBits);  // Apart, so that nothing is kept across the call above
+	return true;
+}
+
+
+// Fills in the encoder for the given version and ECC level, as chosen by selectVersion().
+noinline static void setCompactVersion(struct CompactEncoder *enc, int version, enum qrcodegen_Ecc ecl, int dataUsedBits) {
+	// The terminator and the bit padding are zeros, as in qrcodegen_encodeSegmentsScored()
+	int dataCapacityBits = getNumDataCodewords(version, ecl) * 8;
+	int terminatorBits = dataCapacityBits - dataUsedBits;
+	if (terminatorBits > 4)
+		terminatorBits = 4;
+	
+	int numBlocks = NUM_ERROR_CORRECTION_BLOCKS[(int)ecl][version];
+	int blockEccLen = ECC_CODEWORDS_PER_BLOCK  [(int)ecl][version];
+	int rawCodewords = getNumRawDataModules(version) / 8;
+	enc->version = (uint8_t)version;
+	enc->qrsize = (int16_t)(version * 4 + 17);
+	enc->padStart = (int16_t)((dataUsedBits + terminatorBits + 7) / 8 * 8);
+	enc->numBlocks = (int16_t)numBlocks;
+	enc->blockEccLen = (int16_t)blockEccLen;
+	enc->rawCodewords = (int16_t)rawCodewords;
+	enc->dataLen = (int16_t)(dataCapacityBits / 8);
+	enc->numShortBlocks = (int16_t)(numBlocks - rawCodewords % numBlocks);
+	enc->shortBlockDataLen = (int16_t)(rawCodewords / numBlocks - blockEccLen);
+	enc->ecl = (uint8_t)ecl;
+	enc->numAlign = (uint8_t)(version == 1 ? 0 : version / 7 + 2);
+	enc->alignStep = (uint8_t)(version == 1 ? 0 : getAlignmentPatternStep(version));
+	uintptr_t lines = ((uintptr_t)enc->ecc + 3) & ~(uintptr_t)3;
+	enc->ecc = (uint8_t *)(lines + (size_t)(2 * getCompactLineWords(enc)) * sizeof(uint32_t));
+}
+
+
+// Calculates the ECC codewords of each block, the data bytes being read from the bit stream.
+noinline static void calcCompactEcc(const struct CompactEncoder *enc) {
+	int numShortData = enc->numShortBlocks * enc->shortBlockDataLen;  // The data bytes in the short blocks
+	memset(enc->ecc, 0, (size_t)(enc->numBlocks * enc->blockEccLen) * sizeof(enc->ecc[0]));
+	for (int i = 0; i < enc->dataLen; i++) {
+		int block = i < numShortData ? i / enc->shortBlockDataLen
+			: enc->numShortBlocks + (i - numShortData) / (enc->shortBlockDataLen + 1);
+		reedSolomonDivideByteLog(getCompactDataByte(enc, i), reedSolomonGetDivisorLog(enc->blockEccLen),
+			enc->blockEccLen, &enc->ecc[block * enc->blockEccLen]);
+	}
+}
+
+
+// Sets the mask that the modules are computed with.
+static void setCompactMask(struct CompactEncoder *enc, enum qrcodegen_Mask mask) {
+	assert(0 <= (int)mask && (int)mask <= 7);
+	enc->mask = (uint8_t)mask;
+	enc->formatBits = (int16_t)getFormatBits((enum qrcodegen_Ecc)enc->ecl, mask);
+}
+
+
+// Public function - see documentation comment in header file.
+void qrcodegen_storeRow(void *qrcode, int y, const uint32_t row[], int size) {
+	uint8_t *out = (uint8_t *)qrcode;
+	if (y == 0) {  // The rows come in order, so clear the bitmap first and just XOR them in
+		memset(out, 0, (size_t)((size * size + 7) / 8 + 1) * sizeof(out[0]));
+		out[0] = (uint8_t)size;
+	}
+	for (int x = 0; x < size; x += 32) {
+		int n = size - x < 32 ? size - x : 32;
+		xorRowBits(out, x, y, n, row[x >> 5]);
+	}
+}
+
+
+// Computes the rows of the QR Code with the mask of pass, one after the other into the two lines of the
+// work buffer. In the last pass, with the best mask, passes them on to the sink. Else sets penalty to their
+// score, like getPenaltyScoreSampled() does for a bitmap with a stride of 1, less that of the timing column;
+// the columns are then computed pair by pair, from the right. The fast choice stops once it reaches minPenalty.
+noinline static void scanCompactRows(struct CompactEncoder *enc) {
+	setCompactMask(enc, (enum qrcodegen_Mask)(enc->pass < 8 ? enc->pass : enc->best));
+	enc->penalty = 0;
+	enc->black = 0;
+	for (enc->y = 0; enc->y < enc->qrsize; enc->y++) {
+		memset(getCompactRowLine(enc), 0, (size_t)getCompactLineWords(enc) * sizeof(uint32_t));
+		enc->start = 0;
+		for (enc->right = enc->qrsize - 1; enc->right >= 1; enc->right -= 2) {
+			if (enc->right == 6)  // The timing column holds no codewords
+				enc->right = 5;
+			int modules = getCompactPairModules(enc, false);
+			uint32_t *row = getCompactRowLine(enc);
+			row[enc->right >> 5] |= (uint32_t)(modules & 1) << (enc->right & 31);
+			row[(enc->right - 1) >> 5] |= (uint32_t)(modules >> 1) << ((enc->right - 1) & 31);
+			enc->black += (int16_t)((modules & 1) + (modules >> 1));
+		}
+		int timing = getCompactFunctionModule(enc, 6, enc->y);
+		getCompactRowLine(enc)[0] |= (uint32_t)timing << 6;
+		enc->black += (int16_t)timing;
+		if (enc->pass == 8) {
+			enc->sink(enc->sinkContext, enc->y, getCompactRowLine(enc), enc->qrsize);
+			continue;
+		}
+		scoreCompactRow(enc);
+		if (enc->fast && enc->penalty >= enc->minPenalty)
+			return;
+	}
+	if (enc->pass == 8)
+		return;
+	
+	// Balance of black and white modules
+	int total = enc->qrsize * enc->qrsize;
+	int k = (int)((labs(enc->black * 20L - total * 10L) + total - 1) / total) - 1;
+	enc->penalty += k * PENALTY_N4;
+	
+	// Adjacent modules in column having same color, and finder-like patterns,
+	// except in the timing column, which is the same with every mask
+	enc->start = 0;
+	for (enc->right = enc->qrsize - 1; enc->right >= 1; enc->right -= 2) {
+		if (enc->fast && enc->penalty >= enc->minPenalty)
+			return;
+		if (enc->right == 6)
+			enc->right = 5;
+		memset(getCompactLines(enc), 0, (size_t)(2 * getCompactLineWords(enc)) * sizeof(uint32_t));
+		for (enc->y = isCompactPairUpward(enc) ? enc->qrsize - 1 : 0; 0 <= enc->y && enc->y < enc->qrsize;
+				enc->y += isCompactPairUpward(enc) ? -1 : 1) {  // In the zigzag order
+			int modules = getCompactPairModules(enc, true);
+			uint32_t *lines = getCompactLines(enc);
+			lines[enc->y >> 5] |= (uint32_t)(modules & 1) << (enc->y & 31);
+			lines[getCompactLineWords(enc) + (enc->y >> 5)] |= (uint32_t)(modules >> 1) << (enc->y & 31);
+		}
+		scoreCompactColumns(enc);
+	}
+}
+
+
+// Adds the penalty score of row y, in its line of the work buffer, and of its 2*2 blocks with the row above.
+noinline static void scoreCompactRow(struct CompactEncoder *enc) {
+	uint32_t *row = getCompactRowLine(enc);
+	long result = getLinePenaltyScore(row, enc->qrsize);
+	if (enc->y > 0)
+		result += getBlockPenaltyScore(&getCompactLines(enc)[((enc->y & 1) ^ 1) * getCompactLineWords(enc)], row, enc->qrsize);
+	enc->penalty += (int32_t)result;
+}
+
+
+// Adds the penalty score of the columns right and right - 1, in the two lines of the work buffer.
+noinline static void scoreCompactColumns(struct CompactEncoder *enc) {
+	uint32_t *lines = getCompactLines(enc);
+	long result = getLinePenaltyScore(lines, enc->qrsize);
+	result += getLinePenaltyScore(&lines[getCompactLineWords(enc)], enc->qrsize);
+	enc->penalty += (int32_t)result;
+}
+
+
+// Returns the line of the work buffer that row y of the encoder goes to.
+alwaysinline static uint32_t *getCompactRowLine(const struct CompactEncoder *enc) {
+	return &getCompactLines(enc)[(enc->y & 1) * getCompactLineWords(enc)];
+}
+
+
+// Returns the number of words of a line of the work buffer: module i is bit (i % 32) of line[i / 32],
+// followed by zero bits. getBlockPenaltyScore() also reads the word after a line, here the next line
+// or the ECC, but masks off the bits from it.
+static int getCompactLineWords(const struct CompactEncoder *enc) {
+	return (enc->qrsize + 31) / 32;
+}
+
+
+// Returns the two lines of the work buffer, one after the other, just before the ECC.
+static uint32_t *getCompactLines(const struct CompactEncoder *enc) {
+	return (uint32_t *)((uintptr_t)enc->ecc - (size_t)(2 * getCompactLineWords(enc)) * sizeof(uint32_t));
+}
+
+
+// Returns the colors of the modules of row y in the columns right and right - 1 of the encoder, in bits 0 and 1.
+// The zigzag index of the first codeword module of the pair is start, which is moved on to the next pair.
+// Down the columns, the rows must come in the zigzag order instead, and start is moved on past each one.
+noinline static int getCompactPairModules(struct CompactEncoder *enc, bool column) {
+	int right = enc->right, y = enc->y;
+	int i = enc->start;
+	if (!column) {
+		int n = countPairDataModules(enc, right, enc->qrsize);
+		enc->start = (int16_t)(i + n);
+		if (isCompactPairUpward(enc))  // The rows below come first
+			i += n - countPairDataModules(enc, right, y + 1);
+		else
+			i += countPairDataModules(enc, right, y);
+	}
+	int module = getCompactModule(enc, right, y, i);  // In each row the right module comes first
+	i += module >> 1;
+	int left = getCompactModule(enc, right - 1, y, i);
+	if (column)
+		enc->start = (int16_t)(i + (left >> 1));
+	return (module & 1) | (left & 1) << 1;
+}
+
+
+// Tells whether the zigzag goes up the columns right and right - 1 of the encoder, as it does from the right,
+// alternating with down.
+static bool isCompactPairUpward(const struct CompactEncoder *enc) {
+	return ((enc->right + 1) & 2) == 0;
+}
+
+
+// Returns the color of the module at the given coordinates, 0 or 1, plus 2 if it is a codeword module;
+// then i is its zigzag index. The remainder bits are white before the mask, as drawCodewords() leaves them.
+alwaysinline static int getCompactModule(const struct CompactEncoder *enc, int x, int y, int i) {
+	int result = getCompactFunctionModule(enc, x, y);
+	if (result >= 0)
+		return result;
+	unsigned int pattern = MASK_ROW_PATTERNS[enc->mask][y % 12];
+	return 2 | ((i < enc->rawCodewords * 8 && getCompactCodewordBit(enc, i)) ^ getBit((int)pattern, x % 6));
+}
+
+
+// Returns 0 or 1 for the color of the function module at the given coordinates with the format bits
+// of the encoder, or -1 if it is a codeword module. Matches the drawing functions in what they draw last.
+alwaysinline static int getCompactFunctionModule(const struct CompactEncoder *enc, int x, int y) {
+	int qrsize = enc->qrsize;
+	int formatBits = enc->formatBits;
+	int dx, dy;  // Relative to the center of a finder pattern
+	if (x < 9 && y < 9) {
+		if (x == 8 && y != 6)
+			return getBit(formatBits, y < 6 ? y : y - 1);
+		if (y == 8 && x != 6)
+			return getBit(formatBits, x == 7 ? 8 : 14 - x);
+		dx = x - 3;
+		dy = y - 3;
+	} else if (x >= qrsize - 8 && y < 9) {
+		if (y == 8)
+			return getBit(formatBits, qrsize - 1 - x);
+		dx = x - (qrsize - 4);
+		dy = y - 3;
+	} else if (x < 9 && y >= qrsize - 8) {
+		if (x == 8)
+			return y == qrsize - 8 ? 1 : getBit(formatBits, y - qrsize + 15);
+		dx = x - 3;
+		dy = y - (qrsize - 4);
+	} else if (x == 6 || y == 6) {  // Timing patterns
+		return (x == 6 ? y : x) % 2 == 0;
+	} else if (enc->version >= 7 && x >= qrsize - 11 && x < qrsize - 8 && y < 6) {  // Version blocks
+		return (int)((getVersionBits(enc->version) >> (y * 3 + x - (qrsize - 11))) & 1);
+	} else if (enc->version >= 7 && y >= qrsize - 11 && y < qrsize - 8 && x < 6) {
+		return (int)((getVersionBits(enc->version) >> (x * 3 + y - (qrsize - 11))) & 1);
+	} else {  // Alignment patterns, except on the three finder corners
+		int n = enc->numAlign;
+		int i = getCompactAlignIndex(enc, x);
+		int j = getCompactAlignIndex(enc, y);
+		if (i < 0 || j < 0 || (i == 0 && j == 0) || (i == 0 && j == n - 1) || (i == n - 1 && j == 0))
+			return -1;
+		dx = x - getCompactAlignPosition(enc, i);
+		dy = y - getCompactAlignPosition(enc, j);
+		int dist = abs(dx) > abs(dy) ? abs(dx) : abs(dy);
+		return dist != 1;
+	}
+	int dist = abs(dx) > abs(dy) ? abs(dx) : abs(dy);  // Finder pattern with its separator
+	return dist != 2 && dist != 4;
+}
+
+
+// Returns the position of alignment pattern i, as getAlignmentPatternPositions() lists them.
+alwaysinline static int getCompactAlignPosition(const struct CompactEncoder *enc, int i) {
+	return i == 0 ? 6 : enc->qrsize - 7 - (enc->numAlign - 1 - i) * enc->alignStep;
+}
+
+
+// Returns the index of the alignment pattern position within 2 of the given coordinate, or -1 if there is none.
+// The positions are further apart than 5, so there is at most one.
+alwaysinline static int getCompactAlignIndex(const struct CompactEncoder *enc, int pos) {
+	int n = enc->numAlign;
+	if (n == 0)
+		return -1;
+	if (abs(pos - 6) <= 2)
+		return 0;
+	int d = enc->qrsize - 5 - pos;  // From 2 past the last position
+	if (d < 0)
+		return -1;
+	int k = d / enc->alignStep;  // Steps back from the last position
+	if (d - k * enc->alignStep > 4 || k >= n - 1)
+		return -1;
+	return n - 1 - k;
+}
+
+
+// Returns the number of function modules in the rows [0 : end] of column x, from the same
+// layout as initializeFunctionModules() but counted without drawing.
+alwaysinline static int countColumnFunctionModules(const struct CompactEncoder *enc, int x, int end) {
+	int qrsize = enc->qrsize;
+	if (x == 6)  // Timing pattern
+		return end;
+	#define ROWS_IN(a, b)  ((b) < end ? (b) - (a) : (end > (a) ? end - (a) : 0))  // Rows of [a : b] in [0 : end]
+	int result = ROWS_IN(6, 7);  // Timing pattern
+	if (x < 9 || x >= qrsize - 8)  // Finder patterns and format bits, except the row 6 counted above
+		result += ROWS_IN(0, 9) - ROWS_IN(6, 7);
+	if (x < 9)
+		result += ROWS_IN(qrsize - 8, qrsize);
+	if (enc->version >= 7) {  // Version blocks
+		if (x >= qrsize - 11 && x < qrsize - 8)
+			result += ROWS_IN(0, 6);
+		if (x < 6)
+			result += ROWS_IN(qrsize - 11, qrsize - 8);
+	}
+	int n = enc->numAlign;
+	int i = getCompactAlignIndex(enc, x);
+	for (int j = 0; i >= 0 && j < n; j++) {
+		if ((i == 0 && j == 0) || (i == 0 && j == n - 1) || (i == n - 1 && j == 0))
+			continue;
+		int pos = getCompactAlignPosition(enc, j);
+		result += ROWS_IN(pos - 2, pos + 3);
+		if (pos == 6)
+			result -= ROWS_IN(6, 7);  // Overlaps the timing pattern
+	}
+	#undef ROWS_IN
+	return result;
+}
+
+
+// Returns the number of codeword (non-function) modules in the rows [0 : end] of the columns right and right - 1.
+alwaysinline static int countPairDataModules(const struct CompactEncoder *enc, int right, int end) {
+	return 2 * end - countColumnFunctionModules(enc, right, end) - countColumnFunctionModules(enc, right - 1, end);
+}
+
+
+// Returns bit i of the interleaved sequence of data and ECC codewords that drawCodewords() places,
+// finding the block and the position in it like addEccAndInterleave() interleaves them.
+// Requires 0 <= i < rawCodewords * 8.
+alwaysinline static bool getCompactCodewordBit(const struct CompactEncoder *enc, int i) {
+	int k = i >> 3;
+	int numBlocks = enc->numBlocks;
+	if (k >= enc->dataLen) {
+		k -= enc->dataLen;
+		return getBit(enc->ecc[k % numBlocks * enc->blockEccLen + k / numBlocks], 7 - (i & 7));
+	}
+	int block, j;
+	if (k < enc->shortBlockDataLen * numBlocks) {
+		block = k % numBlocks;
+		j = k / numBlocks;
+	} else {  // The last data byte of the long blocks
+		block = k - enc->shortBlockDataLen * numBlocks + enc->numShortBlocks;
+		j = enc->shortBlockDataLen;
+	}
+	int start = block * enc->shortBlockDataLen + (block > enc->numShortBlocks ? block - enc->numShortBlocks : 0);
+	return getCompactDataBit(enc, (start + j) * 8 + (i & 7)) != 0;
+}
+
+
+// Returns byte i of the data codewords, see getCompactDataBit().
+noinline static uint8_t getCompactDataByte(const struct CompactEncoder *enc, int i) {
+	int result = 0;
+	for (int k = 0; k < 8; k++)
+		result = result << 1 | getCompactDataBit(enc, i * 8 + k);
+	return (uint8_t)result;
+}
+
+
+// Returns bit i of the data codewords, i.e. of the segments with their headers
+// followed by the terminator, the bit padding and the pad bytes.
+alwaysinline static int getCompactDataBit(const struct CompactEncoder *enc, int i) {
+	int pos = i;
+	for (int j = 0; j < enc->len; j++) {
+		const struct qrcodegen_Segment *seg = &enc->segs[j];
+		int countBits = numCharCountBits(seg->mode, enc->version);
+		if (pos < 4)
+			return ((int)seg->mode >> (3 - pos)) & 1;
+		pos -= 4;
+		if (pos < countBits)
+			return (seg->numChars >> (countBits - 1 - pos)) & 1;
+		pos -= countBits;
+		if (pos < seg->bitLength)
+			return (seg->data[pos >> 3] >> (7 - (pos & 7))) & 1;
+		pos -= seg->bitLength;
+	}
+	if (i < enc->padStart)
+		return 0;
+	int padByte = ((i - enc->padStart) >> 3) % 2 == 0 ? 0xEC : 0x11;
+	return (padByte >> (7 - (i & 7))) & 1;
+}
+
+
 
 /*---- Error correction code generation functions ----*/
 
@@ -303,13 +1051,12 @@ testable void addEccAndInterleave(uint8_t data[], int version, enum qrcodegen_Ec
 	
 	// Split data into blocks, calculate ECC, and interleave
 	// (not concatenate) the bytes into a single sequence
-	uint8_t rsdiv[qrcodegen_REED_SOLOMON_DEGREE_MAX];
-	reedSolomonComputeDivisor(blockEccLen, rsdiv);
+	const uint8_t *rsdivLog = reedSolomonGetDivisorLog(blockEccLen);
 	const uint8_t *dat = data;
 	for (int i = 0; i < numBlocks; i++) {
 		int datLen = shortBlockDataLen + (i < numShortBlocks ? 0 : 1);
 		uint8_t *ecc = &data[dataLen];  // Temporary storage
-		reedSolomonComputeRemainder(dat, datLen, rsdiv, blockEccLen, ecc);
+		reedSolomonComputeRemainderLog(dat, datLen, rsdivLog, blockEccLen, ecc);
 		for (int j = 0, k = i; j < datLen; j++, k += numBlocks) {  // Copy data
 			if (j == shortBlockDataLen)
 				k -= numShortBlocks;
@@ -353,8 +1100,48 @@ testable int getNumRawDataModules(int ver) {
 
 /*---- Reed-Solomon ECC generator functions ----*/
 
+// Returns the Reed-Solomon ECC generator polynomial for the given degree, as the logarithms of its coefficients
+// in the same order as reedSolomonComputeDivisor() would produce them. The degree must be one that appears
+// in ECC_CODEWORDS_PER_BLOCK, as only those are precomputed by gen_tables.py.
+static const uint8_t *reedSolomonGetDivisorLog(int degree) {
+	assert(1 <= degree && degree <= qrcodegen_REED_SOLOMON_DEGREE_MAX);
+	return &RS_DIVISOR_LOG[RS_DIVISOR_OFFSET[degree]];
+}
+
+
+// Computes the Reed-Solomon error correction codeword for the given data and divisor polynomials.
+// The remainder when data[0 : dataLen] is divided by divisor[0 : degree] is stored in result[0 : degree].
+// All polynomials are in big endian, and the generator has an implicit leading 1 term.
+// The generator is given as the logarithms of its coefficients, so that each multiplication
+// is a single antilog lookup.
+static void reedSolomonComputeRemainderLog(const uint8_t data[], int dataLen,
+		const uint8_t generatorLog[], int degree, uint8_t result[]) {
+	assert(1 <= degree && degree <= qrcodegen_REED_SOLOMON_DEGREE_MAX);
+	memset(result, 0, (size_t)degree * sizeof(result[0]));
+	for (int i = 0; i < dataLen; i++)  // Polynomial division
+		reedSolomonDivideByteLog(data[i], generatorLog, degree, result);
+}
+
+
+// Does one step of the polynomial division of reedSolomonComputeRemainderLog(), updating the remainder
+// in result[0 : degree] for the next data byte. The remainder starts as all zeros.
+static void reedSolomonDivideByteLog(uint8_t data, const uint8_t generatorLog[], int degree, uint8_t result[]) {
+	uint8_t factor = data ^ result[0];
+	memmove(&result[0], &result[1], (size_t)(degree - 1) * sizeof(result[0]));
+	result[degree - 1] = 0;
+	if (factor == 0)
+		return;
+	const uint8_t *product = &GF256_EXP[GF256_LOG[factor]];  // product[log(g)] == g * factor
+	for (int j = 0; j < degree; j++)
+		result[j] ^= product[generatorLog[j]];
+}
+
+
+// The general forms of the above, for testing and benchmarking the tables against
+#ifdef QRCODEGEN_TEST
+
 // Computes a Reed-Solomon ECC generator polynomial for the given degree, storing in result[0 : degree].
-// This could be implemented as a lookup table over all possible parameter values, instead of as an algorithm.
+// The encoder itself uses the precomputed tables instead, see reedSolomonGetDivisorLog().
 testable void reedSolomonComputeDivisor(int degree, uint8_t result[]) {
 	assert(1 <= degree && degree <= qrcodegen_REED_SOLOMON_DEGREE_MAX);
 	// Polynomial coefficients are stored from highest to lowest power, excluding the leading term which is always 1.
@@ -365,50 +1152,44 @@ testable void reedSolomonComputeDivisor(int degree, uint8_t result[]) {
 	// Compute the product polynomial (x - r^0) * (x - r^1) * (x - r^2) * ... * (x - r^{degree-1}),
 	// drop the highest monomial term which is always 1x^degree.
 	// Note that r = 0x02, which is a generator element of this field GF(2^8/0x11D).
-	uint8_t root = 1;
 	for (int i = 0; i < degree; i++) {
 		// Multiply the current product by (x - r^i)
+		uint8_t root = GF256_EXP[i];
 		for (int j = 0; j < degree; j++) {
 			result[j] = reedSolomonMultiply(result[j], root);
 			if (j + 1 < degree)
 				result[j] ^= result[j + 1];
 		}
-		root = reedSolomonMultiply(root, 0x02);
 	}
 }
 
 
-// Computes the Reed-Solomon error correction codeword for the given data and divisor polynomials.
-// The remainder when data[0 : dataLen] is divided by divisor[0 : degree] is stored in result[0 : degree].
-// All polynomials are in big endian, and the generator has an implicit leading 1 term.
+// Same as reedSolomonComputeRemainderLog(), but with the generator coefficients given as they are.
 testable void reedSolomonComputeRemainder(const uint8_t data[], int dataLen,
 		const uint8_t generator[], int degree, uint8_t result[]) {
 	assert(1 <= degree && degree <= qrcodegen_REED_SOLOMON_DEGREE_MAX);
-	memset(result, 0, (size_t)degree * sizeof(result[0]));
-	for (int i = 0; i < dataLen; i++) {  // Polynomial division
-		uint8_t factor = data[i] ^ result[0];
-		memmove(&result[0], &result[1], (size_t)(degree - 1) * sizeof(result[0]));
-		result[degree - 1] = 0;
-		for (int j = 0; j < degree; j++)
-			result[j] ^= reedSolomonMultiply(generator[j], factor);
+	// The coefficients of a generator are never zero, so they all have a logarithm
+	uint8_t generatorLog[qrcodegen_REED_SOLOMON_DEGREE_MAX];
+	for (int j = 0; j < degree; j++) {
+		assert(generator[j] != 0);
+		generatorLog[j] = GF256_LOG[generator[j]];
 	}
+	reedSolomonComputeRemainderLog(data, dataLen, generatorLog, degree, result);
 }
 
-#undef qrcodegen_REED_SOLOMON_DEGREE_MAX
-
 
 // Returns the product of the two given field elements modulo GF(2^8/0x11D).
-// All inputs are valid. This could be implemented as a 256*256 lookup table.
+// All inputs are valid. Uses the log/antilog tables, as x * y == 2^(log(x) + log(y)).
 testable uint8_t reedSolomonMultiply(uint8_t x, uint8_t y) {
-	// Russian peasant multiplication
-	uint8_t z = 0;
-	for (int i = 7; i >= 0; i--) {
-		z = (uint8_t)((z << 1) ^ ((z >> 7) * 0x11D));
-		z ^= ((y >> i) & 1) * x;
-	}
-	return z;
+	if (x == 0 || y == 0)
+		return 0;
+	return GF256_EXP[GF256_LOG[x] + GF256_LOG[y]];
 }
 
+#endif  // QRCODEGEN_TEST
+
+#undef qrcodegen_REED_SOLOMON_DEGREE_MAX
+
 
 
 /*---- Drawing function modules ----*/
@@ -416,6 +1197,14 @@ testable uint8_t reedSolomonMultiply(uint8_t x, uint8_t y) {
 // Clears the given QR Code grid with white modules for the given
 // version's size, then marks every function module as black.
 testable void initializeFunctionModules(int version, uint8_t qrcode[]) {
+#if QRCODEGEN_TEMPLATE_VERSION_MAX > 0
+	if (version <= QRCODEGEN_TEMPLATE_VERSION_MAX) {  // Copy the pre-rendered template
+		int start = TEMPLATE_OFFSET[version];
+		memcpy(qrcode, &FUNCTION_TEMPLATES[start], (size_t)(TEMPLATE_OFFSET[version + 1] - start) * sizeof(qrcode[0]));
+		return;
+	}
+#endif
+	
 	// Initialize QR Code
 	int qrsize = version * 4 + 17;
 	memset(qrcode, 0, (size_t)((qrsize * qrsize + 7) / 8 + 1) * sizeof(qrcode[0]));
@@ -453,6 +1242,15 @@ testable void initializeFunctionModules(int version, uint8_t qrcode[]) {
 // non-function modules. This does not draw the format bits. This requires all function modules to be previously
 // marked black (namely by initializeFunctionModules()), because this may skip redrawing black function modules.
 static void drawWhiteFunctionModules(uint8_t qrcode[], int version) {
+#if QRCODEGEN_TEMPLATE_VERSION_MAX > 0
+	if (version <= QRCODEGEN_TEMPLATE_VERSION_MAX) {  // Replace the function modules by the template
+		int start = TEMPLATE_OFFSET[version], end = TEMPLATE_OFFSET[version + 1];
+		for (int i = 1; i < end - start; i++)
+			qrcode[i] = (uint8_t)((qrcode[i] & ~FUNCTION_TEMPLATES[start + i]) | BASE_TEMPLATES[start + i]);
+		return;
+	}
+#endif
+	
 	// Draw horizontal and vertical timing patterns
 	int qrsize = qrcodegen_getSize(qrcode);
 	for (int i = 7; i < qrsize - 7; i += 2) {
@@ -490,14 +1288,8 @@ static void drawWhiteFunctionModules(uint8_t qrcode[], int version) {
 	
 	// Draw version blocks
 	if (version >= 7) {
-		// Calculate error correction code and pack bits
-		int rem = version;  // version is uint6, in the range [7, 40]
-		for (int i = 0; i < 12; i++)
-			rem = (rem << 1) ^ ((rem >> 11) * 0x1F25);
-		long bits = (long)version << 12 | rem;  // uint18
-		assert(bits >> 18 == 0);
-		
 		// Draw two copies
+		long bits = getVersionBits(version);
 		for (int i = 0; i < 6; i++) {
 			for (int j = 0; j < 3; j++) {
 				int k = qrsize - 11 + j;
@@ -514,15 +1306,7 @@ static void drawWhiteFunctionModules(uint8_t qrcode[], int version) {
 // on the given mask and error correction level. This always draws all modules of
 // the format bits, unlike drawWhiteFunctionModules() which might skip black modules.
 static void drawFormatBits(enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask, uint8_t qrcode[]) {
-	// Calculate error correction code and pack bits
-	assert(0 <= (int)mask && (int)mask <= 7);
-	static const int table[] = {1, 0, 3, 2};
-	int data = table[(int)ecl] << 3 | (int)mask;  // errCorrLvl is uint2, mask is uint3
-	int rem = data;
-	for (int i = 0; i < 10; i++)
-		rem = (rem << 1) ^ ((rem >> 9) * 0x537);
-	int bits = (data << 10 | rem) ^ 0x5412;  // uint15
-	assert(bits >> 15 == 0);
+	int bits = getFormatBits(ecl, mask);
 	
 	// Draw first copy
 	for (int i = 0; i <= 5; i++)
@@ -543,6 +1327,33 @@ static void drawFormatBits(enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask, uin
 }
 
 
+// Returns the 15 format bits, with their error correction code, for the given mask and error correction level.
+static int getFormatBits(enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask) {
+	// Calculate error correction code and pack bits
+	assert(0 <= (int)mask && (int)mask <= 7);
+	static const int table[] = {1, 0, 3, 2};
+	int data = table[(int)ecl] << 3 | (int)mask;  // errCorrLvl is uint2, mask is uint3
+	int rem = data;
+	for (int i = 0; i < 10; i++)
+		rem = (rem << 1) ^ ((rem >> 9) * 0x537);
+	int bits = (data << 10 | rem) ^ 0x5412;  // uint15
+	assert(bits >> 15 == 0);
+	return bits;
+}
+
+
+// Returns the 18 version bits, with their error correction code, for the given version in the range [7, 40].
+static long getVersionBits(int version) {
+	// Calculate error correction code and pack bits
+	int rem = version;  // version is uint6, in the range [7, 40]
+	for (int i = 0; i < 12; i++)
+		rem = (rem << 1) ^ ((rem >> 11) * 0x1F25);
+	long bits = (long)version << 12 | rem;  // uint18
+	assert(bits >> 18 == 0);
+	return bits;
+}
+
+
 // Calculates and stores an ascending list of positions of alignment patterns
 // for this version number, returning the length of the list (in the range [0,7]).
 // Each position is in the range [0,177), and are used on both the x and y axes.
@@ -551,8 +1362,7 @@ testable int getAlignmentPatternPositions(int version, uint8_t result[7]) {
 	if (version == 1)
 		return 0;
 	int numAlign = version / 7 + 2;
-	int step = (version == 32) ? 26 :
-		(version*4 + numAlign*2 + 1) / (numAlign*2 - 2) * 2;
+	int step = getAlignmentPatternStep(version);
 	for (int i = numAlign - 1, pos = version * 4 + 10; i >= 1; i--, pos -= step)
 		result[i] = (uint8_t)pos;
 	result[0] = 6;
@@ -560,6 +1370,14 @@ testable int getAlignmentPatternPositions(int version, uint8_t result[7]) {
 }
 
 
+// Returns the distance between adjacent alignment patterns after the first one, for versions 2 and up.
+static int getAlignmentPatternStep(int version) {
+	int numAlign = version / 7 + 2;
+	return (version == 32) ? 26 :
+		(version*4 + numAlign*2 + 1) / (numAlign*2 - 2) * 2;
+}
+
+
 // Sets every pixel in the range [left : left + width] * [top : top + height] to black.
 static void fillRectangle(int left, int top, int width, int height, uint8_t qrcode[]) {
 	for (int dy = 0; dy < height; dy++) {
@@ -574,7 +1392,7 @@ static void fillRectangle(int left, int top, int width, int height, uint8_t qrco
 
 // Draws the raw codewords (including data and ECC) onto the given QR Code. This requires the initial state of
 // the QR Code to be black at function modules and white at codeword modules (including unused remainder bits).
-static void drawCodewords(const uint8_t data[], int dataLen, uint8_t qrcode[]) {
+testable void drawCodewords(const uint8_t data[], int dataLen, uint8_t qrcode[]) {
 	int qrsize = qrcodegen_getSize(qrcode);
 	int i = 0;  // Bit index into the data
 	// Do the funny zigzag scan
@@ -605,113 +1423,223 @@ static void drawCodewords(const uint8_t data[], int dataLen, uint8_t qrcode[]) {
 // before masking. Due to the arithmetic of XOR, calling applyMask() with
 // the same mask value a second time will undo the mask. A final well-formed
 // QR Code needs exactly one (not zero, two, etc.) mask applied.
-static void applyMask(const uint8_t functionModules[], uint8_t qrcode[], enum qrcodegen_Mask mask) {
+// Works on 32 modules of a row at a time: the mask row is built by replicating its
+// 6-module period, and the function modules are cleared from it before XORing.
+testable void applyMask(const uint8_t functionModules[], uint8_t qrcode[], enum qrcodegen_Mask mask) {
 	assert(0 <= (int)mask && (int)mask <= 7);  // Disallows qrcodegen_Mask_AUTO
 	int qrsize = qrcodegen_getSize(qrcode);
 	for (int y = 0; y < qrsize; y++) {
-		for (int x = 0; x < qrsize; x++) {
-			if (getModule(functionModules, x, y))
-				continue;
-			bool invert;
-			switch ((int)mask) {
-				case 0:  invert = (x + y) % 2 == 0;                    break;
-				case 1:  invert = y % 2 == 0;                          break;
-				case 2:  invert = x % 3 == 0;                          break;
-				case 3:  invert = (x + y) % 3 == 0;                    break;
-				case 4:  invert = (x / 3 + y / 2) % 2 == 0;            break;
-				case 5:  invert = x * y % 2 + x * y % 3 == 0;          break;
-				case 6:  invert = (x * y % 2 + x * y % 3) % 2 == 0;    break;
-				case 7:  invert = ((x + y) % 2 + x * y % 3) % 2 == 0;  break;
-				default:  assert(false);  return;
-			}
-			bool val = getModule(qrcode, x, y);
-			setModule(qrcode, x, y, val ^ invert);
+		unsigned int pattern = MASK_ROW_PATTERNS[(int)mask][y % 12];
+		for (int x = 0; x < qrsize; x += 32) {
+			int n = qrsize - x < 32 ? qrsize - x : 32;
+			// Rotate the period so that bit 0 is at x, then repeat it at every 6th bit
+			int phase = x % 6;
+			uint32_t period = (pattern >> phase | pattern << (6 - phase)) & 0x3F;
+			uint32_t invert = period * UINT32_C(0x41041041);
+			xorRowBits(qrcode, x, y, n, invert & ~getRowBits(functionModules, x, y, n));
 		}
 	}
 }
 
 
+// Chooses the mask for qrcodegen_Mask_FAST. The masks are ranked by their estimated penalty scores, then
+// the best numCandidates of them are scored in full, each abandoned once it can't beat the best so far.
+// With numCandidates == 8 the ranking is skipped and the choice is the same as with qrcodegen_Mask_AUTO.
+// The arguments are as for qrcodegen_MaskScorer; qrcode[] is left unmasked, but with some format bits.
+// The masks are applied on the fly as the rows are read, instead of to the whole bitmap.
+testable enum qrcodegen_Mask chooseMaskFast(const uint8_t functionModules[], uint8_t qrcode[],
+		enum qrcodegen_Ecc ecl, int numCandidates) {
+	assert(1 <= numCandidates && numCandidates <= 8);
+	int order[8];
+	for (int i = 0; i < 8; i++)
+		order[i] = i;
+	if (numCandidates < 8) {
+		long estimates[8];
+		for (int i = 0; i < 8; i++) {
+			drawFormatBits(ecl, (enum qrcodegen_Mask)i, qrcode);
+			estimates[i] = getPenaltyScoreSampled(qrcode, functionModules, (enum qrcodegen_Mask)i, PENALTY_SAMPLE_STRIDE, LONG_MAX);
+			// Insertion sort, stable so that the lower mask comes first among equal estimates
+			int j = i;
+			for (; j > 0 && estimates[order[j - 1]] > estimates[i]; j--)
+				order[j] = order[j - 1];
+			order[j] = i;
+		}
+	}
+	
+	int mask = order[0];
+	long minPenalty = LONG_MAX;
+	for (int c = 0; c < numCandidates; c++) {
+		int i = order[c];
+		// To win, a mask must score below the best, or equal to it if it's a lower mask
+		long bound = minPenalty == LONG_MAX || i > mask ? minPenalty : minPenalty + 1;
+		drawFormatBits(ecl, (enum qrcodegen_Mask)i, qrcode);
+		long penalty = getPenaltyScoreSampled(qrcode, functionModules, (enum qrcodegen_Mask)i, 1, bound);
+		if (penalty < bound) {
+			mask = i;
+			minPenalty = penalty;
+		}
+	}
+	return (enum qrcodegen_Mask)mask;
+}
+
+
 // Calculates and returns the penalty score based on state of the given QR Code's current modules.
 // This is used by the automatic mask choice algorithm to find the mask pattern that yields the lowest score.
-static long getPenaltyScore(const uint8_t qrcode[]) {
+testable long getPenaltyScore(const uint8_t qrcode[]) {
+	return getPenaltyScoreSampled(qrcode, NULL, qrcodegen_Mask_0, 1, LONG_MAX);
+}
+
+
+// Returns the penalty score like getPenaltyScore() with a stride of 1. With a larger stride it is
+// estimated on every stride'th row with the row above it and on every stride'th group of 8 columns,
+// for ranking the masks quickly. As all the terms are non-negative, the scoring stops once the sum
+// reaches the given bound: any result >= bound means only that the score isn't below it.
+// If functionModules[] isn't null, qrcode[] is unmasked and the mask is applied to each row as it is read.
+// Works on lines of modules packed into 32-bit words: runs are found by counting trailing zeros,
+// 2*2 blocks by comparing adjacent rows with XOR, and the balance by counting the bits set. The
+// columns are transposed 8*8 modules at a time into packed lines, 8 columns being scored at once.
+testable long getPenaltyScoreSampled(const uint8_t qrcode[], const uint8_t functionModules[],
+		enum qrcodegen_Mask mask, int stride, long bound) {
+	assert(stride >= 1);
 	int qrsize = qrcodegen_getSize(qrcode);
+	int numWords = (qrsize + 31) / 32;
 	long result = 0;
 	
-	// Adjacent modules in row having same color, and finder-like patterns
+	// Adjacent modules in row having same color, finder-like patterns, 2*2 blocks, and balance
+	uint32_t rows[2][qrcodegen_LINE_WORDS + 1];  // Plus a zero word for shifting in the right neighbors
+	int black = 0, total = 0;
 	for (int y = 0; y < qrsize; y++) {
-		bool runColor = false;
-		int runX = 0;
-		int runHistory[7] = {0};
-		for (int x = 0; x < qrsize; x++) {
-			if (getModule(qrcode, x, y) == runColor) {
-				runX++;
-				if (runX == 5)
-					result += PENALTY_N1;
-				else if (runX > 5)
-					result++;
-			} else {
-				finderPenaltyAddHistory(runX, runHistory, qrsize);
-				if (!runColor)
-					result += finderPenaltyCountPatterns(runHistory, qrsize) * PENALTY_N3;
-				runColor = getModule(qrcode, x, y);
-				runX = 1;
-			}
+		bool sampled = y % stride == 0;
+		if (!sampled && (y + 1) % stride != 0)
+			continue;  // Neither sampled nor above a sampled row
+		uint32_t *row = rows[y & 1];
+		for (int i = 0; i < numWords; i++) {
+			int n = qrsize - i * 32 < 32 ? qrsize - i * 32 : 32;
+			row[i] = getMaskedRowBits(qrcode, functionModules, mask, i * 32, y, n);
 		}
-		result += finderPenaltyTerminateAndCount(runColor, runX, runHistory, qrsize) * PENALTY_N3;
+		row[numWords] = 0;
+		if (!sampled)
+			continue;
+		for (int i = 0; i < numWords; i++)
+			black += popCount(row[i]);
+		total += qrsize;
+		result += getLinePenaltyScore(row, qrsize);
+		if (y > 0)
+			result += getBlockPenaltyScore(rows[(y & 1) ^ 1], row, qrsize);
+		if (result >= bound)
+			return result;
 	}
+	
+	// Balance of black and white modules
+	// Note that size is odd, so black/total != 1/2 when every row is counted
+	// Compute the smallest integer k >= 0 such that (45-5k)% <= black/total <= (55+5k)%
+	int k = (int)((labs(black * 20L - total * 10L) + total - 1) / total) - 1;
+	if (k > 0)  // A sample can be exactly half black, making k negative
+		result += k * PENALTY_N4;
+	
 	// Adjacent modules in column having same color, and finder-like patterns
-	for (int x = 0; x < qrsize; x++) {
-		bool runColor = false;
-		int runY = 0;
-		int runHistory[7] = {0};
-		for (int y = 0; y < qrsize; y++) {
-			if (getModule(qrcode, x, y) == runColor) {
-				runY++;
-				if (runY == 5)
-					result += PENALTY_N1;
-				else if (runY > 5)
-					result++;
-			} else {
-				finderPenaltyAddHistory(runY, runHistory, qrsize);
-				if (!runColor)
-					result += finderPenaltyCountPatterns(runHistory, qrsize) * PENALTY_N3;
-				runColor = getModule(qrcode, x, y);
-				runY = 1;
-			}
+	for (int x = 0; x < qrsize && result < bound; x += 8 * stride) {
+		int numColumns = qrsize - x < 8 ? qrsize - x : 8;
+		uint32_t columns[8][qrcodegen_LINE_WORDS] = {{0}};
+		for (int y = 0; y < qrsize; y += 8) {
+			// Byte i of tile is the row y + i, after transposing byte j is the column x + j
+			uint64_t tile = 0;
+			for (int i = 0; i < 8 && y + i < qrsize; i++)
+				tile |= (uint64_t)getMaskedRowBits(qrcode, functionModules, mask, x, y + i, numColumns) << (i * 8);
+			tile = transposeBits8x8(tile);
+			for (int j = 0; j < numColumns; j++)
+				columns[j][y >> 5] |= (uint32_t)((tile >> (j * 8)) & 0xFF) << (y & 31);
 		}
-		result += finderPenaltyTerminateAndCount(runColor, runY, runHistory, qrsize) * PENALTY_N3;
+		for (int j = 0; j < numColumns; j++)
+			result += getLinePenaltyScore(columns[j], qrsize);
 	}
-	
-	// 2*2 blocks of modules having same color
-	for (int y = 0; y < qrsize - 1; y++) {
-		for (int x = 0; x < qrsize - 1; x++) {
-			bool  color = getModule(qrcode, x, y);
-			if (  color == getModule(qrcode, x + 1, y) &&
-			      color == getModule(qrcode, x, y + 1) &&
-			      color == getModule(qrcode, x + 1, y + 1))
-				result += PENALTY_N2;
+	return result;
+}
+
+
+// Returns the modules [x : x + n] of row y like getRowBits(), with the given mask applied to the codeword
+// modules if functionModules[] isn't null, in the same way as applyMask(). A helper function for getPenaltyScoreSampled().
+static uint32_t getMaskedRowBits(const uint8_t qrcode[], const uint8_t functionModules[],
+		enum qrcodegen_Mask mask, int x, int y, int n) {
+	uint32_t bits = getRowBits(qrcode, x, y, n);
+	if (functionModules == NULL)
+		return bits;
+	unsigned int pattern = MASK_ROW_PATTERNS[(int)mask][y % 12];
+	int phase = x % 6;
+	uint32_t period = (pattern >> phase | pattern << (6 - phase)) & 0x3F;
+	uint32_t invert = period * UINT32_C(0x41041041) & (UINT32_MAX >> (32 - n));
+	return bits ^ (invert & ~getRowBits(functionModules, x, y, n));
+}
+
+
+// Returns the penalty score of one row or column of modules, for adjacent modules having the same
+// color and for finder-like patterns. Module i of the line is bit (i % 32) of line[i / 32].
+// A helper function for getPenaltyScore().
+noinline static long getLinePenaltyScore(const uint32_t line[], int qrsize) {
+	long result = 0;
+	bool runColor = false;
+	int runLength = 0;
+	int16_t runHistory[7] = {0};
+	for (int i = 0; i < qrsize; ) {
+		bool color = ((line[i >> 5] >> (i & 31)) & 1) != 0;
+		int length = getLineRunLength(line, i, qrsize, color);
+		if (length >= 5)
+			result += PENALTY_N1 + (length - 5);
+		if (color == runColor)  // Only for a white run at the start of the line
+			runLength += length;
+		else {
+			finderPenaltyAddHistory(runLength, runHistory, qrsize);
+			if (!runColor)
+				result += finderPenaltyCountPatterns(runHistory, qrsize) * PENALTY_N3;
+			runColor = color;
+			runLength = length;
 		}
+		i += length;
 	}
-	
-	// Balance of black and white modules
-	int black = 0;
-	for (int y = 0; y < qrsize; y++) {
-		for (int x = 0; x < qrsize; x++) {
-			if (getModule(qrcode, x, y))
-				black++;
-		}
+	result += finderPenaltyTerminateAndCount(runColor, runLength, runHistory, qrsize) * PENALTY_N3;
+	return result;
+}
+
+
+// Returns the penalty score of the 2*2 blocks of a single color that span the two given adjacent rows,
+// packed like the lines of getLinePenaltyScore() and each followed by a zero word. A helper function
+// for getPenaltyScore().
+noinline static long getBlockPenaltyScore(const uint32_t above[], const uint32_t row[], int qrsize) {
+	long result = 0;
+	// Bit x of same is set iff the 2*2 block at (x, y - 1) has a single color
+	for (int i = 0; i * 32 < qrsize - 1; i++) {
+		uint32_t rightAbove = above[i] >> 1 | above[i + 1] << 31;
+		uint32_t right = row[i] >> 1 | row[i + 1] << 31;
+		uint32_t same = ~(above[i] ^ row[i]) & ~(above[i] ^ rightAbove) & ~(row[i] ^ right);
+		int n = qrsize - 1 - i * 32;  // Blocks start at x < qrsize - 1
+		if (n < 32)
+			same &= (UINT32_C(1) << n) - 1;
+		result += popCount(same) * PENALTY_N2;
 	}
-	int total = qrsize * qrsize;  // Note that size is odd, so black/total != 1/2
-	// Compute the smallest integer k >= 0 such that (45-5k)% <= black/total <= (55+5k)%
-	int k = (int)((labs(black * 20L - total * 10L) + total - 1) / total) - 1;
-	result += k * PENALTY_N4;
 	return result;
 }
 
 
+// Returns the number of modules of the given color in the line, starting at the given
+// position and ending no later than the given end. A helper function for getPenaltyScore().
+static int getLineRunLength(const uint32_t line[], int start, int end, bool color) {
+	int i = start;
+	while (i < end) {
+		// Set bits mark the modules of the other color, the shifted in zeros are undecided
+		uint32_t other = (line[i >> 5] ^ (color ? UINT32_MAX : 0)) >> (i & 31);
+		if (other != 0) {
+			i += countTrailingZeros(other);
+			break;
+		}
+		i += 32 - (i & 31);
+	}
+	return (i < end ? i : end) - start;
+}
+
+
 // Can only be called immediately after a white run is added, and
 // returns either 0, 1, or 2. A helper function for getPenaltyScore().
-static int finderPenaltyCountPatterns(const int runHistory[7], int qrsize) {
+alwaysinline static int finderPenaltyCountPatterns(const int16_t runHistory[7], int qrsize) {
 	int n = runHistory[1];
 	assert(n <= qrsize * 3);
 	bool core = n > 0 && runHistory[2] == n && runHistory[3] == n * 3 && runHistory[4] == n && runHistory[5] == n;
@@ -723,7 +1651,7 @@ static int finderPenaltyCountPatterns(const int runHistory[7], int qrsize) {
 
 
 // Must be called at the end of a line (row or column) of modules. A helper function for getPenaltyScore().
-static int finderPenaltyTerminateAndCount(bool currentRunColor, int currentRunLength, int runHistory[7], int qrsize) {
+static int finderPenaltyTerminateAndCount(bool currentRunColor, int currentRunLength, int16_t runHistory[7], int qrsize) {
 	if (currentRunColor) {  // Terminate black run
 		finderPenaltyAddHistory(currentRunLength, runHistory, qrsize);
 		currentRunLength = 0;
@@ -735,11 +1663,16 @@ static int finderPenaltyTerminateAndCount(bool currentRunColor, int currentRunLe
 
 
 // Pushes the given value to the front and drops the last value. A helper function for getPenaltyScore().
-static void finderPenaltyAddHistory(int currentRunLength, int runHistory[7], int qrsize) {
+alwaysinline static void finderPenaltyAddHistory(int currentRunLength, int16_t runHistory[7], int qrsize) {
 	if (runHistory[0] == 0)
 		currentRunLength += qrsize;  // Add white border to initial run
-	memmove(&runHistory[1], &runHistory[0], 6 * sizeof(runHistory[0]));
-	runHistory[0] = currentRunLength;
+	runHistory[6] = runHistory[5];
+	runHistory[5] = runHistory[4];
+	runHistory[4] = runHistory[3];
+	runHistory[3] = runHistory[2];
+	runHistory[2] = runHistory[1];
+	runHistory[1] = runHistory[0];
+	runHistory[0] = (int16_t)currentRunLength;
 }
 
 
@@ -764,6 +1697,103 @@ bool qrcodegen_getModule(const uint8_t qrcode[], int x, int y) {
 }
 
 
+// Public function - see documentation comment in header file.
+void qrcodegen_renderPages(const uint8_t qrcode[], uint8_t pages[], int width, int numPages,
+		int left, int top, int quietZone, int scale) {
+	assert(pages != NULL && width >= 0 && numPages >= 0 && quietZone >= 0 && scale >= 1);
+	int qrsize = qrcodegen_getSize(qrcode);
+	int extent = (qrsize + quietZone * 2) * scale;  // Side of the square that is drawn, in pixels
+	int symbolLeft = left + quietZone * scale;
+	int symbolTop = top + quietZone * scale;
+	
+	// The pixels [x0 : x1] * [y0 : y1] of the square are inside the buffer
+	int x0 = left > 0 ? left : 0;
+	int x1 = left + extent < width ? left + extent : width;
+	int y0 = top > 0 ? top : 0;
+	int y1 = top + extent < numPages * 8 ? top + extent : numPages * 8;
+	if (x0 >= x1 || y0 >= y1)
+		return;
+	
+	for (int page = y0 >> 3; page <= (y1 - 1) >> 3; page++) {
+		uint8_t rowMask = 0;  // The rows of this page inside the square
+		for (int k = 0; k < 8; k++) {
+			int y = page * 8 + k;
+			if (y0 <= y && y < y1)
+				rowMask |= 1 << k;
+		}
+		uint8_t *out = &pages[page * width];
+		for (int x = x0; x < x1; x += 8) {
+			int n = x1 - x < 8 ? x1 - x : 8;
+			int moduleLeft = floorDiv(x - symbolLeft, scale);
+			int numModules = floorDiv(x + n - 1 - symbolLeft, scale) - moduleLeft + 1;
+			uint8_t columnModule[8];  // The module of each pixel column relative to moduleLeft, if scaled
+			for (int j = 0; scale > 1 && j < n; j++)
+				columnModule[j] = (uint8_t)(floorDiv(x + j - symbolLeft, scale) - moduleLeft);
+			
+			// Byte k of tile is the pixel row page * 8 + k, bit j being the column x + j
+			uint64_t tile = 0;
+			for (int k = 0; k < 8; k++) {
+				int moduleY = floorDiv(page * 8 + k - symbolTop, scale);
+				if (((rowMask >> k) & 1) == 0 || moduleY < 0 || moduleY >= qrsize)
+					continue;
+				uint32_t modules = getRowBitsClipped(qrcode, moduleLeft, moduleY, numModules);
+				uint32_t row = 0;
+				if (scale == 1)
+					row = modules;
+				else {
+					for (int j = 0; j < n; j++)
+						row |= ((modules >> columnModule[j]) & 1) << j;
+				}
+				tile |= (uint64_t)row << (k * 8);
+			}
+			
+			// After transposing, byte j is the column x + j, bit k being the row page * 8 + k
+			tile = transposeBits8x8(tile);
+			for (int j = 0; j < n; j++)
+				out[x + j] = (uint8_t)((out[x + j] & ~rowMask) | ((tile >> (j * 8)) & rowMask));
+		}
+	}
+}
+
+
+// Public function - see documentation comment in header file.
+void qrcodegen_renderPageRow(void *layout, int y, const uint32_t row[], int size) {
+	const struct qrcodegen_PageLayout *lay = (const struct qrcodegen_PageLayout *)layout;
+	assert(lay != NULL && lay->pages != NULL && lay->width >= 0 && lay->numPages >= 0
+		&& lay->quietZone >= 0 && lay->scale >= 1 && 0 <= y && y < size);
+	int scale = lay->scale;
+	int extent = (size + lay->quietZone * 2) * scale;
+	int symbolLeft = lay->left + lay->quietZone * scale;
+	int moduleTop = lay->top + (lay->quietZone + y) * scale;  // The first pixel row of module row y
+	
+	// The pixel rows [y0 : y1] of this row, with the quiet zone above the first and below the last
+	int y0 = y == 0 ? lay->top : moduleTop;
+	int y1 = y == size - 1 ? lay->top + extent : moduleTop + scale;
+	y0 = y0 > 0 ? y0 : 0;
+	y1 = y1 < lay->numPages * 8 ? y1 : lay->numPages * 8;
+	int x0 = lay->left > 0 ? lay->left : 0;
+	int x1 = lay->left + extent < lay->width ? lay->left + extent : lay->width;
+	int firstModule = floorDiv(x0 - symbolLeft, scale);
+	int firstPhase = x0 - symbolLeft - firstModule * scale;  // Pixel column of x0 within its module
+	
+	for (int py = y0; py < y1; py++) {
+		bool inRow = moduleTop <= py && py < moduleTop + scale;
+		uint8_t bit = (uint8_t)(1 << (py & 7));
+		uint8_t *out = &lay->pages[(py >> 3) * lay->width];
+		for (int x = x0, module = firstModule, phase = firstPhase; x < x1; x++) {
+			if (inRow && 0 <= module && module < size && ((row[module >> 5] >> (module & 31)) & 1) != 0)
+				out[x] |= bit;
+			else
+				out[x] &= (uint8_t)~bit;
+			if (++phase == scale) {
+				phase = 0;
+				module++;
+			}
+		}
+	}
+}
+
+
 // Gets the module at the given coordinates, which must be in bounds.
 testable bool getModule(const uint8_t qrcode[], int x, int y) {
 	int qrsize = qrcode[0];
@@ -773,6 +1803,53 @@ testable bool getModule(const uint8_t qrcode[], int x, int y) {
 }
 
 
+// Returns the modules [x : x + n] of row y, the module at x + i being bit i of the result.
+// Requires 1 <= n <= 32, and all the modules must be in bounds.
+testable uint32_t getRowBits(const uint8_t qrcode[], int x, int y, int n) {
+	int qrsize = qrcode[0];
+	assert(21 <= qrsize && qrsize <= 177 && 0 <= x && 1 <= n && n <= 32 && x + n <= qrsize && 0 <= y && y < qrsize);
+	int index = y * qrsize + x;
+	int shift = index & 7;
+	const uint8_t *p = &qrcode[(index >> 3) + 1];
+	uint64_t bits = 0;
+	for (int i = 0; i * 8 < shift + n; i++)  // At most 5 bytes
+		bits |= (uint64_t)p[i] << (i * 8);
+	return (uint32_t)(bits >> shift) & (UINT32_MAX >> (32 - n));
+}
+
+
+// Returns the modules [x : x + n] of row y like getRowBits(), with light modules for x
+// out of bounds. Requires 1 <= n <= 32 and 0 <= y < size.
+static uint32_t getRowBitsClipped(const uint8_t qrcode[], int x, int y, int n) {
+	int qrsize = qrcode[0];
+	int start = x > 0 ? x : 0;
+	int end = x + n < qrsize ? x + n : qrsize;
+	if (start >= end)
+		return 0;
+	return getRowBits(qrcode, start, y, end - start) << (start - x);
+}
+
+
+// Returns x / y rounded towards negative infinity. Requires y > 0.
+static int floorDiv(int x, int y) {
+	return x >= 0 ? x / y : -((-x + y - 1) / y);
+}
+
+
+// XORs the bits [0 : n] of the given value onto the modules [x : x + n] of row y, bit i going to
+// the module at x + i. Requires 1 <= n <= 32, and all the modules must be in bounds.
+static void xorRowBits(uint8_t qrcode[], int x, int y, int n, uint32_t bits) {
+	int qrsize = qrcode[0];
+	assert(21 <= qrsize && qrsize <= 177 && 0 <= x && 1 <= n && n <= 32 && x + n <= qrsize && 0 <= y && y < qrsize);
+	int index = y * qrsize + x;
+	int shift = index & 7;
+	uint8_t *p = &qrcode[(index >> 3) + 1];
+	uint64_t delta = (uint64_t)(bits & (UINT32_MAX >> (32 - n))) << shift;
+	for (int i = 0; i * 8 < shift + n; i++)
+		p[i] ^= (uint8_t)(delta >> (i * 8));
+}
+
+
 // Sets the module at the given coordinates, which must be in bounds.
 testable void setModule(uint8_t qrcode[], int x, int y, bool isBlack) {
 	int qrsize = qrcode[0];
@@ -795,6 +1872,43 @@ testable void setModuleBounded(uint8_t qrcode[], int x, int y, bool isBlack) {
 }
 
 
+// Transposes the 8*8 bit matrix where bit (i * 8 + j) is the element at row i and column j.
+static uint64_t transposeBits8x8(uint64_t x) {
+	uint64_t t;
+	t = (x ^ (x >>  7)) & UINT64_C(0x00AA00AA00AA00AA);  x ^= t ^ (t <<  7);
+	t = (x ^ (x >> 14)) & UINT64_C(0x0000CCCC0000CCCC);  x ^= t ^ (t << 14);
+	t = (x ^ (x >> 28)) & UINT64_C(0x00000000F0F0F0F0);  x ^= t ^ (t << 28);
+	return x;
+}
+
+
+// Returns the number of the trailing zero bits of x. Requires x != 0.
+static int countTrailingZeros(uint32_t x) {
+	assert(x != 0);
+#if defined(__GNUC__)
+	return __builtin_ctz(x);
+#else
+	int result = 0;
+	for (; (x & 1) == 0; x >>= 1)
+		result++;
+	return result;
+#endif
+}
+
+
+// Returns the number of the bits set in x.
+static int popCount(uint32_t x) {
+#if defined(__GNUC__)
+	return __builtin_popcount(x);
+#else
+	x = x - ((x >> 1) & 0x55555555);
+	x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+	x = (x + (x >> 4)) & 0x0F0F0F0F;
+	return (int)((x * 0x01010101) >> 24);
+#endif
+}
+
+
 // Returns true iff the i'th bit of x is set to 1. Requires x >= 0 and 0 <= i <= 14.
 static bool getBit(int x, int i) {
 	return ((x >> i) & 1) != 0;
@@ -893,10 +2007,10 @@ struct qrcodegen_Segment qrcodegen_makeNumeric(const char *digits, uint8_t buf[]
 	result.mode = qrcodegen_Mode_NUMERIC;
 	int bitLen = calcSegmentBitLength(result.mode, len);
 	assert(bitLen != -1);
+	(void)bitLen;  // Only checked by the asserts
 	result.numChars = (int)len;
-	if (bitLen > 0)
-		memset(buf, 0, ((size_t)bitLen + 7) / 8 * sizeof(buf[0]));
-	result.bitLength = 0;
+	struct BitWriter writer;
+	bitWriterInit(&writer, buf, 0);
 	
 	unsigned int accumData = 0;
 	int accumCount = 0;
@@ -906,13 +2020,14 @@ struct qrcodegen_Segment qrcodegen_makeNumeric(const char *digits, uint8_t buf[]
 		accumData = accumData * 10 + (unsigned int)(c - '0');
 		accumCount++;
 		if (accumCount == 3) {
-			appendBitsToBuffer(accumData, 10, buf, &result.bitLength);
+			bitWriterAppend(&writer, accumData, 10);
 			accumData = 0;
 			accumCount = 0;
 		}
 	}
 	if (accumCount > 0)  // 1 or 2 digits remaining
-		appendBitsToBuffer(accumData, accumCount * 3 + 1, buf, &result.bitLength);
+		bitWriterAppend(&writer, accumData, accumCount * 3 + 1);
+	result.bitLength = bitWriterFinish(&writer);
 	assert(result.bitLength == bitLen);
 	result.data = buf;
 	return result;
@@ -927,10 +2042,10 @@ struct qrcodegen_Segment qrcodegen_makeAlphanumeric(const char *text, uint8_t bu
 	result.mode = qrcodegen_Mode_ALPHANUMERIC;
 	int bitLen = calcSegmentBitLength(result.mode, len);
 	assert(bitLen != -1);
+	(void)bitLen;  // Only checked by the asserts
 	result.numChars = (int)len;
-	if (bitLen > 0)
-		memset(buf, 0, ((size_t)bitLen + 7) / 8 * sizeof(buf[0]));
-	result.bitLength = 0;
+	struct BitWriter writer;
+	bitWriterInit(&writer, buf, 0);
 	
 	unsigned int accumData = 0;
 	int accumCount = 0;
@@ -940,13 +2055,14 @@ struct qrcodegen_Segment qrcodegen_makeAlphanumeric(const char *text, uint8_t bu
 		accumData = accumData * 45 + (unsigned int)(temp - ALPHANUMERIC_CHARSET);
 		accumCount++;
 		if (accumCount == 2) {
-			appendBitsToBuffer(accumData, 11, buf, &result.bitLength);
+			bitWriterAppend(&writer, accumData, 11);
 			accumData = 0;
 			accumCount = 0;
 		}
 	}
 	if (accumCount > 0)  // 1 character remaining
-		appendBitsToBuffer(accumData, 6, buf, &result.bitLength);
+		bitWriterAppend(&writer, accumData, 6);
+	result.bitLength = bitWriterFinish(&writer);
 	assert(result.bitLength == bitLen);
 	result.data = buf;
 	return result;
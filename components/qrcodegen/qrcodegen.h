@@ -71,6 +71,10 @@ enum qrcodegen_Mask {
 	// A special value to tell the QR Code encoder to
 	// automatically select an appropriate mask pattern
 	qrcodegen_Mask_AUTO = -1,
+	// Like qrcodegen_Mask_AUTO, but faster: the masks are ranked on a sample of the rows
+	// and columns, and only the best few are scored in full, each abandoned as soon as it
+	// can't win. Usually picks the same mask as qrcodegen_Mask_AUTO, always a valid one
+	qrcodegen_Mask_FAST = -2,
 	// The eight actual mask patterns
 	qrcodegen_Mask_0 = 0,
 	qrcodegen_Mask_1,
@@ -127,6 +131,41 @@ struct qrcodegen_Segment {
 
 
 
+/* 
+ * Evaluates the mask patterns for the automatic mask choice, see qrcodegen_encodeSegmentsScored().
+ * When called, qrcode[] holds the function modules and the codewords but no mask, and functionModules[]
+ * has every function module black. The function must store the penalty score of mask i into
+ * penalties[i] for each 0 <= i < 8, as qrcodegen_getMaskPenalty() calculates it, and must not modify
+ * qrcode[] or functionModules[]. The context is passed through as given to the encoder.
+ */
+typedef void (*qrcodegen_MaskScorer)(void *context, const uint8_t qrcode[], const uint8_t functionModules[],
+	enum qrcodegen_Ecc ecl, long penalties[8]);
+
+
+/* 
+ * Receives the rows of a QR Code from qrcodegen_encodeSegmentsCompact(), in order from y = 0 to size - 1.
+ * The module at x of row y is bit (x % 32) of row[x / 32], 1 meaning black. The row array is only
+ * valid during the call. The context is passed through as given to the encoder.
+ */
+typedef void (*qrcodegen_RowSink)(void *context, int y, const uint32_t row[], int size);
+
+
+/* 
+ * The page-major frame buffer and placement of a QR Code, for qrcodegen_renderPageRow().
+ * The fields mean the same as the arguments of qrcodegen_renderPages().
+ */
+struct qrcodegen_PageLayout {
+	uint8_t *pages;
+	int width;
+	int numPages;
+	int left;
+	int top;
+	int quietZone;
+	int scale;
+};
+
+
+
 /*---- Macro constants and functions ----*/
 
 #define qrcodegen_VERSION_MIN   1  // The minimum version number supported in the QR Code Model 2 standard
@@ -143,6 +182,33 @@ struct qrcodegen_Segment {
 // Use this more convenient value to avoid calculating tighter memory bounds for buffers.
 #define qrcodegen_BUFFER_LEN_MAX  qrcodegen_BUFFER_LEN_FOR_VERSION(qrcodegen_VERSION_MAX)
 
+// The number of 8-bit codewords of the given version, data and ECC together, as a compile-time constant.
+// Requires qrcodegen_VERSION_MIN <= n <= qrcodegen_VERSION_MAX.
+#define qrcodegen_RAW_CODEWORDS_FOR_VERSION(n)  \
+	(((16 * (n) + 128) * (n) + 64 - ((n) >= 2 ? (25 * ((n) / 7 + 2) - 10) * ((n) / 7 + 2) - 55 : 0) \
+	- ((n) >= 7 ? 36 : 0)) / 8)
+
+// Calculates the number of bytes of the work buffer of qrcodegen_encodeSegmentsCompact() that suffices for
+// any QR Code up to and including the given version number at the given error correction level, without
+// boostEcl, as a compile-time constant: the two lines of modules that the rows and columns are scored in,
+// from the first 4-byte boundary, then the ECC codewords, bounded by a fraction of the raw codewords for each
+// level. For example 'uint8_t work[qrcodegen_COMPACT_BUFFER_LEN_FOR_ECL(10, qrcodegen_Ecc_LOW)];' is 98 bytes,
+// against 408 bytes for one version 10 bitmap. Requires qrcodegen_VERSION_MIN <= n <= qrcodegen_VERSION_MAX.
+#define qrcodegen_COMPACT_BUFFER_LEN_FOR_ECL(n, ecl)  \
+	(((ecl) == qrcodegen_Ecc_LOW    ? (qrcodegen_RAW_CODEWORDS_FOR_VERSION(n) *  5 + 21) / 22 + ((n) == 1) : \
+	  (ecl) == qrcodegen_Ecc_MEDIUM ? (qrcodegen_RAW_CODEWORDS_FOR_VERSION(n) *  5 + 12) / 13 : \
+	  (ecl) == qrcodegen_Ecc_QUARTILE ? (qrcodegen_RAW_CODEWORDS_FOR_VERSION(n) * 14 + 24) / 25 : \
+	  (qrcodegen_RAW_CODEWORDS_FOR_VERSION(n) * 2 + 2) / 3) \
+	+ 3 + (4 * (n) + 48) / 32 * 8)
+
+// Calculates the number of bytes of the work buffer of qrcodegen_encodeSegmentsCompact() that suffices for
+// any QR Code up to and including the given version number at any error correction level, with or without
+// boostEcl, as a compile-time constant. Requires qrcodegen_VERSION_MIN <= n <= qrcodegen_VERSION_MAX.
+#define qrcodegen_COMPACT_BUFFER_LEN_FOR_VERSION(n)  qrcodegen_COMPACT_BUFFER_LEN_FOR_ECL(n, qrcodegen_Ecc_HIGH)
+
+// The offset that qrcodegen_encodeTextBatch() stores for a text too long to fit in the range of versions.
+#define qrcodegen_BATCH_NO_FIT  ((size_t)-1)
+
 
 
 /*---- Functions (high level) to generate QR Codes ----*/
@@ -192,6 +258,23 @@ bool qrcodegen_encodeBinary(uint8_t dataAndTemp[], size_t dataLen, uint8_t qrcod
 	enum qrcodegen_Ecc ecl, int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl);
 
 
+/* 
+ * Encodes the given texts like qrcodegen_encodeText() with the same parameters, one after the other
+ * into the given arena, reusing tempBuffer for all of them. Each QR Code is stored right after the
+ * previous one and takes qrcodegen_BUFFER_LEN_FOR_VERSION(its version) bytes, so a batch of small
+ * codes packs densely even if maxVersion is large. Its offset in the arena is stored in offsets[i],
+ * or qrcodegen_BATCH_NO_FIT if the text is too long to fit in the range of versions, and then
+ * it takes no space. Returns the number of texts processed: fewer than count only if the arena
+ * is full, in which case the rest can be encoded by another call with a fresh arena.
+ * - The array tempBuffer must have a length of at least qrcodegen_BUFFER_LEN_FOR_VERSION(maxVersion),
+ *   and the arena must not overlap it or the texts.
+ * - The array offsets must have a length of at least count.
+ */
+size_t qrcodegen_encodeTextBatch(const char *const texts[], size_t count, uint8_t tempBuffer[],
+	uint8_t arena[], size_t arenaLen, size_t offsets[],
+	enum qrcodegen_Ecc ecl, int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl);
+
+
 /*---- Functions (low level) to generate QR Codes ----*/
 
 /* 
@@ -217,7 +300,8 @@ bool qrcodegen_encodeSegments(const struct qrcodegen_Segment segs[], size_t len,
  * chosen for the output. Iff boostEcl is true, then the ECC level of the result
  * may be higher than the ecl argument if it can be done without increasing the
  * version. The mask is either between qrcodegen_Mask_0 to 7 to force that mask, or
- * qrcodegen_Mask_AUTO to automatically choose an appropriate mask (which may be slow).
+ * qrcodegen_Mask_AUTO to automatically choose an appropriate mask (which may be slow),
+ * or qrcodegen_Mask_FAST to choose one in a fraction of the time (see the enum).
  * This function allows the user to create a custom sequence of segments that switches
  * between modes (such as alphanumeric and byte) to encode text in less space.
  * This is a low-level API; the high-level API is qrcodegen_encodeText() and qrcodegen_encodeBinary().
@@ -229,6 +313,54 @@ bool qrcodegen_encodeSegmentsAdvanced(const struct qrcodegen_Segment segs[], siz
 	int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl, uint8_t tempBuffer[], uint8_t qrcode[]);
 
 
+/* 
+ * Same as qrcodegen_encodeSegmentsAdvanced(), but with qrcodegen_Mask_AUTO the penalty scores
+ * of the mask patterns are evaluated by calling the given scorer, for example to spread the
+ * work over several threads (see qrcodegen_pool.h). With a null scorer, or with a fixed mask,
+ * this is the same as qrcodegen_encodeSegmentsAdvanced(). Of the masks with the lowest score
+ * the lowest numbered one is chosen, so the result doesn't depend on the scorer.
+ * qrcodegen_Mask_FAST doesn't use the scorer.
+ */
+bool qrcodegen_encodeSegmentsScored(const struct qrcodegen_Segment segs[], size_t len, enum qrcodegen_Ecc ecl,
+	int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl, uint8_t tempBuffer[], uint8_t qrcode[],
+	qrcodegen_MaskScorer scorer, void *scorerContext);
+
+
+/* 
+ * Returns the penalty score of the given unmasked QR Code with the given mask applied, for use
+ * by a qrcodegen_MaskScorer. The arguments qrcode[], functionModules[] and ecl are the ones the
+ * scorer received. The masked copy is built in the given work array, which must not overlap
+ * the others and must have a length of at least qrcodegen_BUFFER_LEN_FOR_VERSION(version).
+ * This function is thread-safe as long as each thread has its own work array.
+ */
+long qrcodegen_getMaskPenalty(const uint8_t qrcode[], const uint8_t functionModules[],
+	enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask, uint8_t work[]);
+
+
+/* 
+ * Encodes the given segments like qrcodegen_encodeSegmentsAdvanced(), to the same QR Code, but
+ * without a bitmap or a temporary buffer: the rows are passed to the given sink one at a time.
+ * Only the ECC codewords and two lines of modules are stored, in workBuffer[], which must have
+ * a length of at least qrcodegen_COMPACT_BUFFER_LEN_FOR_ECL(maxVersion, ecl) without boostEcl, or
+ * else qrcodegen_COMPACT_BUFFER_LEN_FOR_VERSION(maxVersion). The data codewords are read back from
+ * the segments, so their data buffers must stay intact and must not overlap workBuffer[].
+ * The modules are computed one line at a time, which makes this several times slower than
+ * the bitmap encoder, especially with qrcodegen_Mask_AUTO. qrcodegen_Mask_FAST only abandons
+ * the masks early here, without the sampling, so it chooses like qrcodegen_Mask_AUTO. Returns false without calling
+ * the sink if the data is too long to fit in the range of versions.
+ */
+bool qrcodegen_encodeSegmentsCompact(const struct qrcodegen_Segment segs[], size_t len, enum qrcodegen_Ecc ecl,
+	int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl, uint8_t workBuffer[],
+	qrcodegen_RowSink sink, void *sinkContext);
+
+
+/* 
+ * A qrcodegen_RowSink that stores the rows into the QR Code bitmap given as context, in the format
+ * of the other encoders. The bitmap must have a length of at least qrcodegen_BUFFER_LEN_FOR_VERSION(version).
+ */
+void qrcodegen_storeRow(void *qrcode, int y, const uint32_t row[], int size);
+
+
 /* 
  * Tests whether the given string can be encoded as a segment in alphanumeric mode.
  * A string is encodable iff each character is in the following set: 0 to 9, A to Z
@@ -306,6 +438,31 @@ int qrcodegen_getSize(const uint8_t qrcode[]);
 bool qrcodegen_getModule(const uint8_t qrcode[], int x, int y);
 
 
+/* 
+ * Renders the given QR Code into a page-major monochrome frame buffer, as used by SSD1306-style
+ * displays: byte (page * width + x) holds the pixels at column x and rows page * 8 to page * 8 + 7,
+ * the pixel at row page * 8 + k being bit k. A set bit is a dark module.
+ * - The buffer has numPages * 8 rows and width columns, i.e. numPages * width bytes.
+ * - Each module is drawn as a square of scale * scale pixels, with scale >= 1.
+ * - The symbol is surrounded by a light quiet zone of quietZone >= 0 modules. The top left
+ *   corner of the quiet zone is at pixel (left, top), which may lie outside the buffer.
+ * - Only the pixels of the symbol and its quiet zone are written, the rest of the buffer
+ *   is left as it was, so that the code can be drawn next to other content.
+ */
+void qrcodegen_renderPages(const uint8_t qrcode[], uint8_t pages[], int width, int numPages,
+	int left, int top, int quietZone, int scale);
+
+
+/* 
+ * A qrcodegen_RowSink that renders the rows into a page-major frame buffer as they come, like
+ * qrcodegen_renderPages() does for the whole QR Code, with the struct qrcodegen_PageLayout given
+ * as context. The quiet zone above the symbol is drawn with the first row and the one below with
+ * the last. So qrcodegen_encodeSegmentsCompact() can draw a code without any bitmap: the pages
+ * and its ECC buffer are all the memory it takes.
+ */
+void qrcodegen_renderPageRow(void *layout, int y, const uint32_t row[], int size);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,304 @@
+/*
+ * Parallel mask evaluation for the QR Code generator
+ *
+ * See qrcodegen_pool.h for the interface.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "qrcodegen_pool.h"
+
+#ifdef ESP_PLATFORM
+	#include "sdkconfig.h"
+	#include <freertos/FreeRTOS.h>
+	#include <freertos/task.h>
+	#include <freertos/semphr.h>
+#else
+	#include <pthread.h>
+#endif
+
+#ifndef CONFIG_QRCODEGEN_MASK_POOL_STACK_SIZE
+	#define CONFIG_QRCODEGEN_MASK_POOL_STACK_SIZE 2048
+#endif
+#ifndef CONFIG_QRCODEGEN_MASK_POOL_PRIORITY
+	#define CONFIG_QRCODEGEN_MASK_POOL_PRIORITY 5
+#endif
+
+
+/*---- Types ----*/
+
+struct Worker {
+	struct qrcodegen_MaskPool *pool;
+	int index;
+	uint8_t *work;  // Scratch buffer for the masked copies
+#ifdef ESP_PLATFORM
+	TaskHandle_t task;
+#else
+	pthread_t thread;
+	bool started;
+#endif
+};
+
+
+struct qrcodegen_MaskPool {
+	int numWorkers;
+	int maxVersion;  // The largest QR Code the work buffers hold
+
+	// The job being scored, set by the caller before waking the workers
+	const uint8_t *qrcode;
+	const uint8_t *functionModules;
+	enum qrcodegen_Ecc ecl;
+	long *penalties;
+	bool quit;
+
+#ifdef ESP_PLATFORM
+	SemaphoreHandle_t lock;  // Serializes the callers
+	SemaphoreHandle_t done;  // Given once by each worker that finished its share
+#else
+	pthread_mutex_t lock;  // Serializes the callers
+	pthread_mutex_t mutex;  // Guards the fields below and the job
+	pthread_cond_t start;
+	pthread_cond_t finish;
+	unsigned long generation;  // Incremented for each job
+	int pending;  // The number of workers still scoring the current job
+#endif
+
+	struct Worker workers[8];
+};
+
+
+
+/*---- Work shared by both platforms ----*/
+
+// Scores the share of the current job that belongs to the given worker
+static void scoreShare(struct Worker *worker) {
+	struct qrcodegen_MaskPool *pool = worker->pool;
+	for (int i = worker->index; i < 8; i += pool->numWorkers) {
+		pool->penalties[i] = qrcodegen_getMaskPenalty(pool->qrcode, pool->functionModules,
+			pool->ecl, (enum qrcodegen_Mask)i, worker->work);
+	}
+}
+
+
+// Returns whether the work buffers of the pool hold the given QR Code. If not, asserts, or without
+// assertions gives every mask the same penalty, so that the encoder still makes a valid QR Code
+static bool fitsPool(const struct qrcodegen_MaskPool *pool, const uint8_t qrcode[], long penalties[8]) {
+	int version = (qrcodegen_getSize(qrcode) - 17) / 4;
+	assert(version <= pool->maxVersion);
+	if (version <= pool->maxVersion)
+		return true;
+	for (int i = 0; i < 8; i++)
+		penalties[i] = 0;
+	return false;
+}
+
+
+static void freePool(struct qrcodegen_MaskPool *pool) {
+	for (int i = 0; i < 8; i++)
+		free(pool->workers[i].work);  // Null for the unused workers
+	free(pool);
+}
+
+
+
+#ifdef ESP_PLATFORM
+
+/*---- FreeRTOS workers ----*/
+
+static void workerTask(void *arg) {
+	struct Worker *worker = (struct Worker *)arg;
+	struct qrcodegen_MaskPool *pool = worker->pool;
+	for (;;) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		if (pool->quit)
+			break;
+		scoreShare(worker);
+		xSemaphoreGive(pool->done);
+	}
+	xSemaphoreGive(pool->done);
+	vTaskDelete(NULL);
+}
+
+
+// Public function - see documentation comment in header file.
+struct qrcodegen_MaskPool *qrcodegen_createMaskPool(int numWorkers, int maxVersion) {
+	assert(1 <= numWorkers && numWorkers <= 8);
+	assert(qrcodegen_VERSION_MIN <= maxVersion && maxVersion <= qrcodegen_VERSION_MAX);
+	struct qrcodegen_MaskPool *pool = calloc(1, sizeof(*pool));
+	if (pool == NULL)
+		return NULL;
+	pool->numWorkers = numWorkers;
+	pool->maxVersion = maxVersion;
+	for (int i = 0; i < numWorkers; i++) {
+		pool->workers[i].work = malloc((size_t)qrcodegen_BUFFER_LEN_FOR_VERSION(maxVersion));
+		if (pool->workers[i].work == NULL) {
+			freePool(pool);
+			return NULL;
+		}
+	}
+	pool->lock = xSemaphoreCreateMutex();
+	pool->done = xSemaphoreCreateCounting(numWorkers, 0);
+	if (pool->lock == NULL || pool->done == NULL)
+		goto fail;
+
+	for (int i = 0; i < numWorkers; i++) {
+		struct Worker *worker = &pool->workers[i];
+		worker->pool = pool;
+		worker->index = i;
+		if (xTaskCreatePinnedToCore(workerTask, "qrcodegen_mask", CONFIG_QRCODEGEN_MASK_POOL_STACK_SIZE,
+				worker, CONFIG_QRCODEGEN_MASK_POOL_PRIORITY, &worker->task, i % portNUM_PROCESSORS) != pdPASS) {
+			pool->numWorkers = i;  // Stop only the ones already running
+			qrcodegen_deleteMaskPool(pool);
+			return NULL;
+		}
+	}
+	return pool;
+
+fail:
+	if (pool->lock != NULL)
+		vSemaphoreDelete(pool->lock);
+	if (pool->done != NULL)
+		vSemaphoreDelete(pool->done);
+	freePool(pool);
+	return NULL;
+}
+
+
+// Public function - see documentation comment in header file.
+void qrcodegen_deleteMaskPool(struct qrcodegen_MaskPool *pool) {
+	if (pool == NULL)
+		return;
+	pool->quit = true;
+	for (int i = 0; i < pool->numWorkers; i++)
+		xTaskNotifyGive(pool->workers[i].task);
+	for (int i = 0; i < pool->numWorkers; i++)
+		xSemaphoreTake(pool->done, portMAX_DELAY);
+	vSemaphoreDelete(pool->lock);
+	vSemaphoreDelete(pool->done);
+	freePool(pool);
+}
+
+
+// Public function - see documentation comment in header file.
+void qrcodegen_scoreMasksOnPool(void *context, const uint8_t qrcode[], const uint8_t functionModules[],
+		enum qrcodegen_Ecc ecl, long penalties[8]) {
+	struct qrcodegen_MaskPool *pool = (struct qrcodegen_MaskPool *)context;
+	if (!fitsPool(pool, qrcode, penalties))
+		return;
+	xSemaphoreTake(pool->lock, portMAX_DELAY);
+	pool->qrcode = qrcode;
+	pool->functionModules = functionModules;
+	pool->ecl = ecl;
+	pool->penalties = penalties;
+	for (int i = 0; i < pool->numWorkers; i++)
+		xTaskNotifyGive(pool->workers[i].task);
+	for (int i = 0; i < pool->numWorkers; i++)
+		xSemaphoreTake(pool->done, portMAX_DELAY);
+	xSemaphoreGive(pool->lock);
+}
+
+
+#else
+
+/*---- POSIX thread workers ----*/
+
+static void *workerThread(void *arg) {
+	struct Worker *worker = (struct Worker *)arg;
+	struct qrcodegen_MaskPool *pool = worker->pool;
+	unsigned long seen = 0;
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		while (pool->generation == seen && !pool->quit)
+			pthread_cond_wait(&pool->start, &pool->mutex);
+		if (pool->quit)
+			break;
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->mutex);
+		scoreShare(worker);
+		pthread_mutex_lock(&pool->mutex);
+		if (--pool->pending == 0)
+			pthread_cond_signal(&pool->finish);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+
+// Public function - see documentation comment in header file.
+struct qrcodegen_MaskPool *qrcodegen_createMaskPool(int numWorkers, int maxVersion) {
+	assert(1 <= numWorkers && numWorkers <= 8);
+	assert(qrcodegen_VERSION_MIN <= maxVersion && maxVersion <= qrcodegen_VERSION_MAX);
+	struct qrcodegen_MaskPool *pool = calloc(1, sizeof(*pool));
+	if (pool == NULL)
+		return NULL;
+	pool->numWorkers = numWorkers;
+	pool->maxVersion = maxVersion;
+	for (int i = 0; i < numWorkers; i++) {
+		pool->workers[i].work = malloc((size_t)qrcodegen_BUFFER_LEN_FOR_VERSION(maxVersion));
+		if (pool->workers[i].work == NULL) {
+			freePool(pool);
+			return NULL;
+		}
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->finish, NULL);
+
+	for (int i = 0; i < numWorkers; i++) {
+		struct Worker *worker = &pool->workers[i];
+		worker->pool = pool;
+		worker->index = i;
+		if (pthread_create(&worker->thread, NULL, workerThread, worker) != 0) {
+			qrcodegen_deleteMaskPool(pool);
+			return NULL;
+		}
+		worker->started = true;
+	}
+	return pool;
+}
+
+
+// Public function - see documentation comment in header file.
+void qrcodegen_deleteMaskPool(struct qrcodegen_MaskPool *pool) {
+	if (pool == NULL)
+		return;
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->mutex);
+	for (int i = 0; i < pool->numWorkers; i++) {
+		if (pool->workers[i].started)
+			pthread_join(pool->workers[i].thread, NULL);
+	}
+	pthread_cond_destroy(&pool->finish);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_mutex_destroy(&pool->lock);
+	freePool(pool);
+}
+
+
+// Public function - see documentation comment in header file.
+void qrcodegen_scoreMasksOnPool(void *context, const uint8_t qrcode[], const uint8_t functionModules[],
+		enum qrcodegen_Ecc ecl, long penalties[8]) {
+	struct qrcodegen_MaskPool *pool = (struct qrcodegen_MaskPool *)context;
+	if (!fitsPool(pool, qrcode, penalties))
+		return;
+	pthread_mutex_lock(&pool->lock);
+	pthread_mutex_lock(&pool->mutex);
+	pool->qrcode = qrcode;
+	pool->functionModules = functionModules;
+	pool->ecl = ecl;
+	pool->penalties = penalties;
+	pool->pending = pool->numWorkers;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+	while (pool->pending > 0)
+		pthread_cond_wait(&pool->finish, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+#endif  // ESP_PLATFORM
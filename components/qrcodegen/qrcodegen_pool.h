@@ -0,0 +1,54 @@
+/*
+ * Parallel mask evaluation for the QR Code generator
+ *
+ * A small pool of worker threads that scores the 8 candidate masks of
+ * qrcodegen_Mask_AUTO concurrently, each worker in its own scratch buffer.
+ * On the ESP32 the workers are FreeRTOS tasks pinned round-robin to the cores,
+ * elsewhere they are POSIX threads.
+ *
+ * Usage:
+ *   struct qrcodegen_MaskPool *pool = qrcodegen_createMaskPool(2, maxVersion);
+ *   qrcodegen_encodeSegmentsScored(..., qrcodegen_scoreMasksOnPool, pool);
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "qrcodegen.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+struct qrcodegen_MaskPool;
+
+
+/*
+ * Creates a pool of the given number of workers (1 to 8), for QR Codes up to the given version.
+ * Returns null if the workers or their buffers could not be allocated.
+ */
+struct qrcodegen_MaskPool *qrcodegen_createMaskPool(int numWorkers, int maxVersion);
+
+
+/*
+ * Stops the workers and frees the pool. The pool must not be in use.
+ */
+void qrcodegen_deleteMaskPool(struct qrcodegen_MaskPool *pool);
+
+
+/*
+ * A qrcodegen_MaskScorer that spreads the masks over the workers of the pool given as context:
+ * worker i scores the masks i, i + numWorkers, etc. Blocks until all of them are scored.
+ * Concurrent calls on the same pool are serialized. The QR Code must be no larger than the
+ * maxVersion of the pool: a larger one fails an assertion, or without assertions gets the same
+ * penalty for every mask, i.e. mask 0.
+ */
+void qrcodegen_scoreMasksOnPool(void *pool, const uint8_t qrcode[], const uint8_t functionModules[],
+	enum qrcodegen_Ecc ecl, long penalties[8]);
+
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,634 @@
+// Runs the driver on the mock transport and reports the bytes on the wire of typical screen updates, over I2C
+// (2 bytes of address and control byte per phase) and SPI (none), with the bus time at the given clocks, on
+// 128x32 and 128x64 panels. After each update the RAM of the emulated controller must equal the framebuffer,
+// otherwise the exit status is 1.
+// A marquee wider than the panel then runs through a few reloads on the emulated scroll: the window must
+// move on by the columns scrolled, without any data sent while the controller scrolls.
+// Two panels on one I2C bus are then updated one after the other, and by ssd1306_flush_panels(): the skew
+// between the two updates done, against the frame period of the panels.
+// Grayscale images then cycle their bitplanes: the bytes per plane, and the share of an I2C bus at 400 kHz
+// and 1 MHz they take at one frame of the panel per plane, and at the frames per plane that the driver
+// derives for a bus at SSD1306_I2C_HZ, as the display service shows them. Averaged over the two planes, the
+// emulated panel must show each pixel at its level, and at the derived frames the planes must fit that bus.
+// A progress bar then fills over the 5 s and 1 s of the safety sequence, on the ticks of its timer: the
+// bytes it sends against a redraw of the whole bar per tick.
+// Then times the driver itself: drawing and flushing each update, in ns of CPU on this machine.
+//
+// Usage: ssd1306_wire [-v] [-i i2c_hz] [-s spi_hz]
+//        -v dumps the stream of each update: C for command bytes, D for data bytes
+
+#define _POSIX_C_SOURCE 200809L  // For getopt() and clock_gettime()
+
+#include "ssd1306.h"
+#include "ssd1306_mock.h"
+#include "ssd1306_progress.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STREAM_CAPACITY 4096
+#define BENCH_MIN_NS    200000000L
+
+#define MARQUEE_LENGTH  300     // columns, 50 characters
+#define MARQUEE_FRAMES  2
+#define MARQUEE_RELOADS 3
+
+#define GRAY_CONTRAST_STEP  (SSD1306_GRAY_CONTRAST / 2)     // per level
+
+typedef struct {
+    const char *name;
+    void (*setup)(int variant); // what is on the screen before, or NULL for a blank screen
+    void (*draw)(int variant);  // variant alternates, so that each repetition changes something
+} scenario_t;
+
+static uint8_t pattern[SSD1306_MAX_PAGES][SSD1306_WIDTH];
+static ssd1306_t *panel;        // that the scenarios draw on
+
+
+static void
+draw_text_line(int variant) {
+    // A line of 10 characters of 6 columns from column 48, like lcd_puts()
+    ssd1306_fb_write(panel, 48, 1, pattern[variant & 1], 60);
+}
+
+
+static void
+draw_same_line(int variant) {
+    (void)variant;
+    ssd1306_fb_write(panel, 48, 1, pattern[0], 60);
+}
+
+
+static void
+draw_char(int variant) {
+    ssd1306_fb_write(panel, 8 * 6, 2, pattern[variant & 1] + 7, 6);
+}
+
+
+static void
+draw_qr_area(int variant) {
+    // A new QR-Code in the 48 x 32 area, like lcd_QR_pages()
+    for (int page = 0; page < 4; ++page) {
+        ssd1306_fb_write(panel, 0, page, pattern[(page + variant) % 4] + 13, 48);
+    }
+}
+
+
+static void
+draw_scattered(int variant) {
+    uint8_t dot = (uint8_t)(1 << (variant & 7));
+    ssd1306_fb_write(panel, 3, 0, &dot, 1);
+    ssd1306_fb_write(panel, 100, 0, &dot, 1);
+    ssd1306_fb_write(panel, 120, panel->geometry.pages - 1, &dot, 1);
+}
+
+
+static void
+draw_clear(int variant) {
+    // In the benchmark, the odd repetitions put back something to clear
+    if (variant & 1) {
+        draw_text_line(0);
+    }
+    else {
+        ssd1306_fb_clear(panel);
+    }
+}
+
+
+static void
+draw_full(int variant) {
+    (void)variant;
+    ssd1306_fb_invalidate(panel);
+}
+
+
+static const scenario_t SCENARIOS[] = {
+    { "one character", NULL, draw_char },
+    { "text line", NULL, draw_text_line },
+    { "same text line", draw_same_line, draw_same_line },
+    { "QR area", NULL, draw_qr_area },
+    { "3 scattered pixels", NULL, draw_scattered },
+    { "clear", draw_text_line, draw_clear },
+    { "full screen", NULL, draw_full },
+};
+#define NUM_SCENARIOS (sizeof(SCENARIOS) / sizeof(SCENARIOS[0]))
+
+
+static int64_t
+nanoseconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static void
+dump_stream(const ssd1306_mock_t *mock) {
+    if (mock->length == 0) {
+        return;
+    }
+    int data = -1;
+    for (size_t i = 0; i < mock->length; ++i) {
+        int is_data = (mock->stream[i] & SSD1306_MOCK_DATA) != 0;
+        if (is_data != data) {
+            printf("%s%c:", (i > 0) ? "\n      " : "      ", is_data ? 'D' : 'C');
+            data = is_data;
+        }
+        printf(" %02x", mock->stream[i] & 0xff);
+    }
+    printf("\n");
+}
+
+
+// True if the pages of the panel in the emulated RAM hold its framebuffer
+static bool
+panel_matches(const ssd1306_t *p, const ssd1306_mock_t *mock) {
+    const uint8_t *fb = ssd1306_fb_pages(p);
+    for (int page = 0; page < p->geometry.pages; ++page) {
+        if (memcmp(mock->ram[page], fb + page * SSD1306_WIDTH, SSD1306_WIDTH) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// The column of the strip that the band shows right after the margin, or -1 if it shows no window of the strip
+static int
+marquee_window(const ssd1306_mock_t *mock, const ssd1306_marquee_t *marquee) {
+    const uint8_t *row = mock->ram[marquee->page];
+    for (int col = 0; col < SSD1306_MARQUEE_RELOAD_COLUMNS; ++col) {
+        if (row[col] != 0) {
+            return -1;
+        }
+    }
+    for (int offset = 0; offset < marquee->length; ++offset) {
+        int col = SSD1306_MARQUEE_RELOAD_COLUMNS;
+        while (col < SSD1306_WIDTH && row[col] == marquee->strip[(offset + col - SSD1306_MARQUEE_RELOAD_COLUMNS) % marquee->length]) {
+            ++col;
+        }
+        if (col == SSD1306_WIDTH) {
+            return offset;
+        }
+    }
+    return -1;
+}
+
+
+static bool
+run_marquee(ssd1306_mock_t *mock, double bits_per_byte, long hz, bool verbose) {
+    static ssd1306_marquee_t marquee;
+    bool ok = true;
+
+    marquee.page = 1;
+    marquee.pages = 1;
+    marquee.frames = MARQUEE_FRAMES;
+    marquee.length = MARQUEE_LENGTH;
+    for (int col = 0; col < MARQUEE_LENGTH; ++col) {
+        marquee.strip[col] = pattern[col / SSD1306_WIDTH][col % SSD1306_WIDTH];
+    }
+    ssd1306_fb_clear(panel);
+    ssd1306_flush(panel);
+    ssd1306_mock_rewind(mock);
+    ssd1306_reset_stats(panel);
+    ssd1306_marquee_set(panel, &marquee);
+    ssd1306_flush(panel);
+
+    double steps_per_s = (double)ssd1306_frame_hz(panel) / MARQUEE_FRAMES;
+    printf("  marquee of %u columns, %.0f columns/s:\n", MARQUEE_LENGTH, steps_per_s);
+    int offset = marquee_window(mock, &marquee);
+    if (!mock->scrolling || offset != 0) {
+        printf("  MISMATCH: the marquee didn't start\n");
+        ok = false;
+    }
+    ssd1306_stats_t stats;
+    for (int reload = 0; reload < MARQUEE_RELOADS && ok; ++reload) {
+        // The controller scrolls on its own; the driver estimates how far from the time
+        int64_t due_us = ssd1306_marquee_due_us(panel);
+        struct timespec ts = { .tv_sec = due_us / 1000000, .tv_nsec = (due_us % 1000000) * 1000 };
+        nanosleep(&ts, NULL);
+        ssd1306_mock_scroll(mock, SSD1306_MARQUEE_RELOAD_COLUMNS);
+        ssd1306_mock_rewind(mock);
+        ssd1306_reset_stats(panel);
+        ssd1306_flush(panel);
+        ssd1306_get_stats(panel, &stats);
+
+        int next = marquee_window(mock, &marquee);
+        printf("  %-20s %12u %7u %10u %10.0f   moved by %d columns\n", "reload", (unsigned)stats.transactions,
+            (unsigned)mock->phases, (unsigned)stats.bytes, stats.bytes * bits_per_byte * 1e6 / hz,
+            (next - offset + MARQUEE_LENGTH) % MARQUEE_LENGTH);
+        if (verbose) {
+            dump_stream(mock);
+        }
+        if (next < 0 || !panel_matches(panel, mock) || mock->violations > 0 || !mock->scrolling) {
+            printf("  MISMATCH: the band doesn't show the next window of the strip\n");
+            ok = false;
+        }
+        offset = next;
+    }
+    // A software ticker sends the band on every step
+    int ticker_bytes = 6 + SSD1306_WIDTH + 2 * mock->base.phase_overhead;
+    printf("  marquee %.0f bytes/s, software ticker %.0f bytes/s\n",
+        stats.bytes * steps_per_s / SSD1306_MARQUEE_RELOAD_COLUMNS, ticker_bytes * steps_per_s);
+
+    ssd1306_marquee_set(panel, NULL);
+    ssd1306_flush(panel);
+    if (mock->scrolling || !panel_matches(panel, mock)) {
+        printf("  MISMATCH: the marquee didn't stop\n");
+        ok = false;
+    }
+    return ok;
+}
+
+
+static bool
+run_bus(const char *bus, ssd1306_geometry_t geometry, uint8_t phase_overhead, double bits_per_byte, long hz,
+        bool verbose) {
+    static uint16_t stream[STREAM_CAPACITY];
+    static ssd1306_mock_t mock;
+    static ssd1306_t bus_panel;
+    bool ok = true;
+
+    panel = &bus_panel;
+    ssd1306_mock_init(&mock, stream, STREAM_CAPACITY, phase_overhead);
+    ssd1306_init(panel, &mock.base, geometry);
+    ssd1306_stats_t stats;
+    ssd1306_get_stats(panel, &stats);
+    printf("%s at %ld kHz, 128x%u: init %u transactions, %u wire bytes\n", bus, hz / 1000, geometry.pages * 8,
+        (unsigned)stats.transactions, (unsigned)stats.bytes);
+    if (mock.rows != geometry.pages * 8 || mock.com_pins != geometry.com_pins) {
+        printf("  MISMATCH: the controller is set up for %u rows, COM pins 0x%02x\n", mock.rows, mock.com_pins);
+        ok = false;
+    }
+    printf("  %-20s %12s %7s %10s %10s\n", "update", "transactions", "phases", "wire bytes", "bus us");
+    for (size_t s = 0; s < NUM_SCENARIOS; ++s) {
+        ssd1306_fb_clear(panel);
+        if (SCENARIOS[s].setup) {
+            SCENARIOS[s].setup(0);
+        }
+        ssd1306_flush(panel);
+        ssd1306_mock_rewind(&mock);
+        ssd1306_reset_stats(panel);
+
+        SCENARIOS[s].draw(0);
+        ssd1306_flush(panel);
+        ssd1306_get_stats(panel, &stats);
+        printf("  %-20s %12u %7u %10u %10.0f\n", SCENARIOS[s].name, (unsigned)stats.transactions, (unsigned)mock.phases,
+            (unsigned)stats.bytes, stats.bytes * bits_per_byte * 1e6 / hz);
+        if (verbose) {
+            dump_stream(&mock);
+        }
+        if (!panel_matches(panel, &mock) || mock.dropped > 0) {
+            printf("  MISMATCH: the panel doesn't show the framebuffer\n");
+            ok = false;
+        }
+    }
+    return run_marquee(&mock, bits_per_byte, hz, verbose) && ok;
+}
+
+
+// Two panels on one I2C bus, one getting a full screen and the other a text line. Flushed one after the
+// other, the second is done a whole update after the first; the skew reported by ssd1306_flush_panels()
+// is the bytes between the two done.
+static bool
+run_two_panels(ssd1306_geometry_t geometry, long hz) {
+    static ssd1306_mock_t mocks[2];
+    static ssd1306_t panels[2];
+    ssd1306_t *const both[2] = { &panels[0], &panels[1] };
+    bool ok = true;
+
+    for (int i = 0; i < 2; ++i) {
+        ssd1306_mock_init(&mocks[i], NULL, 0, 2);
+        ssd1306_init(&panels[i], &mocks[i].base, geometry);
+    }
+    // I2C: 9 clocks per byte with the ACK
+    double frame_bytes = hz / 9.0 / ssd1306_frame_hz(&panels[0]);
+    printf("Two 128x%u panels on I2C at %ld kHz, frame period of %u Hz = %.0f wire bytes:\n", geometry.pages * 8,
+        hz / 1000, (unsigned)ssd1306_frame_hz(&panels[0]), frame_bytes);
+    printf("  %-24s %20s %20s\n", "updates", "sequential skew", "interleaved skew");
+    for (int full = 0; full < 2; ++full) {
+        uint32_t skew[2];
+        for (int interleaved = 0; interleaved < 2; ++interleaved) {
+            for (int i = 0; i < 2; ++i) {
+                panel = &panels[i];
+                ssd1306_fb_clear(panel);
+                ssd1306_flush(panel);
+                if (i == full) {
+                    ssd1306_fb_invalidate(panel);
+                }
+                else {
+                    draw_text_line(0);
+                }
+                ssd1306_reset_stats(panel);
+            }
+            if (interleaved) {
+                if (ssd1306_flush_panels(both, 2, &skew[1]) != ESP_OK) {
+                    ok = false;
+                }
+            }
+            else {
+                ssd1306_flush(&panels[0]);
+                ssd1306_flush(&panels[1]);
+                ssd1306_stats_t stats;
+                ssd1306_get_stats(&panels[1], &stats);
+                skew[0] = stats.bytes;
+            }
+            for (int i = 0; i < 2; ++i) {
+                if (!panel_matches(&panels[i], &mocks[i])) {
+                    printf("  MISMATCH: panel %d doesn't show its framebuffer\n", i);
+                    ok = false;
+                }
+            }
+        }
+        printf("  %-24s %8u bytes %4.0f%% %8u bytes %4.0f%%   of a frame\n",
+            full ? "text line, full screen" : "full screen, text line",
+            (unsigned)skew[0], 100 * skew[0] / frame_bytes, (unsigned)skew[1], 100 * skew[1] / frame_bytes);
+    }
+    return ok;
+}
+
+
+static void
+gray_logo(ssd1306_gray_t *gray) {
+    // In the 48 x 32 area of the QR-Codes
+    for (uint8_t y = 0; y < 32; ++y) {
+        for (uint8_t x = 0; x < 48; ++x) {
+            ssd1306_gray_pixel(gray, x, y, pattern[y >> 3][x + 10 * (y & 7)] & 3);
+        }
+    }
+}
+
+
+static void
+gray_graph(ssd1306_gray_t *gray) {
+    // A history of the signal strength right of the logo: 16 bars of 4 columns, the older ones dimmer
+    for (uint8_t bar = 0; bar < 16; ++bar) {
+        uint8_t height = 4 + pattern[0][bar] % 28;
+        for (uint8_t x = 64 + bar * 4; x < 64 + bar * 4 + 3; ++x) {
+            for (uint8_t y = 32 - height; y < 32; ++y) {
+                ssd1306_gray_pixel(gray, x, y, 1 + bar / 6);
+            }
+        }
+    }
+}
+
+
+static void
+gray_gradient(ssd1306_gray_t *gray) {
+    // 4 vertical bands, one per level: the planes differ in the middle two only
+    for (uint8_t y = 0; y < 8 * SSD1306_MAX_PAGES; ++y) {
+        for (uint8_t x = 0; x < SSD1306_WIDTH; ++x) {
+            ssd1306_gray_pixel(gray, x, y, x / (SSD1306_WIDTH / 4));
+        }
+    }
+}
+
+
+static void
+gray_noise(ssd1306_gray_t *gray) {
+    // The worst case: the planes differ in nearly every byte
+    for (uint8_t y = 0; y < 8 * SSD1306_MAX_PAGES; ++y) {
+        for (uint8_t x = 0; x < SSD1306_WIDTH; ++x) {
+            ssd1306_gray_pixel(gray, x, y, pattern[y & 7][x] >> 6);
+        }
+    }
+}
+
+
+static const struct {
+    const char *name;
+    void (*draw)(ssd1306_gray_t *gray);
+} GRAY_IMAGES[] = {
+    { "logo 48x32", gray_logo },
+    { "logo and graph", gray_graph },
+    { "gradient", gray_gradient },
+    { "full screen noise", gray_noise },
+};
+#define NUM_GRAY_IMAGES (sizeof(GRAY_IMAGES) / sizeof(GRAY_IMAGES[0]))
+
+
+// Cycles the bitplanes of a few images, as the display service does on its timer
+static bool
+run_gray(ssd1306_geometry_t geometry) {
+    static ssd1306_gray_t gray;
+    static ssd1306_mock_t mock;
+    static ssd1306_t gray_panel;
+    static const long BUSES_HZ[] = { 400000, 1000000 };
+    bool ok = true;
+
+    panel = &gray_panel;
+    ssd1306_mock_init(&mock, NULL, 0, 2);
+    mock.base.bytes_per_s = SSD1306_I2C_HZ / 9;
+    ssd1306_init(panel, &mock.base, geometry);
+    uint32_t frame_hz = ssd1306_frame_hz(panel);
+    printf("Grayscale on a 128x%u panel over I2C, frames at %u Hz, frames/plane derived for %ld kHz (*):\n",
+        geometry.pages * 8, (unsigned)frame_hz, (long)SSD1306_I2C_HZ / 1000);
+    printf("  %-20s %11s %13s %9s %9s %9s %9s\n", "image", "bytes/plane", "frames/plane", "bytes/s",
+        "400 kHz", "1 MHz", "CPU ns");
+    memset(&gray, 0, sizeof(gray));
+    for (size_t g = 0; g < NUM_GRAY_IMAGES; ++g) {
+        if (g > 0 && GRAY_IMAGES[g].draw != gray_graph) {
+            memset(&gray, 0, sizeof(gray));
+        }
+        GRAY_IMAGES[g].draw(&gray);
+        // A cycle to get from the last image to this one, then one measured
+        for (int plane = 0; plane < 2; ++plane) {
+            ssd1306_gray_show_plane(panel, &gray, plane);
+            ssd1306_flush(panel);
+        }
+        uint16_t sum[SSD1306_MAX_PAGES * 8][SSD1306_WIDTH];
+        memset(sum, 0, sizeof(sum));
+        ssd1306_reset_stats(panel);
+        for (int plane = 0; plane < 2; ++plane) {
+            ssd1306_gray_show_plane(panel, &gray, plane);
+            ssd1306_flush(panel);
+            for (uint8_t y = 0; y < geometry.pages * 8; ++y) {
+                for (uint8_t x = 0; x < SSD1306_WIDTH; ++x) {
+                    sum[y][x] += ((mock.ram[y >> 3][x] >> (y & 7)) & 1) * mock.contrast;
+                }
+            }
+        }
+        for (uint8_t y = 0; y < geometry.pages * 8; ++y) {
+            for (uint8_t x = 0; x < SSD1306_WIDTH; ++x) {
+                uint8_t level = 2 * ((gray.planes[0][y >> 3][x] >> (y & 7)) & 1) + ((gray.planes[1][y >> 3][x] >> (y & 7)) & 1);
+                if (sum[y][x] != level * GRAY_CONTRAST_STEP) {
+                    ok = false;
+                }
+            }
+        }
+        if (!ok) {
+            printf("  MISMATCH: the panel doesn't show the levels of %s\n", GRAY_IMAGES[g].name);
+        }
+
+        ssd1306_stats_t stats;
+        ssd1306_get_stats(panel, &stats);
+        long iterations = 0;
+        int64_t start = nanoseconds(), elapsed;
+        do {
+            for (int i = 0; i < 1000; ++i, ++iterations) {
+                ssd1306_gray_show_plane(panel, &gray, (int)(iterations & 1));
+                ssd1306_flush(panel);
+            }
+            elapsed = nanoseconds() - start;
+        } while (elapsed < BENCH_MIN_NS);
+
+        double plane_bytes = stats.bytes / 2.0;
+        uint32_t derived = ssd1306_gray_frames_per_plane(panel, &gray);
+        uint32_t frames_shown[2] = { 1, derived };
+        for (int row = 0; row < ((derived > 1) ? 2 : 1); ++row) {
+            uint32_t frames = frames_shown[row];
+            double bytes_per_s = plane_bytes * frame_hz / frames;
+            printf("  %-20s %11.0f %12u%s %9.0f", (row == 0) ? GRAY_IMAGES[g].name : "",
+                plane_bytes, (unsigned)frames, (frames == derived) ? "*" : " ", bytes_per_s);
+            for (size_t b = 0; b < sizeof(BUSES_HZ) / sizeof(BUSES_HZ[0]); ++b) {
+                // I2C: 9 clocks per byte with the ACK
+                double share = bytes_per_s * 9 / BUSES_HZ[b];
+                printf(" %7.0f%%%s", 100 * share, (share > 1) ? "!" : " ");
+            }
+            if (row == 0) {
+                printf(" %9.0f", (double)elapsed / iterations);
+            }
+            printf("\n");
+        }
+        if (plane_bytes * frame_hz / derived * 9 > SSD1306_I2C_HZ) {
+            printf("  OVERRUN: the planes of %s don't fit %u frames of a bus at %ld Hz\n", GRAY_IMAGES[g].name,
+                (unsigned)derived, (long)SSD1306_I2C_HZ);
+            ok = false;
+        }
+    }
+    printf("  (!: over the bus; the planes then show for uneven times and the levels shift)\n");
+    return ok;
+}
+
+
+// Ticks a progress bar as its timer would, through a frame copied into the framebuffer like the display
+// service does
+static bool
+run_progress(long hz) {
+    static const int64_t DURATIONS_US[] = { 5000000, 1000000 };
+    static uint8_t frame[SSD1306_MAX_PAGES][SSD1306_WIDTH];
+    static ssd1306_mock_t mock;
+    static ssd1306_t bar_panel;
+    ssd1306_canvas_t canvas = SSD1306_CANVAS(frame);
+    bool ok = true;
+
+    panel = &bar_panel;
+    ssd1306_mock_init(&mock, NULL, 0, 2);
+    ssd1306_init(panel, &mock.base, SSD1306_GEOMETRY_128X32);
+    canvas.page_count = panel->geometry.pages;
+    // Below a line of text, across the boundary of pages 2 and 3
+    ssd1306_progress_t bar = { .x = 4, .y = 20, .width = 120, .height = 8 };
+    int bar_pages = (bar.y + bar.height - 1) / 8 - bar.y / 8 + 1;
+    uint32_t full_bar_bytes = 6 + 2 * mock.base.phase_overhead + bar.width * bar_pages;
+    printf("Progress bar %dx%d at y %d on I2C at %ld kHz, a redraw of the whole bar %u bytes:\n", bar.width,
+        bar.height, bar.y, hz / 1000, (unsigned)full_bar_bytes);
+    printf("  %-8s %6s %7s %8s %15s %12s %10s\n", "duration", "ticks", "tick Hz", "redraws", "bytes/redraw",
+        "bytes", "whole bar");
+    for (size_t d = 0; d < sizeof(DURATIONS_US) / sizeof(DURATIONS_US[0]); ++d) {
+        memset(frame, 0, sizeof(frame));
+        ssd1306_progress_reset(&bar, &canvas, 0, DURATIONS_US[d]);
+        ssd1306_fb_blit(panel, 0, 0, SSD1306_WIDTH, panel->geometry.pages, &frame[0][0]);
+        ssd1306_flush(panel);
+        ssd1306_reset_stats(panel);
+
+        int64_t period_us = ssd1306_progress_period_us(&bar, DURATIONS_US[d]);
+        uint32_t ticks = 0, max_redraw = 0;
+        for (int64_t now = period_us; !ssd1306_progress_expired(&bar); now += period_us, ++ticks) {
+            if (ssd1306_progress_advance(&bar, &canvas, now) > 0) {
+                ssd1306_stats_t before, after;
+                ssd1306_get_stats(panel, &before);
+                ssd1306_fb_blit(panel, 0, 0, SSD1306_WIDTH, panel->geometry.pages, &frame[0][0]);
+                ssd1306_flush(panel);
+                ssd1306_get_stats(panel, &after);
+                max_redraw = (after.bytes - before.bytes > max_redraw) ? after.bytes - before.bytes : max_redraw;
+            }
+            if (!panel_matches(panel, &mock)) {
+                ok = false;
+            }
+        }
+        if (!ok) {
+            printf("  MISMATCH: the panel doesn't show the bar\n");
+        }
+        ssd1306_stats_t stats;
+        ssd1306_get_stats(panel, &stats);
+        printf("  %6.0f s %6u %7.1f %8u %7.1f max %3u %12u %10u\n", DURATIONS_US[d] / 1e6, (unsigned)ticks,
+            1e6 / period_us, (unsigned)bar.stats.redraws, (double)stats.bytes / bar.stats.redraws,
+            (unsigned)max_redraw, (unsigned)stats.bytes, (unsigned)(full_bar_bytes * ticks));
+    }
+    return ok;
+}
+
+
+static void
+bench(void) {
+    static ssd1306_mock_t mock;
+    static ssd1306_t bench_panel;
+    panel = &bench_panel;
+    ssd1306_mock_init(&mock, NULL, 0, 2);
+    ssd1306_init(panel, &mock.base, SSD1306_GEOMETRY_128X32);
+    printf("Driver CPU time per update, drawing and flushing into the mock:\n");
+    for (size_t s = 0; s < NUM_SCENARIOS; ++s) {
+        long iterations = 0;
+        int64_t start = nanoseconds(), elapsed;
+        do {
+            for (int i = 0; i < 1000; ++i, ++iterations) {
+                SCENARIOS[s].draw((int)iterations);
+                ssd1306_flush(panel);
+            }
+            elapsed = nanoseconds() - start;
+        } while (elapsed < BENCH_MIN_NS);
+        printf("  %-20s %8.0f ns\n", SCENARIOS[s].name, (double)elapsed / iterations);
+    }
+}
+
+
+int
+main(int argc, char **argv) {
+    bool verbose = false;
+    long i2c_hz = 400000, spi_hz = 10000000;
+    int opt;
+    while ((opt = getopt(argc, argv, "vi:s:")) != -1) {
+        switch (opt) {
+            case 'v':
+                verbose = true;
+                break;
+            case 'i':
+                i2c_hz = atol(optarg);
+                break;
+            case 's':
+                spi_hz = atol(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-v] [-i i2c_hz] [-s spi_hz]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (i2c_hz <= 0 || spi_hz <= 0) {
+        fprintf(stderr, "Invalid clock\n");
+        return EXIT_FAILURE;
+    }
+
+    srand(1);
+    for (int page = 0; page < SSD1306_MAX_PAGES; ++page) {
+        for (int col = 0; col < SSD1306_WIDTH; ++col) {
+            pattern[page][col] = (uint8_t)(rand() | 1);  // never blank
+        }
+    }
+
+    // I2C: 9 clocks per byte with the ACK; SPI: 8
+    bool ok = run_bus("I2C", SSD1306_GEOMETRY_128X32, 2, 9, i2c_hz, verbose);
+    ok = run_bus("SPI", SSD1306_GEOMETRY_128X32, 0, 8, spi_hz, verbose) && ok;
+    ok = run_bus("I2C", SSD1306_GEOMETRY_128X64, 2, 9, i2c_hz, verbose) && ok;
+    ok = run_two_panels(SSD1306_GEOMETRY_128X32, i2c_hz) && ok;
+    ok = run_two_panels(SSD1306_GEOMETRY_128X64, i2c_hz) && ok;
+    ok = run_gray(SSD1306_GEOMETRY_128X32) && ok;
+    ok = run_gray(SSD1306_GEOMETRY_128X64) && ok;
+    ok = run_progress(i2c_hz) && ok;
+    bench();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// vim: set sw=4 ts=4 indk= et si:
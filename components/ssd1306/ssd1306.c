@@ -1,79 +1,123 @@
+// The transport-independent part of the driver: commands, framebuffer, flush and marquee, per panel.
+// Pure C apart from the clock, so that it builds on the host with the mock transport.
+#ifndef ESP_PLATFORM
+#   define _POSIX_C_SOURCE 200809L  // For clock_gettime()
+#endif // ESP_PLATFORM
+
 #include "ssd1306.h"
 #include <stdio.h>
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#   include <esp_timer.h>
+#else
+#   include <time.h>
+#endif // ESP_PLATFORM
 
 //#define TEST_PATTERNS 1
 
-esp_err_t
-ssd1306_send_cmd_byte(i2c_port_t port, uint8_t code) {
-    uint8_t send_command_cmd[] = {
-        0x78, 0x00, code
-    };
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write(cmd, send_command_cmd, sizeof(send_command_cmd), true);
-    i2c_master_stop(cmd);
-    esp_err_t status = i2c_master_cmd_begin(port, cmd, 1000);
-    i2c_cmd_link_delete(cmd);
+_Static_assert(SSD1306_MARQUEE_RELOAD_COLUMNS < SSD1306_WIDTH, "SSD1306_MARQUEE_RELOAD_COLUMNS must be narrower than the panel");
+
+
+static int64_t
+now_us(void) {
+#ifdef ESP_PLATFORM
+    return esp_timer_get_time();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif // ESP_PLATFORM
+}
+
+
+// The bytes on the wire of the segments, with the overhead of their phases
+static uint32_t
+wire_bytes(const ssd1306_t *panel, const ssd1306_segment_t *segments, size_t count) {
+    uint32_t bytes = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (i == 0 || segments[i].data != segments[i - 1].data) {
+            bytes += panel->transport->phase_overhead;
+        }
+        bytes += segments[i].length;
+    }
+    return bytes;
+}
+
+
+// Sends the segments in one transaction of the transport, and counts them
+static esp_err_t
+send(ssd1306_t *panel, const ssd1306_segment_t *segments, size_t count) {
+    if (!panel->transport) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    int64_t start = now_us();
+    esp_err_t status = panel->transport->send(panel->transport, segments, count);
+    panel->stats.busy_us += now_us() - start;
+    ++panel->stats.transactions;
+    panel->stats.bytes += wire_bytes(panel, segments, count);
     return status;
 }
 
+
+void
+ssd1306_get_stats(const ssd1306_t *panel, ssd1306_stats_t *out) {
+    *out = panel->stats;
+}
+
+
+void
+ssd1306_reset_stats(ssd1306_t *panel) {
+    memset(&panel->stats, 0, sizeof(panel->stats));
+}
+
+
+uint32_t
+ssd1306_frame_hz(const ssd1306_t *panel) {
+    return panel->frame_hz;
+}
+
 esp_err_t
-ssd1306_send_data_byte(i2c_port_t port, uint8_t value) {
-    uint8_t send_data_cmd[] = {
-        0x78, 0x40, value
-    };
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write(cmd, send_data_cmd, sizeof(send_data_cmd), true);
-    i2c_master_stop(cmd);
-    esp_err_t status = i2c_master_cmd_begin(port, cmd, 1000);
-    i2c_cmd_link_delete(cmd);
-    return status;
+ssd1306_send_cmd_byte(ssd1306_t *panel, uint8_t code) {
+    ssd1306_segment_t segment = { .bytes = &code, .length = 1, .data = false };
+    return send(panel, &segment, 1);
 }
 
 esp_err_t
-ssd1306_send_data(i2c_port_t port, const uint8_t* data, uint16_t n) {
-    static uint8_t send_data_cmd[] = {
-        0x78, 0x40,
-    };
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write(cmd, send_data_cmd, sizeof(send_data_cmd), true);
-    i2c_master_write(cmd, (uint8_t*)data, n, true);
-    i2c_master_stop(cmd);
-    esp_err_t status = i2c_master_cmd_begin(port, cmd, 1000);
-    i2c_cmd_link_delete(cmd);
-    return status;
+ssd1306_send_data_byte(ssd1306_t *panel, uint8_t value) {
+    ssd1306_segment_t segment = { .bytes = &value, .length = 1, .data = true };
+    return send(panel, &segment, 1);
 }
 
 esp_err_t
-ssd1306_memset(i2c_port_t port, uint8_t value, uint16_t n) {
-    static uint8_t send_data_cmd[] = {
-        0x78, 0x40,
-    };
-    uint8_t value_unroll[] = {
-        value, value, value, value, value, value, value, value, value, value, value, value, value, value, value, value,
-    };
+ssd1306_send_data(ssd1306_t *panel, const uint8_t* data, uint16_t n) {
+    ssd1306_segment_t segment = { .bytes = data, .length = n, .data = true };
+    return send(panel, &segment, 1);
+}
 
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write(cmd, send_data_cmd, sizeof(send_data_cmd), true);
-    for (; n > sizeof(value_unroll); n -= sizeof(value_unroll)) {
-        i2c_master_write(cmd, value_unroll, sizeof(value_unroll), true);
-    }
-    if (n > 0) {
-        i2c_master_write(cmd, value_unroll, n, true);
+// Sends one row of values repeatedly, one segment per row, at most the RAM of the controller per transaction
+esp_err_t
+ssd1306_memset(ssd1306_t *panel, uint8_t value, uint16_t n) {
+    uint8_t value_row[SSD1306_WIDTH];
+    memset(value_row, value, sizeof(value_row));
+
+    esp_err_t status = ESP_OK;
+    while (n > 0 && status == ESP_OK) {
+        ssd1306_segment_t segments[SSD1306_MAX_PAGES];
+        size_t count = 0;
+        for (; n > 0 && count < SSD1306_MAX_PAGES; ++count) {
+            uint16_t row = (n > sizeof(value_row)) ? sizeof(value_row) : n;
+            segments[count] = (ssd1306_segment_t){ .bytes = value_row, .length = row, .data = true };
+            n -= row;
+        }
+        status = send(panel, segments, count);
     }
-    i2c_master_stop(cmd);
-    esp_err_t status = i2c_master_cmd_begin(port, cmd, 1000);
-    i2c_cmd_link_delete(cmd);
     return status;
 }
 
 esp_err_t
-ssd1306_set_range(i2c_port_t port, uint8_t col_min, uint8_t col_max, uint8_t page_min, uint8_t page_max) {
+ssd1306_set_range(ssd1306_t *panel, uint8_t col_min, uint8_t col_max, uint8_t page_min, uint8_t page_max) {
     uint8_t set_range_cmd[] = {
-        0x78, 0x00,
         SSD1306_COLUMN_RANGE,
         col_min,
         col_max,
@@ -81,34 +125,523 @@ ssd1306_set_range(i2c_port_t port, uint8_t col_min, uint8_t col_max, uint8_t pag
         page_min,
         page_max,
     };
+    ssd1306_segment_t segment = { .bytes = set_range_cmd, .length = sizeof(set_range_cmd), .data = false };
+    return send(panel, &segment, 1);
+}
 
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write(cmd, set_range_cmd, sizeof(set_range_cmd), true);
-    i2c_master_stop(cmd);
-    esp_err_t status = i2c_master_cmd_begin(port, cmd, 1000);
-    i2c_cmd_link_delete(cmd);
-    return status;
+// Clears the panel through the framebuffer, so only the columns that aren't blank yet are sent
+esp_err_t
+ssd1306_clear(ssd1306_t *panel) {
+    ssd1306_fb_clear(panel);
+    return ssd1306_flush(panel);
+}
+
+
+static void
+fb_mark_dirty(ssd1306_t *panel, uint8_t page, uint8_t col_min, uint8_t col_max) {
+    ssd1306_span_t *span = &panel->dirty[page];
+    if (col_min < span->min) {
+        span->min = col_min;
+    }
+    if (col_max > span->max) {
+        span->max = col_max;
+    }
+}
+
+
+static void
+fb_mark_clean(ssd1306_t *panel, uint8_t page) {
+    panel->dirty[page].min = SSD1306_WIDTH - 1;
+    panel->dirty[page].max = 0;
+}
+
+
+static bool
+fb_is_dirty(const ssd1306_t *panel, uint8_t page) {
+    return panel->dirty[page].min <= panel->dirty[page].max;
+}
+
+
+// Clips n bytes from col to the right edge; returns the number that fit
+static uint16_t
+fb_clip(const ssd1306_t *panel, uint8_t col, uint8_t page, uint16_t n) {
+    if (page >= panel->geometry.pages || col >= SSD1306_WIDTH) {
+        return 0;
+    }
+    return (n > SSD1306_WIDTH - col) ? SSD1306_WIDTH - col : n;
+}
+
+
+void
+ssd1306_fb_write(ssd1306_t *panel, uint8_t col, uint8_t page, const uint8_t *data, uint16_t n) {
+    n = fb_clip(panel, col, page, n);
+    uint8_t *dst = &panel->fb[page][col];
+    int first = -1, last = -1;
+    for (uint16_t i = 0; i < n; ++i) {
+        if (dst[i] != data[i]) {
+            dst[i] = data[i];
+            if (first < 0) {
+                first = i;
+            }
+            last = i;
+        }
+    }
+    if (first >= 0) {
+        fb_mark_dirty(panel, page, col + first, col + last);
+    }
+}
+
+
+void
+ssd1306_fb_memset(ssd1306_t *panel, uint8_t col, uint8_t page, uint8_t value, uint16_t n) {
+    n = fb_clip(panel, col, page, n);
+    uint8_t *dst = &panel->fb[page][col];
+    int first = -1, last = -1;
+    for (uint16_t i = 0; i < n; ++i) {
+        if (dst[i] != value) {
+            dst[i] = value;
+            if (first < 0) {
+                first = i;
+            }
+            last = i;
+        }
+    }
+    if (first >= 0) {
+        fb_mark_dirty(panel, page, col + first, col + last);
+    }
+}
+
+
+void
+ssd1306_fb_blit(ssd1306_t *panel, uint8_t col, uint8_t page, uint8_t width, uint8_t pages, const uint8_t *data) {
+    for (uint8_t i = 0; i < pages; ++i) {
+        ssd1306_fb_write(panel, col, page + i, data + i * width, width);
+    }
+}
+
+
+void
+ssd1306_fb_clear(ssd1306_t *panel) {
+    for (uint8_t page = 0; page < panel->geometry.pages; ++page) {
+        ssd1306_fb_memset(panel, 0, page, 0, SSD1306_WIDTH);
+    }
+}
+
+
+void
+ssd1306_fb_invalidate(ssd1306_t *panel) {
+    for (uint8_t page = 0; page < panel->geometry.pages; ++page) {
+        fb_mark_dirty(panel, page, 0, SSD1306_WIDTH - 1);
+    }
+}
+
+
+const uint8_t *
+ssd1306_fb_pages(const ssd1306_t *panel) {
+    return &panel->fb[0][0];
+}
+
+
+void
+ssd1306_set_contrast(ssd1306_t *panel, uint8_t contrast) {
+    panel->contrast.set = contrast;
+}
+
+
+void
+ssd1306_gray_pixel(ssd1306_gray_t *gray, uint8_t x, uint8_t y, uint8_t level) {
+    if (x >= SSD1306_WIDTH || y >= 8 * SSD1306_MAX_PAGES) {
+        return;
+    }
+    uint8_t bit = 1 << (y & 7);
+    for (int plane = 0; plane < 2; ++plane) {
+        uint8_t *column = &gray->planes[plane][y >> 3][x];
+        *column = (level & (2 >> plane)) ? (*column | bit) : (*column & ~bit);
+    }
+}
+
+
+void
+ssd1306_gray_blit(ssd1306_gray_t *gray, uint8_t col, uint8_t page, uint8_t width, uint8_t pages,
+                  const uint8_t *high, const uint8_t *low) {
+    const uint8_t *const data[2] = { high, low };
+    uint8_t n = (width > SSD1306_WIDTH - col) ? SSD1306_WIDTH - col : width;
+    for (uint8_t i = 0; i < pages && col < SSD1306_WIDTH && page + i < SSD1306_MAX_PAGES; ++i) {
+        for (int plane = 0; plane < 2; ++plane) {
+            memcpy(&gray->planes[plane][page + i][col], data[plane] + i * width, n);
+        }
+    }
+}
+
+
+// Only the columns where the planes differ are rewritten, and the contrast goes out with them
+void
+ssd1306_gray_show_plane(ssd1306_t *panel, const ssd1306_gray_t *gray, int plane) {
+    ssd1306_fb_blit(panel, 0, 0, SSD1306_WIDTH, panel->geometry.pages, &gray->planes[plane][0][0]);
+    ssd1306_set_contrast(panel, SSD1306_GRAY_CONTRAST >> plane);
 }
 
+
+// A window of one page over the columns where the planes differ, for each page that has any, and the
+// contrast after them: merging windows only saves bytes, so the flush takes no more
+uint32_t
+ssd1306_gray_plane_bytes(const ssd1306_t *panel, const ssd1306_gray_t *gray) {
+    const uint8_t overhead = panel->transport ? panel->transport->phase_overhead : 0;
+    uint32_t bytes = 2 + overhead;
+    for (uint8_t page = 0; page < panel->geometry.pages; ++page) {
+        int min = SSD1306_WIDTH, max = -1;
+        for (int col = 0; col < SSD1306_WIDTH; ++col) {
+            if (gray->planes[0][page][col] != gray->planes[1][page][col]) {
+                min = (col < min) ? col : min;
+                max = col;
+            }
+        }
+        if (max >= 0) {
+            bytes += 6 + 2 * overhead + (max - min + 1);
+        }
+    }
+    return bytes;
+}
+
+
+uint32_t
+ssd1306_gray_frames_per_plane(const ssd1306_t *panel, const ssd1306_gray_t *gray) {
+    const uint32_t bytes_per_s = panel->transport ? panel->transport->bytes_per_s : 0;
+    if (bytes_per_s == 0) {
+        return 1;
+    }
+    uint64_t frames = ((uint64_t)ssd1306_gray_plane_bytes(panel, gray) * panel->frame_hz + bytes_per_s - 1) / bytes_per_s;
+    return (frames > 1) ? (uint32_t)frames : 1;
+}
+
+
+// The code of the scroll interval for a number of frames per step, or -1
+static int
+scroll_interval(uint16_t frames) {
+    static const uint16_t FRAMES[8] = { 5, 64, 128, 256, 3, 4, 25, 2 };
+    for (int code = 0; code < 8; ++code) {
+        if (FRAMES[code] == frames) {
+            return code;
+        }
+    }
+    return -1;
+}
+
+
 esp_err_t
-ssd1306_clear(i2c_port_t port) {
-    esp_err_t status = ssd1306_set_range(port, 0, 127, 0, 3);
+ssd1306_marquee_set(ssd1306_t *panel, const ssd1306_marquee_t *new_marquee) {
+    ssd1306_marquee_t *set = &panel->marquee.set;
+    if (!new_marquee || new_marquee->pages == 0) {
+        if (set->pages > 0) {
+            set->pages = 0;
+            panel->marquee.changed = true;
+        }
+        return ESP_OK;
+    }
+    size_t bytes = (size_t)new_marquee->pages * new_marquee->length;
+    if (new_marquee->page + new_marquee->pages > panel->geometry.pages || new_marquee->length == 0
+            || bytes > SSD1306_MARQUEE_MAX_BYTES || scroll_interval(new_marquee->frames) < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (set->page == new_marquee->page && set->pages == new_marquee->pages && set->frames == new_marquee->frames
+            && set->length == new_marquee->length && memcmp(set->strip, new_marquee->strip, bytes) == 0) {
+        return ESP_OK;
+    }
+    set->page = new_marquee->page;
+    set->pages = new_marquee->pages;
+    set->frames = new_marquee->frames;
+    set->length = new_marquee->length;
+    memcpy(set->strip, new_marquee->strip, bytes);
+    // Starting over, so whatever the old one scrolled is moot
+    panel->marquee.offset = 0;
+    panel->marquee.started_us = now_us();
+    panel->marquee.changed = true;
+    return ESP_OK;
+}
+
+
+// A strip up to the width loops over the whole RAM of the band, and never needs a reload
+static bool
+marquee_is_wide(const ssd1306_t *panel) {
+    return panel->marquee.set.length > SSD1306_WIDTH;
+}
+
+
+// The columns the controller has scrolled since the scroll started, estimated from the time
+static uint32_t
+marquee_steps(const ssd1306_t *panel, int64_t now) {
+    return (uint32_t)((now - panel->marquee.started_us) * panel->frame_hz / (panel->marquee.set.frames * 1000000LL));
+}
+
+
+int64_t
+ssd1306_marquee_due_us(const ssd1306_t *panel) {
+    if (panel->marquee.changed) {
+        return 0;
+    }
+    if (!panel->marquee.scrolling || !marquee_is_wide(panel)) {
+        return INT64_MAX;
+    }
+    int64_t due = panel->marquee.started_us
+        + (int64_t)SSD1306_MARQUEE_RELOAD_COLUMNS * panel->marquee.set.frames * 1000000LL / panel->frame_hz;
+    int64_t now = now_us();
+    return (due > now) ? due - now : 0;
+}
+
+
+// Draws the band as the panel has to show it when the scroll starts: for a wide strip, the margin and the strip
+// from the offset on; otherwise the strip padded to the width, rotated by the offset
+static void
+marquee_draw(ssd1306_t *panel) {
+    const ssd1306_marquee_t *set = &panel->marquee.set;
+    uint16_t period = marquee_is_wide(panel) ? set->length : SSD1306_WIDTH;
+    uint8_t margin = marquee_is_wide(panel) ? SSD1306_MARQUEE_RELOAD_COLUMNS : 0;
+    uint8_t row[SSD1306_WIDTH];
+    for (uint8_t i = 0; i < set->pages; ++i) {
+        const uint8_t *strip = set->strip + i * set->length;
+        for (uint16_t col = 0; col < SSD1306_WIDTH; ++col) {
+            uint16_t k = (panel->marquee.offset + col - margin) % period;
+            row[col] = (col >= margin && k < set->length) ? strip[k] : 0;
+        }
+        ssd1306_fb_write(panel, 0, set->page + i, row, SSD1306_WIDTH);
+    }
+}
+
+
+// Plans the next flush into panel->windows: the dirty spans, merged over adjacent pages if allowed and fewer
+// bytes on the wire. While the controller scrolls, any data needs a stop first, after which the scrolled pages
+// must be rewritten; so the flush restarts the marquee if there is anything to send, or a reload is due.
+static void
+flush_plan(ssd1306_t *panel, bool merge) {
+    bool dirty = false;
+    for (uint8_t page = 0; page < panel->geometry.pages; ++page) {
+        dirty = dirty || fb_is_dirty(panel, page);
+    }
+    panel->restart = panel->marquee.changed
+        || (panel->marquee.scrolling && (dirty || ssd1306_marquee_due_us(panel) == 0));
+    if (panel->restart && panel->marquee.scrolling) {
+        uint16_t period = marquee_is_wide(panel) ? panel->marquee.set.length : SSD1306_WIDTH;
+        panel->marquee.offset = (panel->marquee.offset + marquee_steps(panel, now_us()) % period) % period;
+        for (uint8_t page = panel->marquee.page_min; page <= panel->marquee.page_max; ++page) {
+            fb_mark_dirty(panel, page, 0, SSD1306_WIDTH - 1);
+        }
+    }
+    if (panel->restart && panel->marquee.set.pages > 0) {
+        marquee_draw(panel);
+        for (uint8_t i = 0; i < panel->marquee.set.pages; ++i) {
+            fb_mark_dirty(panel, panel->marquee.set.page + i, 0, SSD1306_WIDTH - 1);
+        }
+    }
+
+    // The bytes on the wire besides the data of a window: the 6 bytes of the range, and two phases
+    const int window_overhead = 6 + 2 * panel->transport->phase_overhead;
+    panel->window_count = 0;
+    panel->window_next = 0;
+    for (uint8_t page = 0; page < panel->geometry.pages; ) {
+        if (!fb_is_dirty(panel, page)) {
+            ++page;
+            continue;
+        }
+        // Grow the window over the following dirty pages while the wider union costs less than a window of its own
+        ssd1306_window_t *window = &panel->windows[panel->window_count++];
+        window->col_min = panel->dirty[page].min;
+        window->col_max = panel->dirty[page].max;
+        window->page_min = window->page_max = page;
+        while (merge && window->page_max + 1 < panel->geometry.pages && fb_is_dirty(panel, window->page_max + 1)) {
+            const ssd1306_span_t *next = &panel->dirty[window->page_max + 1];
+            uint8_t merged_min = (next->min < window->col_min) ? next->min : window->col_min;
+            uint8_t merged_max = (next->max > window->col_max) ? next->max : window->col_max;
+            int separate = (window->col_max - window->col_min + 1) * (window->page_max - window->page_min + 1)
+                + window_overhead + (next->max - next->min + 1);
+            int merged = (merged_max - merged_min + 1) * (window->page_max - window->page_min + 2);
+            if (merged > separate) {
+                break;
+            }
+            window->col_min = merged_min;
+            window->col_max = merged_max;
+            ++window->page_max;
+        }
+        page = window->page_max + 1;
+    }
+}
+
+
+// The range command and data segments of a window; range must stay alive until they are sent
+static size_t
+window_segments(const ssd1306_t *panel, const ssd1306_window_t *window, uint8_t range[6], ssd1306_segment_t *segments) {
+    range[0] = SSD1306_COLUMN_RANGE;
+    range[1] = window->col_min;
+    range[2] = window->col_max;
+    range[3] = SSD1306_PAGE_RANGE;
+    range[4] = window->page_min;
+    range[5] = window->page_max;
+    size_t count = 0;
+    segments[count++] = (ssd1306_segment_t){ .bytes = range, .length = 6, .data = false };
+    for (uint8_t page = window->page_min; page <= window->page_max; ++page) {
+        segments[count++] = (ssd1306_segment_t){
+            .bytes = &panel->fb[page][window->col_min],
+            .length = window->col_max - window->col_min + 1,
+            .data = true,
+        };
+    }
+    return count;
+}
+
+
+// The command that starts the scroll of the marquee; left, so the strip reads on from the right edge
+static ssd1306_segment_t
+scroll_segment(const ssd1306_t *panel, uint8_t cmd[8]) {
+    const ssd1306_marquee_t *set = &panel->marquee.set;
+    cmd[0] = SSD1306_SCROLL_LEFT;
+    cmd[1] = 0x00;
+    cmd[2] = set->page;
+    cmd[3] = scroll_interval(set->frames);
+    cmd[4] = set->page + set->pages - 1;
+    cmd[5] = 0x00;
+    cmd[6] = 0xff;
+    cmd[7] = SSD1306_SCROLL_START;
+    return (ssd1306_segment_t){ .bytes = cmd, .length = 8, .data = false };
+}
+
+
+static const uint8_t stop_cmd[] = { SSD1306_SCROLL_STOP };
+
+
+// Sends the planned windows from window_next up to, not including, end in one transaction: after the stop of
+// the scroll if they are the first of a restart, and before its start and a new contrast if they are the last
+static esp_err_t
+flush_send(ssd1306_t *panel, uint8_t end) {
+    uint8_t range_cmd[SSD1306_MAX_PAGES][6];
+    uint8_t scroll_cmd[8];
+    uint8_t contrast_cmd[2] = { SSD1306_CONTRAST, panel->contrast.set };
+    ssd1306_segment_t segments[SSD1306_MAX_SEGMENTS];
+    size_t count = 0;
+    bool first = (panel->window_next == 0), last = (end == panel->window_count);
+
+    if (panel->restart && first && panel->marquee.scrolling) {
+        segments[count++] = (ssd1306_segment_t){ .bytes = stop_cmd, .length = sizeof(stop_cmd), .data = false };
+    }
+    for (uint8_t i = panel->window_next; i < end; ++i) {
+        count += window_segments(panel, &panel->windows[i], range_cmd[i - panel->window_next], segments + count);
+    }
+    if (panel->restart && last && panel->marquee.set.pages > 0) {
+        segments[count++] = scroll_segment(panel, scroll_cmd);
+    }
+    if (last && panel->contrast.set != panel->contrast.shown) {
+        segments[count++] = (ssd1306_segment_t){ .bytes = contrast_cmd, .length = sizeof(contrast_cmd), .data = false };
+    }
+    esp_err_t status = (count > 0) ? send(panel, segments, count) : ESP_OK;
     if (status != ESP_OK) {
+        // Whether the controller got a stop or not, the next flush rewrites what it may have scrolled
+        panel->marquee.changed = panel->marquee.changed || panel->restart;
         return status;
     }
-    return ssd1306_memset(port, 0, 128 * 4);
+    for (; panel->window_next < end; ++panel->window_next) {
+        const ssd1306_window_t *window = &panel->windows[panel->window_next];
+        for (uint8_t page = window->page_min; page <= window->page_max; ++page) {
+            fb_mark_clean(panel, page);
+        }
+    }
+    if (last) {
+        panel->contrast.shown = contrast_cmd[1];
+    }
+    if (panel->restart && first) {
+        panel->marquee.scrolling = false;
+    }
+    if (panel->restart && last) {
+        const ssd1306_marquee_t *set = &panel->marquee.set;
+        panel->marquee.changed = false;
+        panel->marquee.scrolling = (set->pages > 0);
+        panel->marquee.page_min = set->page;
+        panel->marquee.page_max = set->page + set->pages - 1;
+        panel->marquee.started_us = now_us();
+        panel->restart = false;
+    }
+    return ESP_OK;
 }
 
+
 esp_err_t
-ssd1306_init(i2c_port_t port, int sda_io, int scl_io) {
-    static uint8_t init_cmd[] = {
-        0x78, 0x00,
+ssd1306_flush(ssd1306_t *panel) {
+    if (!panel->transport) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    flush_plan(panel, true);
+    return flush_send(panel, panel->window_count);
+}
+
+
+// The bytes on the wire of the planned windows left
+static uint32_t
+flush_bytes_left(const ssd1306_t *panel) {
+    uint32_t bytes = 0;
+    for (uint8_t i = panel->window_next; i < panel->window_count; ++i) {
+        const ssd1306_window_t *window = &panel->windows[i];
+        bytes += 6 + 2 * panel->transport->phase_overhead
+            + (window->col_max - window->col_min + 1) * (window->page_max - window->page_min + 1);
+    }
+    return bytes;
+}
+
+
+esp_err_t
+ssd1306_flush_panels(ssd1306_t *const *panels, size_t count, uint32_t *skew_bytes) {
+    uint32_t sent = 0, first_done = UINT32_MAX, last_done = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (!panels[i]->transport) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        flush_plan(panels[i], false);
+    }
+    for (;;) {
+        // The panel with the most bytes left goes next, so that they all finish together
+        ssd1306_t *panel = NULL;
+        uint32_t most = 0;
+        for (size_t i = 0; i < count; ++i) {
+            bool pending = (panels[i]->window_next < panels[i]->window_count) || panels[i]->restart
+                || panels[i]->contrast.set != panels[i]->contrast.shown;
+            uint32_t left = flush_bytes_left(panels[i]);
+            if (pending && (!panel || left > most)) {
+                panel = panels[i];
+                most = left;
+            }
+        }
+        if (!panel) {
+            break;
+        }
+        // One window, or none if only the marquee changes
+        uint8_t end = (panel->window_next < panel->window_count) ? panel->window_next + 1 : panel->window_next;
+        uint32_t before = panel->stats.bytes;
+        esp_err_t status = flush_send(panel, end);
+        if (status != ESP_OK) {
+            return status;
+        }
+        sent += panel->stats.bytes - before;
+        if (panel->window_next == panel->window_count) {
+            panel->restart = false;
+            first_done = (sent < first_done) ? sent : first_done;
+            last_done = sent;
+        }
+    }
+    if (skew_bytes) {
+        *skew_bytes = (last_done > first_done) ? last_done - first_done : 0;
+    }
+    return ESP_OK;
+}
+
+
+esp_err_t
+ssd1306_init(ssd1306_t *panel, ssd1306_transport_t *transport, ssd1306_geometry_t geometry) {
+    if (geometry.pages == 0 || geometry.pages > SSD1306_MAX_PAGES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const uint8_t init_cmd[] = {
+        SSD1306_SCROLL_STOP,    // it scrolls on over a reset of the MCU
         SSD1306_DISPLAY_OFF,
-        SSD1306_LAST_ROW, 0x1f,
+        SSD1306_LAST_ROW, geometry.pages * 8 - 1,
         SSD1306_CHARGEPUMP, 0x14,
         SSD1306_ADDRESSING_MODE, 0,
-        SSD1306_COM_PINS, 0x02,
+        SSD1306_COM_PINS, geometry.com_pins,
         SSD1306_DISPLAY_RAM,
         SSD1306_DISPLAY_NORMAL,
         SSD1306_CONTRAST, 0x7f,
@@ -117,56 +650,39 @@ ssd1306_init(i2c_port_t port, int sda_io, int scl_io) {
         SSD1306_DISPLAY_ON,
     };
 
-    esp_err_t status;
-    i2c_config_t conf;
-
-    conf.mode = I2C_MODE_MASTER;
-    conf.sda_io_num = sda_io;
-    conf.sda_pullup_en = GPIO_PULLUP_ENABLE;
-    conf.scl_io_num = scl_io;
-    conf.scl_pullup_en = GPIO_PULLUP_ENABLE;
-    conf.master.clk_speed = 400000;
-
-    status = i2c_param_config(port, &conf);
-    if (status != ESP_OK) {
-        printf("i2c_param_config failed; status=0x%02x\n", status);
-        return status;
-    }
-    status = i2c_driver_install(port, I2C_MODE_MASTER, 0, 0, 0);
-    if (status != ESP_OK) {
-        printf("i2c_driver_install failed; status=0x%02x\n", status);
-        return status;
-    }
-
-    i2c_cmd_handle_t cmd;
+    memset(panel, 0, sizeof(*panel));
+    panel->transport = transport;
+    panel->geometry = geometry;
+    panel->frame_hz = SSD1306_OSC_HZ / (54 * 8 * geometry.pages);
+    panel->contrast.set = panel->contrast.shown = 0x7f;     // as in init_cmd
+    ssd1306_reset_stats(panel);
 
     // (Re)initialize the display
     // NOTE: Don't bother resetting values we never change. Noone else changes them either.
-    cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write(cmd, init_cmd, sizeof(init_cmd), true);
-    i2c_master_stop(cmd);
-    status = i2c_master_cmd_begin(port, cmd, 1000);
-    i2c_cmd_link_delete(cmd);
+    ssd1306_segment_t segment = { .bytes = init_cmd, .length = sizeof(init_cmd), .data = false };
+    esp_err_t status = send(panel, &segment, 1);
     if (status != ESP_OK) {
         printf("ssd1306_init failed; status=0x%02x\n", status);
         return status;
     }
-    ssd1306_set_range(port, 0x00, 0x7f, 0, 3);
-    ssd1306_memset(port, 0, 128 * 32 / 8);
+    ssd1306_set_range(panel, 0x00, SSD1306_WIDTH - 1, 0, geometry.pages - 1);
+    ssd1306_memset(panel, 0, SSD1306_WIDTH * geometry.pages);
+    for (uint8_t page = 0; page < SSD1306_MAX_PAGES; ++page) {
+        fb_mark_clean(panel, page);
+    }
 
 #ifdef TEST_PATTERNS
     // Binary pattern to page 0 and 1 (== rows 0..15)
-    ssd1306_set_range(port, 0x00, 0x7f, 0, 1);
+    ssd1306_set_range(panel, 0x00, 0x7f, 0, 1);
     for (uint16_t i = 0; i < 0x100; ++i) {
-        ssd1306_send_data_byte(port, i);
+        ssd1306_send_data_byte(panel, i);
     }
 
     // Binary pattern to the bottom-right 16x16 pixels
     // columns 0x70..0x7f, rows 0x10..0x1f == pages 2..3
-    ssd1306_set_range(port, 0x60, 0x6f, 2, 3);
+    ssd1306_set_range(panel, 0x60, 0x6f, 2, 3);
     for (uint8_t i = 0; i < 0x20; ++i) {
-        ssd1306_send_data_byte(port, i);
+        ssd1306_send_data_byte(panel, i);
     }
 #endif // TEST_PATTERNS
 
@@ -1,12 +1,56 @@
 #ifndef SSD1306_H
 #define SSD1306_H
 
-#include <esp_system.h>
-#include <esp_log.h>
-#include <driver/i2c.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef ESP_PLATFORM
+#   include <esp_err.h>
+#   include <driver/i2c.h>
+#   include <driver/gpio.h>
+#   include <driver/spi_master.h>
+#else
+// The host build: the driver on top of the mock transport (ssd1306_mock.h)
+typedef int esp_err_t;
+#   define ESP_OK 0
+#   define ESP_FAIL -1
+#   define ESP_ERR_NO_MEM 0x101
+#   define ESP_ERR_INVALID_ARG 0x102
+#   define ESP_ERR_INVALID_STATE 0x103
+#endif // ESP_PLATFORM
 
 // https://www.olimex.com/Products/Modules/LCD/MOD-OLED-128x64/resources/SSD1306.pdf
 
+// The columns of the panel
+#ifndef SSD1306_WIDTH
+#   define SSD1306_WIDTH 128
+#endif // SSD1306_WIDTH
+
+// The pages of 8 rows in the RAM of the controller, for 64 rows; a panel shows the first ssd1306_geometry_t.pages
+#define SSD1306_MAX_PAGES 8
+
+// The oscillator, which clocks the frames of the panel and so its hardware scroll: about 370 kHz at the
+// reset value of FREQ_DIV
+#ifndef SSD1306_OSC_HZ
+#   define SSD1306_OSC_HZ 370000
+#endif // SSD1306_OSC_HZ
+
+// The columns a marquee wider than the panel scrolls between two reloads of its pages
+#ifndef SSD1306_MARQUEE_RELOAD_COLUMNS
+#   define SSD1306_MARQUEE_RELOAD_COLUMNS 24
+#endif // SSD1306_MARQUEE_RELOAD_COLUMNS
+
+// The room for the strip of a marquee: its pages times its columns
+#ifndef SSD1306_MARQUEE_MAX_BYTES
+#   define SSD1306_MARQUEE_MAX_BYTES 1024
+#endif // SSD1306_MARQUEE_MAX_BYTES
+
+// The contrast of the high bitplane of grayscale; the low bitplane is shown at half of it
+#ifndef SSD1306_GRAY_CONTRAST
+#   define SSD1306_GRAY_CONTRAST 0xfe
+#endif // SSD1306_GRAY_CONTRAST
+
 typedef enum {
     SSD1306_CONTRAST = 0x81,        // default: 0x7f
     
@@ -60,13 +104,216 @@ typedef enum {
     SSD1306_CHARGEPUMP = 0x8d,  // default: 0
 } ssd1306_cmd_t;
 
-esp_err_t ssd1306_init(i2c_port_t port, int sda_io, int scl_io);
-esp_err_t ssd1306_send_cmd_byte(i2c_port_t port, uint8_t code);
-esp_err_t ssd1306_send_data_byte(i2c_port_t port, uint8_t value);
-esp_err_t ssd1306_send_data(i2c_port_t port, const uint8_t* data, uint16_t n);
-esp_err_t ssd1306_memset(i2c_port_t port, uint8_t value, uint16_t n);
-esp_err_t ssd1306_clear(i2c_port_t port);
-esp_err_t ssd1306_set_range(i2c_port_t port, uint8_t col_min, uint8_t col_max, uint8_t page_min, uint8_t page_max);
+// How the panel is wired to the controller: the rows it has, and so the multiplex ratio (LAST_ROW), and the
+// layout of its COM pins (COM_PINS), sequential on the 128x32 modules and alternative on the 128x64 ones
+typedef struct {
+    uint8_t pages;      // of 8 rows, up to SSD1306_MAX_PAGES
+    uint8_t com_pins;   // the argument of SSD1306_COM_PINS
+} ssd1306_geometry_t;
+
+#define SSD1306_GEOMETRY_128X32 ((ssd1306_geometry_t){ .pages = 4, .com_pins = 0x02 })
+#define SSD1306_GEOMETRY_128X64 ((ssd1306_geometry_t){ .pages = 8, .com_pins = 0x12 })
+
+// A run of command or data bytes. Consecutive segments of the same kind go out as one phase:
+// on I2C a start, the address and a control byte, on SPI a level of the D/C pin.
+typedef struct {
+    const uint8_t *bytes;
+    uint16_t length;
+    bool data;
+} ssd1306_segment_t;
+
+// The most segments the driver sends at once: a ssd1306_flush() of one window per page, between stopping
+// and restarting the scroll of a marquee, and a new contrast
+#define SSD1306_MAX_SEGMENTS (2 * SSD1306_MAX_PAGES + 3)
+
+// How the driver reaches a panel; each transport embeds it as its first member
+typedef struct ssd1306_transport ssd1306_transport_t;
+struct ssd1306_transport {
+    // Sends the segments in one transaction, and returns once they are out
+    esp_err_t (*send)(ssd1306_transport_t *transport, const ssd1306_segment_t *segments, size_t count);
+    uint8_t phase_overhead; // bytes on the wire per phase besides the segments: 2 on I2C, none on SPI
+    uint32_t bytes_per_s;   // the rate of the bus: 9 clocks per byte on I2C, 8 on SPI; 0 if unknown
+};
+
+// Bus usage of a panel since ssd1306_init() or ssd1306_reset_stats()
+typedef struct {
+    uint32_t transactions;  // calls of the transport, e.g. I2C command links of one or more START ... STOP
+    uint32_t bytes;         // written on the wire, including the phase overhead
+    int64_t busy_us;        // wall-clock time spent sending them
+} ssd1306_stats_t;
+
+// Marquee: a band of pages that the controller scrolls left by itself, looping over a strip of columns that
+// repeats end to end (leave blank columns at its end as the gap). The SSD1306 scrolls whole pages, so the
+// marquee owns the full width of its band: whatever is drawn there is overwritten.
+//
+// A strip up to SSD1306_WIDTH columns is padded to the width and scrolls with no traffic at all. The panel
+// shows a longer one through a window of its RAM: after a blank margin of SSD1306_MARQUEE_RELOAD_COLUMNS,
+// which wraps around to the right edge while the window scrolls over it, the strip from the current column.
+// Once the margin is used up, ssd1306_flush() reloads the band with the strip moved on: one burst per
+// SSD1306_MARQUEE_RELOAD_COLUMNS steps, instead of a band per step as in a software ticker.
+// The controller takes no data while it scrolls, so any flush stops the scroll, rewrites the band as well,
+// and restarts it. The position of the strip is estimated from the time and the frame rate of the panel.
+typedef struct {
+    uint8_t page;       // the first page of the band
+    uint8_t pages;      // 0: no marquee
+    uint16_t frames;    // per step of one column: 2, 3, 4, 5, 25, 64, 128 or 256
+    uint16_t length;    // columns of the strip
+    uint8_t strip[SSD1306_MARQUEE_MAX_BYTES];   // pages rows of length bytes, as for ssd1306_fb_blit()
+} ssd1306_marquee_t;
+
+// Grayscale: pixels of 4 levels, kept as two bitplanes in the layout of the framebuffer. The panel shows the
+// planes in turn for the same time, the high bits at SSD1306_GRAY_CONTRAST and the low bits at half of it,
+// so that the eye averages level 3 to 3/4 of that contrast, 2 to 1/2 and 1 to 1/4. Switching planes rewrites
+// only the columns where they differ; see ssd1306_service.h for the cycling on a timer.
+typedef struct {
+    uint8_t planes[2][SSD1306_MAX_PAGES][SSD1306_WIDTH];    // [0]: the high bits, [1]: the low bits
+} ssd1306_gray_t;
+
+// The columns [min, max] of a page that differ from the panel; clean if min > max
+typedef struct {
+    uint8_t min;
+    uint8_t max;
+} ssd1306_span_t;
+
+// A window of ssd1306_set_range() to send: the columns [col_min, col_max] of the pages [page_min, page_max]
+typedef struct {
+    uint8_t col_min, col_max;
+    uint8_t page_min, page_max;
+} ssd1306_window_t;
+
+// A panel: allocate one per panel, and set it up with ssd1306_init(). The members are the driver's.
+typedef struct {
+    ssd1306_transport_t *transport;
+    ssd1306_geometry_t geometry;
+    uint32_t frame_hz;
+
+    // Framebuffer: a copy of the panel RAM, page-major, each byte a column of 8 rows with the LSB on top
+    uint8_t fb[SSD1306_MAX_PAGES][SSD1306_WIDTH];
+    ssd1306_span_t dirty[SSD1306_MAX_PAGES];
+
+    // The next flush: its windows, and whether it restarts the scroll of the marquee
+    ssd1306_window_t windows[SSD1306_MAX_PAGES];
+    uint8_t window_count;
+    uint8_t window_next;
+    bool restart;
+
+    struct {
+        ssd1306_marquee_t set;  // no pages: none
+        bool changed;           // set differs from what the panel shows
+        bool scrolling;         // the controller scrolls the pages [page_min, page_max]
+        uint8_t page_min, page_max;
+        uint16_t offset;        // the column of the strip right of the margin, when the scroll started
+        int64_t started_us;
+    } marquee;
+
+    struct {
+        uint8_t set;            // the next flush sends it, if the panel shows another one
+        uint8_t shown;
+    } contrast;
+
+    ssd1306_stats_t stats;
+} ssd1306_t;
+
+// The I2C clock: the 400 kHz of the datasheet; most modules take 1 MHz, which grayscale may need
+#ifndef SSD1306_I2C_HZ
+#   define SSD1306_I2C_HZ 400000
+#endif // SSD1306_I2C_HZ
+
+#ifdef ESP_PLATFORM
+// The default 7-bit I2C address; 0x3d with the SA0 pin high
+#define SSD1306_I2C_ADDRESS 0x3c
+
+typedef struct {
+    ssd1306_transport_t base;
+    i2c_port_t port;
+    uint8_t header[2][2];   // address and control byte of a command and of a data phase
+    uint8_t *link_storage;  // of the command links, where the IDF can build them in place
+} ssd1306_i2c_t;
+
+// 4-wire SPI: the D/C pin tells commands (low) from data (high)
+typedef struct {
+    ssd1306_transport_t base;
+    spi_device_handle_t device;
+    gpio_num_t dc_io;
+} ssd1306_spi_t;
+
+// Installs the I2C master driver at SSD1306_I2C_HZ, once for all the panels on the bus
+esp_err_t ssd1306_i2c_bus_init(i2c_port_t port, int sda_io, int scl_io);
+// Sets up a transport to the panel at a 7-bit address, on an I2C port whose driver is installed
+esp_err_t ssd1306_i2c_init(ssd1306_i2c_t *i2c, i2c_port_t port, uint8_t address);
+
+// Initializes an SPI bus, with DMA, once for all the panels on it
+esp_err_t ssd1306_spi_bus_init(spi_host_device_t host, int mosi_io, int sclk_io);
+// Sets up a transport on an initialized SPI bus: adds the panel as a device, and configures its D/C pin
+esp_err_t ssd1306_spi_init(ssd1306_spi_t *spi, spi_host_device_t host, int cs_io, int dc_io, int clock_hz);
+#endif // ESP_PLATFORM
+
+// Initializes the panel behind a transport, which must stay valid, and clears it
+esp_err_t ssd1306_init(ssd1306_t *panel, ssd1306_transport_t *transport, ssd1306_geometry_t geometry);
+
+esp_err_t ssd1306_send_cmd_byte(ssd1306_t *panel, uint8_t code);
+esp_err_t ssd1306_send_data_byte(ssd1306_t *panel, uint8_t value);
+esp_err_t ssd1306_send_data(ssd1306_t *panel, const uint8_t* data, uint16_t n);
+esp_err_t ssd1306_memset(ssd1306_t *panel, uint8_t value, uint16_t n);
+esp_err_t ssd1306_clear(ssd1306_t *panel);
+esp_err_t ssd1306_set_range(ssd1306_t *panel, uint8_t col_min, uint8_t col_max, uint8_t page_min, uint8_t page_max);
+
+// The ssd1306_fb_* functions only draw into the framebuffer, and record per page the span of columns that
+// now differ from the panel; ssd1306_flush() sends just those spans. Writing what is already there costs nothing.
+// Columns past the right edge, and pages past the bottom, are clipped.
+
+// Writes n bytes into a page, from the given column on
+void ssd1306_fb_write(ssd1306_t *panel, uint8_t col, uint8_t page, const uint8_t *data, uint16_t n);
+// Sets n bytes of a page, from the given column on, to value
+void ssd1306_fb_memset(ssd1306_t *panel, uint8_t col, uint8_t page, uint8_t value, uint16_t n);
+// Writes a window of pages in the ssd1306_set_range() order: the width bytes of the first page, then of the next...
+void ssd1306_fb_blit(ssd1306_t *panel, uint8_t col, uint8_t page, uint8_t width, uint8_t pages, const uint8_t *data);
+// Sets the whole framebuffer to 0
+void ssd1306_fb_clear(ssd1306_t *panel);
+// Marks the whole framebuffer as differing from the panel, e.g. after the panel lost its RAM
+void ssd1306_fb_invalidate(ssd1306_t *panel);
+// The framebuffer, geometry.pages rows of SSD1306_WIDTH bytes; draw through the ssd1306_fb_* functions only
+const uint8_t *ssd1306_fb_pages(const ssd1306_t *panel);
+// Sends the changed spans in a single transaction: each a ssd1306_set_range() window and its data.
+// Adjacent pages are merged into one window when that is fewer bytes on the wire.
+esp_err_t ssd1306_flush(ssd1306_t *panel);
+
+// Flushes several panels that share a bus, so that they show their changes at about the same time: one
+// window of one page per transaction, always of the panel with the most bytes left, so that they all finish
+// within a window of each other, instead of one after the other. skew_bytes, if not null, receives the bytes
+// on the bus between the first and the last panel done: within one frame period if a page fits it.
+// Stops at the first error.
+esp_err_t ssd1306_flush_panels(ssd1306_t *const *panels, size_t count, uint32_t *skew_bytes);
+
+// Sets the marquee, or removes it with NULL or no pages; the next ssd1306_flush() sends it.
+// Setting the marquee that runs already changes nothing.
+esp_err_t ssd1306_marquee_set(ssd1306_t *panel, const ssd1306_marquee_t *marquee);
+// The us until ssd1306_flush() has to reload the band of the marquee; INT64_MAX if never
+int64_t ssd1306_marquee_due_us(const ssd1306_t *panel);
+
+// Sets the contrast (the segment current), 0x7f after ssd1306_init(); the next ssd1306_flush() sends it in
+// the same transaction, after the data
+void ssd1306_set_contrast(ssd1306_t *panel, uint8_t contrast);
+
+// Sets a pixel of the grayscale bitplanes to a level of 0..3; pixels outside of SSD1306_MAX_PAGES are clipped
+void ssd1306_gray_pixel(ssd1306_gray_t *gray, uint8_t x, uint8_t y, uint8_t level);
+// Writes a window of both bitplanes, each in the order of ssd1306_fb_blit()
+void ssd1306_gray_blit(ssd1306_gray_t *gray, uint8_t col, uint8_t page, uint8_t width, uint8_t pages,
+                       const uint8_t *high, const uint8_t *low);
+// Draws a bitplane (0: high, 1: low) into the framebuffer and sets its contrast; ssd1306_flush() shows it
+void ssd1306_gray_show_plane(ssd1306_t *panel, const ssd1306_gray_t *gray, int plane);
+// The most bytes on the wire that ssd1306_flush() takes to switch from one bitplane to the other
+uint32_t ssd1306_gray_plane_bytes(const ssd1306_t *panel, const ssd1306_gray_t *gray);
+// The fewest frames of the panel each bitplane has to show for, so that switching to the next fits the
+// time on the bus of its transport; 1 if the transport doesn't tell its rate
+uint32_t ssd1306_gray_frames_per_plane(const ssd1306_t *panel, const ssd1306_gray_t *gray);
+
+// The frames per second the panel shows: SSD1306_OSC_HZ / (D * K * rows) with the reset values of
+// FREQ_DIV (D = 1) and PRECHARGE (K = 2 + 2 + 50)
+uint32_t ssd1306_frame_hz(const ssd1306_t *panel);
+
+void ssd1306_get_stats(const ssd1306_t *panel, ssd1306_stats_t *stats);
+void ssd1306_reset_stats(ssd1306_t *panel);
 
 #endif // SSD1306_H
 // vim: set sw=4 ts=4 indk= et si:
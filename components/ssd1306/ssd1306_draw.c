@@ -0,0 +1,153 @@
+#include "ssd1306_draw.h"
+#include <string.h>
+
+// A byte in each of the 4 lanes of a word, one lane per column
+#define LANES(byte) (0x01010101u * (uint8_t)(byte))
+
+// Every op is dst = (dst & keep) ^ flip, with keep and flip derived from the source bits and the mask of the
+// rows it covers. The same expression does a byte or a word of 4 lanes, as no bit crosses a lane.
+typedef struct {
+    uint32_t keep_src;      // ~0: dst loses the set bits of the source
+    uint32_t keep_mask;     // ~0: dst loses the rows covered
+    uint32_t flip_src;      // ~0: dst flips the set bits of the source
+} op_t;
+
+static const op_t OPS[] = {
+    [SSD1306_DRAW_SET] = { ~0u, 0, ~0u },
+    [SSD1306_DRAW_CLEAR] = { ~0u, 0, 0 },
+    [SSD1306_DRAW_INVERT] = { 0, 0, ~0u },
+    [SSD1306_DRAW_COPY] = { 0, ~0u, ~0u },
+};
+
+// A sprite page past the last one, or above the first
+static const uint8_t BLANK[256 + 4];
+
+
+static inline uint32_t
+load(const uint8_t *bytes) {
+    uint32_t word;
+    memcpy(&word, bytes, sizeof(word));
+    return word;
+}
+
+
+static inline void
+store(uint8_t *bytes, uint32_t word) {
+    memcpy(bytes, &word, sizeof(word));
+}
+
+
+static inline uint32_t
+apply(const op_t *op, uint32_t dst, uint32_t src, uint32_t mask) {
+    src &= mask;
+    uint32_t keep = ~((src & op->keep_src) | (mask & op->keep_mask));
+    return (dst & keep) ^ (src & op->flip_src);
+}
+
+
+// a / 8 rounded down, also for negative a
+static inline int
+floor_page(int a) {
+    return (a - (a & 7)) / 8;
+}
+
+
+// The bits of the rows [y_min, y_max) in the page
+static inline uint8_t
+row_mask(int page, int y_min, int y_max) {
+    int lo = (y_min > page * 8) ? y_min - page * 8 : 0;
+    int hi = (y_max < page * 8 + 8) ? y_max - page * 8 : 8;
+    return (uint8_t)(((1u << hi) - 1) & ~((1u << lo) - 1));
+}
+
+
+void
+ssd1306_draw_fill_rect(const ssd1306_canvas_t *canvas, int x, int y, int width, int height, ssd1306_draw_op_t op) {
+    int x_min = (x > 0) ? x : 0, x_max = (x + width < SSD1306_WIDTH) ? x + width : SSD1306_WIDTH;
+    int y_min = (y > 0) ? y : 0, y_max = (y + height < canvas->page_count * 8) ? y + height : canvas->page_count * 8;
+    if (x_min >= x_max || y_min >= y_max) {
+        return;
+    }
+    const op_t *ops = &OPS[op];
+    for (int page = y_min / 8; page <= (y_max - 1) / 8; ++page) {
+        // The source is all set: keep and flip are the same for every column
+        uint32_t mask = LANES(row_mask(page, y_min, y_max));
+        uint32_t keep = ~(mask & (ops->keep_src | ops->keep_mask)), flip = mask & ops->flip_src;
+        uint8_t *dst = &canvas->pages[page][x_min];
+        int n = x_max - x_min, i = 0;
+        for (; i + 4 <= n; i += 4) {
+            store(dst + i, (load(dst + i) & keep) ^ flip);
+        }
+        for (; i < n; ++i) {
+            dst[i] = (uint8_t)((dst[i] & keep) ^ flip);
+        }
+    }
+}
+
+
+void
+ssd1306_draw_hline(const ssd1306_canvas_t *canvas, int x, int y, int width, ssd1306_draw_op_t op) {
+    ssd1306_draw_fill_rect(canvas, x, y, width, 1, op);
+}
+
+
+void
+ssd1306_draw_vline(const ssd1306_canvas_t *canvas, int x, int y, int height, ssd1306_draw_op_t op) {
+    ssd1306_draw_fill_rect(canvas, x, y, 1, height, op);
+}
+
+
+void
+ssd1306_draw_rect(const ssd1306_canvas_t *canvas, int x, int y, int width, int height, ssd1306_draw_op_t op) {
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+    // The sides leave out the corners, so that INVERT doesn't flip them twice
+    ssd1306_draw_hline(canvas, x, y, width, op);
+    if (height > 1) {
+        ssd1306_draw_hline(canvas, x, y + height - 1, width, op);
+    }
+    ssd1306_draw_vline(canvas, x, y + 1, height - 2, op);
+    if (width > 1) {
+        ssd1306_draw_vline(canvas, x + width - 1, y + 1, height - 2, op);
+    }
+}
+
+
+void
+ssd1306_draw_sprite(const ssd1306_canvas_t *canvas, int x, int y, const ssd1306_sprite_t *sprite,
+                    ssd1306_draw_op_t op) {
+    int col_min = (x < 0) ? -x : 0;
+    int col_max = (x + sprite->width < SSD1306_WIDTH) ? sprite->width : SSD1306_WIDTH - x;
+    if (col_min >= col_max || sprite->height == 0) {
+        return;
+    }
+    const op_t *ops = &OPS[op];
+    int y_max = y + sprite->height;
+    int shift = y & 7, top = floor_page(y), sprite_pages = (sprite->height + 7) / 8;
+    int page_min = (top > 0) ? top : 0, page_max = floor_page(y_max - 1);
+    if (page_max >= canvas->page_count) {
+        page_max = canvas->page_count - 1;
+    }
+    // The sprite bytes shift down by shift rows: each canvas byte takes the bottom of the sprite byte at its
+    // page and the top of the one above, each masked in every lane so that no bit spills into the next column
+    const uint32_t below = LANES(0xff << shift), above = LANES(0xff >> (8 - shift));
+    for (int page = page_min; page <= page_max; ++page) {
+        int k = page - top;
+        const uint8_t *cur = (k < sprite_pages) ? sprite->data + k * sprite->width : BLANK;
+        const uint8_t *prev = (k > 0) ? sprite->data + (k - 1) * sprite->width : BLANK;
+        uint32_t mask = LANES(row_mask(page, y, y_max));
+        uint8_t *dst = canvas->pages[page];
+        int col = col_min;
+        for (; col + 4 <= col_max; col += 4) {
+            uint32_t src = ((load(cur + col) << shift) & below) | ((load(prev + col) >> (8 - shift)) & above);
+            store(dst + x + col, apply(ops, load(dst + x + col), src, mask));
+        }
+        for (; col < col_max; ++col) {
+            uint32_t src = ((uint32_t)(cur[col] << shift) & below) | ((uint32_t)(prev[col] >> (8 - shift)) & above);
+            dst[x + col] = (uint8_t)apply(ops, dst[x + col], src, mask);
+        }
+    }
+}
+
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,50 @@
+#ifndef SSD1306_DRAW_H
+#define SSD1306_DRAW_H
+
+#include "ssd1306.h"
+
+// Drawing at any pixel position on a page-major framebuffer: the pages of a ssd1306_frame_t, the bitplanes of
+// a ssd1306_gray_t, or a buffer of one's own. Each byte is a column of 8 rows with the LSB on top, so a row
+// of the canvas is one bit of consecutive bytes and 8 rows of a column are one byte:
+// - fills work on 4 columns at once, a 32-bit word of one byte per column, with a mask of the rows of the
+//   page: a horizontal line is a mask of one bit over the columns, a vertical line a byte per page;
+// - a sprite at a y that isn't a multiple of 8 straddles pages: each byte of the canvas takes the bottom
+//   bits of a sprite byte shifted down, and the top bits of the byte above it, 4 columns per word too.
+// Everything clips to the canvas; coordinates may be negative.
+//
+// Pure C, shared by the firmware and the host tools (host/ssd1306_draw_bench.c).
+
+typedef struct {
+    uint8_t (*pages)[SSD1306_WIDTH];
+    uint8_t page_count;
+} ssd1306_canvas_t;
+
+// The canvas of a two-dimensional array of pages, e.g. SSD1306_CANVAS(frame->pages)
+#define SSD1306_CANVAS(array) ((ssd1306_canvas_t){ .pages = (array), .page_count = sizeof(array) / sizeof((array)[0]) })
+
+// An image in the layout of ssd1306_fb_blit(): (height + 7) / 8 pages of width bytes, e.g. a glyph of font6x8
+typedef struct {
+    const uint8_t *data;
+    uint8_t width;
+    uint8_t height;
+} ssd1306_sprite_t;
+
+// What a fill, or the set pixels of a sprite, do to the canvas
+typedef enum {
+    SSD1306_DRAW_SET,       // light the pixels
+    SSD1306_DRAW_CLEAR,     // darken them
+    SSD1306_DRAW_INVERT,    // flip them
+    SSD1306_DRAW_COPY,      // replace the whole rectangle: by the sprite, or lit for a fill
+} ssd1306_draw_op_t;
+
+void ssd1306_draw_hline(const ssd1306_canvas_t *canvas, int x, int y, int width, ssd1306_draw_op_t op);
+void ssd1306_draw_vline(const ssd1306_canvas_t *canvas, int x, int y, int height, ssd1306_draw_op_t op);
+void ssd1306_draw_fill_rect(const ssd1306_canvas_t *canvas, int x, int y, int width, int height, ssd1306_draw_op_t op);
+// The outline of a box, 1 pixel wide
+void ssd1306_draw_rect(const ssd1306_canvas_t *canvas, int x, int y, int width, int height, ssd1306_draw_op_t op);
+// Draws a sprite with its top left corner at x, y
+void ssd1306_draw_sprite(const ssd1306_canvas_t *canvas, int x, int y, const ssd1306_sprite_t *sprite,
+                         ssd1306_draw_op_t op);
+
+#endif // SSD1306_DRAW_H
+// vim: set sw=4 ts=4 indk= et si:
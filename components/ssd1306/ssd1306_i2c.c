@@ -0,0 +1,102 @@
+// The I2C transport: a transaction is one command link, each phase a (repeated) START, the address and
+// a control byte, and the setup of the bus.
+#include "ssd1306.h"
+#include <esp_idf_version.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// The control bytes: the following bytes are commands, or data
+#define CONTROL_COMMANDS 0x00
+#define CONTROL_DATA 0x40
+
+// Since ESP-IDF v4.4 a command link can be built in caller-provided memory instead of a heap node per
+// operation; ssd1306_i2c_init() allocates that memory once per transport. Before, every link comes from the heap.
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0)
+#   define STATIC_LINKS 1
+// Each segment takes at most a start, the header and itself, then there is the stop;
+// I2C_LINK_RECOMMENDED_SIZE(n) holds 5 * n operations
+#   define LINK_SIZE I2C_LINK_RECOMMENDED_SIZE(SSD1306_MAX_SEGMENTS)
+#endif // ESP_IDF_VERSION
+
+
+static esp_err_t
+i2c_send(ssd1306_transport_t *transport, const ssd1306_segment_t *segments, size_t count) {
+    ssd1306_i2c_t *i2c = (ssd1306_i2c_t *)transport;
+    i2c_cmd_handle_t cmd;
+#ifdef STATIC_LINKS
+    if (i2c->link_storage) {
+        cmd = i2c_cmd_link_create_static(i2c->link_storage, LINK_SIZE);
+    }
+    else
+#endif // STATIC_LINKS
+    {
+        cmd = i2c_cmd_link_create();
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if (i == 0 || segments[i].data != segments[i - 1].data) {
+            i2c_master_start(cmd);
+            i2c_master_write(cmd, i2c->header[segments[i].data], sizeof(i2c->header[0]), true);
+        }
+        i2c_master_write(cmd, (uint8_t*)segments[i].bytes, segments[i].length, true);
+    }
+    i2c_master_stop(cmd);
+    esp_err_t status = i2c_master_cmd_begin(i2c->port, cmd, 1000);
+
+#ifdef STATIC_LINKS
+    if (i2c->link_storage) {
+        i2c_cmd_link_delete_static(cmd);
+    }
+    else
+#endif // STATIC_LINKS
+    {
+        i2c_cmd_link_delete(cmd);
+    }
+    return status;
+}
+
+
+esp_err_t
+ssd1306_i2c_init(ssd1306_i2c_t *i2c, i2c_port_t port, uint8_t address) {
+    i2c->base.send = i2c_send;
+    i2c->base.phase_overhead = sizeof(i2c->header[0]);
+    i2c->base.bytes_per_s = SSD1306_I2C_HZ / 9;
+    i2c->port = port;
+    for (int data = 0; data < 2; ++data) {
+        i2c->header[data][0] = (address << 1) | I2C_MASTER_WRITE;
+        i2c->header[data][1] = data ? CONTROL_DATA : CONTROL_COMMANDS;
+    }
+    i2c->link_storage = NULL;
+#ifdef STATIC_LINKS
+    i2c->link_storage = malloc(LINK_SIZE);  // Falls back to heap links if null
+#endif // STATIC_LINKS
+    return ESP_OK;
+}
+
+
+esp_err_t
+ssd1306_i2c_bus_init(i2c_port_t port, int sda_io, int scl_io) {
+    esp_err_t status;
+    i2c_config_t conf;
+
+    conf.mode = I2C_MODE_MASTER;
+    conf.sda_io_num = sda_io;
+    conf.sda_pullup_en = GPIO_PULLUP_ENABLE;
+    conf.scl_io_num = scl_io;
+    conf.scl_pullup_en = GPIO_PULLUP_ENABLE;
+    conf.master.clk_speed = SSD1306_I2C_HZ;
+
+    status = i2c_param_config(port, &conf);
+    if (status != ESP_OK) {
+        printf("i2c_param_config failed; status=0x%02x\n", status);
+        return status;
+    }
+    status = i2c_driver_install(port, I2C_MODE_MASTER, 0, 0, 0);
+    if (status != ESP_OK) {
+        printf("i2c_driver_install failed; status=0x%02x\n", status);
+        return status;
+    }
+    return ESP_OK;
+}
+
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,205 @@
+#include "ssd1306_mock.h"
+
+#include <string.h>
+
+
+// The number of argument bytes that follow a command
+static int
+command_arguments(uint8_t code) {
+    switch (code) {
+        case SSD1306_CONTRAST:
+        case SSD1306_ADDRESSING_MODE:
+        case SSD1306_LAST_ROW:
+        case SSD1306_OFFSET_ROWS:
+        case SSD1306_COM_PINS:
+        case SSD1306_FREQ_DIV:
+        case SSD1306_PRECHARGE:
+        case SSD1306_VCOM_DESELECT:
+        case SSD1306_FADE_BLINK:
+        case SSD1306_CHARGEPUMP:
+            return 1;
+        case SSD1306_COLUMN_RANGE:
+        case SSD1306_PAGE_RANGE:
+        case SSD1306_VERTICAL_SCROLL_AREA:
+            return 2;
+        case SSD1306_SCROLL_VERTICAL_AND_RIGHT:
+        case SSD1306_SCROLL_VERTICAL_AND_LEFT:
+            return 5;
+        case SSD1306_SCROLL_RIGHT:
+        case SSD1306_SCROLL_LEFT:
+            return 6;
+        default:
+            return 0;
+    }
+}
+
+
+static void
+execute_command(ssd1306_mock_t *mock) {
+    const uint8_t *c = mock->command;
+    switch (c[0]) {
+        case SSD1306_CONTRAST:
+            mock->contrast = c[1];
+            break;
+        case SSD1306_ADDRESSING_MODE:
+            mock->addressing = c[1] & 3;
+            break;
+        case SSD1306_LAST_ROW:
+            mock->rows = (c[1] & 0x3f) + 1;
+            break;
+        case SSD1306_COM_PINS:
+            mock->com_pins = c[1];
+            break;
+        case SSD1306_COLUMN_RANGE:
+            mock->col_min = mock->col = c[1] & 0x7f;
+            mock->col_max = c[2] & 0x7f;
+            break;
+        case SSD1306_PAGE_RANGE:
+            mock->page_min = mock->page = c[1] & 7;
+            mock->page_max = c[2] & 7;
+            break;
+        case SSD1306_DISPLAY_NORMAL:
+        case SSD1306_DISPLAY_INVERSE:
+            mock->inverse = (c[0] == SSD1306_DISPLAY_INVERSE);
+            break;
+        case SSD1306_DISPLAY_OFF:
+        case SSD1306_DISPLAY_ON:
+            mock->on = (c[0] == SSD1306_DISPLAY_ON);
+            break;
+        case SSD1306_SCROLL_STOP:
+        case SSD1306_SCROLL_START:
+            mock->scrolling = (c[0] == SSD1306_SCROLL_START);
+            break;
+        case SSD1306_SCROLL_RIGHT:
+        case SSD1306_SCROLL_LEFT:
+            if (mock->scrolling) {
+                ++mock->violations;
+            }
+            mock->scroll_left = (c[0] == SSD1306_SCROLL_LEFT);
+            mock->scroll_page_min = c[2] & 7;
+            mock->scroll_page_max = c[4] & 7;
+            break;
+        default:
+            // The page mode addresses
+            if ((c[0] & 0xf8) == SSD1306_SELECT_PAGE) {
+                mock->page = c[0] & 7;
+            }
+            else if ((c[0] & 0xf0) == SSD1306_COLUMN_START_LOW) {
+                mock->col = (mock->col & 0xf0) | (c[0] & 0x0f);
+            }
+            else if ((c[0] & 0xf0) == SSD1306_COLUMN_START_HIGH) {
+                mock->col = ((c[0] & 0x07) << 4) | (mock->col & 0x0f);
+            }
+            break;
+    }
+}
+
+
+static void
+receive_command(ssd1306_mock_t *mock, uint8_t byte) {
+    mock->command[mock->command_length++] = byte;
+    if (mock->command_length > command_arguments(mock->command[0])) {
+        execute_command(mock);
+        mock->command_length = 0;
+    }
+}
+
+
+// Stores a data byte and advances the address like the controller
+static void
+receive_data(ssd1306_mock_t *mock, uint8_t byte) {
+    if (mock->scrolling) {
+        ++mock->violations;
+    }
+    mock->ram[mock->page][mock->col] = byte;
+    if (mock->addressing == 2) {
+        // Page mode: the column wraps within the page
+        mock->col = (mock->col + 1) & 0x7f;
+        return;
+    }
+    if (mock->col < mock->col_max) {
+        ++mock->col;
+        return;
+    }
+    mock->col = mock->col_min;
+    mock->page = (mock->page < mock->page_max) ? mock->page + 1 : mock->page_min;
+}
+
+
+static esp_err_t
+mock_send(ssd1306_transport_t *transport, const ssd1306_segment_t *segments, size_t count) {
+    ssd1306_mock_t *mock = (ssd1306_mock_t *)transport;
+    ++mock->transactions;
+    for (size_t i = 0; i < count; ++i) {
+        if (i == 0 || segments[i].data != segments[i - 1].data) {
+            ++mock->phases;
+            // A command cut off by the end of its phase is dropped by the controller
+            mock->command_length = 0;
+        }
+        for (uint16_t k = 0; k < segments[i].length; ++k) {
+            uint8_t byte = segments[i].bytes[k];
+            if (mock->length < mock->capacity) {
+                mock->stream[mock->length++] = byte | (segments[i].data ? SSD1306_MOCK_DATA : 0);
+            }
+            else {
+                ++mock->dropped;
+            }
+            if (segments[i].data) {
+                receive_data(mock, byte);
+            }
+            else {
+                receive_command(mock, byte);
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+
+void
+ssd1306_mock_init(ssd1306_mock_t *mock, uint16_t *stream, size_t capacity, uint8_t phase_overhead) {
+    memset(mock, 0, sizeof(*mock));
+    mock->base.send = mock_send;
+    mock->base.phase_overhead = phase_overhead;
+    mock->stream = stream;
+    mock->capacity = stream ? capacity : 0;
+    // The reset state of the controller
+    mock->addressing = 2;
+    mock->col_max = SSD1306_MOCK_RAM_WIDTH - 1;
+    mock->page_max = SSD1306_MOCK_RAM_PAGES - 1;
+    mock->rows = 64;
+    mock->com_pins = 0x12;
+    mock->contrast = 0x7f;
+}
+
+
+void
+ssd1306_mock_rewind(ssd1306_mock_t *mock) {
+    mock->length = 0;
+    mock->dropped = 0;
+    mock->transactions = 0;
+    mock->phases = 0;
+    mock->violations = 0;
+}
+
+
+void
+ssd1306_mock_scroll(ssd1306_mock_t *mock, unsigned steps) {
+    if (!mock->scrolling) {
+        return;
+    }
+    unsigned shift = steps % SSD1306_MOCK_RAM_WIDTH;
+    if (!mock->scroll_left) {
+        shift = (SSD1306_MOCK_RAM_WIDTH - shift) % SSD1306_MOCK_RAM_WIDTH;
+    }
+    uint8_t row[SSD1306_MOCK_RAM_WIDTH];
+    for (uint8_t page = mock->scroll_page_min; page <= mock->scroll_page_max && page < SSD1306_MOCK_RAM_PAGES; ++page) {
+        // Left: each column shows what was shift columns right of it
+        for (unsigned col = 0; col < SSD1306_MOCK_RAM_WIDTH; ++col) {
+            row[col] = mock->ram[page][(col + shift) % SSD1306_MOCK_RAM_WIDTH];
+        }
+        memcpy(mock->ram[page], row, sizeof(row));
+    }
+}
+
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,58 @@
+#ifndef SSD1306_MOCK_H
+#define SSD1306_MOCK_H
+
+#include "ssd1306.h"
+
+// An in-memory transport, for the host tools (host/) and for tests on the device.
+//
+// Records the bytes exactly as the panel would receive them, each with its D/C level, and emulates the
+// parts of the controller that decide what it shows: the RAM of 128 x 64 pixels, the rows shown and the
+// layout of the COM pins, the horizontal and page addressing modes with their column and page ranges, the
+// contrast, inversion, display on/off and the horizontal scroll, which ssd1306_mock_scroll() steps.
+//
+// Pure C, shared by the firmware and the host tools.
+
+#define SSD1306_MOCK_RAM_WIDTH 128
+#define SSD1306_MOCK_RAM_PAGES 8
+
+// Set in the recorded stream for data bytes, clear for command bytes
+#define SSD1306_MOCK_DATA 0x100
+
+typedef struct {
+    ssd1306_transport_t base;
+
+    uint16_t *stream;       // each byte sent, | SSD1306_MOCK_DATA if data
+    size_t capacity;
+    size_t length;          // bytes recorded
+    size_t dropped;         // bytes that didn't fit the stream any more
+    uint32_t transactions;
+    uint32_t phases;
+
+    // The emulated controller
+    uint8_t ram[SSD1306_MOCK_RAM_PAGES][SSD1306_MOCK_RAM_WIDTH];
+    uint8_t addressing;     // 0: horizontal, 2: page
+    uint8_t col_min, col_max, page_min, page_max;
+    uint8_t col, page;      // where the next data byte goes
+    uint8_t rows;           // the multiplex ratio, from LAST_ROW
+    uint8_t com_pins;
+    uint8_t contrast;
+    bool on;
+    bool inverse;
+    bool scrolling;
+    bool scroll_left;
+    uint8_t scroll_page_min, scroll_page_max;
+    uint32_t violations;    // data, or a scroll setup, sent while scrolling: the controller forbids both
+    uint8_t command[8];     // a command waiting for its arguments
+    uint8_t command_length;
+} ssd1306_mock_t;
+
+// Sets up the mock in its reset state; stream may be null to record nothing. The bus has no rate: set
+// base.bytes_per_s to stand for one
+void ssd1306_mock_init(ssd1306_mock_t *mock, uint16_t *stream, size_t capacity, uint8_t phase_overhead);
+// Forgets the recorded stream and the counts, but not the state of the controller
+void ssd1306_mock_rewind(ssd1306_mock_t *mock);
+// Has the controller scroll by steps columns, if it scrolls: rotates the RAM of the scrolled pages
+void ssd1306_mock_scroll(ssd1306_mock_t *mock, unsigned steps);
+
+#endif // SSD1306_MOCK_H
+// vim: set sw=4 ts=4 indk= et si:
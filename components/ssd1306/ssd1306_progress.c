@@ -0,0 +1,155 @@
+// The progress bar: the drawing is pure C, the timer and the display service are the device's.
+#include "ssd1306_progress.h"
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#   include "ssd1306_service.h"
+#   include <esp_log.h>
+
+static const char *TAG = "ssd1306";
+#endif // ESP_PLATFORM
+
+
+// The columns inside the outline
+static int
+inside_width(const ssd1306_progress_t *bar) {
+    return (bar->width > 2) ? bar->width - 2 : 0;
+}
+
+
+void
+ssd1306_progress_reset(ssd1306_progress_t *bar, const ssd1306_canvas_t *canvas, int64_t now_us,
+                       int64_t duration_us) {
+    bar->start_us = now_us;
+    bar->duration_us = (duration_us > 0) ? duration_us : 1;
+    bar->filled = 0;
+    memset(&bar->stats, 0, sizeof(bar->stats));
+    ssd1306_draw_fill_rect(canvas, bar->x + 1, bar->y + 1, bar->width - 2, bar->height - 2, SSD1306_DRAW_CLEAR);
+    ssd1306_draw_rect(canvas, bar->x, bar->y, bar->width, bar->height, SSD1306_DRAW_SET);
+}
+
+
+int
+ssd1306_progress_due(const ssd1306_progress_t *bar, int64_t now_us) {
+    int64_t elapsed_us = now_us - bar->start_us;
+    if (elapsed_us > bar->duration_us) {
+        elapsed_us = bar->duration_us;
+    }
+    int target = (elapsed_us > 0) ? (int)(inside_width(bar) * elapsed_us / bar->duration_us) : 0;
+    return (target > bar->filled) ? target - bar->filled : 0;
+}
+
+
+int
+ssd1306_progress_advance(ssd1306_progress_t *bar, const ssd1306_canvas_t *canvas, int64_t now_us) {
+    int columns = ssd1306_progress_due(bar, now_us);
+    if (columns > 0) {
+        ssd1306_draw_fill_rect(canvas, bar->x + 1 + bar->filled, bar->y + 1, columns, bar->height - 2, SSD1306_DRAW_SET);
+        bar->filled += columns;
+        bar->stats.columns += columns;
+        ++bar->stats.redraws;
+    }
+    return columns;
+}
+
+
+bool
+ssd1306_progress_expired(const ssd1306_progress_t *bar) {
+    return bar->filled >= inside_width(bar);
+}
+
+
+// The ticks in between would have nothing to draw
+int64_t
+ssd1306_progress_period_us(const ssd1306_progress_t *bar, int64_t duration_us) {
+    int64_t period_us = (inside_width(bar) > 0) ? duration_us / inside_width(bar) : duration_us;
+    return (period_us < 1000000 / SSD1306_PROGRESS_MAX_HZ) ? 1000000 / SSD1306_PROGRESS_MAX_HZ : period_us;
+}
+
+
+#ifdef ESP_PLATFORM
+// Runs in the esp_timer task: it only takes the lock of the back buffer of the service, for the copy
+static void
+progress_tick(void *arg) {
+    ssd1306_progress_t *bar = arg;
+    int64_t now = esp_timer_get_time();
+    int64_t jitter_us = now - (bar->start_us + (int64_t)(bar->stats.ticks + 1) * bar->period_us);
+    jitter_us = (jitter_us < 0) ? -jitter_us : jitter_us;
+    ++bar->stats.ticks;
+    bar->stats.jitter_sum_us += jitter_us;
+    if (jitter_us > bar->stats.max_jitter_us) {
+        bar->stats.max_jitter_us = jitter_us;
+    }
+
+    // Without new columns the frame stays as it is: no lock, and nothing to flush
+    if (ssd1306_progress_due(bar, now) > 0) {
+        ssd1306_frame_t *frame = ssd1306_service_begin();
+        ssd1306_canvas_t canvas = SSD1306_CANVAS(frame->pages);
+        ssd1306_progress_advance(bar, &canvas, now);
+        ssd1306_service_submit();
+    }
+    if (ssd1306_progress_expired(bar)) {
+        esp_timer_stop(bar->timer);
+        bar->running = false;
+        ESP_LOGI(TAG, "Progress bar full; ticks=%u, redraws=%u, max_jitter_us=%u, mean_jitter_us=%u",
+            (unsigned)bar->stats.ticks, (unsigned)bar->stats.redraws, (unsigned)bar->stats.max_jitter_us,
+            (unsigned)(bar->stats.jitter_sum_us / bar->stats.ticks));
+        if (bar->expired) {
+            bar->expired(bar, bar->arg);
+        }
+    }
+}
+
+
+esp_err_t
+ssd1306_progress_start(ssd1306_progress_t *bar, int64_t duration_us) {
+    int columns = inside_width(bar);
+    if (columns == 0 || bar->height < 3 || duration_us <= 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!bar->timer) {
+        const esp_timer_create_args_t timer_args = { .callback = &progress_tick, .arg = bar, .name = "ssd1306_progress" };
+        esp_err_t status = esp_timer_create(&timer_args, &bar->timer);
+        if (status != ESP_OK) {
+            return status;
+        }
+    }
+    ssd1306_progress_stop(bar);
+
+    bar->period_us = ssd1306_progress_period_us(bar, duration_us);
+    ssd1306_service_get_stats(&bar->bus_base);
+    ssd1306_frame_t *frame = ssd1306_service_begin();
+    ssd1306_canvas_t canvas = SSD1306_CANVAS(frame->pages);
+    ssd1306_progress_reset(bar, &canvas, esp_timer_get_time(), duration_us);
+    ssd1306_service_submit();
+    bar->running = true;
+    return esp_timer_start_periodic(bar->timer, bar->period_us);
+}
+
+
+void
+ssd1306_progress_stop(ssd1306_progress_t *bar) {
+    if (bar->running) {
+        esp_timer_stop(bar->timer);
+        bar->running = false;
+    }
+}
+
+
+bool
+ssd1306_progress_running(const ssd1306_progress_t *bar) {
+    return bar->running;
+}
+
+
+void
+ssd1306_progress_get_stats(const ssd1306_progress_t *bar, ssd1306_progress_stats_t *stats) {
+    ssd1306_stats_t bus;
+    ssd1306_service_get_stats(&bus);
+    *stats = bar->stats;
+    stats->bus_transactions = bus.transactions - bar->bus_base.transactions;
+    stats->bus_bytes = bus.bytes - bar->bus_base.bytes;
+}
+#endif // ESP_PLATFORM
+
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,76 @@
+#ifndef SSD1306_PROGRESS_H
+#define SSD1306_PROGRESS_H
+
+#include "ssd1306_draw.h"
+
+#ifdef ESP_PLATFORM
+#   include <esp_timer.h>
+#endif // ESP_PLATFORM
+
+// A progress bar that fills up over a duration, e.g. the 5 s and 1 s steps of the safety sequence of the
+// README. It remembers how far it has filled, so each tick draws only the columns that became due: the
+// display service then sends just those, in a ssd1306_set_range() window as wide as they are, instead of the
+// whole bar. The bar may sit at any row; across a page boundary the window takes both pages.
+//
+// On the device an esp_timer ticks it, at most SSD1306_PROGRESS_MAX_HZ, and not faster than it gains columns.
+// ssd1306_progress_advance() is pure C, so that the host tools drive it with their own clock.
+
+#ifndef SSD1306_PROGRESS_MAX_HZ
+#   define SSD1306_PROGRESS_MAX_HZ 60
+#endif // SSD1306_PROGRESS_MAX_HZ
+
+typedef struct {
+    uint32_t ticks;
+    uint32_t redraws;       // ticks that had new columns to draw
+    uint32_t columns;       // filled
+    int64_t max_jitter_us;  // the most a tick came early or late against the period of the timer
+    int64_t jitter_sum_us;  // of all ticks, for the mean
+    uint32_t bus_transactions;  // of the display service while the bar runs, with whatever else changes
+    uint32_t bus_bytes;
+} ssd1306_progress_stats_t;
+
+typedef struct ssd1306_progress ssd1306_progress_t;
+struct ssd1306_progress {
+    // The bar, outline included, in pixels; set these before starting it
+    int x, y, width, height;
+    // Called by the timer once the bar is full; the bar has stopped then
+    void (*expired)(ssd1306_progress_t *bar, void *arg);
+    void *arg;
+
+    // The rest is the widget's
+    int64_t start_us;
+    int64_t duration_us;
+    int filled;             // columns of the inside drawn so far
+    ssd1306_progress_stats_t stats;
+#ifdef ESP_PLATFORM
+    esp_timer_handle_t timer;
+    int64_t period_us;
+    ssd1306_stats_t bus_base;
+    volatile bool running;
+#endif // ESP_PLATFORM
+};
+
+// Draws the outline and an empty inside, and starts the clock of a bar that fills over duration_us
+void ssd1306_progress_reset(ssd1306_progress_t *bar, const ssd1306_canvas_t *canvas, int64_t now_us,
+                            int64_t duration_us);
+// The columns of the inside that are due at now_us but not drawn yet
+int ssd1306_progress_due(const ssd1306_progress_t *bar, int64_t now_us);
+// Draws the columns due at now_us, and returns how many
+int ssd1306_progress_advance(ssd1306_progress_t *bar, const ssd1306_canvas_t *canvas, int64_t now_us);
+// True once the bar is full
+bool ssd1306_progress_expired(const ssd1306_progress_t *bar);
+// The period of the ticks: one per column gained, but at most SSD1306_PROGRESS_MAX_HZ
+int64_t ssd1306_progress_period_us(const ssd1306_progress_t *bar, int64_t duration_us);
+
+#ifdef ESP_PLATFORM
+// Draws the bar on the screen of the display service, and has the timer fill it over duration_us.
+// Restarting a running bar starts it over, empty.
+esp_err_t ssd1306_progress_start(ssd1306_progress_t *bar, int64_t duration_us);
+// Stops filling, e.g. when the sensor is released; the bar stays on the screen as it is
+void ssd1306_progress_stop(ssd1306_progress_t *bar);
+bool ssd1306_progress_running(const ssd1306_progress_t *bar);
+void ssd1306_progress_get_stats(const ssd1306_progress_t *bar, ssd1306_progress_stats_t *stats);
+#endif // ESP_PLATFORM
+
+#endif // SSD1306_PROGRESS_H
+// vim: set sw=4 ts=4 indk= et si:
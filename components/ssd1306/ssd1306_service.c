@@ -0,0 +1,344 @@
+#include "ssd1306_service.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <freertos/event_groups.h>
+#include <string.h>
+
+static const char *TAG = "ssd1306";
+
+// Set while every submitted frame is on its panel
+#define IDLE_BIT (1 << 0)
+
+// What wakes the task up, in its notification value: a submitted frame, or the tick of the bitplanes of a panel
+#define SUBMIT_BIT (1 << 0)
+#define TICK_BIT(index) (1 << (1 + (index)))
+_Static_assert(SSD1306_SERVICE_MAX_PANELS >= 1 && SSD1306_SERVICE_MAX_PANELS <= 31, "a tick bit per panel");
+
+// A panel of the service, with its back buffer
+typedef struct {
+    ssd1306_t *panel;
+    ssd1306_frame_t back;
+    bool pending;               // back holds a frame not copied to the framebuffer yet
+    ssd1306_stats_t stats;      // of the panel, after the last flush
+
+    // While the panel shows gray: the planes, as the framebuffer only holds the one shown
+    bool gray;
+    ssd1306_gray_t gray_planes;
+    int plane;                  // shown next
+    uint32_t frames;            // of the panel per plane, at the period of the timer
+    uint8_t contrast;           // to restore afterwards
+    esp_timer_handle_t timer;
+    volatile uint32_t ticks;
+    volatile int64_t tick_us;
+    uint32_t ticks_shown;
+    ssd1306_service_gray_stats_t gray_stats;
+} slot_t;
+
+static struct {
+    slot_t slots[SSD1306_SERVICE_MAX_PANELS];
+    ssd1306_t *panels[SSD1306_SERVICE_MAX_PANELS];  // of the slots, for ssd1306_flush_panels()
+    size_t count;
+    TaskHandle_t task;
+    SemaphoreHandle_t lock;     // of the back buffers, pending, begun, submitted and the stats
+    EventGroupHandle_t events;
+    size_t begun;               // the slot between ssd1306_service_begin_panel() and ssd1306_service_submit()
+    uint32_t submitted;
+    uint32_t flushed;           // flushes of the panels; submitted - flushed were coalesced or are pending
+} service;
+
+
+// The esp_timer task runs it: only wakes the service task, which does the transfer
+static void
+gray_tick(void *arg) {
+    size_t index = (size_t)arg;
+    service.slots[index].tick_us = esp_timer_get_time();
+    ++service.slots[index].ticks;
+    xTaskNotify(service.task, TICK_BIT(index), eSetBits);
+}
+
+
+// Starts the timer of the bitplanes at a period of frames, restarts it if the planes need another one, or stops
+// it; true if it did any. Doesn't log, as it runs under the lock.
+static bool
+gray_enable(slot_t *slot, bool on, uint32_t frames) {
+    if (on == slot->gray && (!on || frames == slot->frames)) {
+        return false;
+    }
+    if (slot->gray) {
+        ESP_ERROR_CHECK(esp_timer_stop(slot->timer));
+    }
+    else {
+        slot->contrast = slot->panel->contrast.set;
+        slot->plane = 0;
+    }
+    slot->gray = on;
+    slot->frames = frames;
+    if (on) {
+        slot->ticks_shown = slot->ticks;
+        uint64_t period_us = 1000000ULL * frames / ssd1306_frame_hz(slot->panel);
+        ESP_ERROR_CHECK(esp_timer_start_periodic(slot->timer, period_us));
+    }
+    else {
+        ssd1306_set_contrast(slot->panel, slot->contrast);
+    }
+    return true;
+}
+
+
+// After gray_enable() changed the timer of a panel
+static void
+gray_log(const slot_t *slot) {
+    unsigned index = (unsigned)(slot - service.slots);
+    if (slot->gray) {
+        ESP_LOGI(TAG, "Grayscale on; panel=%u, frames=%u, plane_bytes=%u, plane_us=%u", index, (unsigned)slot->frames,
+            (unsigned)ssd1306_gray_plane_bytes(slot->panel, &slot->gray_planes),
+            (unsigned)(1000000ULL * slot->frames / ssd1306_frame_hz(slot->panel)));
+    }
+    else {
+        ESP_LOGI(TAG, "Grayscale off; panel=%u, planes=%u, overruns=%u, max_late_us=%u", index,
+            (unsigned)slot->gray_stats.planes, (unsigned)slot->gray_stats.overruns, (unsigned)slot->gray_stats.max_late_us);
+    }
+}
+
+
+// The bus usage of all the panels, from their own stats
+static void
+sum_stats(ssd1306_stats_t *sum) {
+    memset(sum, 0, sizeof(*sum));
+    for (size_t i = 0; i < service.count; ++i) {
+        ssd1306_stats_t stats;
+        ssd1306_get_stats(service.slots[i].panel, &stats);
+        sum->transactions += stats.transactions;
+        sum->bytes += stats.bytes;
+        sum->busy_us += stats.busy_us;
+    }
+}
+
+
+static void
+service_task(void *arg) {
+    for (;;) {
+        // A submitted frame, a tick of the bitplanes, or the next reload of a marquee
+        int64_t due_us = INT64_MAX;
+        for (size_t i = 0; i < service.count; ++i) {
+            int64_t panel_due_us = service.slots[i].gray ? INT64_MAX : ssd1306_marquee_due_us(service.slots[i].panel);
+            due_us = (panel_due_us < due_us) ? panel_due_us : due_us;
+        }
+        uint32_t wake = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &wake,
+            (due_us == INT64_MAX) ? portMAX_DELAY : pdMS_TO_TICKS((uint32_t)(due_us / 1000)) + 1);
+
+        // Only the copy runs under the lock; the bus transfer doesn't hold up the producers.
+        // A gray frame waits for the end of the cycle shown, and sets the frames per plane its transfer needs.
+        bool switched[SSD1306_SERVICE_MAX_PANELS] = { false };
+        xSemaphoreTake(service.lock, portMAX_DELAY);
+        for (size_t i = 0; i < service.count; ++i) {
+            slot_t *slot = &service.slots[i];
+            if (!slot->pending || (slot->gray && slot->back.grayscale && slot->plane != 0)) {
+                continue;
+            }
+            uint32_t frames = 0;
+            if (slot->back.grayscale) {
+                slot->gray_planes = slot->back.gray;
+                ssd1306_marquee_set(slot->panel, NULL);
+                frames = ssd1306_gray_frames_per_plane(slot->panel, &slot->gray_planes);
+                frames = (frames > SSD1306_SERVICE_GRAY_FRAMES) ? frames : SSD1306_SERVICE_GRAY_FRAMES;
+            }
+            else {
+                ssd1306_fb_blit(slot->panel, 0, 0, SSD1306_WIDTH, slot->panel->geometry.pages, &slot->back.pages[0][0]);
+                esp_err_t status = ssd1306_marquee_set(slot->panel, &slot->back.marquee);
+                if (status != ESP_OK) {
+                    ESP_LOGW(TAG, "Invalid marquee, ignored; panel=%u, status=0x%x", (unsigned)i, status);
+                }
+            }
+            switched[i] = gray_enable(slot, slot->back.grayscale, frames);
+            slot->pending = false;
+        }
+        xSemaphoreGive(service.lock);
+        for (size_t i = 0; i < service.count; ++i) {
+            if (switched[i]) {
+                gray_log(&service.slots[i]);
+            }
+        }
+
+        // Gray goes out on the ticks only, one plane each; between them its framebuffer doesn't change
+        uint32_t missed[SSD1306_SERVICE_MAX_PANELS] = { 0 };
+        int64_t late_us[SSD1306_SERVICE_MAX_PANELS] = { 0 };
+        bool shown[SSD1306_SERVICE_MAX_PANELS] = { false };
+        for (size_t i = 0; i < service.count; ++i) {
+            slot_t *slot = &service.slots[i];
+            if (!slot->gray || !(wake & TICK_BIT(i))) {
+                continue;
+            }
+            uint32_t ticks = slot->ticks;
+            missed[i] = ticks - slot->ticks_shown - 1;
+            slot->ticks_shown = ticks;
+            late_us[i] = esp_timer_get_time() - slot->tick_us;
+            ssd1306_gray_show_plane(slot->panel, &slot->gray_planes, slot->plane);
+            slot->plane ^= 1;
+            shown[i] = true;
+        }
+
+        ssd1306_stats_t before, after;
+        sum_stats(&before);
+        esp_err_t status = ssd1306_flush_panels(service.panels, service.count, NULL);
+        sum_stats(&after);
+        if (status != ESP_OK) {
+            // The framebuffers stay dirty, so the retry sends what is missing
+            ESP_LOGW(TAG, "Flush failed, retrying; status=0x%x", status);
+            vTaskDelay(pdMS_TO_TICKS(SSD1306_SERVICE_RETRY_MS));
+            xTaskNotify(service.task, SUBMIT_BIT, eSetBits);
+            continue;
+        }
+        ESP_LOGV(TAG, "Flushed; transactions=%u, bytes=%u, us=%u", (unsigned)(after.transactions - before.transactions),
+            (unsigned)(after.bytes - before.bytes), (unsigned)(after.busy_us - before.busy_us));
+
+        xSemaphoreTake(service.lock, portMAX_DELAY);
+        ++service.flushed;
+        bool pending = false;
+        for (size_t i = 0; i < service.count; ++i) {
+            slot_t *slot = &service.slots[i];
+            ssd1306_get_stats(slot->panel, &slot->stats);
+            pending |= slot->pending;
+            if (shown[i]) {
+                ++slot->gray_stats.planes;
+                slot->gray_stats.overruns += missed[i];
+                if (late_us[i] > slot->gray_stats.max_late_us) {
+                    slot->gray_stats.max_late_us = late_us[i];
+                }
+            }
+        }
+        if (!pending) {
+            xEventGroupSetBits(service.events, IDLE_BIT);
+        }
+        xSemaphoreGive(service.lock);
+    }
+}
+
+
+esp_err_t
+ssd1306_service_start_panels(ssd1306_t *const *panels, size_t count, UBaseType_t priority) {
+    if (service.task) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (count == 0 || count > SSD1306_SERVICE_MAX_PANELS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    service.count = count;
+    service.lock = xSemaphoreCreateMutex();
+    service.events = xEventGroupCreate();
+    if (!service.lock || !service.events) {
+        return ESP_ERR_NO_MEM;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        service.slots[i].panel = service.panels[i] = panels[i];
+        const esp_timer_create_args_t timer_args = { .callback = &gray_tick, .arg = (void *)i, .name = "ssd1306_gray" };
+        esp_err_t status = esp_timer_create(&timer_args, &service.slots[i].timer);
+        if (status != ESP_OK) {
+            return status;
+        }
+    }
+    xEventGroupSetBits(service.events, IDLE_BIT);
+    if (xTaskCreate(&service_task, "ssd1306", SSD1306_SERVICE_STACK_SIZE, NULL, priority, &service.task) != pdPASS) {
+        service.task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+
+esp_err_t
+ssd1306_service_start(ssd1306_t *panel, UBaseType_t priority) {
+    return ssd1306_service_start_panels(&panel, 1, priority);
+}
+
+
+ssd1306_frame_t *
+ssd1306_service_begin_panel(size_t index) {
+    xSemaphoreTake(service.lock, portMAX_DELAY);
+    service.begun = (index < service.count) ? index : 0;
+    return &service.slots[service.begun].back;
+}
+
+
+ssd1306_frame_t *
+ssd1306_service_begin(void) {
+    return ssd1306_service_begin_panel(0);
+}
+
+
+ssd1306_frame_t *
+ssd1306_service_try_begin_panel(size_t index) {
+    if (xSemaphoreTake(service.lock, 0) != pdTRUE) {
+        return NULL;
+    }
+    service.begun = (index < service.count) ? index : 0;
+    return &service.slots[service.begun].back;
+}
+
+
+ssd1306_frame_t *
+ssd1306_service_try_begin(void) {
+    return ssd1306_service_try_begin_panel(0);
+}
+
+
+void
+ssd1306_service_submit(void) {
+    slot_t *slot = &service.slots[service.begun];
+    if (slot->pending) {
+        ESP_LOGD(TAG, "Frame coalesced; panel=%u, submitted=%u, flushed=%u", (unsigned)service.begun,
+            (unsigned)service.submitted, (unsigned)service.flushed);
+    }
+    slot->pending = true;
+    ++service.submitted;
+    xEventGroupClearBits(service.events, IDLE_BIT);
+    xSemaphoreGive(service.lock);
+    xTaskNotify(service.task, SUBMIT_BIT, eSetBits);
+}
+
+
+esp_err_t
+ssd1306_service_wait(TickType_t timeout) {
+    EventBits_t bits = xEventGroupWaitBits(service.events, IDLE_BIT, pdFALSE, pdTRUE, timeout);
+    return (bits & IDLE_BIT) ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+
+void
+ssd1306_service_get_stats(ssd1306_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    xSemaphoreTake(service.lock, portMAX_DELAY);
+    for (size_t i = 0; i < service.count; ++i) {
+        stats->transactions += service.slots[i].stats.transactions;
+        stats->bytes += service.slots[i].stats.bytes;
+        stats->busy_us += service.slots[i].stats.busy_us;
+    }
+    xSemaphoreGive(service.lock);
+}
+
+
+void
+ssd1306_service_get_gray_stats(ssd1306_service_gray_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    xSemaphoreTake(service.lock, portMAX_DELAY);
+    for (size_t i = 0; i < service.count; ++i) {
+        const ssd1306_service_gray_stats_t *gray = &service.slots[i].gray_stats;
+        stats->planes += gray->planes;
+        stats->overruns += gray->overruns;
+        stats->max_late_us = (gray->max_late_us > stats->max_late_us) ? gray->max_late_us : stats->max_late_us;
+    }
+    xSemaphoreGive(service.lock);
+}
+
+
+size_t
+ssd1306_service_get_stack_free(void) {
+    // In bytes, as ESP-IDF counts the stack of a task
+    return service.task ? (size_t)uxTaskGetStackHighWaterMark(service.task) : 0;
+}
+
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,88 @@
+#ifndef SSD1306_SERVICE_H
+#define SSD1306_SERVICE_H
+
+#include "ssd1306.h"
+
+#include <freertos/FreeRTOS.h>
+
+// A task that owns the panels of a bus once started, so that whoever shows something never waits for the bus.
+//
+// Each panel has two buffers: the back buffer, where its next screen is drawn between
+// ssd1306_service_begin_panel() and ssd1306_service_submit(), and the framebuffer of the panel as the front
+// buffer. The task copies the back buffers into the front ones under a short lock, only the bytes that
+// changed, and flushes the front buffers outside of it, all together by ssd1306_flush_panels(). Frames
+// submitted while a flush is running are coalesced: only the latest of each panel is sent. After
+// ssd1306_service_start(), nothing else may draw into the framebuffers or talk to the panels.
+// There is one service, for up to SSD1306_SERVICE_MAX_PANELS panels on one bus.
+//
+// A frame may be grayscale instead (ssd1306_gray_t): then an esp_timer of its panel has the task show its
+// bitplanes in turn, each for the same frames of the panel. A new gray frame replaces the planes shown only
+// after a low plane, so that no pixel mixes the bits of two frames. The transfer of a plane has to fit its
+// period, or the planes show for uneven times and the levels shift: so each gray frame shows its planes for
+// as many frames as ssd1306_gray_frames_per_plane() tells from the bytes they differ by and the rate of the
+// bus, and at least SSD1306_SERVICE_GRAY_FRAMES. The panels of a bus each take their own share of it, so
+// with several panels in gray at once they may still overrun: ssd1306_service_get_gray_stats() counts the
+// periods missed, and host/ssd1306_wire tells the bytes a plane takes on the wire.
+
+// Each panel takes a back buffer of a ssd1306_frame_t
+#ifndef SSD1306_SERVICE_MAX_PANELS
+#   define SSD1306_SERVICE_MAX_PANELS 1
+#endif // SSD1306_SERVICE_MAX_PANELS
+
+// The task logs with ESP_LOGI/ESP_LOGW, whose vprintf() takes most of its stack, on top of the locals of a
+// flush of every panel; ssd1306_service_get_stack_free() tells what a gray and coalesced run has left
+// (test/test_ssd1306_service.c)
+#ifndef SSD1306_SERVICE_STACK_SIZE
+#   define SSD1306_SERVICE_STACK_SIZE 3072
+#endif // SSD1306_SERVICE_STACK_SIZE
+
+// The wait before retrying a flush that failed, e.g. on a bus error
+#ifndef SSD1306_SERVICE_RETRY_MS
+#   define SSD1306_SERVICE_RETRY_MS 100
+#endif // SSD1306_SERVICE_RETRY_MS
+
+// The fewest frames of the panel each bitplane of a gray frame shows for: with 1, a 128x32 panel shows up to
+// 214 planes per second, so a gray cycle of 107 Hz, when the bus carries them
+#ifndef SSD1306_SERVICE_GRAY_FRAMES
+#   define SSD1306_SERVICE_GRAY_FRAMES 1
+#endif // SSD1306_SERVICE_GRAY_FRAMES
+
+typedef struct {
+    uint8_t pages[SSD1306_MAX_PAGES][SSD1306_WIDTH];  // the layout of the framebuffer; those of the panel are shown
+    ssd1306_marquee_t marquee;                        // over pages, while it has any; the task keeps it scrolling
+    bool grayscale;                                   // show gray instead of pages and marquee
+    ssd1306_gray_t gray;
+} ssd1306_frame_t;
+
+// The bitplanes shown since ssd1306_service_start(), by all the panels
+typedef struct {
+    uint32_t planes;
+    uint32_t overruns;      // periods of the timer missed, as the transfer of a plane took longer
+    int64_t max_late_us;    // the longest delay from a tick of the timer to the transfer of its plane
+} ssd1306_service_gray_stats_t;
+
+// Starts the task, for panels on one bus initialized by ssd1306_init(); index i of the other functions is panels[i]
+esp_err_t ssd1306_service_start_panels(ssd1306_t *const *panels, size_t count, UBaseType_t priority);
+// Starts the task for a single panel
+esp_err_t ssd1306_service_start(ssd1306_t *panel, UBaseType_t priority);
+
+// Locks and returns the back buffer of a panel, which holds the last frame submitted: draw the changes into it
+ssd1306_frame_t *ssd1306_service_begin_panel(size_t index);
+// The same for the first panel
+ssd1306_frame_t *ssd1306_service_begin(void);
+// The same without waiting: NULL if another caller or the task holds the lock, e.g. from an esp_timer callback
+ssd1306_frame_t *ssd1306_service_try_begin_panel(size_t index);
+ssd1306_frame_t *ssd1306_service_try_begin(void);
+// Unlocks the back buffer and has the task send it; returns at once
+void ssd1306_service_submit(void);
+// Waits until every frame submitted so far is on its panel; ESP_ERR_TIMEOUT if that takes longer than timeout
+esp_err_t ssd1306_service_wait(TickType_t timeout);
+
+// The bus usage of all the panels, as of the last flush of the task
+void ssd1306_service_get_stats(ssd1306_stats_t *stats);
+void ssd1306_service_get_gray_stats(ssd1306_service_gray_stats_t *stats);
+// The fewest bytes of its stack the task has had left so far, to size SSD1306_SERVICE_STACK_SIZE by
+size_t ssd1306_service_get_stack_free(void);
+
+#endif // SSD1306_SERVICE_H
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,76 @@
+// The 4-wire SPI transport: the D/C pin is set at each phase, and each segment is one polled SPI transaction,
+// so that the pin never changes while bytes are shifted out.
+#include "ssd1306.h"
+#include <stdio.h>
+#include <string.h>
+
+
+static esp_err_t
+spi_send(ssd1306_transport_t *transport, const ssd1306_segment_t *segments, size_t count) {
+    ssd1306_spi_t *spi = (ssd1306_spi_t *)transport;
+    for (size_t i = 0; i < count; ++i) {
+        if (i == 0 || segments[i].data != segments[i - 1].data) {
+            gpio_set_level(spi->dc_io, segments[i].data);
+        }
+        if (segments[i].length == 0) {
+            continue;
+        }
+        spi_transaction_t t;
+        memset(&t, 0, sizeof(t));
+        t.length = segments[i].length * 8;
+        t.tx_buffer = segments[i].bytes;
+        esp_err_t status = spi_device_polling_transmit(spi->device, &t);
+        if (status != ESP_OK) {
+            return status;
+        }
+    }
+    return ESP_OK;
+}
+
+
+esp_err_t
+ssd1306_spi_init(ssd1306_spi_t *spi, spi_host_device_t host, int cs_io, int dc_io, int clock_hz) {
+    spi_device_interface_config_t dev_conf;
+    memset(&dev_conf, 0, sizeof(dev_conf));
+    dev_conf.mode = 0;
+    dev_conf.clock_speed_hz = clock_hz;
+    dev_conf.spics_io_num = cs_io;
+    dev_conf.queue_size = 1;
+
+    esp_err_t status = gpio_set_direction(dc_io, GPIO_MODE_OUTPUT);
+    if (status != ESP_OK) {
+        return status;
+    }
+    status = spi_bus_add_device(host, &dev_conf, &spi->device);
+    if (status != ESP_OK) {
+        return status;
+    }
+    spi->base.send = spi_send;
+    spi->base.phase_overhead = 0;
+    spi->base.bytes_per_s = clock_hz / 8;
+    spi->dc_io = dc_io;
+    return ESP_OK;
+}
+
+
+esp_err_t
+ssd1306_spi_bus_init(spi_host_device_t host, int mosi_io, int sclk_io) {
+    spi_bus_config_t bus_conf;
+    memset(&bus_conf, 0, sizeof(bus_conf));
+    bus_conf.mosi_io_num = mosi_io;
+    bus_conf.miso_io_num = -1;
+    bus_conf.sclk_io_num = sclk_io;
+    bus_conf.quadwp_io_num = -1;
+    bus_conf.quadhd_io_num = -1;
+    bus_conf.max_transfer_sz = SSD1306_WIDTH * SSD1306_MAX_PAGES;
+
+    // DMA, as a segment can be a whole row of the framebuffer, longer than the 64 bytes without it
+    esp_err_t status = spi_bus_initialize(host, &bus_conf, 1);
+    if (status != ESP_OK) {
+        printf("spi_bus_initialize failed; status=0x%02x\n", status);
+        return status;
+    }
+    return ESP_OK;
+}
+
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,5 @@
+#
+# Component Makefile of the unit tests, built into the IDF unit-test-app with TEST_COMPONENTS=ssd1306
+#
+
+COMPONENT_ADD_LDFLAGS = -Wl,--whole-archive -l$(COMPONENT_NAME) -Wl,--no-whole-archive
@@ -0,0 +1,75 @@
+// The heap use of the I2C transport: since ESP-IDF v4.4 the command links are built in the memory that
+// ssd1306_i2c_init() allocates, so a steady-state flush must not touch the heap. Run in the unit-test-app:
+//
+//   cd $IDF_PATH/tools/unit-test-app && idf.py -T ssd1306 build flash monitor
+//
+// With CONFIG_HEAP_TRACING_STANDALONE every allocation of the flushes is counted, freed or not; otherwise
+// only the free heap before and after them is compared, which misses an allocation that is freed again.
+// No panel needs to be on the bus: without the ACK the transfers fail, after building the same links.
+#include "ssd1306.h"
+
+#include <esp_heap_caps.h>
+#include <esp_idf_version.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+#ifdef CONFIG_HEAP_TRACING_STANDALONE
+#include <esp_heap_trace.h>
+#endif // CONFIG_HEAP_TRACING_STANDALONE
+
+#define TEST_I2C I2C_NUM_1
+#define TEST_SDA_IO 23
+#define TEST_SCL_IO 22
+#define TEST_FLUSHES 20
+
+
+// A line of text that changes with i, as the screens of the firmware do between two flushes
+static void
+draw_and_flush(ssd1306_t *panel, int i) {
+    uint8_t line[60];
+    memset(line, (i & 1) ? 0x55 : 0xaa, sizeof(line));
+    ssd1306_fb_write(panel, 48, 1, line, sizeof(line));
+    ssd1306_flush(panel);
+}
+
+
+TEST_CASE("steady-state flushes over I2C don't allocate", "[ssd1306]")
+{
+#if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(4, 4, 0)
+    TEST_IGNORE_MESSAGE("every I2C command link comes from the heap before ESP-IDF v4.4");
+#else
+    static ssd1306_i2c_t i2c;
+    static ssd1306_t panel;
+
+    TEST_ESP_OK(ssd1306_i2c_bus_init(TEST_I2C, TEST_SDA_IO, TEST_SCL_IO));
+    TEST_ESP_OK(ssd1306_i2c_init(&i2c, TEST_I2C, SSD1306_I2C_ADDRESS));
+    TEST_ASSERT_NOT_NULL(i2c.link_storage);
+    ssd1306_init(&panel, &i2c.base, SSD1306_GEOMETRY_128X32);
+    draw_and_flush(&panel, 0);
+
+#ifdef CONFIG_HEAP_TRACING_STANDALONE
+    static heap_trace_record_t records[16];
+    TEST_ESP_OK(heap_trace_init_standalone(records, sizeof(records) / sizeof(records[0])));
+    TEST_ESP_OK(heap_trace_start(HEAP_TRACE_ALL));
+#endif // CONFIG_HEAP_TRACING_STANDALONE
+    size_t free_before = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    for (int i = 1; i <= TEST_FLUSHES; ++i) {
+        draw_and_flush(&panel, i);
+    }
+    size_t free_after = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+#ifdef CONFIG_HEAP_TRACING_STANDALONE
+    TEST_ESP_OK(heap_trace_stop());
+    size_t traced = heap_trace_get_count();
+    if (traced > 0) {
+        heap_trace_dump();
+    }
+    TEST_ASSERT_EQUAL(0, traced);
+#endif // CONFIG_HEAP_TRACING_STANDALONE
+    TEST_ASSERT_EQUAL(free_before, free_after);
+
+    free(i2c.link_storage);
+    TEST_ESP_OK(i2c_driver_delete(TEST_I2C));
+#endif // ESP_IDF_VERSION
+}
+
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,65 @@
+// The stack of the display service task, which SSD1306_SERVICE_STACK_SIZE sizes: a run of gray frames and
+// of coalesced text frames, with the logging of the task at its default level, has to leave a margin of it.
+// The task stays for the rest of the boot, on an in-memory panel. Run in the unit-test-app:
+//
+//   cd $IDF_PATH/tools/unit-test-app && idf.py -T ssd1306 build flash monitor
+#include "ssd1306_mock.h"
+#include "ssd1306_service.h"
+
+#include <freertos/task.h>
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#define TEST_STACK_MARGIN 512
+#define TEST_COALESCED 20
+
+
+// Submits a text frame that changes with i, as the screens of the firmware do
+static void
+submit_text(int i) {
+    ssd1306_frame_t *frame = ssd1306_service_begin();
+    frame->grayscale = false;
+    memset(frame->pages, (i & 1) ? 0x55 : 0xaa, sizeof(frame->pages));
+    ssd1306_service_submit();
+}
+
+
+// Submits a gray frame of four levels, which switches the panel to its bitplanes
+static void
+submit_gray(void) {
+    ssd1306_frame_t *frame = ssd1306_service_begin();
+    frame->grayscale = true;
+    memset(&frame->gray, 0, sizeof(frame->gray));
+    for (uint8_t x = 0; x < 64; ++x) {
+        ssd1306_gray_pixel(&frame->gray, x, x % 32, (uint8_t)(x / 16));
+    }
+    ssd1306_service_submit();
+}
+
+
+TEST_CASE("the display service task leaves a margin of its stack", "[ssd1306]")
+{
+    static ssd1306_mock_t mock;
+    static ssd1306_t panel;
+
+    ssd1306_mock_init(&mock, NULL, 0, 0);
+    TEST_ESP_OK(ssd1306_init(&panel, &mock.base, SSD1306_GEOMETRY_128X32));
+    TEST_ESP_OK(ssd1306_service_start(&panel, 5));
+
+    for (int round = 0; round < 2; ++round) {
+        submit_gray();
+        vTaskDelay(pdMS_TO_TICKS(100));     // planes shown on the ticks of the timer
+        for (int i = 0; i < TEST_COALESCED; ++i) {
+            submit_text(i);                 // back to back, most of them coalesced
+        }
+        TEST_ESP_OK(ssd1306_service_wait(pdMS_TO_TICKS(1000)));
+    }
+
+    size_t stack_free = ssd1306_service_get_stack_free();
+    printf("Service stack; size=%u, used=%u, free=%u\n", (unsigned)SSD1306_SERVICE_STACK_SIZE,
+        (unsigned)(SSD1306_SERVICE_STACK_SIZE - stack_free), (unsigned)stack_free);
+    TEST_ASSERT_GREATER_OR_EQUAL(TEST_STACK_MARGIN, stack_free);
+}
+
+// vim: set sw=4 ts=4 indk= et si:
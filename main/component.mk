@@ -4,3 +4,19 @@
 # (Uses default behaviour of compiling all source files in directory, adding 'include' to include path.)
 
 COMPONENT_EMBED_TXTFILES :=  ${PROJECT_PATH}/static_data/private.key ${PROJECT_PATH}/static_data/server.crt
+
+# The QR-Codes of the constant payloads (include/qr_payloads.h) are rendered on the build host
+# by host/gen_static_qr.c, with the same qrcodegen.c as the firmware
+QRCODEGEN_DIR := $(PROJECT_PATH)/components/qrcodegen
+CFLAGS += -I$(COMPONENT_BUILD_DIR)
+COMPONENT_EXTRA_CLEAN := static_qr_pages.h static_qr/qrcodegen_tables.h static_qr/gen_static_qr
+
+peripheral_test.o: static_qr_pages.h
+
+static_qr_pages.h: $(COMPONENT_PATH)/host/gen_static_qr.c $(COMPONENT_PATH)/include/qr_payloads.h $(COMPONENT_PATH)/include/wifi_creds.h \
+		$(QRCODEGEN_DIR)/qrcodegen.c $(QRCODEGEN_DIR)/qrcodegen.h $(QRCODEGEN_DIR)/gen_tables.py
+	mkdir -p static_qr
+	$(PYTHON) $(QRCODEGEN_DIR)/gen_tables.py static_qr/qrcodegen_tables.h
+	$(HOSTCC) -std=c99 -O2 -I$(QRCODEGEN_DIR) -Istatic_qr -I$(COMPONENT_PATH)/include \
+		-o static_qr/gen_static_qr $(COMPONENT_PATH)/host/gen_static_qr.c $(QRCODEGEN_DIR)/qrcodegen.c
+	static_qr/gen_static_qr $@
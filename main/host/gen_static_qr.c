@@ -0,0 +1,70 @@
+// Renders the QR-Codes of the constant payloads of qr_payloads.h into SSD1306 page bitmaps,
+// written as a C header, so that the firmware doesn't have to encode them at runtime.
+// Built and run on the build host by the main component.
+//
+// Usage: gen_static_qr static_qr_pages.h
+
+#include "qrcodegen.h"
+#include "qr_payloads.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int
+emit_pages(FILE *out, const char *name, const char *payload) {
+    uint8_t tempBuffer[WIFI_QR_SIZE];
+    uint8_t qrcode[WIFI_QR_SIZE];
+    size_t input_length = strlen(payload);
+
+    if (input_length > sizeof(tempBuffer)) {
+        fprintf(stderr, "%s: payload too long: %s\n", name, payload);
+        return -1;
+    }
+    memcpy(tempBuffer, payload, input_length);
+    // Byte mode at ECC level L, boosted if it still fits WIFI_QR_VERSION
+    if (!qrcodegen_encodeBinary(tempBuffer, input_length, qrcode, qrcodegen_Ecc_LOW, WIFI_QR_VERSION, WIFI_QR_VERSION, qrcodegen_Mask_AUTO, true)) {
+        fprintf(stderr, "%s: payload does not fit in version %d: %s\n", name, WIFI_QR_VERSION, payload);
+        return -1;
+    }
+
+    uint8_t pages[QR_AREA_WIDTH * QR_AREA_PAGES] = { 0 };
+    qrcodegen_renderPages(qrcode, pages, QR_AREA_WIDTH, QR_AREA_PAGES, QR_AREA_LEFT, QR_AREA_TOP, QR_AREA_QUIET_ZONE, QR_AREA_SCALE);
+
+    fprintf(out, "// %s\n", payload);
+    fprintf(out, "static const uint8_t %s[QR_AREA_WIDTH * QR_AREA_PAGES] = {\n", name);
+    for (size_t i = 0; i < sizeof(pages); ++i) {
+        fprintf(out, "%s0x%02x,%s", (i % QR_AREA_WIDTH) ? " " : "    ", pages[i], (i % QR_AREA_WIDTH == QR_AREA_WIDTH - 1) ? "\n" : "");
+    }
+    fprintf(out, "};\n\n");
+    return 0;
+}
+
+
+int
+main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s static_qr_pages.h\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    FILE *out = fopen(argv[1], "w");
+    if (!out) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(out, "// Generated by gen_static_qr - do not edit.\n");
+    fprintf(out, "#pragma once\n\n");
+    fprintf(out, "#include \"qr_payloads.h\"\n\n");
+    int status = emit_pages(out, "WIFI_QR_PAGES", WIFI_QR_PAYLOAD);
+    if (!status) {
+        status = emit_pages(out, "URL_QR_PAGES", URL_QR_PAYLOAD);
+    }
+    if (fclose(out) || status) {
+        remove(argv[1]);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,311 @@
+// Reassembles a buffer sent as QR-Code frames by lcd_QR_frames() (see qr_frames.h), from the texts of the
+// scanned frames, one per line, in any order and with repeats; e.g. the output of `zbarcam --raw`.
+// Lines that are not frames, and frames of another buffer than the first one seen, are skipped.
+//
+// With -t, measures the throughput of the transport instead: a random buffer is split into frames, each is
+// encoded and rendered like on the device, and a camera is simulated that captures the panel at a given
+// frame rate and fails to decode some of the captures. For each display period, from the fastest the I2C
+// link allows, reports how long the camera takes to collect all the frames, and the payload bytes per second.
+//
+// Usage: qr_unframe [-o output] [scans.txt ...]
+//        qr_unframe -t [-n bytes] [-c camera_fps] [-l loss_percent]
+
+#define _POSIX_C_SOURCE 200809L  // For getopt() and clock_gettime()
+
+#include "qrcodegen.h"
+#include "qr_frames.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// The I2C transfers of lcd_QR_pages() at the default 400 kHz of ssd1306_i2c_bus_init(), in bytes of 9 clocks:
+// address, control byte and the 6 bytes of ssd1306_set_range(), then address, control byte and the pages
+#define I2C_HZ              400000
+#define QR_AREA_BYTES       (48 * 4)
+#define FRAME_I2C_BYTES     (2 + 6 + 2 + QR_AREA_BYTES)
+#define FRAME_I2C_SECONDS   (FRAME_I2C_BYTES * 9.0 / I2C_HZ)
+
+#define TRIALS              200
+
+typedef struct {
+    bool started;
+    uint8_t session;
+    uint16_t last;
+    uint8_t last_length;    // stream bytes of the last frame
+    uint8_t *stream;
+    uint8_t *received;      // per frame
+    uint32_t missing;
+    uint32_t duplicates;
+    uint32_t foreign;       // frames of another buffer
+} decoder_t;
+
+
+static void
+decoder_init(decoder_t *decoder) {
+    memset(decoder, 0, sizeof(*decoder));
+}
+
+
+static void
+decoder_free(decoder_t *decoder) {
+    free(decoder->stream);
+    free(decoder->received);
+    decoder_init(decoder);
+}
+
+
+// Adds a frame; returns true once all of them are in
+static bool
+decoder_add(decoder_t *decoder, const qr_frame_t *frame) {
+    if (!decoder->started) {
+        decoder->started = true;
+        decoder->session = frame->session;
+        decoder->last = frame->last;
+        decoder->stream = malloc(((size_t)frame->last + 1) * QR_FRAMES_DATA_LEN);
+        decoder->received = calloc((size_t)frame->last + 1, 1);
+        if (!decoder->stream || !decoder->received) {
+            fprintf(stderr, "Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        decoder->missing = (uint32_t)frame->last + 1;
+    }
+    if (frame->session != decoder->session || frame->last != decoder->last) {
+        ++decoder->foreign;
+    }
+    else if (decoder->received[frame->index]) {
+        ++decoder->duplicates;
+    }
+    else {
+        decoder->received[frame->index] = 1;
+        --decoder->missing;
+        memcpy(decoder->stream + (size_t)frame->index * QR_FRAMES_DATA_LEN, frame->data, frame->length);
+        if (frame->index == frame->last) {
+            decoder->last_length = frame->length;
+        }
+    }
+    return decoder->started && decoder->missing == 0;
+}
+
+
+// Checks the CRC of the complete stream and returns the length of the buffer, or -1 if it's corrupt
+static long
+decoder_finish(const decoder_t *decoder) {
+    size_t stream_length = (size_t)decoder->last * QR_FRAMES_DATA_LEN + decoder->last_length;
+    if (stream_length < QR_FRAMES_CRC_LEN) {
+        return -1;
+    }
+    size_t length = stream_length - QR_FRAMES_CRC_LEN;
+    const uint8_t *crc_bytes = decoder->stream + length;
+    uint32_t crc = crc_bytes[0] | (uint32_t)crc_bytes[1] << 8 | (uint32_t)crc_bytes[2] << 16 | (uint32_t)crc_bytes[3] << 24;
+    if (qr_frames_crc32(0, decoder->stream, length) != crc || (uint8_t)crc != decoder->session) {
+        return -1;
+    }
+    return (long)length;
+}
+
+
+// Feeds the lines of the given file to the decoder; returns true once it's complete
+static bool
+decode_lines(decoder_t *decoder, FILE *in, unsigned *skipped) {
+    char line[4096];
+    while (fgets(line, sizeof(line), in)) {
+        size_t length = strcspn(line, "\r\n");
+        qr_frame_t frame;
+        if (!qr_frames_parse(line, length, &frame)) {
+            ++*skipped;
+            continue;
+        }
+        if (decoder_add(decoder, &frame)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static int
+decode_main(const char *output, char **inputs, int num_inputs) {
+    decoder_t decoder;
+    decoder_init(&decoder);
+    unsigned skipped = 0;
+    bool complete = false;
+    if (num_inputs == 0) {
+        complete = decode_lines(&decoder, stdin, &skipped);
+    }
+    for (int i = 0; i < num_inputs && !complete; ++i) {
+        FILE *in = fopen(inputs[i], "r");
+        if (!in) {
+            perror(inputs[i]);
+            return EXIT_FAILURE;
+        }
+        complete = decode_lines(&decoder, in, &skipped);
+        fclose(in);
+    }
+    fprintf(stderr, "frames: %u of %u, duplicates=%u, foreign=%u, skipped lines=%u\n",
+        decoder.started ? decoder.last + 1 - decoder.missing : 0, decoder.started ? decoder.last + 1 : 0,
+        decoder.duplicates, decoder.foreign, skipped);
+    if (!complete) {
+        fprintf(stderr, "Incomplete\n");
+        return EXIT_FAILURE;
+    }
+    long length = decoder_finish(&decoder);
+    if (length < 0) {
+        fprintf(stderr, "CRC mismatch\n");
+        return EXIT_FAILURE;
+    }
+
+    FILE *out = output ? fopen(output, "wb") : stdout;
+    if (!out) {
+        perror(output);
+        return EXIT_FAILURE;
+    }
+    if (fwrite(decoder.stream, 1, (size_t)length, out) != (size_t)length || (output && fclose(out) != 0)) {
+        perror(output ? output : "stdout");
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "%ld bytes\n", length);
+    decoder_free(&decoder);
+    return EXIT_SUCCESS;
+}
+
+
+static double
+now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+// The seconds the simulated camera takes to collect all the frames
+static double
+simulate_camera(const qr_frame_t *parsed, uint32_t count, double period, double camera_fps, int loss_percent) {
+    decoder_t decoder;
+    decoder_init(&decoder);
+    double t = (double)rand() / RAND_MAX / camera_fps;  // random phase
+    uint32_t offset = (uint32_t)rand() % count;         // and starting frame
+    for (;; t += 1.0 / camera_fps) {
+        if (rand() % 100 < loss_percent) {
+            continue;
+        }
+        uint32_t index = (offset + (uint32_t)(t / period)) % count;
+        if (decoder_add(&decoder, &parsed[index])) {
+            break;
+        }
+    }
+    decoder_free(&decoder);
+    return t;
+}
+
+
+static int
+test_main(size_t length, double camera_fps, int loss_percent) {
+    uint8_t *data = malloc(length + 1);
+    for (size_t i = 0; i < length; ++i) {
+        data[i] = (uint8_t)rand();
+    }
+    qr_frames_t frames;
+    if (!qr_frames_init(&frames, data, length)) {
+        fprintf(stderr, "Too long for QR frames\n");
+        return EXIT_FAILURE;
+    }
+
+    // Encode and render each frame like render_QR_frame() does, and check that it comes back intact
+    qr_frame_t *parsed = malloc(frames.count * sizeof(*parsed));
+    decoder_t decoder;
+    decoder_init(&decoder);
+    double encode_seconds = 0;
+    for (uint32_t i = 0; i < frames.count; ++i) {
+        char text[QR_FRAMES_TEXT_MAX + 1];
+        uint8_t tempBuffer[qrcodegen_BUFFER_LEN_FOR_VERSION(QR_FRAMES_VERSION)];
+        uint8_t qrcode[qrcodegen_BUFFER_LEN_FOR_VERSION(QR_FRAMES_VERSION)];
+        uint8_t pages[QR_AREA_BYTES] = { 0 };
+        size_t text_length = qr_frames_text(&frames, i, text);
+        double start = now();
+        if (!qrcodegen_encodeText(text, tempBuffer, qrcode, qrcodegen_Ecc_LOW, QR_FRAMES_VERSION, QR_FRAMES_VERSION, qrcodegen_Mask_FAST, true)) {
+            fprintf(stderr, "Frame %u does not fit in version %d: %s\n", (unsigned)i, QR_FRAMES_VERSION, text);
+            return EXIT_FAILURE;
+        }
+        qrcodegen_renderPages(qrcode, pages, 48, 4, 7, 0, 1, 1);
+        encode_seconds += now() - start;
+        if (!qr_frames_parse(text, text_length, &parsed[i]) || parsed[i].index != i) {
+            fprintf(stderr, "Frame %u does not parse: %s\n", (unsigned)i, text);
+            return EXIT_FAILURE;
+        }
+        decoder_add(&decoder, &parsed[i]);
+    }
+    if (decoder.missing != 0 || decoder_finish(&decoder) != (long)length || memcmp(decoder.stream, data, length) != 0) {
+        fprintf(stderr, "Round trip failed\n");
+        return EXIT_FAILURE;
+    }
+    decoder_free(&decoder);
+
+    printf("%u bytes in %u frames of %d bytes (version %d, %d characters), host encode+render %.1f us per frame\n",
+        (unsigned)length, (unsigned)frames.count, QR_FRAMES_DATA_LEN, QR_FRAMES_VERSION, QR_FRAMES_TEXT_MAX,
+        encode_seconds * 1e6 / frames.count);
+    printf("I2C: %d bytes per frame, %.2f ms at %d kHz, at most %.0f payload bytes/s\n", FRAME_I2C_BYTES,
+        FRAME_I2C_SECONDS * 1e3, I2C_HZ / 1000, length / (frames.count * FRAME_I2C_SECONDS));
+    printf("camera at %.0f fps, %d%% of the captures lost, mean of %d runs:\n", camera_fps, loss_percent, TRIALS);
+    printf("  period ms  frame rate  seconds  payload bytes/s\n");
+    const double periods[] = { FRAME_I2C_SECONDS, 0.020, 0.033, 0.050, 0.066, 0.100 };
+    for (size_t p = 0; p < sizeof(periods) / sizeof(periods[0]); ++p) {
+        double total = 0;
+        for (int trial = 0; trial < TRIALS; ++trial) {
+            total += simulate_camera(parsed, frames.count, periods[p], camera_fps, loss_percent);
+        }
+        double seconds = total / TRIALS;
+        printf("  %9.1f  %10.1f  %7.2f  %15.0f%s\n", periods[p] * 1e3, 1 / periods[p], seconds, length / seconds,
+            p == 0 ? "  (I2C limit)" : "");
+    }
+    free(parsed);
+    free(data);
+    return EXIT_SUCCESS;
+}
+
+
+int
+main(int argc, char **argv) {
+    const char *output = NULL;
+    bool test = false;
+    size_t length = 1200;   // about a PEM certificate
+    double camera_fps = 30;
+    int loss_percent = 20;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:tn:c:l:")) != -1) {
+        switch (opt) {
+            case 'o':
+                output = optarg;
+                break;
+            case 't':
+                test = true;
+                break;
+            case 'n':
+                length = strtoul(optarg, NULL, 0);
+                break;
+            case 'c':
+                camera_fps = atof(optarg);
+                break;
+            case 'l':
+                loss_percent = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-o output] [scans.txt ...]\n"
+                    "       %s -t [-n bytes] [-c camera_fps] [-l loss_percent]\n", argv[0], argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (test) {
+        if (camera_fps <= 0 || loss_percent < 0 || loss_percent >= 100) {
+            fprintf(stderr, "Invalid camera parameters\n");
+            return EXIT_FAILURE;
+        }
+        srand(1);
+        return test_main(length, camera_fps, loss_percent);
+    }
+    return decode_main(output, argv + optind, argc - optind);
+}
+
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,63 @@
+#ifndef QR_CACHE_H
+#define QR_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <esp_err.h>
+#include "qrcodegen.h"
+
+// LRU cache of finished QR-Code bitmaps, so that the same payload is not re-encoded
+// every time it is shown, e.g. the frames of the server certificate in lcd_QR_frames().
+// The constant payloads of the display_* screens are rendered at build time instead (static_qr_pages.h).
+// Entries are keyed by the SHA-256 of the payload plus the encoder parameters, and kept in DRAM.
+// Optionally they are also written to NVS, so they survive a reboot.
+
+// The largest QR-Code version that can be cached
+#ifndef QR_CACHE_MAX_VERSION
+#   define QR_CACHE_MAX_VERSION 3
+#endif // QR_CACHE_MAX_VERSION
+
+// The number of bitmaps kept in DRAM: enough for the 28 frames of the server certificate,
+// which are all looked up before the first one is shown again
+#ifndef QR_CACHE_ENTRIES
+#   define QR_CACHE_ENTRIES     32
+#endif // QR_CACHE_ENTRIES
+
+// The number of bitmaps kept in NVS; a new payload replaces the one in its slot
+#ifndef QR_CACHE_NVS_SLOTS
+#   define QR_CACHE_NVS_SLOTS   32
+#endif // QR_CACHE_NVS_SLOTS
+
+// The format of the entries: bump it whenever the encoder or the layout of the entries changes, so that the
+// entries in NVS written by an older firmware are not shown
+#define QR_CACHE_FORMAT      2
+
+#define QR_CACHE_BITMAP_SIZE (qrcodegen_BUFFER_LEN_FOR_VERSION(QR_CACHE_MAX_VERSION))
+
+typedef struct {
+    uint8_t digest[32]; // SHA-256 of the payload
+    uint16_t length;    // payload length
+    uint8_t format;     // QR_CACHE_FORMAT
+    uint8_t version;    // min = max version
+    uint8_t ecl;        // enum qrcodegen_Ecc
+    int8_t mask;        // enum qrcodegen_Mask as requested, may be qrcodegen_Mask_AUTO
+    uint8_t boost_ecl;
+} qr_cache_key_t;
+
+typedef struct {
+    uint32_t hits;      // found in DRAM
+    uint32_t nvs_hits;  // found in NVS, then moved to DRAM
+    uint32_t misses;    // had to be encoded
+    uint32_t evictions; // DRAM entries dropped to make room
+} qr_cache_stats_t;
+
+esp_err_t qr_cache_init(bool use_nvs);
+void qr_cache_make_key(qr_cache_key_t *key, const uint8_t *payload, size_t length,
+    enum qrcodegen_Ecc ecl, int version, enum qrcodegen_Mask mask, bool boost_ecl);
+bool qr_cache_lookup(const qr_cache_key_t *key, uint8_t *qrcode);
+void qr_cache_store(const qr_cache_key_t *key, const uint8_t *qrcode);
+void qr_cache_get_stats(qr_cache_stats_t *stats);
+
+#endif // QR_CACHE_H
+// vim: set sw=4 ts=4 indk= et si:
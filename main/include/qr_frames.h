@@ -0,0 +1,73 @@
+#ifndef QR_FRAMES_H
+#define QR_FRAMES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Splits a buffer that is too large for one QR-Code into numbered frames, to be shown one after
+// the other and reassembled by the receiver (host/qr_unframe.c) in any order, from any number of cycles.
+//
+// Each frame is a text in the QR alphanumeric mode: the unpadded RFC 4648 base32 of a 5 byte header
+// (session, index and last index, big-endian), then of up to QR_FRAMES_DATA_LEN bytes of the stream.
+// The stream is the data followed by its CRC-32, little-endian, and the session is the low byte
+// of that CRC, so that frames of different buffers are not mixed up.
+// Base32 takes 8 characters of 5.5 bits for 5 bytes, 10% more than the byte mode,
+// but the frames are plain text that any scanner app passes on unchanged.
+//
+// Pure C, shared by the firmware and the host tools.
+
+// The QR-Code version of the frames: version 3 (29 x 29) is the largest that fits the 32 rows of the panel
+#ifndef QR_FRAMES_VERSION
+#   define QR_FRAMES_VERSION 3
+#endif // QR_FRAMES_VERSION
+
+// The stream bytes per frame; a whole frame must fit the alphanumeric capacity of QR_FRAMES_VERSION
+// at ECC L, which is 77 characters for version 3: 8 + 64 for 40 bytes
+#ifndef QR_FRAMES_DATA_LEN
+#   define QR_FRAMES_DATA_LEN 40
+#endif // QR_FRAMES_DATA_LEN
+
+#define QR_FRAMES_HEADER_LEN 5
+#define QR_FRAMES_CRC_LEN 4
+
+// The base32 length of n bytes, without padding
+#define QR_FRAMES_BASE32_LEN(n) (((n) * 8 + 4) / 5)
+
+// The longest frame text, without the terminating null
+#define QR_FRAMES_TEXT_MAX (QR_FRAMES_BASE32_LEN(QR_FRAMES_HEADER_LEN) + QR_FRAMES_BASE32_LEN(QR_FRAMES_DATA_LEN))
+
+// The largest buffer that can be split: 65536 frames
+#define QR_FRAMES_MAX_LENGTH (65536UL * QR_FRAMES_DATA_LEN - QR_FRAMES_CRC_LEN)
+
+typedef struct {
+    const uint8_t *data;
+    size_t length;
+    uint32_t crc;       // CRC-32 of the data, sent after it
+    uint32_t count;     // number of frames
+} qr_frames_t;
+
+// A frame as parsed by qr_frames_parse()
+typedef struct {
+    uint8_t session;
+    uint16_t index;
+    uint16_t last;      // index of the last frame
+    uint8_t length;     // stream bytes in data
+    uint8_t data[QR_FRAMES_DATA_LEN];
+} qr_frame_t;
+
+// Prepares the frames of the given data, which must stay valid while they are used.
+// Returns false if it is longer than QR_FRAMES_MAX_LENGTH.
+bool qr_frames_init(qr_frames_t *frames, const uint8_t *data, size_t length);
+
+// Writes the text of the given frame, null-terminated, into text[QR_FRAMES_TEXT_MAX + 1] and returns its length.
+size_t qr_frames_text(const qr_frames_t *frames, uint32_t index, char *text);
+
+// Parses a frame text. Returns false if it is not one, or is inconsistent.
+bool qr_frames_parse(const char *text, size_t length, qr_frame_t *frame);
+
+// CRC-32 (IEEE 802.3) of the given bytes, continued from the given CRC; start with 0
+uint32_t qr_frames_crc32(uint32_t crc, const uint8_t *data, size_t length);
+
+#endif // QR_FRAMES_H
+// vim: set sw=4 ts=4 indk= et si:
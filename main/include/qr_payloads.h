@@ -0,0 +1,35 @@
+#ifndef QR_PAYLOADS_H
+#define QR_PAYLOADS_H
+
+// The QR-Codes of the constant payloads, shared by the firmware and host/gen_static_qr.c,
+// which renders them at build time into static_qr_pages.h
+
+#include "qrcodegen.h"
+#include "wifi_creds.h"
+
+#ifndef CERT_SUBJECT
+#   define CERT_SUBJECT "ptest.local"
+#endif
+
+// QR-Code versions, sizes and information capacity: https://www.qrcode.com/en/about/version.html
+// Version 3 = 29 x 29, binary info cap by ecc mode: L:53, M:42, Q:32 bytes
+#define WIFI_QR_VERSION 3
+#define WIFI_QR_SIZE (qrcodegen_BUFFER_LEN_FOR_VERSION(WIFI_QR_VERSION))
+
+// Encoding wifi parameters on QR-Code: https://github.com/zxing/zxing/wiki/Barcode-Contents#wi-fi-network-config-android-ios-11
+#define WIFI_QR_PAYLOAD "WIFI:S:" AP_SSID ";T:WPA;P:" AP_PASSWORD ";;"
+
+// Encoding URLs on QR-Code: https://github.com/zxing/zxing/wiki/Barcode-Contents#url
+#define URL_QR_PAYLOAD "URL:https://" CERT_SUBJECT
+
+// The QR-Code area on the display: 48x32 pixels on the left, 8 light columns, then the code
+// with a one module quiet zone from column 7 and row 0
+#define QR_AREA_WIDTH       48
+#define QR_AREA_PAGES       4
+#define QR_AREA_LEFT        7
+#define QR_AREA_TOP         0
+#define QR_AREA_QUIET_ZONE  1
+#define QR_AREA_SCALE       1
+
+#endif // QR_PAYLOADS_H
+// vim: set sw=4 ts=4 indk= et si:
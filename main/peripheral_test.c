@@ -1,6 +1,11 @@
-#include "wifi_creds.h"
+#include "qr_payloads.h"
+#include "static_qr_pages.h"
 #include "ssd1306.h"
+#include "ssd1306_service.h"
 #include "qrcodegen.h"
+#include "qrcodegen_pool.h"
+#include "qr_cache.h"
+#include "qr_frames.h"
 #include "font6x8.h"
 #include "dns_server.h"
 
@@ -14,6 +19,7 @@
 #include <esp_wifi.h>
 #include <esp_event_loop.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <esp_https_server.h>
 
 #include <nvs_flash.h>
@@ -21,14 +27,40 @@
 #include <driver/touch_pad.h>
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define SSD1306_I2C I2C_NUM_1
 #define BUTTON_TP_PIN 6
 
-#ifndef CERT_SUBJECT
-#   define CERT_SUBJECT "ptest.local"
-#endif
+// The panel, e.g. SSD1306_GEOMETRY_128X64; the screens are laid out for the top 32 rows
+#ifndef LCD_GEOMETRY
+#   define LCD_GEOMETRY SSD1306_GEOMETRY_128X32
+#endif // LCD_GEOMETRY
+
+// The minimum time each frame of lcd_QR_frames() stays on the panel; 0 switches as fast as the I2C link
+// allows, about 5 ms at 400 kHz. The frame rate of the scanning camera bounds the throughput anyway
+// (host/qr_unframe.c -t); a period of a few camera frames avoids captures of half-overwritten frames
+#ifndef QR_FRAMES_PERIOD_MS
+#   define QR_FRAMES_PERIOD_MS 0
+#endif // QR_FRAMES_PERIOD_MS
+
+// The speed of the text that doesn't fit the panel: frames of the panel per column (see ssd1306_marquee_t),
+// 5 is about 7 characters per second
+#ifndef LCD_MARQUEE_FRAMES
+#   define LCD_MARQUEE_FRAMES 5
+#endif // LCD_MARQUEE_FRAMES
+
+// How long the QR-Code and the scrolling text each stay on the panel, when the text doesn't fit beside the
+// QR-Code; long enough for a line of 32 characters to scroll round
+#ifndef LCD_ALTERNATE_MS
+#   define LCD_ALTERNATE_MS 8000
+#endif // LCD_ALTERNATE_MS
+
+// The number of times the frames are cycled when the certificate is requested on the web page
+#ifndef QR_FRAMES_CYCLES
+#   define QR_FRAMES_CYCLES 10
+#endif // QR_FRAMES_CYCLES
 
 static const char *TAG = "ptest";
 static const char *SERVER_NAME = CERT_SUBJECT;
@@ -38,86 +70,342 @@ extern const uint8_t private_key_end[] asm("_binary_private_key_end");
 extern const uint8_t server_crt_start[] asm("_binary_server_crt_start");
 extern const uint8_t server_crt_end[] asm("_binary_server_crt_end");
 
+static ssd1306_i2c_t panel_i2c;
+static ssd1306_t panel;
+
 // FreeRTOS event group to signal when we are connected
 static EventGroupHandle_t wifi_event_group;
 
 // The event group allows multiple bits for each event, but we only care about one event - are we connected to the AP with an IP?
 const int WIFI_CONNECTED_BIT = BIT0;
 const int BUTTON_BIT = BIT1;
+const int CERTIFICATE_BIT = BIT2;
 
-// QR-Code versions, sizes and information capacity: https://www.qrcode.com/en/about/version.html
-// Version 3 = 29 x 29, binary info cap by ecc mode: L:53, M:42, Q:32 bytes
-#define WIFI_QR_VERSION 3
-#define WIFI_QR_SIZE (qrcodegen_BUFFER_LEN_FOR_VERSION(WIFI_QR_VERSION))
+#ifdef CONFIG_QRCODEGEN_MASK_POOL
+// Scores the QR masks on both cores; null if it couldn't be created, or wasn't faster than one core
+static struct qrcodegen_MaskPool *qr_mask_pool;
+
+// The encodes of each kind that time the pool against one core at boot
+#   define QR_MASK_POOL_ROUNDS 8
+#endif
 
 
 /******************************************************************************
  * LCD operations
+ *
+ * The lcd_* functions draw into a frame of the display service, between ssd1306_service_begin()
+ * and ssd1306_service_submit(); its task sends only what changed, while the caller goes on.
  */
 
-void
-lcd_putchar(int col, int row, char c) {
+// Draws a glyph at pixel column x of a line of width columns, cut off at its end
+static void
+lcd_glyph(uint8_t *line, int width, int x, char c) {
     if ((c < 0x20) || (c & 0x80)) {
         c = 0x20;
     }
-    col *= 6;
-    ssd1306_set_range(SSD1306_I2C, col, col + 5, row, row);
-    ssd1306_send_data(SSD1306_I2C, &font6x8[6 * (c - 0x20)], 6);
+    const uint8_t *glyph = &font6x8[6 * (c - 0x20)];
+    for (int i = 0; i < 6 && x + i < width; ++i) {
+        line[x + i] = glyph[i];
+    }
+}
+
+
+void
+lcd_putchar(ssd1306_frame_t *frame, int col, int row, char c) {
+    lcd_glyph(frame->pages[row], SSD1306_WIDTH, col * 6, c);
 }
 
 
+// Text past the right edge is cut off
 void
-lcd_puts(int col, int row, const char *s) {
-    if (!*s) {
+lcd_puts(ssd1306_frame_t *frame, int col, int row, const char *s) {
+    for (col *= 6; *s && col < SSD1306_WIDTH; col += 6, ++s) {
+        lcd_glyph(frame->pages[row], SSD1306_WIDTH, col, *s);
+    }
+}
+
+
+// True if the text fits from the character column col to the right edge
+static bool
+lcd_fits(int col, const char *s) {
+    return (int)strlen(s) * 6 <= SSD1306_WIDTH - col * 6;
+}
+
+
+// Shows count lines of text at full width from the top, one per page. The controller scrolls whole pages,
+// so the lines from the first to the last that doesn't fit scroll together in the marquee of the frame,
+// with a gap of 3 characters before they come round again
+void
+lcd_text_pages(ssd1306_frame_t *frame, const char *const *lines, int count) {
+    int first = -1, last = -1;
+    size_t longest = 0;
+    for (int row = 0; row < count; ++row) {
+        if (!lcd_fits(0, lines[row])) {
+            first = (first < 0) ? row : first;
+            last = row;
+        }
+    }
+    for (int row = 0; row < count; ++row) {
+        if (row < first || row > last) {
+            lcd_puts(frame, 0, row, lines[row]);
+        }
+        else if (strlen(lines[row]) > longest) {
+            longest = strlen(lines[row]);
+        }
+    }
+    if (first < 0) {
         return;
     }
-    col *= 6;
-    ssd1306_set_range(SSD1306_I2C, col, 127, row, row);
-    static uint8_t send_data_cmd[] = {
-        0x78, 0x40,
-    };
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write(cmd, send_data_cmd, sizeof(send_data_cmd), true);
-    while (*s) {
-        char c = *s;
-        if ((c < 0x20) || (c & 0x80)) {
-            i2c_master_write(cmd, (uint8_t*)&font6x8[0], 6, true);
+
+    ssd1306_marquee_t *marquee = &frame->marquee;
+    marquee->page = first;
+    marquee->pages = last - first + 1;
+    marquee->frames = LCD_MARQUEE_FRAMES;
+    marquee->length = (longest + 3) * 6;
+    if (marquee->length * marquee->pages > SSD1306_MARQUEE_MAX_BYTES) {
+        marquee->length = SSD1306_MARQUEE_MAX_BYTES / marquee->pages;
+    }
+    memset(marquee->strip, 0, marquee->length * marquee->pages);
+    for (int i = 0; i < marquee->pages; ++i) {
+        uint8_t *line = marquee->strip + i * marquee->length;
+        const char *s = lines[first + i];
+        for (int x = 0; *s && x < marquee->length; x += 6, ++s) {
+            lcd_glyph(line, marquee->length, x, *s);
         }
-        else {
-            i2c_master_write(cmd, (uint8_t*)&font6x8[6 * (c - 0x20)], 6, true);
+    }
+}
+
+
+// Draws a QR-Code rendered by qrcodegen_renderPages() with the QR_AREA_* layout
+void
+lcd_QR_pages(ssd1306_frame_t *frame, const uint8_t *pages) {
+    for (int page = 0; page < QR_AREA_PAGES; ++page) {
+        memcpy(frame->pages[page], pages + page * QR_AREA_WIDTH, QR_AREA_WIDTH);
+    }
+}
+
+
+// The screen of the display_* functions: the QR-Code takes the left of every page and the text goes beside
+// it. Text too long for that room alternates with the QR-Code instead, shown alone and scrolling, on lcd_timer,
+// which only runs while it does. The state is only touched between ssd1306_service_begin() and
+// ssd1306_service_submit(), whose lock serializes the callers.
+static struct {
+    const uint8_t *qr_pages;    // rendered with the QR_AREA_* layout
+    const char *lines[QR_AREA_PAGES];
+    int count;
+    bool alternate;             // the lines don't fit beside the QR-Code
+    bool text_shown;            // instead of the QR-Code
+} lcd_screen;
+static esp_timer_handle_t lcd_timer;
+
+
+// Composes the current screen of lcd_screen: the QR-Code with the lines that fit beside it, or the text alone
+static void
+lcd_compose(ssd1306_frame_t *frame) {
+    memset(frame, 0, sizeof(*frame));
+    if (lcd_screen.text_shown) {
+        lcd_text_pages(frame, lcd_screen.lines, lcd_screen.count);
+        return;
+    }
+    for (int row = 0; row < lcd_screen.count; ++row) {
+        if (lcd_fits(8, lcd_screen.lines[row])) {
+            lcd_puts(frame, 8, row, lcd_screen.lines[row]);
         }
-        ++s;
     }
-    i2c_master_stop(cmd);
-    i2c_master_cmd_begin(SSD1306_I2C, cmd, 1000);
-    i2c_cmd_link_delete(cmd);
+    lcd_QR_pages(frame, lcd_screen.qr_pages);
 }
 
 
-bool
-lcd_QR(uint8_t *tempBuffer, size_t input_length) {
-    uint8_t qrcode[WIFI_QR_SIZE];
+// Shows a QR-Code with up to QR_AREA_PAGES lines of text, starting with the QR-Code; the lines are kept
+// by reference, so they must be constants
+static void
+lcd_show(const uint8_t *qr_pages, const char *const *lines, int count) {
+    ssd1306_frame_t *frame = ssd1306_service_begin();
+    lcd_screen.qr_pages = qr_pages;
+    lcd_screen.count = count;
+    lcd_screen.alternate = false;
+    for (int row = 0; row < count; ++row) {
+        lcd_screen.lines[row] = lines[row];
+        lcd_screen.alternate |= !lcd_fits(8, lines[row]);
+    }
+    lcd_screen.text_shown = false;
+    lcd_compose(frame);
+    esp_timer_stop(lcd_timer);      // ESP_ERR_INVALID_STATE if it wasn't running; restarted for a full period
+    if (lcd_screen.alternate) {
+        ESP_ERROR_CHECK(esp_timer_start_periodic(lcd_timer, LCD_ALTERNATE_MS * 1000LL));
+    }
+    ssd1306_service_submit();
+}
+
+
+// Stops the alternation of lcd_screen until the next lcd_show(), e.g. for lcd_QR_frames(); locks and returns
+// the back buffer like ssd1306_service_begin()
+static ssd1306_frame_t *
+lcd_suspend(void) {
+    ssd1306_frame_t *frame = ssd1306_service_begin();
+    esp_timer_stop(lcd_timer);
+    lcd_screen.alternate = false;
+    return frame;
+}
+
 
-    if (!qrcodegen_encodeBinary(tempBuffer, input_length, qrcode, qrcodegen_Ecc_LOW, WIFI_QR_VERSION, WIFI_QR_VERSION, qrcodegen_Mask_AUTO, true)) {
-        ESP_LOGE(TAG, "Failed to generate QR code;");
+// The callback of lcd_timer: switches between the QR-Code and the text, if they still alternate. It runs on
+// the esp_timer task, which also ticks the grayscale planes, so it doesn't wait for the lock: while another
+// caller holds it, this flip is skipped and the next period flips instead
+static void
+lcd_alternate(void *arg) {
+    ssd1306_frame_t *frame = ssd1306_service_try_begin();
+    if (frame == NULL) {
+        return;
+    }
+    if (lcd_screen.alternate) {
+        lcd_screen.text_shown = !lcd_screen.text_shown;
+        lcd_compose(frame);
+    }
+    ssd1306_service_submit();
+}
+
+
+// The mask of the QR frames: with the pool all 8 masks of qrcodegen_Mask_AUTO are scored on both cores,
+// otherwise qrcodegen_Mask_FAST scores a few of them on the calling task
+#ifdef CONFIG_QRCODEGEN_MASK_POOL
+#   define QR_FRAMES_MASK qrcodegen_Mask_AUTO
+#else
+#   define QR_FRAMES_MASK qrcodegen_Mask_FAST
+#endif
+
+
+// Encodes the text of a frame with QR_FRAMES_MASK, the masks scored on the given pool if it isn't null
+static bool
+encode_QR_frame(const char *text, uint8_t *tempBuffer, uint8_t *qrcode, struct qrcodegen_MaskPool *pool) {
+    // Same as qrcodegen_encodeText() for the alphanumeric frame texts, with the scorer of the pool
+    struct qrcodegen_Segment seg = qrcodegen_makeAlphanumeric(text, tempBuffer);
+    return qrcodegen_encodeSegmentsScored(&seg, 1, qrcodegen_Ecc_LOW, QR_FRAMES_VERSION, QR_FRAMES_VERSION, QR_FRAMES_MASK, true,
+        tempBuffer, qrcode, pool ? qrcodegen_scoreMasksOnPool : NULL, pool);
+}
+
+
+// Renders a frame of qr_frames.h into pages with the QR_AREA_* layout. The frames of a buffer are the same every
+// time it is shown, so their bitmaps are looked up in the QR cache before they are encoded.
+static bool
+render_QR_frame(const qr_frames_t *frames, uint32_t index, uint8_t *pages) {
+    _Static_assert(QR_AREA_TOP + (QR_FRAMES_VERSION * 4 + 17 + 2 * QR_AREA_QUIET_ZONE) * QR_AREA_SCALE <= QR_AREA_PAGES * 8,
+        "QR_FRAMES_VERSION doesn't fit the QR area");
+    _Static_assert(QR_FRAMES_VERSION <= QR_CACHE_MAX_VERSION, "QR_FRAMES_VERSION is too large for the QR cache");
+    char text[QR_FRAMES_TEXT_MAX + 1];
+    uint8_t tempBuffer[qrcodegen_BUFFER_LEN_FOR_VERSION(QR_FRAMES_VERSION)];
+    uint8_t qrcode[qrcodegen_BUFFER_LEN_FOR_VERSION(QR_FRAMES_VERSION)];
+
+    size_t length = qr_frames_text(frames, index, text);
+    qr_cache_key_t key;
+    qr_cache_make_key(&key, (const uint8_t *)text, length, qrcodegen_Ecc_LOW, QR_FRAMES_VERSION, QR_FRAMES_MASK, true);
+    if (!qr_cache_lookup(&key, qrcode)) {
+#ifdef CONFIG_QRCODEGEN_MASK_POOL
+        if (!encode_QR_frame(text, tempBuffer, qrcode, qr_mask_pool)) {
+#else
+        if (!encode_QR_frame(text, tempBuffer, qrcode, NULL)) {
+#endif
+            ESP_LOGE(TAG, "QR frame %u does not fit in version %d", (unsigned)index, QR_FRAMES_VERSION);
+            return false;
+        }
+        qr_cache_store(&key, qrcode);
+    }
+    memset(pages, 0, QR_AREA_WIDTH * QR_AREA_PAGES);
+    qrcodegen_renderPages(qrcode, pages, QR_AREA_WIDTH, QR_AREA_PAGES, QR_AREA_LEFT, QR_AREA_TOP, QR_AREA_QUIET_ZONE, QR_AREA_SCALE);
+    return true;
+}
+
+
+// Encodes a frame like render_QR_frame(), but streams the rows straight into the pages, without a bitmap: this
+// takes about a third of the stack (host/qrbench) and several times as long, so it is only for when there is no
+// memory to render the frames up front. Without a bitmap there is nothing to cache either.
+// The frame texts are base32, all alphanumeric.
+static bool
+stream_QR_frame(const qr_frames_t *frames, uint32_t index, uint8_t *pages) {
+    char text[QR_FRAMES_TEXT_MAX + 1];
+    uint8_t data[QR_FRAMES_TEXT_MAX];
+    uint8_t work[qrcodegen_COMPACT_BUFFER_LEN_FOR_VERSION(QR_FRAMES_VERSION)];
+    struct qrcodegen_PageLayout layout = {
+        pages, QR_AREA_WIDTH, QR_AREA_PAGES, QR_AREA_LEFT, QR_AREA_TOP, QR_AREA_QUIET_ZONE, QR_AREA_SCALE,
+    };
+
+    qr_frames_text(frames, index, text);
+    struct qrcodegen_Segment seg = qrcodegen_makeAlphanumeric(text, data);
+    memset(pages, 0, QR_AREA_WIDTH * QR_AREA_PAGES);
+    if (!qrcodegen_encodeSegmentsCompact(&seg, 1, qrcodegen_Ecc_LOW, QR_FRAMES_VERSION, QR_FRAMES_VERSION, qrcodegen_Mask_FAST, true, work,
+            qrcodegen_renderPageRow, &layout)) {
+        ESP_LOGE(TAG, "QR frame %u does not fit in version %d", (unsigned)index, QR_FRAMES_VERSION);
+        return false;
+    }
+    return true;
+}
+
+
+// Cycles a buffer too large for one QR-Code through the QR area as a sequence of frames (see qr_frames.h),
+// cycles times. The frames are rendered up front if there is memory for them, so that showing one is a single
+// I2C transfer; otherwise each one is streamed into the pages just before it is shown. Each frame is waited for, so that the
+// display service doesn't coalesce any away. Logs the throughput of each cycle.
+bool
+lcd_QR_frames(const uint8_t *data, size_t length, int cycles) {
+    qr_frames_t frames;
+    if (!qr_frames_init(&frames, data, length)) {
+        ESP_LOGE(TAG, "Too long for QR frames; length=%u", (unsigned)length);
         return false;
     }
-    //ESP_LOG_BUFFER_HEXDUMP(TAG, qrcode, WIFI_QR_SIZE, ESP_LOG_DEBUG);
-    ssd1306_set_range(SSD1306_I2C, 0, 47, 0, 3);
-    for (int y = 0; y < 32; y += 8) {
-        for (int x = 0; x < 48; ++x) {
-            uint8_t v = 0;
-            for (uint8_t yb = 0; yb < 8; ++yb) {
-                if (qrcodegen_getModule(qrcode, x - 8, y + yb - 1)) {
-                    v |= 1 << yb;
-                }
 
+    // Nothing else on the screen, least of all the marquee of a text that scrolls over the QR area
+    memset(lcd_suspend(), 0, sizeof(ssd1306_frame_t));
+    ssd1306_service_submit();
+
+    const size_t frame_size = QR_AREA_WIDTH * QR_AREA_PAGES;
+    uint8_t *rendered = malloc(frames.count * frame_size);
+    if (rendered) {
+        for (uint32_t i = 0; i < frames.count; ++i) {
+            if (!render_QR_frame(&frames, i, rendered + i * frame_size)) {
+                free(rendered);
+                return false;
             }
-            ssd1306_send_data_byte(SSD1306_I2C, v);
         }
     }
-    return true;
+    else {
+        ESP_LOGW(TAG, "No memory to render %u QR frames, encoding them on the fly", (unsigned)frames.count);
+    }
+    qr_cache_stats_t stats;
+    qr_cache_get_stats(&stats);
+    ESP_LOGI(TAG, "QR cache; hits=%u, nvs_hits=%u, misses=%u, evictions=%u",
+        (unsigned)stats.hits, (unsigned)stats.nvs_hits, (unsigned)stats.misses, (unsigned)stats.evictions);
+
+    uint8_t pages[QR_AREA_WIDTH * QR_AREA_PAGES];
+    const TickType_t period = pdMS_TO_TICKS(QR_FRAMES_PERIOD_MS);
+    bool ok = true;
+    for (int cycle = 0; ok && cycle < cycles; ++cycle) {
+        // The stats of the service are as of its last flush, so let the frames before go out first
+        ssd1306_service_wait(portMAX_DELAY);
+        ssd1306_stats_t before, after;
+        ssd1306_service_get_stats(&before);
+        int64_t start = esp_timer_get_time();
+        TickType_t wake = xTaskGetTickCount();
+        for (uint32_t i = 0; i < frames.count; ++i) {
+            const uint8_t *frame = rendered ? rendered + i * frame_size : pages;
+            if (!rendered && !stream_QR_frame(&frames, i, pages)) {
+                ok = false;
+                break;
+            }
+            lcd_QR_pages(ssd1306_service_begin(), frame);
+            ssd1306_service_submit();
+            ssd1306_service_wait(portMAX_DELAY);
+            if (period > 0) {
+                vTaskDelayUntil(&wake, period);
+            }
+        }
+        int64_t elapsed_us = esp_timer_get_time() - start;
+        ssd1306_service_get_stats(&after);
+        ESP_LOGI(TAG, "QR frames cycle; frames=%u, bytes=%u, ms=%u, bytes_per_s=%u, transactions=%u, bus_bytes=%u, bus_ms=%u",
+            (unsigned)frames.count, (unsigned)length, (unsigned)(elapsed_us / 1000), (unsigned)(elapsed_us > 0 ? length * 1000000LL / elapsed_us : 0),
+            (unsigned)(after.transactions - before.transactions), (unsigned)(after.bytes - before.bytes), (unsigned)((after.busy_us - before.busy_us) / 1000));
+    }
+    free(rendered);
+    return ok;
 }
 
 
@@ -125,31 +413,16 @@ lcd_QR(uint8_t *tempBuffer, size_t input_length) {
  * Show some info on the display
  */
 
+// The display_* functions only compose the screen, so they are quick enough for the event handlers.
 void
 display_wifi_conn(void) {
-    ssd1306_clear(SSD1306_I2C);
-    ssd1306_send_cmd_byte(SSD1306_I2C, SSD1306_DISPLAY_INVERSE);
-
-    lcd_puts(8, 0, "SSID:");
-    lcd_puts(8, 1, AP_SSID);
-    lcd_puts(8, 2, "Password:");
-    lcd_puts(8, 3, AP_PASSWORD);
-
-    {
-        // Encoding wifi parameters on QR-Code: https://github.com/zxing/zxing/wiki/Barcode-Contents#wi-fi-network-config-android-ios-11
-        uint8_t tempBuffer[WIFI_QR_SIZE];
-        size_t input_length = snprintf((char*)tempBuffer, WIFI_QR_SIZE, "WIFI:S:%s;T:WPA;P:%s;;", AP_SSID, AP_PASSWORD);
-        lcd_QR(tempBuffer, input_length);
-    }
+    const char *lines[] = { "SSID:", AP_SSID, "Password:", AP_PASSWORD };
+    lcd_show(WIFI_QR_PAGES, lines, 4);    // WIFI_QR_PAYLOAD
 }
 
 
 void
 display_portal_url(void) {
-
-    ssd1306_clear(SSD1306_I2C);
-    ssd1306_send_cmd_byte(SSD1306_I2C, SSD1306_DISPLAY_INVERSE);
-
     /*char str_ip[16];
     {
         tcpip_adapter_ip_info_t ap_info;
@@ -157,18 +430,9 @@ display_portal_url(void) {
         ip4addr_ntoa_r(&ap_info.ip, str_ip, sizeof(str_ip));
     }*/
 
-    lcd_puts(8, 0, "https://");
-    //lcd_puts(8, 1, str_ip);
-    lcd_puts(8, 1, SERVER_NAME);
-
-    {
-        // Encoding URLs on QR-Code: https://github.com/zxing/zxing/wiki/Barcode-Contents#url
-        uint8_t tempBuffer[WIFI_QR_SIZE];
-        //size_t input_length = snprintf((char*)tempBuffer, sizeof(tempBuffer), "https://%s", str_ip);
-        size_t input_length = snprintf((char*)tempBuffer, sizeof(tempBuffer), "URL:https://%s", SERVER_NAME);
-        lcd_QR(tempBuffer, input_length);
-    }
-
+    //const char *lines[] = { "https://", str_ip };
+    const char *lines[] = { "https://", SERVER_NAME };
+    lcd_show(URL_QR_PAGES, lines, 2);     // URL_QR_PAYLOAD
 }
 
 
@@ -214,7 +478,18 @@ static esp_err_t
 https_root_get_handler(httpd_req_t *req) {
     ESP_LOGD(TAG, "https %d %s", req->method, req->uri);
     httpd_resp_set_type(req, "text/html");
-    httpd_resp_send(req, "<h1>Hello Secure World!</h1>", -1); // -1 = use strlen()
+    httpd_resp_send(req, "<h1>Hello Secure World!</h1>"
+        "<form method=\"post\" action=\"/certificate\"><button>Show the certificate on the display</button></form>", -1); // -1 = use strlen()
+    return ESP_OK;
+}
+
+// Has qr_frames_task cycle the server certificate through the QR area
+static esp_err_t
+https_certificate_post_handler(httpd_req_t *req) {
+    ESP_LOGD(TAG, "https %d %s", req->method, req->uri);
+    xEventGroupSetBits(wifi_event_group, CERTIFICATE_BIT);
+    httpd_resp_set_type(req, "text/html");
+    httpd_resp_send(req, "<h1>Scan the display</h1><p>Decode the frames with host/qr_unframe.</p>", -1);
     return ESP_OK;
 }
 
@@ -225,6 +500,13 @@ httpd_uri_t https_root = {
     .handler   = https_root_get_handler
 };
 
+static const
+httpd_uri_t https_certificate = {
+    .uri       = "/certificate",
+    .method    = HTTP_POST,
+    .handler   = https_certificate_post_handler
+};
+
 static const
 httpd_uri_t http_generate_204 = {
     .uri       = "/generate_204",
@@ -255,6 +537,7 @@ start_https_server(void) {
     }
 
     httpd_register_uri_handler(server, &https_root);
+    httpd_register_uri_handler(server, &https_certificate);
     ESP_LOGI(TAG, "Started https server;");
     return server;
 }
@@ -441,6 +724,61 @@ touchpad_wait_task(void *pvParameter)
 }
 
 
+/******************************************************************************
+ * Certificate transfer
+ */
+
+#ifdef CONFIG_QRCODEGEN_MASK_POOL
+// Times the encode of the first certificate frame with the masks scored on qr_mask_pool against one core, and
+// deletes the pool unless it is faster: the workers take turns with the other tasks, and on one core they only add
+// the hand-over
+static void
+qr_mask_pool_calibrate(void) {
+    qr_frames_t frames;
+    char text[QR_FRAMES_TEXT_MAX + 1];
+    uint8_t tempBuffer[qrcodegen_BUFFER_LEN_FOR_VERSION(QR_FRAMES_VERSION)];
+    uint8_t qrcode[qrcodegen_BUFFER_LEN_FOR_VERSION(QR_FRAMES_VERSION)];
+    int64_t elapsed_us[2] = { 0, 0 };   // one core, then the pool
+
+    qr_frames_init(&frames, server_crt_start, server_crt_end - server_crt_start - 1);
+    qr_frames_text(&frames, 0, text);
+    for (int pooled = 0; pooled < 2; ++pooled) {
+        int64_t start = esp_timer_get_time();
+        for (int round = 0; round < QR_MASK_POOL_ROUNDS; ++round) {
+            encode_QR_frame(text, tempBuffer, qrcode, pooled ? qr_mask_pool : NULL);
+        }
+        elapsed_us[pooled] = esp_timer_get_time() - start;
+    }
+    ESP_LOGI(TAG, "QR mask pool; workers=%d, serial_us=%u, pool_us=%u, speedup_pct=%u", portNUM_PROCESSORS,
+        (unsigned)(elapsed_us[0] / QR_MASK_POOL_ROUNDS), (unsigned)(elapsed_us[1] / QR_MASK_POOL_ROUNDS),
+        (unsigned)(elapsed_us[1] > 0 ? elapsed_us[0] * 100 / elapsed_us[1] : 0));
+    if (elapsed_us[1] >= elapsed_us[0]) {
+        ESP_LOGW(TAG, "The QR mask pool is not faster, scoring the masks sequentially");
+        qrcodegen_deleteMaskPool(qr_mask_pool);
+        qr_mask_pool = NULL;
+    }
+}
+#endif
+
+
+// Hands the server certificate (without the terminating null of EMBED_TXTFILES) over to a phone when the
+// web page asks for it, then restores the screen the event handlers showed last
+static void
+qr_frames_task(void *pvParameter)
+{
+    while (1) {
+        xEventGroupWaitBits(wifi_event_group, CERTIFICATE_BIT, pdTRUE, pdFALSE, portMAX_DELAY);
+        lcd_QR_frames(server_crt_start, server_crt_end - server_crt_start - 1, QR_FRAMES_CYCLES);
+        if (xEventGroupGetBits(wifi_event_group) & WIFI_CONNECTED_BIT) {
+            display_portal_url();
+        }
+        else {
+            display_wifi_conn();
+        }
+    }
+}
+
+
 /******************************************************************************
  * Main entry point
  */
@@ -463,10 +801,28 @@ app_main()
       ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK(ret);
-
-    ssd1306_init(SSD1306_I2C, 23, 22);
+    ESP_ERROR_CHECK(qr_cache_init(true));
+
+    ESP_ERROR_CHECK(ssd1306_i2c_bus_init(SSD1306_I2C, 23, 22));
+    ESP_ERROR_CHECK(ssd1306_i2c_init(&panel_i2c, SSD1306_I2C, SSD1306_I2C_ADDRESS));
+    ssd1306_init(&panel, &panel_i2c.base, LCD_GEOMETRY);
+    ssd1306_send_cmd_byte(&panel, SSD1306_DISPLAY_INVERSE);
+    ESP_ERROR_CHECK(ssd1306_service_start(&panel, 5));
+    const esp_timer_create_args_t lcd_timer_args = { .callback = &lcd_alternate, .name = "lcd_alternate" };
+    ESP_ERROR_CHECK(esp_timer_create(&lcd_timer_args, &lcd_timer));     // started by lcd_show()
+
+#ifdef CONFIG_QRCODEGEN_MASK_POOL
+    qr_mask_pool = qrcodegen_createMaskPool(portNUM_PROCESSORS, QR_FRAMES_VERSION);
+    if (!qr_mask_pool) {
+        ESP_LOGW(TAG, "Failed to create the QR mask pool, scoring the masks sequentially");
+    }
+    else {
+        qr_mask_pool_calibrate();
+    }
+#endif
 
     wifi_event_group = xEventGroupCreate();
+    xTaskCreate(&qr_frames_task, "qr_frames_task", 4096, NULL, 5, NULL);
 
     tcpip_adapter_init();
     {
@@ -0,0 +1,193 @@
+#include "qr_cache.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <esp_log.h>
+#include <nvs.h>
+#include <mbedtls/sha256.h>
+
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "qr_cache";
+static const char *NVS_NAMESPACE = "qr_cache";
+
+typedef struct {
+    qr_cache_key_t key;
+    uint8_t qrcode[QR_CACHE_BITMAP_SIZE];
+} qr_cache_entry_t;
+
+static struct {
+    SemaphoreHandle_t lock;
+    bool use_nvs;
+    uint32_t clock;                         // advanced on every access, for the LRU order
+    uint32_t last_used[QR_CACHE_ENTRIES];   // 0 = empty
+    qr_cache_entry_t entries[QR_CACHE_ENTRIES];
+    qr_cache_stats_t stats;
+} cache;
+
+
+static size_t
+bitmap_size(const qr_cache_key_t *key) {
+    return qrcodegen_BUFFER_LEN_FOR_VERSION(key->version);
+}
+
+
+// The keys are zero-padded by qr_cache_make_key(), so they compare as a whole
+static bool
+key_equal(const qr_cache_key_t *a, const qr_cache_key_t *b) {
+    return memcmp(a, b, sizeof(*a)) == 0;
+}
+
+
+static void
+nvs_slot_name(const qr_cache_key_t *key, char *name, size_t size) {
+    snprintf(name, size, "slot%u", (unsigned)(key->digest[0] % QR_CACHE_NVS_SLOTS));
+}
+
+
+static bool
+nvs_load(const qr_cache_key_t *key, qr_cache_entry_t *entry) {
+    nvs_handle handle;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    char name[16];
+    nvs_slot_name(key, name, sizeof(name));
+    size_t length = sizeof(*entry);
+    esp_err_t err = nvs_get_blob(handle, name, entry, &length);
+    nvs_close(handle);
+    // The slot may hold another payload that hashes to it, or an entry of an older format
+    return err == ESP_OK && length == sizeof(*entry) && key_equal(key, &entry->key);
+}
+
+
+static void
+nvs_save(const qr_cache_entry_t *entry) {
+    nvs_handle handle;
+    esp_err_t err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        char name[16];
+        nvs_slot_name(&entry->key, name, sizeof(name));
+        err = nvs_set_blob(handle, name, entry, sizeof(*entry));
+        if (err == ESP_OK) {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to save QR code to NVS: %s", esp_err_to_name(err));
+    }
+}
+
+
+// Returns the slot to use for a new entry: an empty one, or else the least recently used
+static int
+victim_slot(void) {
+    int victim = 0;
+    for (int i = 0; i < QR_CACHE_ENTRIES; ++i) {
+        if (cache.last_used[i] < cache.last_used[victim]) {
+            victim = i;
+        }
+    }
+    if (cache.last_used[victim]) {
+        ++cache.stats.evictions;
+    }
+    return victim;
+}
+
+
+esp_err_t
+qr_cache_init(bool use_nvs) {
+    cache.lock = xSemaphoreCreateMutex();
+    if (!cache.lock) {
+        return ESP_ERR_NO_MEM;
+    }
+    cache.use_nvs = use_nvs;
+    return ESP_OK;
+}
+
+
+void
+qr_cache_make_key(qr_cache_key_t *key, const uint8_t *payload, size_t length,
+        enum qrcodegen_Ecc ecl, int version, enum qrcodegen_Mask mask, bool boost_ecl) {
+    memset(key, 0, sizeof(*key));   // no stray padding in the NVS blobs nor in key_equal()
+    mbedtls_sha256_ret(payload, length, key->digest, 0);
+    key->length = length;
+    key->format = QR_CACHE_FORMAT;
+    key->version = version;
+    key->ecl = ecl;
+    key->mask = mask;
+    key->boost_ecl = boost_ecl;
+}
+
+
+bool
+qr_cache_lookup(const qr_cache_key_t *key, uint8_t *qrcode) {
+    if (key->version > QR_CACHE_MAX_VERSION) {
+        return false;
+    }
+    bool found = false;
+    xSemaphoreTake(cache.lock, portMAX_DELAY);
+    ++cache.clock;
+    for (int i = 0; i < QR_CACHE_ENTRIES; ++i) {
+        if (cache.last_used[i] && key_equal(key, &cache.entries[i].key)) {
+            memcpy(qrcode, cache.entries[i].qrcode, bitmap_size(key));
+            cache.last_used[i] = cache.clock;
+            ++cache.stats.hits;
+            found = true;
+            break;
+        }
+    }
+    if (!found && cache.use_nvs) {
+        qr_cache_entry_t entry;
+        if (nvs_load(key, &entry)) {
+            int slot = victim_slot();
+            cache.entries[slot] = entry;
+            cache.last_used[slot] = cache.clock;
+            memcpy(qrcode, entry.qrcode, bitmap_size(key));
+            ++cache.stats.nvs_hits;
+            found = true;
+        }
+    }
+    if (!found) {
+        ++cache.stats.misses;
+    }
+    xSemaphoreGive(cache.lock);
+    return found;
+}
+
+
+void
+qr_cache_store(const qr_cache_key_t *key, const uint8_t *qrcode) {
+    if (key->version > QR_CACHE_MAX_VERSION) {
+        return;
+    }
+    qr_cache_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.key = *key;
+    memcpy(entry.qrcode, qrcode, bitmap_size(key));
+
+    xSemaphoreTake(cache.lock, portMAX_DELAY);
+    ++cache.clock;
+    int slot = victim_slot();
+    cache.entries[slot] = entry;
+    cache.last_used[slot] = cache.clock;
+    xSemaphoreGive(cache.lock);
+
+    // Writing the flash takes milliseconds, so the lookups don't wait for it
+    if (cache.use_nvs) {
+        nvs_save(&entry);
+    }
+}
+
+
+void
+qr_cache_get_stats(qr_cache_stats_t *stats) {
+    xSemaphoreTake(cache.lock, portMAX_DELAY);
+    *stats = cache.stats;
+    xSemaphoreGive(cache.lock);
+}
+
+// vim: set sw=4 ts=4 indk= et si:
@@ -0,0 +1,125 @@
+#include "qr_frames.h"
+
+#include <string.h>
+
+static const char BASE32_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+
+
+uint32_t
+qr_frames_crc32(uint32_t crc, const uint8_t *data, size_t length) {
+    // Bitwise: it runs once per buffer, so a table isn't worth its 1 KiB
+    crc = ~crc;
+    for (size_t i = 0; i < length; ++i) {
+        crc ^= data[i];
+        for (int k = 0; k < 8; ++k) {
+            crc = (crc >> 1) ^ (0xedb88320UL & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+
+static char *
+base32_encode(char *out, const uint8_t *data, size_t length) {
+    uint32_t bits = 0;
+    int count = 0;
+    for (size_t i = 0; i < length; ++i) {
+        bits = (bits << 8) | data[i];
+        count += 8;
+        while (count >= 5) {
+            count -= 5;
+            *out++ = BASE32_ALPHABET[(bits >> count) & 0x1f];
+        }
+    }
+    if (count > 0) {
+        *out++ = BASE32_ALPHABET[(bits << (5 - count)) & 0x1f];
+    }
+    return out;
+}
+
+
+// Decodes length characters into bytes; returns the number of bytes, or -1 on an invalid character
+static int
+base32_decode(uint8_t *out, const char *text, size_t length) {
+    uint32_t bits = 0;
+    int count = 0, n = 0;
+    for (size_t i = 0; i < length; ++i) {
+        const char *p = strchr(BASE32_ALPHABET, text[i]);
+        if (p == NULL || text[i] == '\0') {
+            return -1;
+        }
+        bits = (bits << 5) | (uint32_t)(p - BASE32_ALPHABET);
+        count += 5;
+        if (count >= 8) {
+            count -= 8;
+            out[n++] = (uint8_t)(bits >> count);
+        }
+    }
+    return n;
+}
+
+
+bool
+qr_frames_init(qr_frames_t *frames, const uint8_t *data, size_t length) {
+    if (length > QR_FRAMES_MAX_LENGTH) {
+        return false;
+    }
+    frames->data = data;
+    frames->length = length;
+    frames->crc = qr_frames_crc32(0, data, length);
+    frames->count = (uint32_t)((length + QR_FRAMES_CRC_LEN + QR_FRAMES_DATA_LEN - 1) / QR_FRAMES_DATA_LEN);
+    return true;
+}
+
+
+size_t
+qr_frames_text(const qr_frames_t *frames, uint32_t index, char *text) {
+    uint8_t frame[QR_FRAMES_HEADER_LEN + QR_FRAMES_DATA_LEN];
+    uint32_t last = frames->count - 1;
+    frame[0] = (uint8_t)frames->crc;
+    frame[1] = (uint8_t)(index >> 8);
+    frame[2] = (uint8_t)index;
+    frame[3] = (uint8_t)(last >> 8);
+    frame[4] = (uint8_t)last;
+
+    // The slice [start, end) of the stream: the data, then the CRC
+    size_t start = (size_t)index * QR_FRAMES_DATA_LEN;
+    size_t end = start + QR_FRAMES_DATA_LEN;
+    if (end > frames->length + QR_FRAMES_CRC_LEN) {
+        end = frames->length + QR_FRAMES_CRC_LEN;
+    }
+    size_t n = 0;
+    for (size_t i = start; i < end; ++i, ++n) {
+        frame[QR_FRAMES_HEADER_LEN + n] = (i < frames->length) ? frames->data[i] :
+            (uint8_t)(frames->crc >> (8 * (i - frames->length)));
+    }
+    // The header is a whole base32 group, so the data starts on a character boundary
+    char *end_text = base32_encode(text, frame, QR_FRAMES_HEADER_LEN + n);
+    *end_text = '\0';
+    return (size_t)(end_text - text);
+}
+
+
+bool
+qr_frames_parse(const char *text, size_t length, qr_frame_t *frame) {
+    uint8_t header[QR_FRAMES_HEADER_LEN];
+    size_t header_text = QR_FRAMES_BASE32_LEN(QR_FRAMES_HEADER_LEN);
+    if (length <= header_text || length > QR_FRAMES_TEXT_MAX) {
+        return false;
+    }
+    // Reject the lengths that no byte count encodes to, e.g. 1, 3 or 6 characters
+    size_t data_text = length - header_text;
+    int n = base32_decode(frame->data, text + header_text, data_text);
+    if (n <= 0 || QR_FRAMES_BASE32_LEN((size_t)n) != data_text ||
+            base32_decode(header, text, header_text) != QR_FRAMES_HEADER_LEN) {
+        return false;
+    }
+    frame->session = header[0];
+    frame->index = (uint16_t)((header[1] << 8) | header[2]);
+    frame->last = (uint16_t)((header[3] << 8) | header[4]);
+    frame->length = (uint8_t)n;
+    // Every frame but the last is full, and the last holds at least one byte
+    return frame->index <= frame->last && (frame->index == frame->last || n == QR_FRAMES_DATA_LEN);
+}
+
+// vim: set sw=4 ts=4 indk= et si: